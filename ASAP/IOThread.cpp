@@ -1,7 +1,10 @@
 #include "IOThread.h" 
 #include "IOWorker.h" 
+#include "TileBufferPool.h"
 
 #include <limits>
+#include <algorithm>
+#include <cmath>
 
 #include "multiresolutionimageinterface/MultiResolutionImage.h"
 #include "interfaces/interfaces.h"
@@ -12,7 +15,10 @@ using namespace pathology;
 IOThread::IOThread(QObject *parent, unsigned int nrThreads) :
   QObject(parent),
   _abort(false),
-  _threadsWaiting(0)
+  _bufferPool(TileBufferPool::create()),
+  _threadsWaiting(0),
+  _activeJobs(0),
+  _generation(0)
 {
   for (int i = 0; i < nrThreads; ++i) {
     IOWorker* worker = new IOWorker(this);
@@ -36,6 +42,20 @@ void IOThread::shutdown() {
     delete (*it);
   }
   _workers.clear();
+  QMutexLocker locker(&_jobListMutex);
+  for (std::vector<ThreadJob*>::iterator it = _jobList.begin(); it != _jobList.end(); ++it) {
+    recycleJob(*it);
+  }
+  _jobList.clear();
+  for (std::vector<IOJob*>::iterator it = _freeIOJobs.begin(); it != _freeIOJobs.end(); ++it) {
+    delete (*it);
+  }
+  _freeIOJobs.clear();
+  for (std::vector<RenderJob*>::iterator it = _freeRenderJobs.begin(); it != _freeRenderJobs.end(); ++it) {
+    delete (*it);
+  }
+  _freeRenderJobs.clear();
+  _idleCondition.wakeAll();
 }
 
 void IOThread::onBackgroundChannelChanged(int channel) {
@@ -66,25 +86,86 @@ std::vector<IOWorker*> IOThread::getWorkers() {
   return _workers;
 }
 
-void IOThread::addJob(const unsigned int tileSize, const long long imgPosX, const long long imgPosY, const unsigned int level, ImageSource* foregroundTile) 
+void IOThread::addJob(const unsigned int tileSize, const long long imgPosX, const long long imgPosY, const unsigned int level, ImageSource* foregroundTile, bool cancellable) 
 {
+  QMutexLocker locker(&_jobListMutex);
   ThreadJob* job = NULL;
   if (foregroundTile) {
-    job = new RenderJob(tileSize, imgPosX, imgPosY, level, foregroundTile);
+    if (_freeRenderJobs.empty()) {
+      job = new RenderJob(tileSize, imgPosX, imgPosY, level, foregroundTile);
+    }
+    else {
+      RenderJob* renderJob = _freeRenderJobs.back();
+      _freeRenderJobs.pop_back();
+      renderJob->_foregroundTile = foregroundTile;
+      job = renderJob;
+    }
   }
   else {
-    job = new IOJob(tileSize, imgPosX, imgPosY, level);
+    if (_freeIOJobs.empty()) {
+      job = new IOJob(tileSize, imgPosX, imgPosY, level);
+    }
+    else {
+      job = _freeIOJobs.back();
+      _freeIOJobs.pop_back();
+    }
   }
-  QMutexLocker locker(&_jobListMutex);
-  _jobList.push_front(job);
+  job->_tileSize = tileSize;
+  job->_imgPosX = imgPosX;
+  job->_imgPosY = imgPosY;
+  job->_level = level;
+  job->_cancellable = cancellable;
+  updatePriority(job);
+  _jobList.push_back(job);
+  std::push_heap(_jobList.begin(), _jobList.end(), ThreadJobPriority());
   _condition.wakeOne();
 }
 
-void IOThread::setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img, float scale) {
+void IOThread::setFieldOfView(const QRectF& FOV) {
+  QMutexLocker locker(&_jobListMutex);
+  _FOV = FOV;
+  ++_generation;
+}
+
+void IOThread::updatePriority(ThreadJob* job) const {
+  job->_generation = _generation;
+  job->_distance = 0;
+  if (job->_level < _levelDownsamples.size() && !_FOV.isEmpty()) {
+    double tileExtent = job->_tileSize * _levelDownsamples[job->_level];
+    double dx = (job->_imgPosX + 0.5) * tileExtent - _FOV.center().x();
+    double dy = (job->_imgPosY + 0.5) * tileExtent - _FOV.center().y();
+    job->_distance = std::sqrt(dx * dx + dy * dy) / tileExtent;
+  }
+}
+
+bool IOThread::isInFieldOfView(const ThreadJob* job) const {
+  if (job->_level >= _levelDownsamples.size() || _FOV.isEmpty()) {
+    return true;
+  }
+  double tileExtent = job->_tileSize * _levelDownsamples[job->_level];
+  return _FOV.intersects(QRectF(job->_imgPosX * tileExtent, job->_imgPosY * tileExtent, tileExtent, tileExtent));
+}
+
+void IOThread::recycleJob(ThreadJob* job) {
+  if (IOJob* ioJob = dynamic_cast<IOJob*>(job)) {
+    _freeIOJobs.push_back(ioJob);
+  }
+  else if (RenderJob* renderJob = dynamic_cast<RenderJob*>(job)) {
+    // The foreground tile is a copy made for this job only
+    delete renderJob->_foregroundTile;
+    renderJob->_foregroundTile = NULL;
+    _freeRenderJobs.push_back(renderJob);
+  }
+  else {
+    delete job;
+  }
+}
+
+void IOThread::setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img) {
   QMutexLocker locker(&_jobListMutex);
   _for_img = for_img;
   for (unsigned int i = 0; i < _workers.size(); ++i) {
-    _workers[i]->setForegroundImage(for_img, scale);
+    _workers[i]->setForegroundImage(for_img);
   }
 }
 
@@ -92,46 +173,101 @@ void IOThread::setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img, f
 void IOThread::setBackgroundImage(std::weak_ptr<MultiResolutionImage> bck_img) {
   QMutexLocker locker(&_jobListMutex);
   _bck_img = bck_img;
+  _levelDownsamples.clear();
+  if (std::shared_ptr<MultiResolutionImage> local_bck_img = _bck_img.lock()) {
+    for (int i = 0; i < local_bck_img->getNumberOfLevels(); ++i) {
+      _levelDownsamples.push_back(local_bck_img->getLevelDownsample(i));
+    }
+  }
   for (unsigned int i = 0; i < _workers.size(); ++i) {
     _workers[i]->setBackgroundImage(_bck_img);
   }
 }
 
+std::shared_ptr<TileBufferPool> IOThread::getBufferPool() {
+  return _bufferPool;
+}
+
 unsigned int IOThread::getWaitingThreads() {
   return _threadsWaiting;
 }
 
 ThreadJob* IOThread::getJob() {
   _jobListMutex.lock();
-  while (_jobList.empty() && !_abort) {
-    _threadsWaiting++;
-    _condition.wait(&_jobListMutex);
-    _threadsWaiting--;
-  }
-  if (_abort) {
-    _jobListMutex.unlock();
-    return NULL;
+  ThreadJob* job = NULL;
+  while (!job) {
+    while (_jobList.empty() && !_abort) {
+      _threadsWaiting++;
+      _condition.wait(&_jobListMutex);
+      _threadsWaiting--;
+    }
+    if (_abort) {
+      _jobListMutex.unlock();
+      return NULL;
+    }
+    std::pop_heap(_jobList.begin(), _jobList.end(), ThreadJobPriority());
+    ThreadJob* candidate = _jobList.back();
+    _jobList.pop_back();
+
+    // The field of view changed since this job was queued: drop it when it is no longer
+    // visible, otherwise requeue it with an up-to-date priority.
+    if (candidate->_generation != _generation) {
+      if (candidate->_cancellable && !isInFieldOfView(candidate)) {
+        if (_workers.size() > 0) {
+          emit _workers[0]->tileLoaded(QImage(), candidate->_imgPosX, candidate->_imgPosY, candidate->_tileSize, 0, candidate->_level, nullptr, QImage());
+        }
+        recycleJob(candidate);
+        if (_jobList.empty() && _activeJobs == 0) {
+          _idleCondition.wakeAll();
+        }
+      }
+      else {
+        updatePriority(candidate);
+        _jobList.push_back(candidate);
+        std::push_heap(_jobList.begin(), _jobList.end(), ThreadJobPriority());
+      }
+      continue;
+    }
+    job = candidate;
   }
-  ThreadJob* job = _jobList.front();
-  _jobList.pop_front();
+  _activeJobs++;
   _jobListMutex.unlock();
   return job;
 }
 
+void IOThread::releaseJob(ThreadJob* job) {
+  QMutexLocker locker(&_jobListMutex);
+  recycleJob(job);
+  _activeJobs--;
+  if (_jobList.empty() && _activeJobs == 0) {
+    _idleCondition.wakeAll();
+  }
+}
+
+void IOThread::waitForIdle() {
+  QMutexLocker locker(&_jobListMutex);
+  while ((!_jobList.empty() || _activeJobs > 0) && !_abort) {
+    _idleCondition.wait(&_jobListMutex);
+  }
+}
+
 void IOThread::clearJobs() {
   QMutexLocker locker(&_jobListMutex);
   for (auto job : _jobList) {
     if (_workers.size() > 0) {
       if (dynamic_cast<IOJob*>(job)) {
-        emit _workers[0]->tileLoaded(nullptr, job->_imgPosX, job->_imgPosY, job->_tileSize, 0, job->_level, nullptr, nullptr);
+        emit _workers[0]->tileLoaded(QImage(), job->_imgPosX, job->_imgPosY, job->_tileSize, 0, job->_level, nullptr, QImage());
       }
       else {
-        emit _workers[0]->foregroundTileRendered(nullptr, job->_imgPosX, job->_imgPosY, job->_level);
+        emit _workers[0]->foregroundTileRendered(QImage(), job->_imgPosX, job->_imgPosY, job->_level);
       }
     }
-    delete job;
+    recycleJob(job);
   }
   _jobList.clear();
+  if (_activeJobs == 0) {
+    _idleCondition.wakeAll();
+  }
 }
 
 unsigned int IOThread::numberOfJobs() {
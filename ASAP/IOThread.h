@@ -5,13 +5,16 @@
 #include <QPointer>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QRectF>
 #include <memory>
-#include <list>
+#include <vector>
 #include "interfaces/interfaces.h"
+#include "asaplib_export.h"
 
 class MultiResolutionImage;
 class WSITileGraphicsItem;
 class IOWorker;
+class TileBufferPool;
 
 class ThreadJob {
 public: 
@@ -19,9 +22,19 @@ public:
   long long _imgPosX;
   long long _imgPosY;
   unsigned int _level;
+
+  //! Distance (in tiles of the job's level) between the tile and the center of the field of view
+  //! at the time the priority was computed, lower is more urgent
+  double _distance;
+
+  //! Field of view generation the distance was computed for
+  unsigned int _generation;
+
+  //! Cancellable jobs are dropped when they are no longer in the field of view
+  bool _cancellable;
   
   ThreadJob(unsigned int tileSize, long long imgPosX, long long imgPosY, unsigned int level) :
-    _tileSize(tileSize), _imgPosX(imgPosX), _imgPosY(imgPosY), _level(level)
+    _tileSize(tileSize), _imgPosX(imgPosX), _imgPosY(imgPosY), _level(level), _distance(0), _generation(0), _cancellable(false)
   {
   }
 
@@ -51,7 +64,18 @@ public:
 
 };
 
-class IOThread : public QObject
+//! Orders the job heap: tiles of coarser levels first (they cover most of the view quickly),
+//! within a level the tiles closest to the center of the field of view first.
+struct ThreadJobPriority {
+  bool operator()(const ThreadJob* a, const ThreadJob* b) const {
+    if (a->_level != b->_level) {
+      return a->_level < b->_level;
+    }
+    return a->_distance > b->_distance;
+  }
+};
+
+class ASAPLIB_EXPORT IOThread : public QObject
 {
   Q_OBJECT
     
@@ -59,18 +83,33 @@ public:
   IOThread(QObject *parent, unsigned int nrThreads = 2);
   ~IOThread();
 
-  void addJob(const unsigned int tileSize, const long long imgPosX, const long long imgPosY, const unsigned int level, ImageSource* foregroundTile = NULL);
+  //! Adds a job to the queue. Cancellable jobs are dropped when their tile has left the field of
+  //! view by the time a worker picks them up; a tileLoaded signal without image is emitted for them.
+  void addJob(const unsigned int tileSize, const long long imgPosX, const long long imgPosY, const unsigned int level, ImageSource* foregroundTile = NULL, bool cancellable = false);
   void setBackgroundImage(std::weak_ptr<MultiResolutionImage> bck_img);
-  void setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img, float scale = 1.);
+  void setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img);
+
+  //! Sets the current field of view (in level 0 coordinates), which starts a new generation:
+  //! queued jobs are re-prioritized or dropped lazily when they are next considered.
+  void setFieldOfView(const QRectF& FOV);
   
+  //! Returns the most urgent job, blocks until one is available. Jobs should be handed back
+  //! with releaseJob once they are executed.
   ThreadJob* getJob();
+  void releaseJob(ThreadJob* job);
   void clearJobs();
   unsigned int numberOfJobs();
+
+  //! Blocks until the queue is empty and no worker is executing a job
+  void waitForIdle();
   void shutdown();
 
   std::vector<IOWorker*> getWorkers();
   unsigned int getWaitingThreads();
 
+  //! Pool the workers render tiles into, shared with the items displaying them
+  std::shared_ptr<TileBufferPool> getBufferPool();
+
   public slots:
 
   void onBackgroundChannelChanged(int channel);
@@ -84,11 +123,28 @@ private :
   bool _abort;
   QMutex _jobListMutex;
   QWaitCondition _condition;
+  QWaitCondition _idleCondition;
   std::weak_ptr<MultiResolutionImage> _bck_img;
   std::weak_ptr<MultiResolutionImage> _for_img;
-  std::list<ThreadJob*> _jobList;
+  std::vector<float> _levelDownsamples;
+
+  //! Binary heap ordered by ThreadJobPriority
+  std::vector<ThreadJob*> _jobList;
+
+  //! Executed jobs are kept for reuse instead of being reallocated for every tile
+  std::vector<IOJob*> _freeIOJobs;
+  std::vector<RenderJob*> _freeRenderJobs;
+
   std::vector<IOWorker*> _workers;
+  std::shared_ptr<TileBufferPool> _bufferPool;
   unsigned int _threadsWaiting;
+  unsigned int _activeJobs;
+  QRectF _FOV;
+  unsigned int _generation;
+
+  void updatePriority(ThreadJob* job) const;
+  bool isInFieldOfView(const ThreadJob* job) const;
+  void recycleJob(ThreadJob* job);
 };
   
 
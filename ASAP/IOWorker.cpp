@@ -1,10 +1,8 @@
 #include "IOWorker.h" 
 #include "IOThread.h"
-#include "UtilityFunctions.h"
+#include "TileBufferPool.h"
 #include "multiresolutionimageinterface/MultiResolutionImage.h"
 #include <QImage>
-#include <QPixmap>
-#include <QPainter>
 
 using namespace pathology;
 
@@ -13,8 +11,9 @@ IOWorker::IOWorker(IOThread* thread) :
   _abort(false),
   _backgroundChannel(0),
   _foregroundChannel(0),
-  _foregroundImageScale(1.),
-  _LUT()
+  _LUT(),
+  _backgroundLUT(pathology::DefaultColorLookupTables["Background"]),
+  _bufferPool(thread->getBufferPool())
 {
 }
 
@@ -40,8 +39,10 @@ void IOWorker::setForegroundChannel(int channel) {
 }
 
 void IOWorker::setLUT(const pathology::LUT& LUT) {
+  // Compile outside the lock, so rendering is not blocked while the tables are built
+  pathology::CompiledLUT compiledLUT(LUT);
   mutex.lock();
-  _LUT = LUT;
+  _LUT = compiledLUT;
   mutex.unlock();
 }
 
@@ -51,18 +52,21 @@ void IOWorker::setBackgroundImage(std::weak_ptr<MultiResolutionImage> bck_img) {
   mutex.unlock();
 }
 
-void IOWorker::setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img, float scale) {
+void IOWorker::setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img) {
   mutex.lock();
   _for_img = for_img;
-  _foregroundImageScale = scale;
   mutex.unlock();
 }
 
 void IOWorker::run()
 {
   forever{
-    ThreadJob * newJob = dynamic_cast<IOThread*>(parent())->getJob();
+    IOThread* ioThread = dynamic_cast<IOThread*>(parent());
+    ThreadJob * newJob = ioThread->getJob();
     if (_abort) {
+      if (newJob) {
+        ioThread->releaseJob(newJob);
+      }
       return;
     }
 
@@ -73,8 +77,8 @@ void IOWorker::run()
     else if (RenderJob* job = dynamic_cast<RenderJob*>(newJob)) {
       executeRenderJob(job);
     }
-    delete newJob;
     mutex.unlock();
+    ioThread->releaseJob(newJob);
   }
 }
 
@@ -82,135 +86,139 @@ bool IOWorker::executeIOJob(IOJob* job) {
   std::shared_ptr<MultiResolutionImage> local_bck_img = _bck_img.lock();
   float levelDownsample = local_bck_img->getLevelDownsample(job->_level);
   ImageSource* foregroundTile = NULL;
-  QPixmap* foregroundPixmap = NULL;
+  QImage foregroundImage;
   if (std::shared_ptr<MultiResolutionImage> local_for_img = _for_img.lock()) {
-    if (local_for_img->getDataType() == pathology::DataType::UChar) {
+    // Float16 and Bit images are read as float and unsigned char
+    pathology::DataType foregroundType = pathology::decodedDataType(local_for_img->getDataType());
+    if (foregroundType == pathology::DataType::UChar) {
       foregroundTile = getForegroundTile<unsigned char>(local_for_img, job);
-      foregroundPixmap = renderForegroundImage<unsigned char>(dynamic_cast<Patch<unsigned char>*>(foregroundTile), job->_tileSize);
+      foregroundImage = renderForegroundImage<unsigned char>(dynamic_cast<Patch<unsigned char>*>(foregroundTile), job->_tileSize);
     }
-    else if (local_for_img->getDataType() == pathology::DataType::UInt16) {
+    else if (foregroundType == pathology::DataType::UInt16) {
       foregroundTile = getForegroundTile<unsigned short>(local_for_img, job);
-      foregroundPixmap = renderForegroundImage<unsigned short>(dynamic_cast<Patch<unsigned short>*>(foregroundTile), job->_tileSize);
+      foregroundImage = renderForegroundImage<unsigned short>(dynamic_cast<Patch<unsigned short>*>(foregroundTile), job->_tileSize);
     }
-    else if (local_for_img->getDataType() == pathology::DataType::UInt32) {
+    else if (foregroundType == pathology::DataType::UInt32) {
       foregroundTile = getForegroundTile<unsigned int>(local_for_img, job);
-      foregroundPixmap = renderForegroundImage<unsigned int>(dynamic_cast<Patch<unsigned int>*>(foregroundTile), job->_tileSize);
+      foregroundImage = renderForegroundImage<unsigned int>(dynamic_cast<Patch<unsigned int>*>(foregroundTile), job->_tileSize);
     }
-    else if (local_for_img->getDataType() == pathology::DataType::Float) {
+    else if (foregroundType == pathology::DataType::Float) {
       foregroundTile = getForegroundTile<float>(local_for_img, job);
-      foregroundPixmap = renderForegroundImage<float>(dynamic_cast<Patch<float>*>(foregroundTile), job->_tileSize);
+      foregroundImage = renderForegroundImage<float>(dynamic_cast<Patch<float>*>(foregroundTile), job->_tileSize);
     }
   }
 
   if (local_bck_img) {
-    QPixmap* backgroundTile = NULL;
+    QImage backgroundTile;
     pathology::ColorType cType = local_bck_img->getColorType();
-    if (local_bck_img->getDataType() == pathology::DataType::UChar) {
+    pathology::DataType backgroundType = pathology::decodedDataType(local_bck_img->getDataType());
+    if (backgroundType == pathology::DataType::UChar) {
       backgroundTile = renderBackgroundImage<unsigned char>(local_bck_img, job, cType);
     }
-    else if (local_bck_img->getDataType() == pathology::DataType::Float) {
+    else if (backgroundType == pathology::DataType::Float) {
       backgroundTile = renderBackgroundImage<float>(local_bck_img, job, cType);
     }
-    else if (local_bck_img->getDataType() == pathology::DataType::UInt16) {
+    else if (backgroundType == pathology::DataType::UInt16) {
       backgroundTile = renderBackgroundImage<unsigned short>(local_bck_img, job, cType);
     }
-    else if (local_bck_img->getDataType() == pathology::DataType::UInt32) {
+    else if (backgroundType == pathology::DataType::UInt32) {
       backgroundTile = renderBackgroundImage<unsigned int>(local_bck_img, job, cType);
     }
-    emit tileLoaded(backgroundTile, job->_imgPosX, job->_imgPosY, job->_tileSize, job->_tileSize * job->_tileSize * local_bck_img->getSamplesPerPixel(), job->_level, foregroundTile, foregroundPixmap);
+    emit tileLoaded(backgroundTile, job->_imgPosX, job->_imgPosY, job->_tileSize, job->_tileSize * job->_tileSize * local_bck_img->getSamplesPerPixel(), job->_level, foregroundTile, foregroundImage);
     return true;
   }
   return false;
 }
 
 bool IOWorker::executeRenderJob(RenderJob* job) {
-  QPixmap* foregroundPixmap = NULL;
+  QImage foregroundImage;
   if (job->_foregroundTile->getDataType() == pathology::DataType::UChar) {
-    foregroundPixmap = renderForegroundImage<unsigned char>(dynamic_cast<Patch<unsigned char>*>(job->_foregroundTile), job->_tileSize);
+    foregroundImage = renderForegroundImage<unsigned char>(dynamic_cast<Patch<unsigned char>*>(job->_foregroundTile), job->_tileSize);
   }
   else if (job->_foregroundTile->getDataType() == pathology::DataType::UInt16) {
-    foregroundPixmap = renderForegroundImage<unsigned short>(dynamic_cast<Patch<unsigned short>*>(job->_foregroundTile), job->_tileSize);
+    foregroundImage = renderForegroundImage<unsigned short>(dynamic_cast<Patch<unsigned short>*>(job->_foregroundTile), job->_tileSize);
   }
   else if (job->_foregroundTile->getDataType() == pathology::DataType::UInt32) {
-    foregroundPixmap = renderForegroundImage<unsigned int>(dynamic_cast<Patch<unsigned int>*>(job->_foregroundTile), job->_tileSize);
+    foregroundImage = renderForegroundImage<unsigned int>(dynamic_cast<Patch<unsigned int>*>(job->_foregroundTile), job->_tileSize);
   }
   else if (job->_foregroundTile->getDataType() == pathology::DataType::Float) {
-    foregroundPixmap = renderForegroundImage<float>(dynamic_cast<Patch<float>*>(job->_foregroundTile), job->_tileSize);
-  }
-  if (foregroundPixmap) {
-    emit foregroundTileRendered(foregroundPixmap, job->_imgPosX, job->_imgPosY, job->_level);
-    return true;
-  }
-  else {
-    return false;
+    foregroundImage = renderForegroundImage<float>(dynamic_cast<Patch<float>*>(job->_foregroundTile), job->_tileSize);
   }
+  emit foregroundTileRendered(foregroundImage, job->_imgPosX, job->_imgPosY, job->_level);
+  return !foregroundImage.isNull();
 }
 
 template<typename T>
-QPixmap* IOWorker::renderBackgroundImage(std::shared_ptr<MultiResolutionImage> local_bck_img, const IOJob* job, pathology::ColorType colorType) {
+QImage IOWorker::renderBackgroundImage(std::shared_ptr<MultiResolutionImage> local_bck_img, const IOJob* job, pathology::ColorType colorType) {
   float levelDownsample = local_bck_img->getLevelDownsample(job->_level);
   unsigned int samplesPerPixel = local_bck_img->getSamplesPerPixel();
-  T *imgBuf = new T[job->_tileSize*job->_tileSize*samplesPerPixel];
+
+  // T is the data type of the image, so getRawRegion hands back the buffer of the reader itself
+  T *imgBuf = NULL;
   local_bck_img->getRawRegion(job->_imgPosX * levelDownsample * job->_tileSize, job->_imgPosY * levelDownsample * job->_tileSize, job->_tileSize, job->_tileSize, job->_level, imgBuf);
+  if (!imgBuf) {
+    return QImage();
+  }
+
+  // Render in the formats raster pixmaps use natively, so converting the image to a pixmap on the
+  // GUI thread does not have to convert the pixels
+  unsigned long long nrPixels = static_cast<unsigned long long>(job->_tileSize) * job->_tileSize;
   QImage renderedImg;
   if (colorType == pathology::ColorType::RGB) {
-    renderedImg = QImage(reinterpret_cast<unsigned char*>(imgBuf), (job->_tileSize), (job->_tileSize), (job->_tileSize) * 3, QImage::Format_RGB888);
+    renderedImg = _bufferPool->createImage(job->_tileSize, job->_tileSize, QImage::Format_RGB32);
+    const unsigned char* rgb = reinterpret_cast<const unsigned char*>(imgBuf);
+    QRgb* pixels = reinterpret_cast<QRgb*>(renderedImg.bits());
+    for (unsigned long long i = 0; i < nrPixels; ++i, rgb += 3) {
+      pixels[i] = qRgb(rgb[0], rgb[1], rgb[2]);
+    }
   }
   else if (colorType == pathology::ColorType::RGBA) {
-    renderedImg = QImage(reinterpret_cast<unsigned char*>(imgBuf), (job->_tileSize), (job->_tileSize), (job->_tileSize) * 4, QImage::Format_RGBA8888);
+    renderedImg = _bufferPool->createImage(job->_tileSize, job->_tileSize, QImage::Format_ARGB32_Premultiplied);
+    const unsigned char* rgba = reinterpret_cast<const unsigned char*>(imgBuf);
+    QRgb* pixels = reinterpret_cast<QRgb*>(renderedImg.bits());
+    for (unsigned long long i = 0; i < nrPixels; ++i, rgba += 4) {
+      pixels[i] = qPremultiply(qRgba(rgba[0], rgba[1], rgba[2], rgba[3]));
+    }
   }
   else {
-    renderedImg = convertMonochromeToRGB(imgBuf, job->_tileSize, job->_tileSize, _backgroundChannel, samplesPerPixel, local_bck_img->getMinValue(_backgroundChannel), local_bck_img->getMaxValue(_backgroundChannel), pathology::DefaultColorLookupTables["Background"]);
+    renderedImg = _bufferPool->createImage(job->_tileSize, job->_tileSize, QImage::Format_ARGB32_Premultiplied);
+    _backgroundLUT.apply(imgBuf, nrPixels, _backgroundChannel, samplesPerPixel, local_bck_img->getMinValue(_backgroundChannel), local_bck_img->getMaxValue(_backgroundChannel), reinterpret_cast<unsigned int*>(renderedImg.bits()));
   }
-  QPixmap* renderedPixmap = new QPixmap(QPixmap::fromImage(renderedImg));
   delete[] imgBuf;
-  return renderedPixmap;
+  return renderedImg;
 }
 
 template<typename T>
 Patch<T>* IOWorker::getForegroundTile(std::shared_ptr<MultiResolutionImage> local_for_img, const IOJob* job) {
   std::shared_ptr<MultiResolutionImage> loc_bck_img = _bck_img.lock();
-  int levelDifference = loc_bck_img->getBestLevelForDownSample(_foregroundImageScale);
-  int fgImageLevel = job->_level - levelDifference;
 
-  // If we request a level which is outside the range of the foreground image (e.g. level 8 when it only has 7 levels), get level 7 and scale up.
-  float foregroundExtraScaling = 1.;
-  if (fgImageLevel > local_for_img->getNumberOfLevels()) {
-    fgImageLevel = local_for_img->getNumberOfLevels() - 1;
-  }
-  else if (fgImageLevel < 0) {
-    fgImageLevel = 0;
+  // The foreground tile covers the background tile at the same size, resampled from the best
+  // foreground level (also beyond its coarsest level). Nearest neighbor keeps label values intact.
+  double foregroundDownsample = local_for_img->getDimensions()[0] / static_cast<double>(loc_bck_img->getLevelDimensions(job->_level)[0]);
+  long long startX = static_cast<long long>(job->_imgPosX * foregroundDownsample * job->_tileSize);
+  long long startY = static_cast<long long>(job->_imgPosY * foregroundDownsample * job->_tileSize);
+  Patch<T>* foregroundTile = new Patch<T>(local_for_img->getRegionAtDownsample<T>(startX, startY, job->_tileSize, job->_tileSize, foregroundDownsample,
+    pathology::Interpolation::NearestNeighbor));
+  if (!foregroundTile->getPointer()) {
+    delete foregroundTile;
+    return NULL;
   }
-  foregroundExtraScaling = local_for_img->getLevelDimensions(fgImageLevel)[0] / static_cast<float>(loc_bck_img->getLevelDimensions(job->_level)[0]);
-  pathology::DataType foregroundDataType = local_for_img->getDataType();
-
-  int correctedTileSize = job->_tileSize * foregroundExtraScaling;
-  unsigned int samplesPerPixel = local_for_img->getSamplesPerPixel();
-  float fgLevelDownsample = local_for_img->getLevelDownsample(fgImageLevel);
-  T* imgBuf = new T[correctedTileSize * correctedTileSize * samplesPerPixel];
-  local_for_img->getRawRegion(job->_imgPosX * fgLevelDownsample * foregroundExtraScaling * job->_tileSize, job->_imgPosY * fgLevelDownsample * foregroundExtraScaling * job->_tileSize, correctedTileSize, correctedTileSize, fgImageLevel, imgBuf);
-  std::vector<double> minValues, maxValues;
-  for (unsigned int i = 0; i < local_for_img->getSamplesPerPixel(); ++i) {
-    minValues.push_back(local_for_img->getMinValue(i));
-    maxValues.push_back(local_for_img->getMaxValue(i));
-  }
-  Patch<T>* foregroundTile = new Patch<T>({ static_cast<unsigned long long>(correctedTileSize), static_cast<unsigned long long>(correctedTileSize), 1 }, local_for_img->getColorType(), imgBuf, true, minValues, maxValues);
   return foregroundTile;
 }
 
 template<typename T>
-QPixmap* IOWorker::renderForegroundImage(Patch<T>* foregroundTile, unsigned int backgroundTileSize) {
+QImage IOWorker::renderForegroundImage(Patch<T>* foregroundTile, unsigned int backgroundTileSize) {
+  if (!foregroundTile) {
+    return QImage();
+  }
   std::vector<unsigned long long> dims = foregroundTile->getDimensions();
-  QImage renderedImage = convertMonochromeToRGB(foregroundTile->getPointer(), dims[0], dims[0], _foregroundChannel, foregroundTile->getSamplesPerPixel(), foregroundTile->getMinValue(_foregroundChannel), foregroundTile->getMaxValue(_foregroundChannel), _LUT);
-
-  if (!renderedImage.isNull()) {
-    if (backgroundTileSize != dims[0]) {
-      renderedImage = renderedImage.scaled(backgroundTileSize, backgroundTileSize);
-    }
-    QPixmap* renderedPixmap = new QPixmap(QPixmap::fromImage(renderedImage));
-    return renderedPixmap;
+  if (!foregroundTile->getPointer() || dims[0] == 0) {
+    return QImage();
   }
-  else {
-    return new QPixmap();
+  QImage renderedImage = _bufferPool->createImage(dims[0], dims[0], QImage::Format_ARGB32_Premultiplied);
+  _LUT.apply(foregroundTile->getPointer(), dims[0] * dims[0], _foregroundChannel, foregroundTile->getSamplesPerPixel(), foregroundTile->getMinValue(_foregroundChannel), foregroundTile->getMaxValue(_foregroundChannel), reinterpret_cast<unsigned int*>(renderedImage.bits()));
+  if (backgroundTileSize != dims[0]) {
+    renderedImage = renderedImage.scaled(backgroundTileSize, backgroundTileSize);
   }
-}
\ No newline at end of file
+  return renderedImage;
+}
@@ -3,14 +3,16 @@
 
 #include <QThread>
 #include <QMutex>
-#include <QPixmap>
+#include <QImage>
 #include <memory>
 #include "core/PathologyEnums.h"
+#include "core/CompiledLUT.h"
 #include "IOThread.h"
 
 class MultiResolutionImage;
 class FilterInterface;
 class WSITileGraphicsItem;
+class TileBufferPool;
 
 class IOWorker : public QThread
 {
@@ -26,11 +28,13 @@ public:
   void setLUT(const pathology::LUT& LUTname);
 
   void setBackgroundImage(std::weak_ptr<MultiResolutionImage> bck_img);
-  void setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img, float scale = 1.);
+  void setForegroundImage(std::weak_ptr<MultiResolutionImage> for_img);
 
 signals:
-  void tileLoaded(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile = NULL, QPixmap* foregroundPixmap = NULL);
-  void foregroundTileRendered(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel);
+  //! Tiles are emitted as images backed by the buffer pool of the IOThread, they are converted to
+  //! pixmaps on the GUI thread. A null tile means the tile could not be loaded or was dropped.
+  void tileLoaded(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile = NULL, QImage foregroundImage = QImage());
+  void foregroundTileRendered(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel);
 
 protected :
   void run();
@@ -43,22 +47,21 @@ private :
   bool _abort;
   int _backgroundChannel;
   int _foregroundChannel;
-
-  //! Foreground images can only be the same size or smaller than the background images, thus this value ranges from 1 to +inf
-  float _foregroundImageScale;
-  pathology::LUT _LUT;
+  pathology::CompiledLUT _LUT;
+  pathology::CompiledLUT _backgroundLUT;
+  std::shared_ptr<TileBufferPool> _bufferPool;
 
   bool executeIOJob(IOJob* job);
   bool executeRenderJob(RenderJob* job);
 
   template <typename T>
-  QPixmap* renderBackgroundImage(std::shared_ptr<MultiResolutionImage> local_bck_img, const IOJob* currentJob, pathology::ColorType colorType);
+  QImage renderBackgroundImage(std::shared_ptr<MultiResolutionImage> local_bck_img, const IOJob* currentJob, pathology::ColorType colorType);
 
   template<typename T>
   Patch<T>* getForegroundTile(std::shared_ptr<MultiResolutionImage> local_for_img, const IOJob* currentJob);
   
   template<typename T>
-  QPixmap* renderForegroundImage(Patch<T>* foregroundTile, unsigned int backgroundTileSize);
+  QImage renderForegroundImage(Patch<T>* foregroundTile, unsigned int backgroundTileSize);
 
 };
   
@@ -9,9 +9,10 @@
 
 const char* const MiniMap::coverageColors[] = { "red", "green", "yellow", "black", "purple", "orange" };
 
-MiniMap::MiniMap(const QPixmap& overview, QWidget *parent) 
+MiniMap::MiniMap(const QPixmap& overview, const QSizeF& sceneSize, QWidget *parent) 
   : QWidget(parent),
     _overview(overview),
+    _sceneSize(sceneSize),
     _fieldOfView(QRectF()),
     _aspectRatio(1),
     _manager(NULL),
@@ -23,7 +24,7 @@ MiniMap::MiniMap(const QPixmap& overview, QWidget *parent)
   policy.setVerticalPolicy(QSizePolicy::Fixed);
   setSizePolicy(policy);
   if (!overview.isNull()) {
-    _aspectRatio = static_cast<float>(_overview.width()) / _overview.height();
+    _aspectRatio = static_cast<float>(_sceneSize.width() / _sceneSize.height());
   }
 }
 
@@ -54,7 +55,7 @@ void MiniMap::onCoverageUpdated() {
 void MiniMap::mousePressEvent(QMouseEvent *event) {
   float posX = event->pos().x();
   float posY = event->pos().y();
-  QPointF pos((_overview.width() * posX) / width() + 1, (_overview.height() * posY) / height() + 1);
+  QPointF pos((_sceneSize.width() * posX) / width() + 1, (_sceneSize.height() * posY) / height() + 1);
   emit positionClicked(pos);
 }
 
@@ -81,7 +82,7 @@ void MiniMap::paintEvent(QPaintEvent *event) {
       for (std::vector<QPainterPath>::const_iterator it = pths.begin(); it != pths.end(); ++it) {
         if (!it->isEmpty()) {
           QTransform trans;
-          trans = trans.scale(width() / static_cast<float>(_overview.width()), height() / static_cast<float>(_overview.height()));
+          trans = trans.scale(width() / _sceneSize.width(), height() / _sceneSize.height());
           QPainterPath qpf2 = trans.map(*it);
           unsigned int colorIndex = (it - pths.begin()) % 6;
           painter.setPen(QPen(QColor(coverageColors[colorIndex])));
@@ -95,10 +96,10 @@ void MiniMap::paintEvent(QPaintEvent *event) {
       QPen blue = QPen(QColor("blue"));
       blue.setWidth(3);
       painter.setPen(blue);
-      float rectX = width() * (_fieldOfView.left() / _overview.width()) + 1;
-      float rectY = height() * (_fieldOfView.top() / _overview.height()) + 1;
-      float rectW = width() * (_fieldOfView.width() / _overview.width()) - 2;
-      float rectH = height() * (_fieldOfView.height() / _overview.height()) - 2;
+      float rectX = width() * (_fieldOfView.left() / _sceneSize.width()) + 1;
+      float rectY = height() * (_fieldOfView.top() / _sceneSize.height()) + 1;
+      float rectW = width() * (_fieldOfView.width() / _sceneSize.width()) - 2;
+      float rectH = height() * (_fieldOfView.height() / _sceneSize.height()) - 2;
       if (rectW > 3 && rectH > 3) {
         painter.drawRect(rectX, rectY, rectW, rectH);
       }
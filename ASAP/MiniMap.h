@@ -3,6 +3,7 @@
 
 #include <QWidget>
 #include <QPointer>
+#include <QSizeF>
 
 class QPixmap;
 class TileManager;
@@ -11,7 +12,8 @@ class MiniMap : public QWidget {
   Q_OBJECT
 
 public:
-  MiniMap(const QPixmap& overview, QWidget *parent);
+  //! The overview shows the whole scene of sceneSize, it may have a lower resolution
+  MiniMap(const QPixmap& overview, const QSizeF& sceneSize, QWidget *parent);
 
   QSize sizeHint() const;
   int heightForWidth(int w) const;
@@ -29,6 +31,7 @@ protected:
 
 private:
   QPixmap _overview;
+  QSizeF _sceneSize;
   QRectF _fieldOfView;
   QPointer<TileManager> _manager;
   float _aspectRatio; //Width / height
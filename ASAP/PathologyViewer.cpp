@@ -1,6 +1,7 @@
 #include "PathologyViewer.h"
 
 #include <iostream>
+#include <algorithm>
 
 #include <QResizeEvent>
 #include <QApplication>
@@ -298,13 +299,13 @@ void PathologyViewer::initialize(std::shared_ptr<MultiResolutionImage> img) {
   std::vector<IOWorker*> workers = _ioThread->getWorkers();
   for (int i = 0; i < workers.size(); ++i) {
     QObject::connect(workers[i], 
-        SIGNAL(tileLoaded(QPixmap*, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, ImageSource*, QPixmap*)), 
+        SIGNAL(tileLoaded(QImage, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, ImageSource*, QImage)), 
         _manager, 
-        SLOT(onTileLoaded(QPixmap*, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, ImageSource*, QPixmap*)));
+        SLOT(onTileLoaded(QImage, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, ImageSource*, QImage)));
     QObject::connect(workers[i], 
-        SIGNAL(foregroundTileRendered(QPixmap*, unsigned int, unsigned int, unsigned int)), 
+        SIGNAL(foregroundTileRendered(QImage, unsigned int, unsigned int, unsigned int)), 
         _manager, 
-        SLOT(onForegroundTileRendered(QPixmap*, unsigned int, unsigned int, unsigned int)));
+        SLOT(onForegroundTileRendered(QImage, unsigned int, unsigned int, unsigned int)));
   }
     //ʼͼ
   initializeImage(scene(), tileSize, lastLevel);
@@ -320,9 +321,10 @@ void PathologyViewer::initialize(std::shared_ptr<MultiResolutionImage> img) {
 
     //ǰͼı
 void PathologyViewer::onForegroundImageChanged(std::weak_ptr<MultiResolutionImage> for_img, float scale) {
+  // The workers derive the scale of the foreground from the dimensions of both images
   _for_img = for_img;
   if (_ioThread) {
-    _ioThread->setForegroundImage(_for_img, scale);
+    _ioThread->setForegroundImage(_for_img);
     _manager->refresh();
   }
 }
@@ -379,33 +381,32 @@ void PathologyViewer::initializeImage(QGraphicsScene* scn, unsigned int tileSize
   QRectF FOV = this->mapToScene(this->rect()).boundingRect();
   QRectF FOVImage = QRectF(FOV.left() / this->_sceneScale, FOV.top() / this->_sceneScale, FOV.width() / this->_sceneScale, FOV.height() / this->_sceneScale);
   emit fieldOfViewChanged(FOVImage, _img->getBestLevelForDownSample(maxDownsample / this->transform().m11()));
-  while (_ioThread->numberOfJobs() > 0) {
-  }
+  _ioThread->waitForIdle();
 }
     
     //ʼGUI ϵһ
 void PathologyViewer::initializeGUIComponents(unsigned int level) {
   // Initialize the minimap ʼСͼ
+  // The minimap shows a thumbnail of at most 1024 pixels, which can be decoded at a reduced
+  // resolution, instead of the full level; it maps the thumbnail onto the scene (the level)
   std::vector<unsigned long long> overviewDimensions = _img->getLevelDimensions(level);
-    //minimapС
-  unsigned int size = overviewDimensions[0] * overviewDimensions[1] * _img->getSamplesPerPixel();
-    
-  unsigned char* overview = new unsigned char[size];
-  _img->getRawRegion<unsigned char>(0, 0, overviewDimensions[0], overviewDimensions[1], level, overview);
+  unsigned int overviewSize = std::min<unsigned long long>(std::max(overviewDimensions[0], overviewDimensions[1]), 1024);
+  Patch<unsigned char> overview = _img->getThumbnail(overviewSize);
+  std::vector<unsigned long long> thumbnailDimensions = overview.getDimensions();
   QImage ovImg;
-  if (_img->getColorType() == pathology::ColorType::RGBA) {
-    ovImg = QImage(overview, overviewDimensions[0], overviewDimensions[1], overviewDimensions[0] * 4, QImage::Format_RGBA8888).convertToFormat(QImage::Format_RGB888);
+  // An empty thumbnail (the level could not be read) leaves the minimap blank
+  if (overview.getPointer() && _img->getColorType() == pathology::ColorType::RGBA) {
+    ovImg = QImage(overview.getPointer(), thumbnailDimensions[0], thumbnailDimensions[1], thumbnailDimensions[0] * 4, QImage::Format_RGBA8888).convertToFormat(QImage::Format_RGB888);
   }
-  else if (_img->getColorType() == pathology::ColorType::RGB) {
-    ovImg = QImage(overview, overviewDimensions[0], overviewDimensions[1], overviewDimensions[0] * 3, QImage::Format_RGB888);
+  else if (overview.getPointer() && _img->getColorType() == pathology::ColorType::RGB) {
+    ovImg = QImage(overview.getPointer(), thumbnailDimensions[0], thumbnailDimensions[1], thumbnailDimensions[0] * 3, QImage::Format_RGB888);
   }
   QPixmap ovPixMap = QPixmap(QPixmap::fromImage(ovImg));
-  delete[] overview;
   if (_map) {
     _map->deleteLater();
     _map = NULL;
   }
-  _map = new MiniMap(ovPixMap, this);
+  _map = new MiniMap(ovPixMap, QSizeF(overviewDimensions[0], overviewDimensions[1]), this);
   if (_scaleBar) {
     _scaleBar->deleteLater();
     _scaleBar = NULL;
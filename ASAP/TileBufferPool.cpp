@@ -0,0 +1,117 @@
+#include "TileBufferPool.h"
+
+#include <new>
+
+namespace {
+
+  //! Every buffer is preceded by a header which refers back to the pool, so a buffer can be
+  //! released without knowing where it came from (e.g. from a QImage cleanup function). The size
+  //! of the header keeps the buffer itself aligned.
+  struct BufferHeader {
+    std::shared_ptr<TileBufferPool> pool;
+    unsigned long long byteSize;
+  };
+
+  const unsigned long long HEADER_SIZE = 64;
+  static_assert(sizeof(BufferHeader) <= HEADER_SIZE, "BufferHeader does not fit in the space reserved for it");
+
+}
+
+std::shared_ptr<TileBufferPool> TileBufferPool::create(unsigned long long maxFreeBytes) {
+  return std::shared_ptr<TileBufferPool>(new TileBufferPool(maxFreeBytes));
+}
+
+TileBufferPool::TileBufferPool(unsigned long long maxFreeBytes) :
+  _maxFreeBytes(maxFreeBytes),
+  _freeBytes(0),
+  _allocations(0),
+  _reuses(0),
+  _outstandingBuffers(0),
+  _outstandingBytes(0)
+{
+}
+
+TileBufferPool::~TileBufferPool() {
+  for (auto it = _freeBuffers.begin(); it != _freeBuffers.end(); ++it) {
+    for (unsigned char* block : it->second) {
+      delete[] block;
+    }
+  }
+  _freeBuffers.clear();
+}
+
+unsigned char* TileBufferPool::acquire(unsigned long long byteSize) {
+  unsigned char* block = NULL;
+  {
+    QMutexLocker locker(&_mutex);
+    auto it = _freeBuffers.find(byteSize);
+    if (it != _freeBuffers.end() && !it->second.empty()) {
+      block = it->second.back();
+      it->second.pop_back();
+      _freeBytes -= byteSize;
+      ++_reuses;
+    }
+    else {
+      ++_allocations;
+    }
+    ++_outstandingBuffers;
+    _outstandingBytes += byteSize;
+  }
+  if (!block) {
+    block = new unsigned char[HEADER_SIZE + byteSize];
+  }
+  BufferHeader* header = new (block) BufferHeader();
+  header->pool = shared_from_this();
+  header->byteSize = byteSize;
+  return block + HEADER_SIZE;
+}
+
+void TileBufferPool::release(void* buffer) {
+  if (!buffer) {
+    return;
+  }
+  unsigned char* block = static_cast<unsigned char*>(buffer) - HEADER_SIZE;
+  BufferHeader* header = reinterpret_cast<BufferHeader*>(block);
+  // Take over the reference to the pool, it might be the last one
+  std::shared_ptr<TileBufferPool> pool = std::move(header->pool);
+  unsigned long long byteSize = header->byteSize;
+  header->~BufferHeader();
+  pool->recycle(block, byteSize);
+}
+
+void TileBufferPool::recycle(unsigned char* block, unsigned long long byteSize) {
+  QMutexLocker locker(&_mutex);
+  --_outstandingBuffers;
+  _outstandingBytes -= byteSize;
+  if (_freeBytes + byteSize <= _maxFreeBytes) {
+    _freeBuffers[byteSize].push_back(block);
+    _freeBytes += byteSize;
+  }
+  else {
+    delete[] block;
+  }
+}
+
+QImage TileBufferPool::createImage(unsigned int width, unsigned int height, QImage::Format format) {
+  // Scanlines of a QImage have to be 32-bit aligned
+  unsigned int bytesPerLine = ((width * QImage::toPixelFormat(format).bitsPerPixel() + 31) / 32) * 4;
+  unsigned char* buffer = acquire(static_cast<unsigned long long>(bytesPerLine) * height);
+  return QImage(buffer, width, height, bytesPerLine, format, &TileBufferPool::release, buffer);
+}
+
+TileBufferPool::Statistics TileBufferPool::getStatistics() {
+  QMutexLocker locker(&_mutex);
+  Statistics statistics;
+  statistics.allocations = _allocations;
+  statistics.reuses = _reuses;
+  statistics.outstandingBuffers = _outstandingBuffers;
+  statistics.outstandingBytes = _outstandingBytes;
+  statistics.freeBytes = _freeBytes;
+  return statistics;
+}
+
+void TileBufferPool::resetStatistics() {
+  QMutexLocker locker(&_mutex);
+  _allocations = 0;
+  _reuses = 0;
+}
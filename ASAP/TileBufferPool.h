@@ -0,0 +1,62 @@
+#ifndef TileBufferPool_H
+#define TileBufferPool_H
+
+#include <QImage>
+#include <QMutex>
+#include <memory>
+#include <vector>
+#include <map>
+#include "asaplib_export.h"
+
+//! Pool of tile-sized buffers shared by the IO workers and the viewer. Tiles are rendered into
+//! pooled memory and the memory is handed back when the last user of a tile is gone (e.g. when
+//! its item is evicted from the WSITileGraphicsItemCache), so panning reuses a small working set
+//! of buffers instead of allocating several per tile. Buffers are kept per byte size, which is
+//! determined by the tile size and pixel format. Thread-safe.
+class ASAPLIB_EXPORT TileBufferPool : public std::enable_shared_from_this<TileBufferPool> {
+public:
+  struct Statistics {
+    //! Buffers allocated because no free buffer of the requested size was available
+    unsigned long long allocations;
+    //! Requests served from the free buffers
+    unsigned long long reuses;
+    //! Buffers which are handed out and not released yet, and their total size
+    unsigned long long outstandingBuffers;
+    unsigned long long outstandingBytes;
+    //! Total size of the free buffers
+    unsigned long long freeBytes;
+  };
+
+  //! Buffers are only kept for reuse as long as the free buffers do not exceed maxFreeBytes
+  static std::shared_ptr<TileBufferPool> create(unsigned long long maxFreeBytes = 128 * 1024 * 1024);
+  ~TileBufferPool();
+
+  //! Returns a buffer of at least byteSize bytes, which should be handed back with release.
+  //! Buffers keep the pool alive until they are released.
+  unsigned char* acquire(unsigned long long byteSize);
+  static void release(void* buffer);
+
+  //! Image backed by a pooled buffer, the buffer is released when the last copy of the image
+  //! (or of a raster pixmap sharing its data) is destroyed
+  QImage createImage(unsigned int width, unsigned int height, QImage::Format format);
+
+  Statistics getStatistics();
+  void resetStatistics();
+
+private:
+  TileBufferPool(unsigned long long maxFreeBytes);
+  TileBufferPool(const TileBufferPool& that);
+
+  void recycle(unsigned char* block, unsigned long long byteSize);
+
+  QMutex _mutex;
+  std::map<unsigned long long, std::vector<unsigned char*> > _freeBuffers;
+  unsigned long long _maxFreeBytes;
+  unsigned long long _freeBytes;
+  unsigned long long _allocations;
+  unsigned long long _reuses;
+  unsigned long long _outstandingBuffers;
+  unsigned long long _outstandingBytes;
+};
+
+#endif
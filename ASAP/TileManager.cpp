@@ -1,4 +1,3 @@
-#include <sstream>
 #include "core/ImageSource.h"
 #include "TileManager.h"
 #include "multiresolutionimageinterface/MultiResolutionImage.h"
@@ -7,8 +6,18 @@
 #include "WSITileGraphicsItemCache.h"
 #include <QGraphicsScene>
 #include <QPainterPath>
+#include <QRegion>
 #include <QCoreApplication>
+#include <QPixmap>
+#include <QTimer>
 #include <cmath>
+#include <algorithm>
+
+namespace {
+  //! Time in milliseconds a batch of pending tiles may take to convert before the rest is left
+  //! for the next batch, so a burst of loaded tiles does not stall painting
+  const qint64 MAX_UPLOAD_TIME_PER_BATCH = 8;
+}
 
 TileManager::TileManager(std::shared_ptr<MultiResolutionImage> img, unsigned int tileSize, unsigned int lastRenderLevel, IOThread* ioThread, WSITileGraphicsItemCache* cache, QGraphicsScene* scene) :
 _ioThread(ioThread),
@@ -19,26 +28,47 @@ _lastLevel(),
 _coverage(),
 _cache(cache),
 _scene(scene),
-_coverageMaps(),
+_coverageMaps(lastRenderLevel + 1),
+_coverageMapsDirty(lastRenderLevel + 1, false),
 _coverageMapCacheMode(false),
-_renderForeground(true)
+_renderForeground(true),
+_pendingFieldOfView(),
+_pendingFieldOfViewLevel(0),
+_pendingFieldOfViewTiles(0),
+_lastFieldOfViewLoadTime(-1),
+_uploadScheduled(false)
 {
   for (unsigned int i = 0; i < img->getNumberOfLevels(); ++i) {
     _levelDownsamples.push_back(img->getLevelDownsample(i));
     _levelDimensions.push_back(img->getLevelDimensions(i));
   }
+  for (unsigned int i = 0; i < img->getNumberOfLevels(); ++i) {
+    // Tile requests can include the tile just outside the level, see loadTilesForFieldOfView
+    QPoint nrTiles = getLevelTiles(i) + QPoint(1, 1);
+    unsigned long long totalTiles = static_cast<unsigned long long>(nrTiles.x()) * nrTiles.y();
+    _coverageDimensions.push_back(nrTiles);
+    _coverage.push_back(std::vector<unsigned char>((totalTiles + 3) / 4, 0));
+    _visited.push_back(std::vector<unsigned char>((totalTiles + 7) / 8, 0));
+    _nrCoveredTiles.push_back(0);
+  }
 }
 
 TileManager::~TileManager() {
+  discardPendingTiles();
   _ioThread = NULL;
   _cache = NULL;
   _scene = NULL;
 }
 
 void TileManager::resetCoverage(unsigned int level) {
-  _coverage[level] = std::map<int, std::map<int, unsigned char> >();
+  if (level < _coverage.size()) {
+    std::fill(_coverage[level].begin(), _coverage[level].end(), 0);
+    std::fill(_visited[level].begin(), _visited[level].end(), 0);
+    _nrCoveredTiles[level] = 0;
+  }
   if (_coverageMaps.size() > level) {
     _coverageMaps[level] = QPainterPath();
+    _coverageMapsDirty[level] = false;
   }
 }
 
@@ -72,9 +102,11 @@ QPoint TileManager::getLevelTiles(unsigned int level) {
 
 void TileManager::loadAllTilesForLevel(unsigned int level) {
   if (_ioThread) {
-    if (level < _levelDownsamples.size()) {
+    if (level < _levelDownsamples.size() && level <= _lastRenderLevel) {
       std::vector<unsigned long long> baseLevelDims = _levelDimensions[0];
-      this->loadTilesForFieldOfView(QRectF(0, 0, baseLevelDims[0], baseLevelDims[1]), level);
+      QPoint topLeftTile = this->pixelCoordinatesToTileCoordinates(QPointF(0, 0), level);
+      QPoint bottomRightTile = this->pixelCoordinatesToTileCoordinates(QPointF(baseLevelDims[0], baseLevelDims[1]), level);
+      queueTiles(topLeftTile, bottomRightTile, level, false);
     }
   }
 }
@@ -87,32 +119,63 @@ void TileManager::loadTilesForFieldOfView(const QRectF& FOV, const unsigned int
     QPoint topLeftTile = this->pixelCoordinatesToTileCoordinates(FOV.topLeft(), level);
     QPoint bottomRightTile = this->pixelCoordinatesToTileCoordinates(FOV.bottomRight(), level);
     QRect FOVTile = QRect(topLeftTile, bottomRightTile);
-    QPoint nrTiles = getLevelTiles(level);
-    float levelDownsample = _levelDownsamples[level];
     if (FOVTile != _lastFOV || level != _lastLevel) {
       _lastLevel = level;
       _lastFOV = FOVTile;
-      for (int x = topLeftTile.x(); x <= bottomRightTile.x(); ++x) {
-        if (x >= 0 && x <= nrTiles.x()) {
-          for (int y = topLeftTile.y(); y <= bottomRightTile.y(); ++y) {
-            if (y >= 0 && y <= nrTiles.y()) {
-              if (providesCoverage(level, x, y) < 1) {
-                setCoverage(level, x, y, 1);
-                _ioThread->addJob(_tileSize, x, y, level);
-              }
-            }
+      // Queued tiles which are no longer visible are dropped by the IO thread
+      _ioThread->setFieldOfView(FOV);
+      _fieldOfViewTimer.start();
+      _pendingFieldOfView = FOVTile;
+      _pendingFieldOfViewLevel = level;
+      _pendingFieldOfViewTiles = 0;
+      QPoint nrTiles = getLevelTiles(level);
+      for (int x = std::max(topLeftTile.x(), 0); x <= std::min(bottomRightTile.x(), nrTiles.x()); ++x) {
+        for (int y = std::max(topLeftTile.y(), 0); y <= std::min(bottomRightTile.y(), nrTiles.y()); ++y) {
+          if (providesCoverage(level, x, y) < 2) {
+            ++_pendingFieldOfViewTiles;
           }
         }
       }
+      queueTiles(topLeftTile, bottomRightTile, level, true);
+      if (_pendingFieldOfViewTiles == 0) {
+        _lastFieldOfViewLoadTime = 0;
+        emit fieldOfViewLoaded(level, _lastFieldOfViewLoadTime);
+      }
+      else {
+        _lastFieldOfViewLoadTime = -1;
+      }
     }
   }
 }
 
+unsigned int TileManager::queueTiles(const QPoint& topLeftTile, const QPoint& bottomRightTile, unsigned int level, bool cancellable) {
+  unsigned int nrQueued = 0;
+  QPoint nrTiles = getLevelTiles(level);
+  for (int x = topLeftTile.x(); x <= bottomRightTile.x(); ++x) {
+    if (x >= 0 && x <= nrTiles.x()) {
+      for (int y = topLeftTile.y(); y <= bottomRightTile.y(); ++y) {
+        if (y >= 0 && y <= nrTiles.y()) {
+          if (providesCoverage(level, x, y) < 1) {
+            setCoverage(level, x, y, 1);
+            _ioThread->addJob(_tileSize, x, y, level, NULL, cancellable);
+            ++nrQueued;
+          }
+        }
+      }
+    }
+  }
+  return nrQueued;
+}
+
+qint64 TileManager::getLastFieldOfViewLoadTime() const {
+  return _lastFieldOfViewLoadTime;
+}
+
 void TileManager::updateTileForegounds() {
   _ioThread->clearJobs();
-  while (_ioThread->getWaitingThreads() != _ioThread->getWorkers().size()) {
-  }
+  _ioThread->waitForIdle();
   QCoreApplication::processEvents();
+  uploadPendingTiles();
   if (_cache) {
     std::vector<WSITileGraphicsItem*> cachedTiles = _cache->getAllItems();
     for (auto item : cachedTiles) {
@@ -120,7 +183,7 @@ void TileManager::updateTileForegounds() {
       unsigned int tileLevel = item->getTileLevel();
       unsigned int tileX = item->getTileX();
       unsigned int tileY = item->getTileY();
-      if (providesCoverage(tileLevel, tileX, tileY) == 2) {
+      if (providesCoverage(tileLevel, tileX, tileY) == 2 && item->getForegroundTile()) {
         ImageSource* foregroundTile = item->getForegroundTile()->clone();
         _ioThread->addJob(tileSize, tileX, tileY, tileLevel, foregroundTile);
       }
@@ -128,51 +191,106 @@ void TileManager::updateTileForegounds() {
   }
 }
 
-void TileManager::onForegroundTileRendered(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel) {
-  if (_cache) {
-    std::stringstream ss;
-    ss << tileX << "_" << tileY << "_" << tileLevel;
-    std::string key;
-    ss >> key;
+void TileManager::onForegroundTileRendered(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel) {
+  PendingTile pendingTile = { QImage(), tile, NULL, tileX, tileY, 0, 0, tileLevel, true };
+  _pendingTiles.push_back(pendingTile);
+  scheduleUpload();
+}
 
-    WSITileGraphicsItem* item = NULL;
-    unsigned int size = 0;
-    _cache->get(key, item, size);
-    if (item) {
-      if (tile) {
-        item->setForegroundPixmap(tile);
+void TileManager::onTileLoaded(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile, QImage foregroundImage) {
+  if (tile.isNull()) {
+    delete foregroundTile;
+    updateFieldOfViewProgress(tileX, tileY, tileLevel);
+    setCoverage(tileLevel, tileX, tileY, 0);
+    return;
+  }
+  PendingTile pendingTile = { tile, foregroundImage, foregroundTile, tileX, tileY, tileSize, tileByteSize, tileLevel, false };
+  _pendingTiles.push_back(pendingTile);
+  scheduleUpload();
+}
+
+void TileManager::scheduleUpload() {
+  if (!_uploadScheduled) {
+    _uploadScheduled = true;
+    QTimer::singleShot(0, this, &TileManager::uploadPendingTiles);
+  }
+}
+
+void TileManager::uploadPendingTiles() {
+  _uploadScheduled = false;
+  QElapsedTimer batchTimer;
+  batchTimer.start();
+  unsigned int nrUploaded = 0;
+  while (nrUploaded < _pendingTiles.size() && (nrUploaded == 0 || batchTimer.elapsed() < MAX_UPLOAD_TIME_PER_BATCH)) {
+    PendingTile& pendingTile = _pendingTiles[nrUploaded++];
+    if (pendingTile.foregroundOnly) {
+      WSITileGraphicsItem* item = NULL;
+      unsigned int size = 0;
+      if (_cache) {
+        _cache->get(WSITileGraphicsItemCache::tileKey(pendingTile.tileX, pendingTile.tileY, pendingTile.tileLevel), item, size);
+      }
+      if (item) {
+        if (!pendingTile.foregroundImage.isNull()) {
+          item->setForegroundPixmap(QPixmap::fromImage(std::move(pendingTile.foregroundImage)));
+        }
+        setCoverage(pendingTile.tileLevel, pendingTile.tileX, pendingTile.tileY, 2);
+      }
+      else if (_cache) {
+        setCoverage(pendingTile.tileLevel, pendingTile.tileX, pendingTile.tileY, 0);
       }
-      setCoverage(tileLevel, tileX, tileY, 2);
     }
     else {
-      setCoverage(tileLevel, tileX, tileY, 0);
+      updateFieldOfViewProgress(pendingTile.tileX, pendingTile.tileY, pendingTile.tileLevel);
+      addTileItem(pendingTile);
     }
   }
+  _pendingTiles.erase(_pendingTiles.begin(), _pendingTiles.begin() + nrUploaded);
+  if (!_pendingTiles.empty()) {
+    scheduleUpload();
+  }
 }
 
-void TileManager::onTileLoaded(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile, QPixmap* foregroundPixmap) {
-  if (tile) {
-    WSITileGraphicsItem* item = new WSITileGraphicsItem(tile, tileX, tileY, tileSize, tileByteSize, tileLevel, _lastRenderLevel, _levelDownsamples, this, foregroundPixmap, foregroundTile, _foregroundOpacity, _renderForeground);
-    std::stringstream ss;
-    ss << tileX << "_" << tileY << "_" << tileLevel;
-    std::string key;
-    ss >> key;
-    if (_scene) {
-      setCoverage(tileLevel, tileX, tileY, 2);
-      float tileDownsample = _levelDownsamples[tileLevel];
-      float maxDownsample = _levelDownsamples[_lastRenderLevel];
-      float posX = (tileX * tileDownsample * tileSize) / maxDownsample + ((tileSize * tileDownsample) / (2 * maxDownsample));
-      float posY = (tileY * tileDownsample * tileSize) / maxDownsample + ((tileSize * tileDownsample) / (2 * maxDownsample));
-      _scene->addItem(item);
-      item->setPos(posX, posY);
-      item->setZValue(1. / ((float)tileLevel + 1.));
-    }
-    if (_cache) {
-      _cache->set(key, item, tileByteSize, tileLevel == _lastRenderLevel);
-    }
+void TileManager::addTileItem(PendingTile& pendingTile) {
+  // With raster pixmaps the pixmap adopts the pooled buffer of the image, which then goes back to
+  // the pool when the item is evicted from the cache and deleted
+  QPixmap foregroundPixmap;
+  if (!pendingTile.foregroundImage.isNull()) {
+    foregroundPixmap = QPixmap::fromImage(std::move(pendingTile.foregroundImage));
   }
-  else {
-    setCoverage(tileLevel, tileX, tileY, 0);
+  unsigned int tileX = pendingTile.tileX;
+  unsigned int tileY = pendingTile.tileY;
+  unsigned int tileSize = pendingTile.tileSize;
+  unsigned int tileLevel = pendingTile.tileLevel;
+  WSITileGraphicsItem* item = new WSITileGraphicsItem(QPixmap::fromImage(std::move(pendingTile.tile)), tileX, tileY, tileSize, pendingTile.tileByteSize, tileLevel, _lastRenderLevel, _levelDownsamples, this, foregroundPixmap, pendingTile.foregroundTile, _foregroundOpacity, _renderForeground);
+  pendingTile.foregroundTile = NULL;
+  if (_scene) {
+    setCoverage(tileLevel, tileX, tileY, 2);
+    float tileDownsample = _levelDownsamples[tileLevel];
+    float maxDownsample = _levelDownsamples[_lastRenderLevel];
+    float posX = (tileX * tileDownsample * tileSize) / maxDownsample + ((tileSize * tileDownsample) / (2 * maxDownsample));
+    float posY = (tileY * tileDownsample * tileSize) / maxDownsample + ((tileSize * tileDownsample) / (2 * maxDownsample));
+    _scene->addItem(item);
+    item->setPos(posX, posY);
+    item->setZValue(1. / ((float)tileLevel + 1.));
+  }
+  if (_cache) {
+    _cache->set(WSITileGraphicsItemCache::tileKey(tileX, tileY, tileLevel), item, pendingTile.tileByteSize, tileLevel == _lastRenderLevel);
+  }
+}
+
+void TileManager::discardPendingTiles() {
+  for (auto& pendingTile : _pendingTiles) {
+    delete pendingTile.foregroundTile;
+  }
+  _pendingTiles.clear();
+}
+
+void TileManager::updateFieldOfViewProgress(unsigned int tileX, unsigned int tileY, unsigned int tileLevel) {
+  if (_pendingFieldOfViewTiles > 0 && tileLevel == _pendingFieldOfViewLevel && _pendingFieldOfView.contains(QPoint(tileX, tileY))) {
+    if (--_pendingFieldOfViewTiles == 0) {
+      _lastFieldOfViewLoadTime = _fieldOfViewTimer.elapsed();
+      emit fieldOfViewLoaded(tileLevel, _lastFieldOfViewLoadTime);
+    }
   }
 }
 
@@ -200,29 +318,22 @@ void TileManager::onRenderForegroundChanged(bool renderForeground) {
 
 void TileManager::setCoverageMapModeToCache() {
   _coverageMapCacheMode = true;
+  std::fill(_coverageMapsDirty.begin(), _coverageMapsDirty.end(), true);
 }
 void TileManager::setCoverageMapModeToVisited() {
   _coverageMapCacheMode = false;
+  std::fill(_coverageMapsDirty.begin(), _coverageMapsDirty.end(), true);
 }
 
 unsigned char TileManager::providesCoverage(unsigned int level, int tile_x, int tile_y) {
-  std::map<int, std::map<int, unsigned char> >& cover_level = _coverage[level];
-  if (cover_level.empty()) {
+  if (level >= _coverage.size()) {
     return 0;
   }
-
   if (tile_x < 0 || tile_y < 0) {
-    for (std::map<int, std::map<int, unsigned char> >::iterator it_x = cover_level.begin(); it_x != cover_level.end(); ++it_x) {
-      for (std::map<int, unsigned char>::iterator it_y = it_x->second.begin(); it_y != it_x->second.end(); ++it_y) {
-        if (it_y->second != 2) {
-          return 0;
-        }
-      }
-    }
-    return 2;
+    unsigned long long totalTiles = static_cast<unsigned long long>(_coverageDimensions[level].x() - 1) * (_coverageDimensions[level].y() - 1);
+    return _nrCoveredTiles[level] > 0 && _nrCoveredTiles[level] == totalTiles ? 2 : 0;
   }
-
-  return cover_level[tile_x][tile_y];
+  return getTileState(level, tile_x, tile_y);
 }
 
 bool TileManager::isCovered(unsigned int level, int tile_x, int tile_y) {
@@ -247,37 +358,84 @@ bool TileManager::isCovered(unsigned int level, int tile_x, int tile_y) {
 }
 
 void TileManager::setCoverage(unsigned int level, int tile_x, int tile_y, unsigned char covers) {
-  _coverage[level][tile_x][tile_y] = covers;
-  if (_coverageMaps.empty()) {
-    _coverageMaps.resize(_lastRenderLevel + 1);
-  }
-  if (level != _lastRenderLevel) {
-    if (covers == 2 || covers == 0) {
-      float rectSize = _tileSize / (_levelDownsamples[_lastRenderLevel] / _levelDownsamples[level]);
-      QPainterPath rect;
-      rect.addRect(QRectF(tile_x * rectSize - 1, tile_y * rectSize - 1, rectSize + 1, rectSize + 1));
-      if (covers == 2) {
-        _coverageMaps[level] = _coverageMaps[level].united(rect);
-      }
-      else if (covers == 0) {
-        if (_coverageMapCacheMode) {
-          _coverageMaps[level] = _coverageMaps[level].subtracted(rect);
-        }
+  if (!isValidTile(level, tile_x, tile_y)) {
+    return;
+  }
+  unsigned long long index = static_cast<unsigned long long>(tile_y) * _coverageDimensions[level].x() + tile_x;
+  unsigned char& packed = _coverage[level][index >> 2];
+  unsigned int shift = (index & 3) << 1;
+  unsigned char previous = (packed >> shift) & 3;
+  packed = (packed & ~(3 << shift)) | ((covers & 3) << shift);
+  // Only tiles inside the level count towards full coverage
+  if (tile_x < _coverageDimensions[level].x() - 1 && tile_y < _coverageDimensions[level].y() - 1) {
+    if (covers == 2 && previous != 2) {
+      ++_nrCoveredTiles[level];
+    }
+    else if (covers != 2 && previous == 2) {
+      --_nrCoveredTiles[level];
+    }
+  }
+  if (level < _lastRenderLevel) {
+    if (covers == 2) {
+      unsigned char& visited = _visited[level][index >> 3];
+      unsigned char bit = 1 << (index & 7);
+      if (!(visited & bit) || _coverageMapCacheMode) {
+        _coverageMapsDirty[level] = true;
       }
+      visited |= bit;
+    }
+    else if (covers == 0 && previous == 2 && _coverageMapCacheMode) {
+      _coverageMapsDirty[level] = true;
     }
   }
   emit coverageUpdated();
 }
 
+void TileManager::rebuildCoverageMap(unsigned int level) {
+  // Horizontal runs of covered tiles are merged into a region, which is turned into a single
+  // outline; in cache mode only the currently loaded tiles count, otherwise all visited tiles.
+  float rectSize = _tileSize / (_levelDownsamples[_lastRenderLevel] / _levelDownsamples[level]);
+  QRegion region;
+  const QPoint& nrTiles = _coverageDimensions[level];
+  for (int y = 0; y < nrTiles.y(); ++y) {
+    int runStart = -1;
+    for (int x = 0; x <= nrTiles.x(); ++x) {
+      bool covered = false;
+      if (x < nrTiles.x()) {
+        unsigned long long index = static_cast<unsigned long long>(y) * nrTiles.x() + x;
+        covered = _coverageMapCacheMode ? getTileState(level, x, y) == 2 : (_visited[level][index >> 3] >> (index & 7)) & 1;
+      }
+      if (covered && runStart < 0) {
+        runStart = x;
+      }
+      else if (!covered && runStart >= 0) {
+        QPoint topLeft(std::floor(runStart * rectSize), std::floor(y * rectSize));
+        QPoint bottomRight(std::ceil(x * rectSize), std::ceil((y + 1) * rectSize));
+        region += QRect(topLeft, bottomRight - QPoint(1, 1));
+        runStart = -1;
+      }
+    }
+  }
+  QPainterPath coverageMap;
+  coverageMap.addRegion(region);
+  _coverageMaps[level] = coverageMap.simplified();
+  _coverageMapsDirty[level] = false;
+}
+
 std::vector<QPainterPath> TileManager::getCoverageMaps() {
+  for (unsigned int level = 0; level < _coverageMapsDirty.size() && level < _coverage.size(); ++level) {
+    if (_coverageMapsDirty[level]) {
+      rebuildCoverageMap(level);
+    }
+  }
   return _coverageMaps;
 }
 
 void TileManager::clear() {
   _ioThread->clearJobs();
-  while (_ioThread->getWaitingThreads() != _ioThread->getWorkers().size()) {
-  }
+  _ioThread->waitForIdle();
   QCoreApplication::processEvents();
+  discardPendingTiles();
   if (_cache) {
     _cache->clear();
   }
@@ -289,8 +447,10 @@ void TileManager::clear() {
       delete itm;
     }
   }
-  _coverage.clear();
-  _coverageMaps.clear();
+  for (unsigned int level = 0; level < _coverage.size(); ++level) {
+    resetCoverage(level);
+  }
+  _pendingFieldOfViewTiles = 0;
   emit coverageUpdated();
 }
 
@@ -5,8 +5,11 @@
 #include <QRectF>
 #include <QPointF>
 #include <QPointer>
-#include <map>
+#include <QElapsedTimer>
+#include <QImage>
+#include <vector>
 #include <memory>
+#include "asaplib_export.h"
 
 class MultiResolutionImage;
 class IOThread;
@@ -15,9 +18,8 @@ class WSITileGraphicsItem;
 class QGraphicsScene;
 class QPainterPath;
 class ImageSource;
-class QPixmap;
 
-class TileManager : public QObject {
+class ASAPLIB_EXPORT TileManager : public QObject {
   Q_OBJECT
 
 private:
@@ -27,24 +29,84 @@ private:
   QRect _lastFOV;
   unsigned int _lastLevel;
   unsigned int _lastRenderLevel;
-  std::map<unsigned int, std::map<int, std::map<int, unsigned char> > > _coverage;
+
+  //! Tile states per level, 2 bits per tile in row-major order (0 = not loaded, 1 = loading, 
+  //! 2 = loaded), with the number of tiles per level in _coverageDimensions
+  std::vector<std::vector<unsigned char> > _coverage;
+  std::vector<QPoint> _coverageDimensions;
+  std::vector<unsigned long long> _nrCoveredTiles;
+
+  //! Tiles that have been loaded at some point, 1 bit per tile, for the visited coverage maps
+  std::vector<std::vector<unsigned char> > _visited;
+
   QPointer<IOThread> _ioThread;
   QPointer<WSITileGraphicsItemCache> _cache;
   QPointer<QGraphicsScene> _scene;
+
+  //! Coverage maps are rebuilt from the tile states when requested after a change
   std::vector<QPainterPath> _coverageMaps;
+  std::vector<bool> _coverageMapsDirty;
   bool _coverageMapCacheMode;
   float _foregroundOpacity;
   bool _renderForeground;
+
+  //! Time-to-full-viewport measurement: the tiles of the last field of view which were not
+  //! loaded yet when it was requested and the time since the request
+  QElapsedTimer _fieldOfViewTimer;
+  QRect _pendingFieldOfView;
+  unsigned int _pendingFieldOfViewLevel;
+  unsigned int _pendingFieldOfViewTiles;
+  qint64 _lastFieldOfViewLoadTime;
+
+  //! Tiles rendered by the workers waiting to be converted to pixmaps, which has to happen on the
+  //! GUI thread. They are converted in batches so the scene is updated once for many tiles.
+  struct PendingTile {
+    QImage tile;
+    QImage foregroundImage;
+    ImageSource* foregroundTile;
+    unsigned int tileX;
+    unsigned int tileY;
+    unsigned int tileSize;
+    unsigned int tileByteSize;
+    unsigned int tileLevel;
+    bool foregroundOnly;
+  };
+  std::vector<PendingTile> _pendingTiles;
+  bool _uploadScheduled;
+
+  void scheduleUpload();
+  void uploadPendingTiles();
+  void discardPendingTiles();
+  void addTileItem(PendingTile& tile);
+  void updateFieldOfViewProgress(unsigned int tileX, unsigned int tileY, unsigned int tileLevel);
   
   QPoint pixelCoordinatesToTileCoordinates(QPointF coordinate, unsigned int level);
   QPointF tileCoordinatesToPixelCoordinates(QPoint coordinate, unsigned int level);
   QPoint getLevelTiles(unsigned int level);
+  unsigned int queueTiles(const QPoint& topLeftTile, const QPoint& bottomRightTile, unsigned int level, bool cancellable);
+  void rebuildCoverageMap(unsigned int level);
+
+  inline bool isValidTile(unsigned int level, int tile_x, int tile_y) const {
+    return level < _coverage.size() && tile_x >= 0 && tile_y >= 0 && tile_x < _coverageDimensions[level].x() && tile_y < _coverageDimensions[level].y();
+  }
+
+  inline unsigned char getTileState(unsigned int level, int tile_x, int tile_y) const {
+    if (!isValidTile(level, tile_x, tile_y)) {
+      return 0;
+    }
+    unsigned long long index = static_cast<unsigned long long>(tile_y) * _coverageDimensions[level].x() + tile_x;
+    return (_coverage[level][index >> 2] >> ((index & 3) << 1)) & 3;
+  }
 
   TileManager(const TileManager& that);
 
 signals:
   void coverageUpdated();
 
+  //! Emitted when all tiles of the last requested field of view are loaded, with the time in
+  //! milliseconds since the field of view was requested
+  void fieldOfViewLoaded(unsigned int level, qint64 loadTime);
+
 public:
   // make sure to set `item` to NULL in the constructor
   TileManager(std::shared_ptr<MultiResolutionImage> img, unsigned int tileSize, unsigned int lastRenderLevel, IOThread* renderThread, WSITileGraphicsItemCache* _cache, QGraphicsScene* scene);
@@ -68,9 +130,12 @@ public:
 
   void reloadLastFOV();
 
+  //! Time in milliseconds it took to fully load the last field of view, -1 if it is still loading
+  qint64 getLastFieldOfViewLoadTime() const;
+
 public slots:
-  void onForegroundTileRendered(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel);
-  void onTileLoaded(QPixmap* tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile, QPixmap* foregroundPixmap);
+  void onForegroundTileRendered(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileLevel);
+  void onTileLoaded(QImage tile, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int tileLevel, ImageSource* foregroundTile, QImage foregroundImage);
   void onTileRemoved(WSITileGraphicsItem* tile);
   void onForegroundOpacityChanged(float opacity);
   void onRenderForegroundChanged(bool renderForeground);
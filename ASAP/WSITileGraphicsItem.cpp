@@ -12,9 +12,9 @@
 #include <QElapsedTimer>
 
 
-WSITileGraphicsItem::WSITileGraphicsItem(QPixmap* item, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int itemLevel, unsigned int lastRenderLevel, const std::vector<float>& imgDownsamples, TileManager* manager, QPixmap* foregroundPixmap, ImageSource* foregroundTile, float foregroundOpacity, bool renderForeground) :
+WSITileGraphicsItem::WSITileGraphicsItem(const QPixmap& item, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int itemLevel, unsigned int lastRenderLevel, const std::vector<float>& imgDownsamples, TileManager* manager, const QPixmap& foregroundPixmap, ImageSource* foregroundTile, float foregroundOpacity, bool renderForeground) :
   QGraphicsItem(),
-  _item(NULL),
+  _item(item),
   _manager(NULL),
   _tileX(tileX),
   _tileY(tileY),
@@ -27,9 +27,6 @@ WSITileGraphicsItem::WSITileGraphicsItem(QPixmap* item, unsigned int tileX, unsi
   _foregroundOpacity(foregroundOpacity),
   _renderForeground(renderForeground)
 {
-  if (item) {
-    _item = item;
-  }
   if (manager) {
     _manager = manager;
   }
@@ -55,14 +52,6 @@ WSITileGraphicsItem::WSITileGraphicsItem(QPixmap* item, unsigned int tileX, unsi
 }
 
 WSITileGraphicsItem::~WSITileGraphicsItem() {
-  if (_item) {
-    delete _item;
-    _item = NULL;
-  }
-  if (_foregroundPixmap) {
-    delete _foregroundPixmap;
-    _foregroundPixmap = NULL;
-  }
   if (_foregroundTile) {
     delete _foregroundTile;
     _foregroundTile = NULL;
@@ -81,7 +70,7 @@ void WSITileGraphicsItem::paint(QPainter *painter, const QStyleOptionGraphicsIte
                                 QWidget *widget){
   float lod = option->levelOfDetailFromTransform(painter->worldTransform());
   if (lod > _lowerLOD) {
-    if (_item) {
+    if (!_item.isNull()) {
       bool draw = false;
       if (lod <= _upperLOD) {
         draw = true;
@@ -91,10 +80,10 @@ void WSITileGraphicsItem::paint(QPainter *painter, const QStyleOptionGraphicsIte
       }
       if (draw) {
         QRectF pixmapArea = QRectF((option->exposedRect.left() + (_physicalSize / 2))*(_tileSize / _physicalSize), (option->exposedRect.top() + (_physicalSize / 2))*(_tileSize / _physicalSize), option->exposedRect.width()*(_tileSize / _physicalSize), option->exposedRect.height()*(_tileSize / _physicalSize));
-        painter->drawPixmap(option->exposedRect, *_item, pixmapArea);
-        if (_foregroundPixmap && _renderForeground && _foregroundOpacity > 0.0001) {
+        painter->drawPixmap(option->exposedRect, _item, pixmapArea);
+        if (!_foregroundPixmap.isNull() && _renderForeground && _foregroundOpacity > 0.0001) {
           painter->setOpacity(_foregroundOpacity);
-          painter->drawPixmap(option->exposedRect, *_foregroundPixmap, pixmapArea);
+          painter->drawPixmap(option->exposedRect, _foregroundPixmap, pixmapArea);
         }
       }
     }
@@ -103,16 +92,14 @@ void WSITileGraphicsItem::paint(QPainter *painter, const QStyleOptionGraphicsIte
 
 void WSITileGraphicsItem::debugPrint() {
   std::cout << "Position (x,y): (" << this->pos().x() << ", "<< this->pos().y() << ")" << std::endl;
-  std::cout << "Has pixmap: " << (_item ? "Yes" : "No") << std::endl;
+  std::cout << "Has pixmap: " << (!_item.isNull() ? "Yes" : "No") << std::endl;
   std::cout << "Visible: " << this->isVisible() << std::endl;
   std::cout << "Level: " << _itemLevel << std::endl;
   std::cout << "Bounding rectangle (x,y,w,h): (" << _boundingRect.x() << ", " << _boundingRect.y() << ", " << _boundingRect.width() << ", " << _boundingRect.height() << ")" << std::endl;
 }
 
-void WSITileGraphicsItem::setForegroundPixmap(QPixmap* foregroundPixmap) {
-  QPixmap* oldPixmap = _foregroundPixmap;
+void WSITileGraphicsItem::setForegroundPixmap(const QPixmap& foregroundPixmap) {
   _foregroundPixmap = foregroundPixmap;
-  delete oldPixmap;
   this->update();
 }
 
@@ -2,6 +2,7 @@
 #define WSITileGraphicsItem_H
 
 #include <QGraphicsItem>
+#include <QPixmap>
 #include <memory>
 
 class TileManager;
@@ -11,9 +12,9 @@ class ImageSource;
 class WSITileGraphicsItem : public QGraphicsItem {
 public:
   // make sure to set `item` to NULL in the constructor
-  WSITileGraphicsItem(QPixmap* item, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int itemLevel,
+  WSITileGraphicsItem(const QPixmap& item, unsigned int tileX, unsigned int tileY, unsigned int tileSize, unsigned int tileByteSize, unsigned int itemLevel,
                       unsigned int lastRenderLevel, const std::vector<float>& imgDownsamples, TileManager* manager,
-                      QPixmap* foregroundPixmap = NULL, ImageSource* foregroundTile = NULL, float foregroundOpacity = 1.0, bool renderForeground = true);
+                      const QPixmap& foregroundPixmap = QPixmap(), ImageSource* foregroundTile = NULL, float foregroundOpacity = 1.0, bool renderForeground = true);
   ~WSITileGraphicsItem();
 
   // you will need to add a destructor
@@ -30,7 +31,7 @@ public:
   unsigned int getTileLevel() { return _itemLevel; }
   unsigned int getTileSize() { return _tileSize; }
   
-  void setForegroundPixmap(QPixmap* foregroundPixmap);
+  void setForegroundPixmap(const QPixmap& foregroundPixmap);
   ImageSource* getForegroundTile();
 
   void setForegroundOpacity(float opacity);
@@ -42,8 +43,8 @@ public:
 private:
   // you'll probably want to store information about where you're
   // going to load the pixmap from, too
-  QPixmap *_item;
-  QPixmap* _foregroundPixmap;
+  QPixmap _item;
+  QPixmap _foregroundPixmap;
   ImageSource* _foregroundTile;
   float _foregroundOpacity;
   float _physicalSize;
@@ -7,7 +7,7 @@ WSITileGraphicsItemCache::~WSITileGraphicsItemCache() {
 
 void WSITileGraphicsItemCache::evict() {
   // Identify least recently used key 
-  std::map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> >::iterator it = _cache.find(_LRU.front());
+  std::unordered_map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> >::iterator it = _cache.find(_LRU.front());
 
   // Erase both elements to completely purge record 
   WSITileGraphicsItem* itemToEvict = it->second.first.first;
@@ -25,7 +25,7 @@ void WSITileGraphicsItemCache::clear() {
 
 void WSITileGraphicsItemCache::get(const keyType& k, WSITileGraphicsItem*& tile, unsigned int& size) {
 
-  std::map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> >::iterator it = _cache.find(k);
+  std::unordered_map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> >::iterator it = _cache.find(k);
 
   if (it == _cache.end()) {
     tile = NULL;
@@ -2,15 +2,23 @@
 #define WSITileGraphicsItemCache_H
 
 #include "multiresolutionimageinterface/TileCache.h"
+#include "asaplib_export.h"
 #include <QObject>
+#include <unordered_map>
 
 class WSITileGraphicsItem;
 
-class WSITileGraphicsItemCache : public QObject, public TileCache<WSITileGraphicsItem* >  {
+class ASAPLIB_EXPORT WSITileGraphicsItemCache : public QObject, public TileCache<WSITileGraphicsItem*, unsigned long long>  {
   Q_OBJECT
 
 public :
   ~WSITileGraphicsItemCache();
+
+  //! Packs a tile position into a cache key: 8 bits for the level, 28 bits for each coordinate
+  static inline keyType tileKey(unsigned int tileX, unsigned int tileY, unsigned int level) {
+    return (static_cast<keyType>(level & 0xFF) << 56) | (static_cast<keyType>(tileX & 0xFFFFFFF) << 28) | static_cast<keyType>(tileY & 0xFFFFFFF);
+  }
+
   void clear();
   void get(const keyType& k, WSITileGraphicsItem*& tile, unsigned int& size);
   int set(const keyType& k, WSITileGraphicsItem* v, unsigned int size, bool topLevel = false);
@@ -21,11 +29,13 @@ protected:
 
 private :
 
-  // Structure of the cache is as follow: each entry has a position string as the key (x-y-level)
+  // Structure of the cache is as follow: each entry has a packed position as the key (see tileKey)
   // Each value contains ((tile, size), iterator to position in _LRU)
-  std::map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> > _cache;
+  std::unordered_map<keyType, std::pair<std::pair<WSITileGraphicsItem*, unsigned int>, keyTypeList::iterator> > _cache;
 
 signals:
+  //! The receiver takes ownership of the item, deleting it hands its tile memory back to the
+  //! TileBufferPool of the IOThread
   void itemEvicted(WSITileGraphicsItem* item);
 };
 
@@ -10,6 +10,7 @@
 #include "QtAnnotationGroup.h"
 #include "annotation/Annotation.h"
 #include "annotation/ImageScopeRepository.h"
+#include "annotation/XmlRepository.h"
 #include "annotation/AnnotationToMask.h"
 #include "DotQtAnnotation.h"
 #include "PolyQtAnnotation.h"
@@ -39,6 +40,7 @@
 #include <QProgressDialog>
 #include <QMessageBox>
 #include <QInputDialog>
+#include <QTimer>
 
 #include <numeric>
 #include <iostream>
@@ -56,7 +58,9 @@ AnnotationWorkstationExtensionPlugin::AnnotationWorkstationExtensionPlugin() :
   _currentAnnotationLine(NULL),
   _currentAnnotationLabel(NULL),
   _currentAnnotationHeaderLabel(NULL),
-  _currentPixelArea(1.)
+  _currentPixelArea(1.),
+  _autosaveTimer(NULL),
+  _autosaveEnabled(false)
 {
   QUiLoader loader;
   QFile file(":/AnnotationWorkstationExtensionPlugin_ui/AnnotationDockWidget.ui");
@@ -98,6 +102,11 @@ AnnotationWorkstationExtensionPlugin::AnnotationWorkstationExtensionPlugin() :
   QtAnnotation::selectionSensitivity = _settings->value("annotationSelectionSensitivity", 100.).value<float>();
   QtAnnotation::annotationColorForRects = _settings->value("annotationColorForRects", true).value<bool>();
 
+  // Autosave only journals the annotations changed since the last save, see XmlRepository
+  _autosaveTimer = new QTimer(this);
+  connect(_autosaveTimer, SIGNAL(timeout()), this, SLOT(autosave()));
+  setAutosaveInterval(_settings->value("annotationAutosaveInterval", 60).value<int>());
+
   qRegisterMetaTypeStreamOperators<QtAnnotation*>("QtAnnotation*");
   qRegisterMetaTypeStreamOperators<QtAnnotationGroup*>("QtAnnotationGroup*");
 }
@@ -135,6 +144,13 @@ void AnnotationWorkstationExtensionPlugin::onOptionsButtonPressed() {
   annotationColorForRects->setToolTip("Set the color of the rectangles to the same color as the annotation itself.");
   optionsDialogLayout->addRow("Selection sensitivity", selSensSpinBox);
   optionsDialogLayout->addRow("Use annotation color for coordinate indicators", annotationColorForRects);
+  QSpinBox* autosaveSpinBox = new QSpinBox();
+  autosaveSpinBox->setMinimum(0);
+  autosaveSpinBox->setMaximum(3600);
+  autosaveSpinBox->setValue(_autosaveTimer->isActive() ? _autosaveTimer->interval() / 1000 : 0);
+  autosaveSpinBox->setObjectName("AutosaveInterval");
+  autosaveSpinBox->setToolTip("Interval in seconds at which changes are saved to the loaded or last saved annotation file. Set to 0 to disable autosaving.");
+  optionsDialogLayout->addRow("Autosave interval (s)", autosaveSpinBox);
   dialogLayout->addLayout(optionsDialogLayout);
   QPushButton* cancel = new QPushButton("Cancel");
   QPushButton* ok = new QPushButton("Ok");
@@ -153,6 +169,24 @@ void AnnotationWorkstationExtensionPlugin::onOptionsButtonPressed() {
     QtAnnotation::annotationColorForRects = colorForRects;
     _settings->setValue("annotationSelectionSensitivity", newSelectionSensitivity);
     _settings->setValue("annotationColorForRects", colorForRects);
+    setAutosaveInterval(autosaveSpinBox->value());
+    _settings->setValue("annotationAutosaveInterval", autosaveSpinBox->value());
+  }
+}
+
+void AnnotationWorkstationExtensionPlugin::setAutosaveInterval(int seconds) {
+  if (seconds > 0) {
+    _autosaveTimer->start(seconds * 1000);
+  }
+  else {
+    _autosaveTimer->stop();
+  }
+}
+
+void AnnotationWorkstationExtensionPlugin::autosave() {
+  // Annotations which are still being drawn are saved once they are finished
+  if (_autosaveEnabled && !_generatedAnnotation && _annotationService && _annotationService->getList()->isModified()) {
+    _annotationService->saveRepositoryIncremental();
   }
 }
 
@@ -162,6 +196,7 @@ void AnnotationWorkstationExtensionPlugin::clear() {
       std::dynamic_pointer_cast<AnnotationTool>((*it))->cancelAnnotation();
     }
   }
+  _autosaveEnabled = false;
   _treeWidget->clearSelection();
   clearTreeWidget();
   clearQtAnnotations();
@@ -362,6 +397,9 @@ void AnnotationWorkstationExtensionPlugin::onLoadButtonPressed(const std::string
         tr("The annotations could not be loaded."),
         QMessageBox::Ok);
     }
+    else {
+      _autosaveEnabled = std::dynamic_pointer_cast<XmlRepository>(_annotationService->getRepository()) != NULL;
+    }
     // Check if it is an ImageScopeRepository, if so, offer the user the chance to reload with new closing distance
     std::shared_ptr<ImageScopeRepository> imscRepo = std::dynamic_pointer_cast<ImageScopeRepository>(_annotationService->getRepository());
     if (imscRepo) {
@@ -581,6 +619,7 @@ bool AnnotationWorkstationExtensionPlugin::onSaveButtonPressed() {
     }
     else {
       _annotationService->getList()->resetModifiedStatus();
+      _autosaveEnabled = std::dynamic_pointer_cast<XmlRepository>(_annotationService->getRepository()) != NULL;
       return true;
     }
   }
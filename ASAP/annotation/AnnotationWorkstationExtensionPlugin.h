@@ -18,6 +18,7 @@ class QEvent;
 class QSettings;
 class QFrame;
 class QLabel;
+class QTimer;
 
 class ANNOTATIONPLUGIN_EXPORT AnnotationWorkstationExtensionPlugin : public WorkstationExtensionPluginInterface
 {
@@ -66,6 +67,7 @@ private slots:
     void resizeOnExpand();
     void updateAnnotationToolTip(QtAnnotation* annotation);
     void updateGeneratingAnnotationLabel(QtAnnotation* annotation);
+    void autosave();
 
 protected:
     QRectF _start_zoom;
@@ -88,12 +90,15 @@ private :
     QEvent* _oldEvent;
     std::weak_ptr<MultiResolutionImage> _img;
     float _currentPixelArea;
+    QTimer* _autosaveTimer;
+    bool _autosaveEnabled;
 
     bool shouldClear();
     void clear();
     void clearTreeWidget();
     void clearAnnotationList();
     void clearQtAnnotations();
+    void setAutosaveInterval(int seconds);
 
     static unsigned int _annotationIndex;
     static unsigned int _annotationGroupIndex;
@@ -17,12 +17,12 @@ void DotQtAnnotation::moveCoordinatesBy(const Point& moveBy) {
 }
 
 void DotQtAnnotation::moveCoordinateBy(const Point& moveBy) {
-  std::vector<Point> coords = this->getAnnotation()->getCoordinates();
+  Point coord = this->getAnnotation()->getCoordinate(0);
   prepareGeometryChange();
-  coords[0].setX(coords[0].getX() + moveBy.getX() / _scale);
-  coords[0].setY(coords[0].getY() + moveBy.getY() / _scale);
-  this->getAnnotation()->setCoordinates(coords);
-  this->setPos(QPointF(coords[0].getX()*_scale, coords[0].getY()*_scale));
+  coord.setX(coord.getX() + moveBy.getX() / _scale);
+  coord.setY(coord.getY() + moveBy.getY() / _scale);
+  this->getAnnotation()->setCoordinate(0, coord);
+  this->setPos(QPointF(coord.getX()*_scale, coord.getY()*_scale));
   onAnnotationChanged();
 }
 
@@ -29,7 +29,7 @@ MeasurementQtAnnotation::MeasurementQtAnnotation(const std::shared_ptr<Annotatio
 QRectF MeasurementQtAnnotation::boundingRect() const {
   QRectF bRect;
   if (_annotation) {    
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     QPointF last = this->mapFromScene(coords[coords.size() - 1].getX()*_scale, coords[coords.size() - 1].getY()*_scale);
     float left = last.x() <= 0 ? last.x() : 0;
     float top = last.y() <= 0 ? last.y() : 0;
@@ -45,7 +45,7 @@ void MeasurementQtAnnotation::paint(QPainter *painter, const QStyleOptionGraphic
   if (_annotation) {
     QColor lineColor = this->getDrawingColor();
     _currentLoD = option->levelOfDetailFromTransform(painter->worldTransform());
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     if (coords.size() > 1) {
       if (isSelected()) {
         painter->setPen(QPen(QBrush(lineColor.lighter(150)), _lineAnnotationSelectedThickness / _currentLoD));
@@ -96,7 +96,7 @@ bool MeasurementQtAnnotation::contains(const QPointF & point) const {
     double curSelectionSensitivitySquared = curSelectionSensitivity * curSelectionSensitivity;
     double imgX = imgPoint.x();
     double imgY = imgPoint.y();
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     double minDist = std::numeric_limits<double>::max();
 
     minDist = std::numeric_limits<double>::max();
@@ -26,7 +26,7 @@ void PointSetQtAnnotation::paint(QPainter *painter, const QStyleOptionGraphicsIt
   if (_annotation) {
     _currentLoD = option->levelOfDetailFromTransform(painter->worldTransform());
     //painter->drawRect(_bRect);
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     if (isSelected()) {
         if (QtAnnotation::annotationColorForRects) {
             painter->setPen(QPen(QBrush(getDrawingColor().lighter(150)), 4.5 * _rectSize / _currentLoD, Qt::PenStyle::SolidLine, Qt::PenCapStyle::SquareCap));
@@ -64,7 +64,7 @@ bool PointSetQtAnnotation::contains(const QPointF & point) const {
     double curSelectionSensitivitySquared = curSelectionSensitivity * curSelectionSensitivity;
     double imgX = imgPoint.x();
     double imgY = imgPoint.y();
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     double minDist = std::numeric_limits<double>::max();
     _lastClickedFirstCoordinateIndex = -1;
 
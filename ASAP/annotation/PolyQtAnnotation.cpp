@@ -133,7 +133,7 @@ void PolyQtAnnotation::paint(QPainter *painter, const QStyleOptionGraphicsItem *
     QColor fillColor = this->getDrawingColor();
     fillColor.setAlphaF(0.3);
     _currentLoD = option->levelOfDetailFromTransform(painter->worldTransform());
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     if (coords.size() > 1) {
       if (isSelected()) {
         painter->setPen(QPen(QBrush(lineColor.lighter(150)), _lineAnnotationSelectedThickness / _currentLoD));
@@ -202,7 +202,7 @@ bool PolyQtAnnotation::contains(const QPointF & point) const {
     double curSelectionSensitivitySquared = curSelectionSensitivity * curSelectionSensitivity;
     double imgX = imgPoint.x();
     double imgY = imgPoint.y();
-    std::vector<Point> coords = _annotation->getCoordinates();
+    const std::vector<Point>& coords = _annotation->getCoordinates();
     double minDist = std::numeric_limits<double>::max();
     _lastClickedFirstCoordinateIndex = -1;
     _lastClickedSecondCoordinateIndex = -1;
@@ -126,14 +126,14 @@ void QtAnnotation::setCoordinates(const std::vector<Point>& coordinates) {
 }
 
 void QtAnnotation::moveCoordinateBy(unsigned int index, const Point& moveBy) {
-  std::vector<Point> coords = _annotation->getCoordinates();
-  if (index < coords.size()) {
+  if (index < _annotation->getNumberOfPoints()) {
     prepareGeometryChange();
-    coords[index].setX(coords[index].getX() + moveBy.getX() / _scale);
-    coords[index].setY(coords[index].getY() + moveBy.getY() / _scale);
-    _annotation->setCoordinates(coords);
+    Point coord = _annotation->getCoordinate(index);
+    coord.setX(coord.getX() + moveBy.getX() / _scale);
+    coord.setY(coord.getY() + moveBy.getY() / _scale);
+    _annotation->setCoordinate(index, coord);
     if (index == 0) {
-      this->setPos(QPointF(coords[0].getX()*_scale, coords[0].getY()*_scale));
+      this->setPos(QPointF(coord.getX()*_scale, coord.getY()*_scale));
     }
   }
   onAnnotationChanged();
@@ -146,8 +146,9 @@ void QtAnnotation::moveCoordinatesBy(const Point& moveBy) {
     it->setX(it->getX() + moveBy.getX() / _scale);
     it->setY(it->getY() + moveBy.getY() / _scale);
   }
-  _annotation->setCoordinates(coords);
-  this->setPos(QPointF(coords[0].getX()*_scale, coords[0].getY()*_scale));
+  _annotation->setCoordinates(std::move(coords));
+  Point first = _annotation->getCoordinate(0);
+  this->setPos(QPointF(first.getX()*_scale, first.getY()*_scale));
   onAnnotationChanged();
   emit annotationChanged(this);
 }
@@ -487,7 +487,7 @@ void VisualizationWorkstationExtensionPlugin::setDefaultVisualizationParameters(
   if (_dockWidget) {
     if (_settings) {
       _settings->beginGroup("VisualizationWorkstationExtensionPlugin");
-      pathology::DataType dtype = img->getDataType();
+      pathology::DataType dtype = pathology::decodedDataType(img->getDataType());
       if (dtype == pathology::DataType::Float) {
         _settings->beginGroup("VisualizationSettingsForFloatType");
       }
@@ -518,7 +518,7 @@ void VisualizationWorkstationExtensionPlugin::setDefaultVisualizationParameters(
     else {
       _opacity = 0.5;
       _foregroundChannel = 0;
-      if (img->getDataType() == pathology::DataType::UChar || img->getDataType() == pathology::DataType::UInt32 || img->getDataType() == pathology::DataType::UInt16) {
+      if (img->getDataType() == pathology::DataType::UChar || img->getDataType() == pathology::DataType::UInt32 || img->getDataType() == pathology::DataType::UInt16 || img->getDataType() == pathology::DataType::Bit) {
         _currentLUT = "Label";
       }
       else {
@@ -549,7 +549,7 @@ void VisualizationWorkstationExtensionPlugin::onImageClosed() {
   // Store current visualization settings based on ImageType (later replace this with Result specific settings)
   if (_settings && _foreground) {
     _settings->beginGroup("VisualizationWorkstationExtensionPlugin");
-    pathology::DataType dtype = _foreground->getDataType();
+    pathology::DataType dtype = pathology::decodedDataType(_foreground->getDataType());
     if (dtype == pathology::DataType::Float) {
       _settings->beginGroup("VisualizationSettingsForFloatType");
     }
@@ -50,27 +50,22 @@ namespace ASAP
 
 			if (image)
 			{
-				unsigned char* data(nullptr);
-				std::vector<unsigned long long> dimensions;
+				if (image->getDataType() != pathology::DataType::UChar) {
+					return m_invalid_icon;
+				}
 
-				if (image->getDataType() == pathology::DataType::UChar) {
-					if (image->getNumberOfLevels() > 1)
-					{
-						dimensions = image->getLevelDimensions(image->getNumberOfLevels() - 1);
-						image->getRawRegion(0, 0, dimensions[0], dimensions[1], image->getNumberOfLevels() - 1, data);
-					}
-					else
-					{
-						dimensions = image->getDimensions();
-						if (dimensions[0] * dimensions[1] < (1024 * 1024)) {
-							image->getRawRegion(0, 0, dimensions[0], dimensions[1], 0, data);
-						}
-						else {
-							return m_invalid_icon;
-						}
-					}
+				// Large single-level images are only used when their tiles can be decoded at a reduced
+				// resolution, decoding them in full takes too long.
+				std::vector<unsigned long long> dimensions = image->getDimensions();
+				EncodedTileInfo info;
+				if (image->getNumberOfLevels() == 1 && dimensions[0] * dimensions[1] >= (1024 * 1024) && !image->getEncodedTileInfo(0, info)) {
+					return m_invalid_icon;
 				}
-				else {
+
+				Patch<unsigned char> thumbnail = image->getThumbnail(size);
+				dimensions = thumbnail.getDimensions();
+				const unsigned char* data = thumbnail.getPointer();
+				if (!data) {
 					return m_invalid_icon;
 				}
 
@@ -115,7 +110,6 @@ namespace ASAP
 					}
 				}
 
-				delete[] data;
 				scaled_image = qimage.scaled(QSize(size, size), Qt::AspectRatioMode::KeepAspectRatio);
 				m_thumbnail_cache->addThumbnailToCache(QString::fromStdString(filepath), scaled_image);
 				QPixmap pixmap(QPixmap::fromImage(scaled_image));
@@ -4,26 +4,36 @@
 #include <limits>
 #include <cmath>
 #include <iterator>
+#include <utility>
 
 const char* Annotation::_typeStrings[7] = { "None", "Dot", "Polygon", "Spline", "PointSet", "Measurement", "Rectangle"};
 
 Annotation::Annotation() :
   _type(Annotation::Type::NONE),
-  _coordinates()
+  _coordinates(),
+  _area(0),
+  _bboxValid(false),
+  _areaValid(false)
 {
 }
 
+void Annotation::invalidateGeometry() {
+  _bboxValid = false;
+  _areaValid = false;
+  _modified = true;
+}
+
 std::string Annotation::getTypeAsString() const {
   return _typeStrings[static_cast<int>(_type)];
 }
 
 bool Annotation::isClockwise() const {
   if (!_coordinates.empty()) {
-    std::vector<Point> coords = _coordinates;
-    coords.push_back(coords[0]);
     double cwise = 0;
-    for (unsigned int pt = 0; pt < coords.size() - 1; ++pt) {
-      double toAdd = (coords[pt + 1].getX() - coords[pt].getX()) * ((coords[pt + 1].getY() + coords[pt].getY()));
+    for (unsigned int pt = 0; pt < _coordinates.size(); ++pt) {
+      const Point& current = _coordinates[pt];
+      const Point& next = pt + 1 < _coordinates.size() ? _coordinates[pt + 1] : _coordinates[0];
+      double toAdd = (next.getX() - current.getX()) * ((next.getY() + current.getY()));
       cwise += toAdd;
     }
     return cwise < 0;
@@ -43,18 +53,19 @@ void Annotation::setTypeFromString(const std::string& type) {
 }
 
 float Annotation::getArea() const {
-  if (!_coordinates.empty()) {
+  if (!_areaValid) {
     double  area = 0.;
-    int j = _coordinates.size() - 1;
-    for (int i = 0; i < _coordinates.size(); i++) {
-      area += (_coordinates[j].getX() + _coordinates[i].getX())*(_coordinates[j].getY() - _coordinates[i].getY());
-      j = i;
+    if (!_coordinates.empty()) {
+      int j = _coordinates.size() - 1;
+      for (int i = 0; i < _coordinates.size(); i++) {
+        area += (_coordinates[j].getX() + _coordinates[i].getX())*(_coordinates[j].getY() - _coordinates[i].getY());
+        j = i;
+      }
     }
-    return std::abs(area*.5);
-  }
-  else{
-    return 0.0;
+    _area = std::abs(area*.5);
+    _areaValid = true;
   }
+  return _area;
 }
 
 unsigned int Annotation::getNumberOfPoints() const {
@@ -64,13 +75,13 @@ unsigned int Annotation::getNumberOfPoints() const {
 void Annotation::addCoordinate(const float& x, const float& y)
 {
 	_coordinates.push_back(Point(x, y));
-  _modified = true;
+  invalidateGeometry();
 }
 
 void Annotation::addCoordinate(const Point& xy)
 {
   _coordinates.push_back(xy);
-  _modified = true;
+  invalidateGeometry();
 }
 
 void Annotation::insertCoordinate(const int& index, const Point& xy) {
@@ -80,12 +91,11 @@ void Annotation::insertCoordinate(const int& index, const Point& xy) {
   else {
     _coordinates.insert(_coordinates.begin() + index, xy);
   }
-  _modified = true;
+  invalidateGeometry();
 }
 
 void Annotation::insertCoordinate(const int& index, const float& x, const float& y) {
   this->insertCoordinate(index, Point(x, y));
-  _modified = true;
 }
 
 void Annotation::removeCoordinate(const int& index) {
@@ -95,7 +105,7 @@ void Annotation::removeCoordinate(const int& index) {
   else {
     _coordinates.erase(_coordinates.begin() + index);
   }
-  _modified = true;
+  invalidateGeometry();
 }
 
 Point Annotation::getCoordinate(const int& index) const
@@ -108,7 +118,18 @@ Point Annotation::getCoordinate(const int& index) const
   }
 }
 
-std::vector<Point> Annotation::getCoordinates() const
+void Annotation::setCoordinate(const int& index, const Point& xy)
+{
+  if (index < 0) {
+    *(_coordinates.end() - abs(index)) = xy;
+  }
+  else {
+    *(_coordinates.begin() + index) = xy;
+  }
+  invalidateGeometry();
+}
+
+const std::vector<Point>& Annotation::getCoordinates() const
 {
   return _coordinates;
 }
@@ -116,12 +137,18 @@ std::vector<Point> Annotation::getCoordinates() const
 void Annotation::setCoordinates(const std::vector<Point>& coordinates)
 {
   _coordinates = coordinates;
-  _modified = true;
+  invalidateGeometry();
+}
+
+void Annotation::setCoordinates(std::vector<Point>&& coordinates)
+{
+  _coordinates = std::move(coordinates);
+  invalidateGeometry();
 }
 
 void Annotation::clearCoordinates() {
   _coordinates.clear();
-  _modified = true;
+  invalidateGeometry();
 }
 
 void Annotation::setType(const Annotation::Type& type)
@@ -136,67 +163,70 @@ Annotation::Type Annotation::getType() const
 }
 
 std::vector<Point> Annotation::getImageBoundingBox() const {
-  std::vector<Point> bbox;
-  Point topLeft(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-  Point bottomRight(std::numeric_limits<float>::min(), std::numeric_limits<float>::min());
-  
-  if (_coordinates.empty()) {
-    topLeft = Point(0, 0);
-    bottomRight = Point(0, 0);
-  }
-  else {
-    for (std::vector<Point>::const_iterator it = _coordinates.begin(); it != _coordinates.end(); ++it) {
-      if (it->getX() > bottomRight.getX()) {
-        bottomRight.setX(it->getX());
-      }
-      if (it->getY() > bottomRight.getY()) {
-        bottomRight.setY(it->getY());
-      }
-      if (it->getX() < topLeft.getX()) {
-        topLeft.setX(it->getX());
-      }
-      if (it->getY() < topLeft.getY()) {
-        topLeft.setY(it->getY());
+  if (!_bboxValid) {
+    Point topLeft(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Point bottomRight(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+
+    if (_coordinates.empty()) {
+      topLeft = Point(0, 0);
+      bottomRight = Point(0, 0);
+    }
+    else {
+      for (std::vector<Point>::const_iterator it = _coordinates.begin(); it != _coordinates.end(); ++it) {
+        if (it->getX() > bottomRight.getX()) {
+          bottomRight.setX(it->getX());
+        }
+        if (it->getY() > bottomRight.getY()) {
+          bottomRight.setY(it->getY());
+        }
+        if (it->getX() < topLeft.getX()) {
+          topLeft.setX(it->getX());
+        }
+        if (it->getY() < topLeft.getY()) {
+          topLeft.setY(it->getY());
+        }
       }
     }
+    _bboxTopLeft = topLeft;
+    _bboxBottomRight = bottomRight;
+    _bboxValid = true;
   }
-
-  bbox.push_back(topLeft);
-  bbox.push_back(bottomRight);
-  return bbox;
+  return std::vector<Point>{_bboxTopLeft, _bboxBottomRight};
 }
 
 void Annotation::simplify(unsigned int nrPoints, float epsilon) {
-  std::vector<float> inPoints;
-  std::vector<float> outPoints;
-  for (std::vector<Point>::iterator it = _coordinates.begin(); it != _coordinates.end(); ++it) {
-    inPoints.push_back(it->getX());
-    inPoints.push_back(it->getY());
-  }
-  std::vector<float>::const_iterator begin = inPoints.begin();
-  std::vector<float>::const_iterator end = inPoints.end();
+  // Points are two packed floats, so the coordinates can be handed to psimpl as a flat
+  // float array. psimpl copies its input before writing the (ordered, smaller) result, 
+  // which makes it safe to write the output over the input.
+  static_assert(sizeof(Point) == 2 * sizeof(float), "Point should consist of two packed floats");
   if (nrPoints > 0) {
-    psimpl::simplify_douglas_peucker_n<2>(begin, end, nrPoints, std::back_inserter(outPoints));
+    if (nrPoints < 2 || _coordinates.size() <= nrPoints) {
+      return;
+    }
   }
-  else {
-    psimpl::simplify_douglas_peucker<2>(begin, end, epsilon, std::back_inserter(outPoints));
+  else if (_coordinates.size() < 3 || epsilon == 0) {
+    return;
   }
-  _coordinates.clear();
-  for (std::vector<float>::iterator it = outPoints.begin(); it != outPoints.end(); ++it) {
-    float x = *it;
-    ++it;
-    float y = *it;
-    _coordinates.push_back(Point(x,y));
+  float* coords = reinterpret_cast<float*>(_coordinates.data());
+  const float* begin = coords;
+  const float* end = coords + 2 * _coordinates.size();
+  float* last = NULL;
+  if (nrPoints > 0) {
+    last = psimpl::simplify_douglas_peucker_n<2>(begin, end, nrPoints, coords);
   }
-  _modified = true;
+  else {
+    last = psimpl::simplify_douglas_peucker<2>(begin, end, epsilon, coords);
+  }
+  _coordinates.resize((last - coords) / 2);
+  invalidateGeometry();
 }
 
 Point Annotation::getCenter() {
   Point center(0, 0);
   if (!_coordinates.empty()) {
-    std::vector<Point> bbox = getImageBoundingBox();
-    center.setX((bbox[0].getX() + bbox[1].getX())/2.);
-    center.setY((bbox[0].getY() + bbox[1].getY()) / 2.);
+    getImageBoundingBox();
+    center.setX((_bboxTopLeft.getX() + _bboxBottomRight.getX())/2.);
+    center.setY((_bboxTopLeft.getY() + _bboxBottomRight.getY()) / 2.);
   }
   return center;
 }
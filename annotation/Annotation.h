@@ -32,8 +32,13 @@ public:
   void insertCoordinate(const int& index, const Point& xy);
   void removeCoordinate(const int& index);
   void setCoordinates(const std::vector<Point>& coordinates);
+  void setCoordinates(std::vector<Point>&& coordinates);
+  void setCoordinate(const int& index, const Point& xy);
   Point getCoordinate(const int& index) const;
-  std::vector<Point> getCoordinates() const;
+
+  //! Returns a reference to the coordinates, which stays valid until the annotation
+  //! is modified or destroyed. Copy the vector if it needs to outlive that.
+  const std::vector<Point>& getCoordinates() const;
   void clearCoordinates();
 
 	void setType(const Annotation::Type& type);
@@ -42,10 +47,12 @@ public:
   std::string getTypeAsString() const;
   void setTypeFromString(const std::string& type);
 
+  //! The bounding box and area are cached and recomputed only after the coordinates change
   std::vector<Point> getImageBoundingBox() const;
   std::vector<Point> getLocalBoundingBox();
   Point getCenter();
 
+  //! Simplifies the polygon (Douglas-Peucker) in place, either to nrPoints or with tolerance epsilon
   void simplify(unsigned int nrPoints=0, float epsilon=1.0);
 
   float getArea() const;
@@ -54,8 +61,17 @@ public:
   bool isClockwise() const;
 
 private:
+  void invalidateGeometry();
+
   Type _type;
 	std::vector<Point> _coordinates;
+
+  // Cached geometric properties, invalidated whenever the coordinates change
+  mutable Point _bboxTopLeft;
+  mutable Point _bboxBottomRight;
+  mutable float _area;
+  mutable bool _bboxValid;
+  mutable bool _areaValid;
   static const char* _typeStrings[7];
 };
 #endif
\ No newline at end of file
@@ -18,12 +18,18 @@ std::string AnnotationBase::getColor() const {
 }
 
 void AnnotationBase::setColor(const std::string& color) {
-  _color = color;
+  if (_color != color) {
+    _color = color;
+    _modified = true;
+  }
 }
 
 void AnnotationBase::setName(const std::string& name)
 {
-	_name = name;
+  if (_name != name) {
+    _name = name;
+    _modified = true;
+  }
 }
 
 std::string AnnotationBase::getName() const
@@ -39,6 +45,9 @@ void AnnotationBase::setGroup(const std::shared_ptr<AnnotationGroup>& group) {
       currentGroup->removeMember(this->shared_from_this());
     }
     _group = group;
+    if (currentGroup != group) {
+      _modified = true;
+    }
     if (group) {
       group->addMember(this->shared_from_this());
     }
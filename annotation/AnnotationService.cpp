@@ -52,6 +52,15 @@ bool AnnotationService::saveRepositoryToFile(const std::string& source) {
   return _repo->save();
 }
 
+bool AnnotationService::saveRepositoryIncremental() {
+  if (_repo) {
+    return _repo->saveIncremental();
+  }
+  else {
+    return false;
+  }
+}
+
 bool AnnotationService::load() {
   if (_repo) {
     return _repo->load();
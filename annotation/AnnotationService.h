@@ -19,6 +19,9 @@ public:
   bool loadRepositoryFromFile(const std::string& source);
   bool saveRepositoryToFile(const std::string& source);
 
+  //! Writes only the changes since the last load/save to the current repository
+  bool saveRepositoryIncremental();
+
 private:
   std::shared_ptr<AnnotationList> _list;
   std::shared_ptr<Repository> _repo;
@@ -7,19 +7,25 @@
 #include "core/ProgressMonitor.h"
 #include "core/PathologyEnums.h"
 #include <algorithm>
+#include <utility>
+
+AnnotationToMask::AnnotationToMask() :
+  _monitor(NULL)
+{
+}
 
 void AnnotationToMask::setProgressMonitor(ProgressMonitor* monitor) {
   _monitor = monitor;
 }
 
-void AnnotationToMask::convert(const std::shared_ptr<AnnotationList>& annotationList, const std::string& maskFile, const std::vector<unsigned long long>& dimensions, const std::vector<double>& spacing, const std::map<std::string, int> nameToLabel, const std::vector<std::string> nameOrder) const {
+bool AnnotationToMask::convert(const std::shared_ptr<AnnotationList>& annotationList, const std::string& maskFile, const std::vector<unsigned long long>& dimensions, const std::vector<double>& spacing, const std::map<std::string, int> nameToLabel, const std::vector<std::string> nameOrder) const {
   bool hasGroups = !annotationList->getGroups().empty();
   std::vector<std::shared_ptr<Annotation> > annotations = annotationList->getAnnotations();
   for (auto annotation = annotations.begin(); annotation != annotations.end(); ++annotation) {
     if (!(*annotation)->isClockwise()) {
       std::vector<Point> coords = (*annotation)->getCoordinates();
       std::reverse(coords.begin(), coords.end());
-      (*annotation)->setCoordinates(coords);
+      (*annotation)->setCoordinates(std::move(coords));
     }
   }
   if (!nameOrder.empty() && !nameToLabel.empty()) {
@@ -59,7 +65,9 @@ void AnnotationToMask::convert(const std::shared_ptr<AnnotationList>& annotation
 		writer.setInterpolation(pathology::Interpolation::NearestNeighbor);
     std::vector<double> spacing_copy(spacing);
 		writer.setSpacing(spacing_copy);
-		writer.writeImageInformation(dimensions[0], dimensions[1]);
+		if (writer.writeImageInformation(dimensions[0], dimensions[1]) != 0) {
+			return false;
+		}
 		unsigned char* buffer = new unsigned char[512 * 512];
 		for (unsigned long long ty = 0; ty < dimensions[1]; ty += 512) {
 			for (unsigned long long tx = 0; tx < dimensions[0]; tx += 512) {
@@ -68,12 +76,14 @@ void AnnotationToMask::convert(const std::shared_ptr<AnnotationList>& annotation
           if (!nameToLabel.empty() && !(*annotation)->getGroup() && hasGroups) {
             continue;
           }
-          std::string nm = (*annotation)->getName();
-          std::vector<Point> coords = (*annotation)->getCoordinates();
+          // The bounding box is cached by the annotation, so this is a cheap way to skip
+          // annotations which do not overlap the current tile
           std::vector<Point> bbox = (*annotation)->getImageBoundingBox();
-          if (!coords.empty()) {
-            coords.push_back(coords[0]);
+          if (bbox[1].getX() <= tx || bbox[0].getX() >= tx + 512 || bbox[1].getY() <= ty || bbox[0].getY() >= ty + 512) {
+            continue;
           }
+          std::string nm = (*annotation)->getName();
+          const std::vector<Point>& coords = (*annotation)->getCoordinates();
           int label = 1;
           if (!nameToLabel.empty()) {
             std::map<std::string, int>::const_iterator it;
@@ -115,40 +125,43 @@ void AnnotationToMask::convert(const std::shared_ptr<AnnotationList>& annotation
 			  writer.writeBaseImagePart((void*)buffer);
 			}
 		}
-		writer.finishImage();
 		delete[] buffer;
+		return writer.finishImage() == 0;
 	}
+	return false;
 }
 
-int AnnotationToMask::cn_PnPoly(const Point& P, const std::vector<Point>& V) const {
+// The polygon V is treated as closed: the edge from the last to the first vertex is
+// included, so callers do not need to append a copy of the first vertex.
+int AnnotationToMask::cn_PnPoly(const Point& P, const std::vector<Point>& V) {
   int    cn = 0;    // the  crossing number counter
 
   // loop through all edges of the polygon
-  for (int i = 0; i < V.size() - 1; i++) {    // edge from V[i]  to V[i+1]
-    if (((V[i].getY() <= P.getY()) && (V[i + 1].getY() > P.getY()))     // an upward crossing
-      || ((V[i].getY() > P.getY()) && (V[i + 1].getY() <= P.getY()))) { // a downward crossing
+  for (size_t i = 0, j = V.size() - 1; i < V.size(); j = i++) {    // edge from V[j]  to V[i]
+    if (((V[j].getY() <= P.getY()) && (V[i].getY() > P.getY()))     // an upward crossing
+      || ((V[j].getY() > P.getY()) && (V[i].getY() <= P.getY()))) { // a downward crossing
       // compute  the actual edge-ray intersect x-coordinate
-      float vt = (float)(P.getY() - V[i].getY()) / (V[i + 1].getY() - V[i].getY());
-      if (P.getX() <  V[i].getX() + vt * (V[i + 1].getX() - V[i].getX())) // P.x < intersect
+      float vt = (float)(P.getY() - V[j].getY()) / (V[i].getY() - V[j].getY());
+      if (P.getX() <  V[j].getX() + vt * (V[i].getX() - V[j].getX())) // P.x < intersect
         ++cn;   // a valid crossing of y=P.y right of P.x
     }
   }
   return (cn & 1);
 }
 
-int AnnotationToMask::wn_PnPoly(const Point& P, const std::vector<Point>& V) const {
+int AnnotationToMask::wn_PnPoly(const Point& P, const std::vector<Point>& V) {
   int    wn = 0;    // the  winding number counter
 
   // loop through all edges of the polygon
-  for (int i = 0; i<V.size() - 1; i++) {   // edge from V[i] to  V[i+1]
-    if (V[i].getY() <= P.getY()) {          // start y <= P.y
-      if (V[i + 1].getY()  > P.getY())      // an upward crossing
-        if (isLeft(V[i], V[i + 1], P) > 0)  // P left of  edge
+  for (size_t i = 0, j = V.size() - 1; i < V.size(); j = i++) {   // edge from V[j] to  V[i]
+    if (V[j].getY() <= P.getY()) {          // start y <= P.y
+      if (V[i].getY()  > P.getY())      // an upward crossing
+        if (isLeft(V[j], V[i], P) > 0)  // P left of  edge
           ++wn;            // have  a valid up intersect
     }
     else {                        // start y > P.y (no test needed)
-      if (V[i + 1].getY() <= P.getY())     // a downward crossing
-        if (isLeft(V[i], V[i + 1], P) < 0)  // P right of  edge
+      if (V[i].getY() <= P.getY())     // a downward crossing
+        if (isLeft(V[j], V[i], P) < 0)  // P right of  edge
           --wn;            // have  a valid down intersect
     }
   }
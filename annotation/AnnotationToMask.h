@@ -15,20 +15,26 @@ class ProgressMonitor;
 class ANNOTATION_EXPORT AnnotationToMask {
 
 public :
-  void convert(const std::shared_ptr<AnnotationList>& annotationList, const std::string& maskFile, const std::vector<unsigned long long>& dimensions, const std::vector<double>& spacing, const std::map<std::string, int> nameToLabel = std::map<std::string, int>(), const std::vector<std::string> nameOrder = std::vector<std::string>()) const;
+  AnnotationToMask();
+
+  //! Rasterizes the annotations into a mask of the given dimensions, returns false when the
+  //! mask could not be written
+  bool convert(const std::shared_ptr<AnnotationList>& annotationList, const std::string& maskFile, const std::vector<unsigned long long>& dimensions, const std::vector<double>& spacing, const std::map<std::string, int> nameToLabel = std::map<std::string, int>(), const std::vector<std::string> nameOrder = std::vector<std::string>()) const;
   void setProgressMonitor(ProgressMonitor* monitor);
 
+  //! Crossing number (0 or 1) and winding number of the closed polygon V around P, P lies inside
+  //! V when the winding number is not 0
+  static int cn_PnPoly(const Point& P, const std::vector<Point>& V);
+  static int wn_PnPoly(const Point& P, const std::vector<Point>& V);
+
 private:
 
-  inline int isLeft(Point P0, Point P1, Point P2) const
+  static inline int isLeft(Point P0, Point P1, Point P2)
   {
     return static_cast<int>((P1.getX() - P0.getX()) * (P0.getY() - P2.getY())
       - (P2.getX() - P0.getX()) * (P0.getY() - P1.getY()));
   }
 
-  int cn_PnPoly(const Point& P, const std::vector<Point>& V) const;
-  int wn_PnPoly(const Point& P, const std::vector<Point>& V) const;
-
   ProgressMonitor* _monitor;
 };
 
@@ -0,0 +1,274 @@
+#include "AnnotationToMaskBatch.h"
+#include "AnnotationToMask.h"
+#include "AnnotationService.h"
+#include "AnnotationList.h"
+#include "Annotation.h"
+#include "multiresolutionimageinterface/MultiResolutionImage.h"
+#include "multiresolutionimageinterface/MultiResolutionImageReader.h"
+#include "multiresolutionimageinterface/MultiResolutionImageFactory.h"
+#include "core/filetools.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  // FNV-1a, only used to detect changed inputs, not for security
+  unsigned long long hashBytes(const std::string& data, unsigned long long hash = 14695981039346656037ULL) {
+    for (std::string::const_iterator it = data.begin(); it != data.end(); ++it) {
+      hash ^= static_cast<unsigned char>(*it);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  std::string inputHash(const AnnotationToMaskBatch::Job& job, const std::string& settings) {
+    std::string annotationData;
+    core::readFile(job.annotationPath, annotationData);
+    unsigned long long hash = hashBytes(annotationData);
+    hash = hashBytes(job.imagePath, hash);
+    hash = hashBytes(settings, hash);
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+  }
+
+  double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+}
+
+SlideReaderPool::SlideReaderPool(const unsigned int& capacity) :
+  _capacity(std::max(1u, capacity))
+{
+  // Plugin registration is not thread-safe, make sure it happened before the workers start
+  MultiResolutionImageFactory::registerExternalFileFormats();
+}
+
+std::shared_ptr<MultiResolutionImage> SlideReaderPool::get(const std::string& path) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (std::list<std::pair<std::string, std::shared_ptr<MultiResolutionImage> > >::iterator it = _images.begin(); it != _images.end(); ++it) {
+    if (it->first == path) {
+      _images.splice(_images.begin(), _images, it);
+      return _images.front().second;
+    }
+  }
+  // Opening only reads the headers of the slide, which is short compared to rasterizing a mask,
+  // so holding the lock costs little and guarantees every slide is opened once
+  MultiResolutionImageReader reader;
+  std::shared_ptr<MultiResolutionImage> img(reader.open(path));
+  if (!img || !img->valid()) {
+    return std::shared_ptr<MultiResolutionImage>();
+  }
+  _images.push_front(std::make_pair(path, img));
+  while (_images.size() > _capacity) {
+    _images.pop_back();
+  }
+  return img;
+}
+
+unsigned int SlideReaderPool::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return static_cast<unsigned int>(_images.size());
+}
+
+AnnotationToMaskBatch::AnnotationToMaskBatch() :
+  _numberOfWorkers(0),
+  _numberOfWorkersUsed(0),
+  _level(0),
+  _skipMode(SkipMode::Timestamp)
+{
+}
+
+void AnnotationToMaskBatch::setNumberOfWorkers(const unsigned int& numberOfWorkers) {
+  _numberOfWorkers = numberOfWorkers;
+}
+
+void AnnotationToMaskBatch::setLevel(const unsigned int& level) {
+  _level = level;
+}
+
+void AnnotationToMaskBatch::setLabels(const std::map<std::string, int>& nameToLabel, const std::vector<std::string>& nameOrder) {
+  _nameToLabel = nameToLabel;
+  _nameOrder = nameOrder;
+}
+
+void AnnotationToMaskBatch::setSkipMode(const SkipMode& skipMode) {
+  _skipMode = skipMode;
+}
+
+void AnnotationToMaskBatch::setJobFinishedCallback(const JobFinishedCallback& callback) {
+  _callback = callback;
+}
+
+unsigned int AnnotationToMaskBatch::getNumberOfWorkersUsed() const {
+  return _numberOfWorkersUsed;
+}
+
+std::vector<AnnotationToMaskBatch::Result> AnnotationToMaskBatch::run(const std::vector<Job>& jobs) {
+  unsigned int nrWorkers = _numberOfWorkers;
+  if (nrWorkers == 0) {
+    nrWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nrWorkers = std::min(nrWorkers, static_cast<unsigned int>(std::max<size_t>(jobs.size(), 1)));
+  _numberOfWorkersUsed = nrWorkers;
+
+  // Everything which changes the contents of a mask, so the hash skip mode redoes masks of which
+  // the settings changed
+  std::stringstream settings;
+  settings << "level=" << _level << ";mapping=";
+  for (std::map<std::string, int>::const_iterator it = _nameToLabel.begin(); it != _nameToLabel.end(); ++it) {
+    settings << it->first << "=" << it->second << ",";
+  }
+  settings << ";order=";
+  for (std::vector<std::string>::const_iterator it = _nameOrder.begin(); it != _nameOrder.end(); ++it) {
+    settings << *it << ",";
+  }
+
+  SlideReaderPool pool(2 * nrWorkers);
+  std::vector<Result> results(jobs.size());
+  std::atomic<size_t> nextJob(0);
+  size_t finishedJobs = 0;
+  std::mutex callbackMutex;
+
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < nrWorkers; ++i) {
+    workers.push_back(std::thread([&]() {
+      for (size_t jobIndex = nextJob++; jobIndex < jobs.size(); jobIndex = nextJob++) {
+        try {
+          results[jobIndex] = processJob(jobs[jobIndex], pool, settings.str());
+        }
+        catch (std::exception& e) {
+          results[jobIndex].message = e.what();
+        }
+        std::lock_guard<std::mutex> lock(callbackMutex);
+        ++finishedJobs;
+        if (_callback) {
+          _callback(jobIndex, finishedJobs, results[jobIndex]);
+        }
+      }
+    }));
+  }
+  for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it) {
+    it->join();
+  }
+  return results;
+}
+
+bool AnnotationToMaskBatch::isUpToDate(const Job& job, const std::string& hash) const {
+  std::error_code ec;
+  if (_skipMode == SkipMode::None || !fs::exists(job.outputPath, ec)) {
+    return false;
+  }
+  if (_skipMode == SkipMode::Hash) {
+    std::string storedHash;
+    if (!core::readFile(job.outputPath + ".hash", storedHash)) {
+      return false;
+    }
+    return storedHash.substr(0, storedHash.find_last_not_of(" \t\r\n") + 1) == hash;
+  }
+  fs::file_time_type outputTime = fs::last_write_time(job.outputPath, ec);
+  if (ec) {
+    return false;
+  }
+  fs::file_time_type annotationTime = fs::last_write_time(job.annotationPath, ec);
+  if (ec || annotationTime > outputTime) {
+    return false;
+  }
+  fs::file_time_type imageTime = fs::last_write_time(job.imagePath, ec);
+  return !ec && imageTime <= outputTime;
+}
+
+AnnotationToMaskBatch::Result AnnotationToMaskBatch::processJob(const Job& job, SlideReaderPool& pool, const std::string& settings) const {
+  Result result;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::string hash;
+  if (_skipMode == SkipMode::Hash) {
+    hash = inputHash(job, settings);
+  }
+  if (isUpToDate(job, hash)) {
+    result.status = Result::Status::UpToDate;
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+
+  std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+  std::shared_ptr<MultiResolutionImage> img = pool.get(job.imagePath);
+  result.openTime = elapsedMs(stepStart);
+  if (!img) {
+    result.message = "Could not open image " + job.imagePath;
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+  if (_level >= static_cast<unsigned int>(img->getNumberOfLevels())) {
+    result.message = "Image does not have level " + std::to_string(_level);
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+  std::vector<unsigned long long> dimensions = img->getLevelDimensions(_level);
+  double downsample = img->getLevelDownsample(_level);
+  std::vector<double> spacing = img->getSpacing();
+  for (std::vector<double>::iterator it = spacing.begin(); it != spacing.end(); ++it) {
+    *it *= downsample;
+  }
+
+  stepStart = std::chrono::steady_clock::now();
+  AnnotationService annotationService;
+  if (!annotationService.loadRepositoryFromFile(job.annotationPath)) {
+    result.message = "Could not load annotations from " + job.annotationPath;
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+  std::shared_ptr<AnnotationList> annotationList = annotationService.getList();
+  // Annotations are stored in level 0 coordinates, bring them to the requested level
+  if (downsample != 1.0) {
+    std::vector<std::shared_ptr<Annotation> > annotations = annotationList->getAnnotations();
+    for (std::vector<std::shared_ptr<Annotation> >::iterator annotation = annotations.begin(); annotation != annotations.end(); ++annotation) {
+      std::vector<Point> coords = (*annotation)->getCoordinates();
+      for (std::vector<Point>::iterator pt = coords.begin(); pt != coords.end(); ++pt) {
+        pt->setX(pt->getX() / downsample);
+        pt->setY(pt->getY() / downsample);
+      }
+      (*annotation)->setCoordinates(std::move(coords));
+    }
+  }
+  result.loadTime = elapsedMs(stepStart);
+
+  fs::path outputPath(job.outputPath);
+  std::error_code ec;
+  if (outputPath.has_parent_path()) {
+    fs::create_directories(outputPath.parent_path(), ec);
+  }
+  std::string tmpPath = job.outputPath + ".tmp.tif";
+  stepStart = std::chrono::steady_clock::now();
+  AnnotationToMask maskConverter;
+  bool written = maskConverter.convert(annotationList, tmpPath, dimensions, spacing, _nameToLabel, _nameOrder);
+  result.rasterizeTime = elapsedMs(stepStart);
+  if (!written) {
+    fs::remove(tmpPath, ec);
+    result.message = "Could not write mask " + job.outputPath;
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+  fs::rename(tmpPath, job.outputPath, ec);
+  if (ec) {
+    result.message = "Could not move mask to " + job.outputPath + ": " + ec.message();
+    result.totalTime = elapsedMs(start);
+    return result;
+  }
+  if (_skipMode == SkipMode::Hash) {
+    core::writeFile(job.outputPath + ".hash", hash);
+  }
+  result.status = Result::Status::Written;
+  result.totalTime = elapsedMs(start);
+  return result;
+}
@@ -0,0 +1,112 @@
+#ifndef ANNOTATIONTOMASKBATCH_H
+#define ANNOTATIONTOMASKBATCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "annotation_export.h"
+
+class MultiResolutionImage;
+
+//! Keeps the most recently used slides open, so batches which reference the same slide multiple
+//! times (e.g. different label sets) only pay the opening cost once. Slides are opened while the
+//! pool is locked, so workers which ask for the same slide at the same time share one reader.
+class ANNOTATION_EXPORT SlideReaderPool {
+
+public :
+  SlideReaderPool(const unsigned int& capacity);
+
+  //! Returns an empty pointer when the slide cannot be opened
+  std::shared_ptr<MultiResolutionImage> get(const std::string& path);
+
+  //! Number of slides which are currently open
+  unsigned int size() const;
+
+private:
+  unsigned int _capacity;
+  std::list<std::pair<std::string, std::shared_ptr<MultiResolutionImage> > > _images;
+  mutable std::mutex _mutex;
+};
+
+//! Converts the annotations of many slides to masks (see AnnotationToMask), processing several
+//! slides at the same time. Masks are first written to a temporary file, so an interrupted run
+//! never leaves a mask behind that looks up to date.
+class ANNOTATION_EXPORT AnnotationToMaskBatch {
+
+public :
+
+  //! The slide the mask should be aligned to, the annotation file and the path of the mask
+  struct Job {
+    std::string imagePath;
+    std::string annotationPath;
+    std::string outputPath;
+  };
+
+  struct Result {
+    enum class Status {
+      Written,
+      UpToDate,
+      Failed
+    };
+
+    Status status = Status::Failed;
+    std::string message;
+    //! Durations of the steps of the job in milliseconds
+    double openTime = 0;
+    double loadTime = 0;
+    double rasterizeTime = 0;
+    double totalTime = 0;
+  };
+
+  //! When an existing output is skipped: Timestamp when it is newer than its inputs, Hash when
+  //! the inputs and settings are unchanged since it was written (stored next to it in a .hash
+  //! file) and None never
+  enum class SkipMode {
+    Timestamp,
+    Hash,
+    None
+  };
+
+  //! Called after each job with the index of the job, the number of finished jobs and the
+  //! result. Calls come from the worker threads but never overlap.
+  typedef std::function<void(size_t, size_t, const Result&)> JobFinishedCallback;
+
+  AnnotationToMaskBatch();
+
+  //! Number of slides which are processed concurrently, 0 (default) uses all cores
+  void setNumberOfWorkers(const unsigned int& numberOfWorkers);
+
+  //! Pyramid level of the slides the masks should be aligned to (default 0)
+  void setLevel(const unsigned int& level);
+
+  //! Labels as in AnnotationToMask::convert
+  void setLabels(const std::map<std::string, int>& nameToLabel, const std::vector<std::string>& nameOrder = std::vector<std::string>());
+
+  void setSkipMode(const SkipMode& skipMode);
+  void setJobFinishedCallback(const JobFinishedCallback& callback);
+
+  //! Processes the jobs and returns their results in the same order
+  std::vector<Result> run(const std::vector<Job>& jobs);
+
+  //! Number of workers used by the last run
+  unsigned int getNumberOfWorkersUsed() const;
+
+private:
+  Result processJob(const Job& job, SlideReaderPool& pool, const std::string& settings) const;
+  bool isUpToDate(const Job& job, const std::string& hash) const;
+
+  unsigned int _numberOfWorkers;
+  unsigned int _numberOfWorkersUsed;
+  unsigned int _level;
+  std::map<std::string, int> _nameToLabel;
+  std::vector<std::string> _nameOrder;
+  SkipMode _skipMode;
+  JobFinishedCallback _callback;
+};
+
+#endif
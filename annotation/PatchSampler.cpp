@@ -0,0 +1,329 @@
+#include "PatchSampler.h"
+#include "AnnotationList.h"
+#include "Annotation.h"
+#include "AnnotationGroup.h"
+#include "AnnotationToMask.h"
+#include "multiresolutionimageinterface/MultiResolutionImage.h"
+#include "core/PathologyEnums.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+PatchSampler::PatchSampler(MultiResolutionImage* image, const double& spacing, const unsigned int& patchSize) :
+  _image(image),
+  _mask(NULL),
+  _spacing(spacing),
+  _patchSize(patchSize),
+  _seed(0),
+  _numberOfThreads(std::max(1u, std::thread::hardware_concurrency())),
+  _queueSize(64),
+  _numberOfPatches(0),
+  _downsample(1.),
+  _cellSize(1.),
+  _gridWidth(0),
+  _nextIndex(0),
+  _claimIndex(0),
+  _started(false),
+  _stopped(false)
+{
+}
+
+PatchSampler::~PatchSampler() {
+  stop();
+}
+
+void PatchSampler::setMask(MultiResolutionImage* mask) {
+  _mask = mask;
+}
+
+void PatchSampler::setAnnotations(const std::shared_ptr<AnnotationList>& annotations, const std::map<std::string, int>& nameToLabel) {
+  // The polygons are copied, so the producer threads never touch the annotations
+  _polygons.clear();
+  if (!annotations) {
+    return;
+  }
+  bool hasGroups = !annotations->getGroups().empty();
+  std::vector<std::shared_ptr<Annotation> > annotationList = annotations->getAnnotations();
+  for (std::vector<std::shared_ptr<Annotation> >::const_iterator annotation = annotationList.begin(); annotation != annotationList.end(); ++annotation) {
+    if (!nameToLabel.empty() && !(*annotation)->getGroup() && hasGroups) {
+      continue;
+    }
+    int label = 1;
+    if (!nameToLabel.empty()) {
+      std::map<std::string, int>::const_iterator it = nameToLabel.find(hasGroups ? (*annotation)->getGroup()->getName() : (*annotation)->getName());
+      label = it != nameToLabel.end() ? it->second : 0;
+    }
+    if (label <= 0 || (*annotation)->getCoordinates().size() < 3) {
+      continue;
+    }
+    std::vector<Point> bbox = (*annotation)->getImageBoundingBox();
+    LabeledPolygon polygon;
+    polygon.coordinates = (*annotation)->getCoordinates();
+    polygon.topLeft = bbox[0];
+    polygon.bottomRight = bbox[1];
+    polygon.label = label;
+    _polygons.push_back(polygon);
+  }
+}
+
+void PatchSampler::setLabelWeights(const std::map<int, float>& weights) {
+  _weights = weights;
+}
+
+void PatchSampler::setSeed(const unsigned long long& seed) {
+  _seed = seed;
+}
+
+void PatchSampler::setNumberOfThreads(const unsigned int& numberOfThreads) {
+  _numberOfThreads = std::max(1u, numberOfThreads);
+}
+
+void PatchSampler::setQueueSize(const unsigned int& queueSize) {
+  _queueSize = std::max(1u, queueSize);
+}
+
+void PatchSampler::setNumberOfPatches(const unsigned long long& numberOfPatches) {
+  _numberOfPatches = numberOfPatches;
+}
+
+std::map<int, unsigned long long> PatchSampler::getLabelCounts() const {
+  return _labelCounts;
+}
+
+int PatchSampler::polygonLabel(const std::vector<const LabeledPolygon*>& polygons, const Point& point) {
+  int label = 0;
+  for (std::vector<const LabeledPolygon*>::const_iterator polygon = polygons.begin(); polygon != polygons.end(); ++polygon) {
+    if ((*polygon)->label > label && point.getX() > (*polygon)->topLeft.getX() && point.getX() < (*polygon)->bottomRight.getX() &&
+      point.getY() > (*polygon)->topLeft.getY() && point.getY() < (*polygon)->bottomRight.getY() &&
+      AnnotationToMask::wn_PnPoly(point, (*polygon)->coordinates) != 0) {
+      label = (*polygon)->label;
+    }
+  }
+  return label;
+}
+
+bool PatchSampler::buildSamplingGrid() {
+  std::vector<unsigned long long> dims = _image->getDimensions();
+  std::vector<double> imageSpacing = _image->getSpacing();
+  if (dims.size() < 2 || dims[0] == 0 || dims[1] == 0) {
+    return false;
+  }
+  _downsample = 1.;
+  if (_spacing > 0 && !imageSpacing.empty() && imageSpacing[0] > 0) {
+    _downsample = _spacing / imageSpacing[0];
+  }
+  // A few cells per patch, with at most 4096 cells along the longest side of the slide
+  _cellSize = std::max(1., std::max(_patchSize * _downsample / 4., std::max(dims[0], dims[1]) / 4096.));
+  _gridWidth = static_cast<unsigned long long>(std::ceil(dims[0] / _cellSize));
+  unsigned long long gridHeight = static_cast<unsigned long long>(std::ceil(dims[1] / _cellSize));
+  std::vector<unsigned char> labels(_gridWidth * gridHeight, 0);
+
+  if (_mask) {
+    std::vector<unsigned long long> maskDims = _mask->getDimensions();
+    double maskScale = static_cast<double>(maskDims[0]) / dims[0];
+    Patch<unsigned char> maskGrid = _mask->getRegionAtDownsample<unsigned char>(0, 0, _gridWidth, gridHeight, _cellSize * maskScale, pathology::Interpolation::NearestNeighbor);
+    if (maskGrid.getPointer()) {
+      unsigned int nrSamples = _mask->getSamplesPerPixel();
+      for (unsigned long long i = 0; i < labels.size(); ++i) {
+        labels[i] = maskGrid.getPointer()[i * nrSamples];
+      }
+    }
+  }
+  else if (!_polygons.empty()) {
+    // Every polygon only visits the cells within its bounding box
+    for (std::vector<LabeledPolygon>::const_iterator polygon = _polygons.begin(); polygon != _polygons.end(); ++polygon) {
+      long long firstX = std::max(0LL, static_cast<long long>(polygon->topLeft.getX() / _cellSize));
+      long long firstY = std::max(0LL, static_cast<long long>(polygon->topLeft.getY() / _cellSize));
+      long long lastX = std::min(static_cast<long long>(_gridWidth) - 1, static_cast<long long>(polygon->bottomRight.getX() / _cellSize));
+      long long lastY = std::min(static_cast<long long>(gridHeight) - 1, static_cast<long long>(polygon->bottomRight.getY() / _cellSize));
+      std::vector<const LabeledPolygon*> single(1, &(*polygon));
+      for (long long y = firstY; y <= lastY; ++y) {
+        for (long long x = firstX; x <= lastX; ++x) {
+          unsigned char& label = labels[y * _gridWidth + x];
+          Point center(static_cast<float>((x + 0.5) * _cellSize), static_cast<float>((y + 0.5) * _cellSize));
+          label = std::max(label, static_cast<unsigned char>(polygonLabel(single, center)));
+        }
+      }
+    }
+  }
+  else {
+    // Tissue is coloured or dark, the background of a slide is bright and grey and the area
+    // outside the scanned region is often black
+    Patch<unsigned char> thumbnail = _image->getRegionAtDownsample<unsigned char>(0, 0, _gridWidth, gridHeight, _cellSize);
+    if (thumbnail.getPointer()) {
+      unsigned int nrSamples = _image->getSamplesPerPixel();
+      unsigned int nrColors = std::min(3u, nrSamples);
+      for (unsigned long long i = 0; i < labels.size(); ++i) {
+        const unsigned char* pixel = thumbnail.getPointer() + i * nrSamples;
+        unsigned char minimum = *std::min_element(pixel, pixel + nrColors);
+        unsigned char maximum = *std::max_element(pixel, pixel + nrColors);
+        bool background = maximum == 0 || (maximum - minimum < 20 && minimum > 200);
+        labels[i] = background ? 0 : 1;
+      }
+    }
+  }
+
+  std::map<int, float> weights = _weights;
+  _labelCounts.clear();
+  for (unsigned long long i = 0; i < labels.size(); ++i) {
+    ++_labelCounts[labels[i]];
+  }
+  if (weights.empty()) {
+    for (std::map<int, unsigned long long>::const_iterator count = _labelCounts.begin(); count != _labelCounts.end(); ++count) {
+      if (count->first != 0) {
+        weights[count->first] = 1.;
+      }
+    }
+  }
+  _cells.clear();
+  _sampledLabels.clear();
+  _cumulativeWeights.clear();
+  for (std::map<int, float>::const_iterator weight = weights.begin(); weight != weights.end(); ++weight) {
+    if (weight->second > 0 && _labelCounts.count(weight->first)) {
+      _sampledLabels.push_back(weight->first);
+      _cumulativeWeights.push_back((_cumulativeWeights.empty() ? 0. : _cumulativeWeights.back()) + weight->second);
+      _cells[weight->first].reserve(_labelCounts[weight->first]);
+    }
+  }
+  for (unsigned long long i = 0; i < labels.size(); ++i) {
+    std::map<int, std::vector<unsigned int> >::iterator cells = _cells.find(labels[i]);
+    if (cells != _cells.end()) {
+      cells->second.push_back(static_cast<unsigned int>(i));
+    }
+  }
+  return !_sampledLabels.empty();
+}
+
+void PatchSampler::samplePatch(const unsigned long long& index, TrainingPatch& patch) const {
+  std::seed_seq sequence{ static_cast<unsigned int>(_seed), static_cast<unsigned int>(_seed >> 32), static_cast<unsigned int>(index), static_cast<unsigned int>(index >> 32) };
+  std::mt19937_64 generator(sequence);
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  double pick = uniform(generator) * _cumulativeWeights.back();
+  unsigned int labelIndex = std::min<unsigned int>(std::upper_bound(_cumulativeWeights.begin(), _cumulativeWeights.end(), pick) - _cumulativeWeights.begin(), _sampledLabels.size() - 1);
+  const std::vector<unsigned int>& cells = _cells.at(_sampledLabels[labelIndex]);
+  unsigned int cell = cells[std::uniform_int_distribution<size_t>(0, cells.size() - 1)(generator)];
+  double centerX = (cell % _gridWidth + uniform(generator)) * _cellSize;
+  double centerY = (cell / _gridWidth + uniform(generator)) * _cellSize;
+  double extent = _patchSize * _downsample;
+
+  patch.label = _sampledLabels[labelIndex];
+  patch.x = static_cast<long long>(std::floor(centerX - extent / 2. + 0.5));
+  patch.y = static_cast<long long>(std::floor(centerY - extent / 2. + 0.5));
+  patch.patchSize = _patchSize;
+  patch.samplesPerPixel = _image->getSamplesPerPixel();
+  unsigned long long nrPixels = static_cast<unsigned long long>(_patchSize) * _patchSize;
+  Patch<unsigned char> pixels = _image->getRegionAtDownsample<unsigned char>(patch.x, patch.y, _patchSize, _patchSize, _downsample);
+  if (pixels.getPointer()) {
+    patch.pixels.assign(pixels.getPointer(), pixels.getPointer() + nrPixels * patch.samplesPerPixel);
+  }
+  else {
+    patch.pixels.assign(nrPixels * patch.samplesPerPixel, 0);
+  }
+
+  patch.labels.clear();
+  if (_mask) {
+    double maskScale = static_cast<double>(_mask->getDimensions()[0]) / _image->getDimensions()[0];
+    Patch<unsigned char> labels = _mask->getRegionAtDownsample<unsigned char>(static_cast<long long>(std::floor(patch.x * maskScale + 0.5)), static_cast<long long>(std::floor(patch.y * maskScale + 0.5)),
+      _patchSize, _patchSize, _downsample * maskScale, pathology::Interpolation::NearestNeighbor);
+    patch.labels.assign(nrPixels, 0);
+    if (labels.getPointer()) {
+      unsigned int nrSamples = _mask->getSamplesPerPixel();
+      for (unsigned long long i = 0; i < nrPixels; ++i) {
+        patch.labels[i] = labels.getPointer()[i * nrSamples];
+      }
+    }
+  }
+  else if (!_polygons.empty()) {
+    std::vector<const LabeledPolygon*> overlapping;
+    for (std::vector<LabeledPolygon>::const_iterator polygon = _polygons.begin(); polygon != _polygons.end(); ++polygon) {
+      if (polygon->bottomRight.getX() > patch.x && polygon->topLeft.getX() < patch.x + extent &&
+        polygon->bottomRight.getY() > patch.y && polygon->topLeft.getY() < patch.y + extent) {
+        overlapping.push_back(&(*polygon));
+      }
+    }
+    patch.labels.assign(nrPixels, 0);
+    if (!overlapping.empty()) {
+      for (unsigned int y = 0; y < _patchSize; ++y) {
+        for (unsigned int x = 0; x < _patchSize; ++x) {
+          Point center(static_cast<float>(patch.x + (x + 0.5) * _downsample), static_cast<float>(patch.y + (y + 0.5) * _downsample));
+          patch.labels[y * _patchSize + x] = static_cast<unsigned char>(polygonLabel(overlapping, center));
+        }
+      }
+    }
+  }
+}
+
+bool PatchSampler::start() {
+  std::unique_lock<std::mutex> lock(_queueMutex);
+  if (_started) {
+    return !_sampledLabels.empty();
+  }
+  _started = true;
+  if (!_image || _patchSize == 0 || !buildSamplingGrid()) {
+    _stopped = true;
+    return false;
+  }
+  _slots.assign(_queueSize, TrainingPatch());
+  _ready.assign(_queueSize, false);
+  for (unsigned int i = 0; i < _numberOfThreads; ++i) {
+    _threads.push_back(std::thread(&PatchSampler::produce, this));
+  }
+  return true;
+}
+
+void PatchSampler::stop() {
+  {
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _stopped = true;
+  }
+  _slotFree.notify_all();
+  _slotReady.notify_all();
+  for (std::vector<std::thread>::iterator thread = _threads.begin(); thread != _threads.end(); ++thread) {
+    if (thread->joinable()) {
+      thread->join();
+    }
+  }
+  _threads.clear();
+}
+
+void PatchSampler::produce() {
+  while (true) {
+    unsigned long long index = 0;
+    {
+      // Patch i can only be sampled once patch i - queue size has been taken, which bounds the
+      // memory used and frees the slot of patch i
+      std::unique_lock<std::mutex> lock(_queueMutex);
+      _slotFree.wait(lock, [this] { return _stopped || _claimIndex < _nextIndex + _queueSize; });
+      if (_stopped || (_numberOfPatches > 0 && _claimIndex >= _numberOfPatches)) {
+        return;
+      }
+      index = _claimIndex++;
+    }
+    TrainingPatch patch;
+    samplePatch(index, patch);
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _slots[index % _queueSize] = std::move(patch);
+    _ready[index % _queueSize] = true;
+    _slotReady.notify_all();
+  }
+}
+
+bool PatchSampler::next(TrainingPatch& patch) {
+  if (!start()) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(_queueMutex);
+  if (_numberOfPatches > 0 && _nextIndex >= _numberOfPatches) {
+    return false;
+  }
+  unsigned int slot = _nextIndex % _queueSize;
+  _slotReady.wait(lock, [this, slot] { return _stopped || _ready[slot]; });
+  if (!_ready[slot]) {
+    return false;
+  }
+  patch = std::move(_slots[slot]);
+  _ready[slot] = false;
+  ++_nextIndex;
+  _slotFree.notify_all();
+  return true;
+}
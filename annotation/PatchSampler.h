@@ -0,0 +1,138 @@
+#ifndef PATCHSAMPLER_H
+#define PATCHSAMPLER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "annotation_export.h"
+#include "core/Point.h"
+
+class AnnotationList;
+class MultiResolutionImage;
+
+//! Samples training patches from a slide on background threads. Patches of patchSize x patchSize
+//! pixels at a target spacing are read around random positions of which the label is taken from a
+//! mask image, from annotations or, without either, from a tissue detection on a low resolution
+//! version of the slide (label 1 for tissue, 0 for the white background). A label is drawn
+//! according to the label weights first and then a uniformly random position with that label,
+//! so rare labels can be sampled as often as common ones.
+//!
+//! Producer threads fill a bounded queue from which next takes the patches. Patch i is always
+//! sampled from a generator seeded with the seed and i and is returned as the i-th patch, so the
+//! patches do not depend on the number of threads or their timing.
+class ANNOTATION_EXPORT PatchSampler {
+
+public :
+
+  struct TrainingPatch {
+    //! patchSize x patchSize x samples pixels of the slide, row by row
+    std::vector<unsigned char> pixels;
+    //! patchSize x patchSize labels of the mask or the annotations, empty when sampling tissue
+    std::vector<unsigned char> labels;
+    //! The label which was sampled
+    int label;
+    //! Top-left corner of the patch in base level coordinates
+    long long x;
+    long long y;
+    unsigned int patchSize;
+    unsigned int samplesPerPixel;
+  };
+
+  //! The image (and the mask) are not owned by the sampler and have to outlive it. A spacing of
+  //! 0 or less, or an image without spacing, samples at the resolution of the base level.
+  PatchSampler(MultiResolutionImage* image, const double& spacing, const unsigned int& patchSize);
+  ~PatchSampler();
+
+  //! Takes the labels from a mask image, which covers the same area as the image at any resolution
+  void setMask(MultiResolutionImage* mask);
+
+  //! Takes the labels from annotations, as AnnotationToMask does: by the name of the group of an
+  //! annotation (of the annotation itself when there are no groups) in nameToLabel, 1 for all
+  //! annotations when nameToLabel is empty, and the highest label where annotations overlap
+  void setAnnotations(const std::shared_ptr<AnnotationList>& annotations, const std::map<std::string, int>& nameToLabel = std::map<std::string, int>());
+
+  //! Relative probability of sampling each label, labels without a weight are not sampled. When
+  //! no weights are set every label except 0 is sampled equally often.
+  void setLabelWeights(const std::map<int, float>& weights);
+
+  void setSeed(const unsigned long long& seed);
+  void setNumberOfThreads(const unsigned int& numberOfThreads);
+
+  //! Number of patches which are prepared ahead of next (default 64)
+  void setQueueSize(const unsigned int& queueSize);
+
+  //! Number of patches after which next returns false, 0 for no limit (default)
+  void setNumberOfPatches(const unsigned long long& numberOfPatches);
+
+  //! Determines the labels of the sampling grid and starts the producer threads. The settings
+  //! cannot be changed afterwards. Called by next when needed; returns false when there is
+  //! nothing to sample.
+  bool start();
+
+  //! Stops the producer threads, next returns false afterwards
+  void stop();
+
+  //! Waits for the next patch, returns false when all patches have been sampled or the sampler
+  //! was stopped
+  bool next(TrainingPatch& patch);
+
+  //! Number of positions of each label on the sampling grid, available after start
+  std::map<int, unsigned long long> getLabelCounts() const;
+
+private:
+
+  struct LabeledPolygon {
+    std::vector<Point> coordinates;
+    Point topLeft;
+    Point bottomRight;
+    int label;
+  };
+
+  bool buildSamplingGrid();
+  static int polygonLabel(const std::vector<const LabeledPolygon*>& polygons, const Point& point);
+  void produce();
+  void samplePatch(const unsigned long long& index, TrainingPatch& patch) const;
+
+  //! Not owned by the sampler
+  MultiResolutionImage* _image;
+  MultiResolutionImage* _mask;
+
+  std::vector<LabeledPolygon> _polygons;
+  std::map<int, float> _weights;
+  double _spacing;
+  unsigned int _patchSize;
+  unsigned long long _seed;
+  unsigned int _numberOfThreads;
+  unsigned int _queueSize;
+  unsigned long long _numberOfPatches;
+
+  //! Downsample of the patches and size of a cell of the sampling grid, relative to the base level
+  double _downsample;
+  double _cellSize;
+  unsigned long long _gridWidth;
+  //! Cells of the sampling grid (y * _gridWidth + x) of the labels which are sampled, the number
+  //! of cells of every label and the labels which are sampled with their cumulative weights
+  std::map<int, std::vector<unsigned int> > _cells;
+  std::map<int, unsigned long long> _labelCounts;
+  std::vector<int> _sampledLabels;
+  std::vector<double> _cumulativeWeights;
+
+  //! The queue: patch i is stored in slot i % _queueSize once it has been sampled
+  std::vector<TrainingPatch> _slots;
+  std::vector<bool> _ready;
+  unsigned long long _nextIndex;
+  unsigned long long _claimIndex;
+  bool _started;
+  bool _stopped;
+  std::mutex _queueMutex;
+  std::condition_variable _slotFree;
+  std::condition_variable _slotReady;
+  std::vector<std::thread> _threads;
+};
+
+#endif
@@ -20,6 +20,14 @@ bool Repository::load() {
   return loadSucces;
 }
 
+bool Repository::saveIncremental() {
+  bool saveSucces = save();
+  if (saveSucces && _list) {
+    _list->resetModifiedStatus();
+  }
+  return saveSucces;
+}
+
 void Repository::setSource(const std::string& sourcePath) 
 {
 	_source = sourcePath;
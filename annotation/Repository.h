@@ -18,6 +18,10 @@ public:
   bool load();
   virtual bool save() const = 0;
 
+  //! Persists only the changes made since the last load or save. Repositories
+  //! that do not support incremental writes fall back to a full save.
+  virtual bool saveIncremental();
+
 protected:
 
   virtual bool loadFromRepo() = 0;
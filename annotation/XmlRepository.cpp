@@ -3,21 +3,46 @@
 #include "AnnotationGroup.h"
 #include "AnnotationList.h"
 #include "core/Point.h"
+#include "core/filetools.h"
 #include <vector>
 #include <string>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
 #include <stdio.h>
 #include "pugixml.hpp"
 
 XmlRepository::XmlRepository(const std::shared_ptr<AnnotationList>& list) :
-Repository(list)
+Repository(list),
+_compacting(false),
+_journalSize(0),
+_compactionThreshold(16 * 1024 * 1024)
 {
 }
 
+XmlRepository::~XmlRepository() {
+  waitForCompaction();
+}
+
+void XmlRepository::setCompactionThreshold(const unsigned long long& compactionThreshold) {
+  _compactionThreshold = compactionThreshold;
+}
+
+unsigned long long XmlRepository::getCompactionThreshold() const {
+  return _compactionThreshold;
+}
+
+std::string XmlRepository::journalPath() const {
+  return _source + ".journal";
+}
+
 bool XmlRepository::save() const
 {
   if (!_list) {
     return false;
   }
+  waitForCompaction();
   pugi::xml_document xml;
   pugi::xml_node root = xml.append_child("ASAP_Annotations");
   if (root.empty()) {
@@ -38,7 +63,229 @@ bool XmlRepository::save() const
     saveGroup(*it, &nodeGroups);
   }
 
-  return xml.save_file(_source.c_str());
+  if (!xml.save_file(_source.c_str())) {
+    return false;
+  }
+
+  // The full file supersedes any journal written before
+  std::lock_guard<std::mutex> l(_journalMutex);
+  core::deleteFile(journalPath());
+  core::deleteFile(journalPath() + ".compacting");
+  updatePersistedState();
+  return true;
+}
+
+bool XmlRepository::saveIncremental()
+{
+  if (!_list || _source.empty()) {
+    return false;
+  }
+  // Without a base file there is nothing to append to
+  if (!core::fileExists(_source)) {
+    return Repository::saveIncremental();
+  }
+
+  std::vector<std::shared_ptr<Annotation> > annotations = _list->getAnnotations();
+  std::set<std::string> currentNames;
+  std::set<const Annotation*> currentAnnotations;
+  for (std::vector<std::shared_ptr<Annotation> >::const_iterator it = annotations.begin(); it != annotations.end(); ++it) {
+    // Journal entries are keyed on the annotation name, duplicates can only be stored by a full save
+    if (!currentNames.insert((*it)->getName()).second) {
+      return Repository::saveIncremental();
+    }
+    currentAnnotations.insert(it->get());
+  }
+
+  pugi::xml_document entry;
+  pugi::xml_node nodeEntry = entry.append_child("JournalEntry");
+
+  // Annotations that were deleted or renamed since the last save
+  for (std::map<std::string, std::weak_ptr<Annotation> >::const_iterator it = _persistedAnnotations.begin(); it != _persistedAnnotations.end(); ++it) {
+    std::shared_ptr<Annotation> persisted = it->second.lock();
+    bool stillPresent = persisted && persisted->getName() == it->first && currentAnnotations.find(persisted.get()) != currentAnnotations.end();
+    if (!stillPresent && currentNames.find(it->first) == currentNames.end()) {
+      pugi::xml_node nodeRemoved = nodeEntry.append_child("Removed");
+      nodeRemoved.append_attribute("Name").set_value(it->first.c_str());
+    }
+  }
+
+  // Groups are few, so when any of them changed the complete set is written
+  std::vector<std::shared_ptr<AnnotationGroup> > groups = _list->getGroups();
+  bool groupsChanged = groups.size() != _persistedGroups.size();
+  for (unsigned int i = 0; i < groups.size() && !groupsChanged; ++i) {
+    groupsChanged = groups[i]->isModified() || _persistedGroups[i].lock() != groups[i];
+  }
+  if (groupsChanged) {
+    pugi::xml_node nodeGroups = nodeEntry.append_child("AnnotationGroups");
+    for (std::vector<std::shared_ptr<AnnotationGroup>>::const_iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+      saveGroup(*it, &nodeGroups);
+    }
+  }
+
+  // Annotations refer to their group by name, so a modified group also dirties its members
+  pugi::xml_node nodeAnnotations;
+  for (std::vector<std::shared_ptr<Annotation> >::const_iterator it = annotations.begin(); it != annotations.end(); ++it) {
+    std::shared_ptr<AnnotationGroup> group = (*it)->getGroup();
+    std::map<std::string, std::weak_ptr<Annotation> >::const_iterator persisted = _persistedAnnotations.find((*it)->getName());
+    bool dirty = (*it)->isModified() || (group && group->isModified()) || persisted == _persistedAnnotations.end() || persisted->second.lock() != *it;
+    if (dirty) {
+      if (nodeAnnotations.empty()) {
+        nodeAnnotations = nodeEntry.append_child("Annotations");
+      }
+      saveAnnotation(*it, &nodeAnnotations);
+    }
+  }
+
+  if (nodeEntry.first_child().empty()) {
+    return true;
+  }
+
+  // One entry per line; an entry that was only partially written (e.g. on a crash) fails to
+  // parse and is skipped when the journal is replayed
+  std::ostringstream serializedEntry;
+  entry.save(serializedEntry, "", pugi::format_raw | pugi::format_no_declaration);
+  serializedEntry << "\n";
+  std::string line = serializedEntry.str();
+  bool shouldCompact = false;
+  {
+    std::lock_guard<std::mutex> l(_journalMutex);
+    std::ofstream journal(journalPath(), std::ios::out | std::ios::app | std::ios::binary);
+    journal.write(line.c_str(), line.size());
+    journal.close();
+    if (journal.fail()) {
+      return false;
+    }
+    _journalSize += line.size();
+    shouldCompact = _journalSize > _compactionThreshold;
+    updatePersistedState();
+  }
+  _list->resetModifiedStatus();
+
+  if (shouldCompact) {
+    compact();
+  }
+  return true;
+}
+
+void XmlRepository::updatePersistedState() const {
+  _persistedAnnotations.clear();
+  _persistedGroups.clear();
+  if (!_list) {
+    return;
+  }
+  std::vector<std::shared_ptr<Annotation> > annotations = _list->getAnnotations();
+  for (std::vector<std::shared_ptr<Annotation> >::const_iterator it = annotations.begin(); it != annotations.end(); ++it) {
+    _persistedAnnotations[(*it)->getName()] = *it;
+  }
+  std::vector<std::shared_ptr<AnnotationGroup> > groups = _list->getGroups();
+  _persistedGroups.assign(groups.begin(), groups.end());
+}
+
+void XmlRepository::compact() {
+  if (_compacting || _source.empty()) {
+    return;
+  }
+  waitForCompaction();
+  _compacting = true;
+  _compactionThread = std::thread(&XmlRepository::compactJournal, this, _source);
+}
+
+void XmlRepository::waitForCompaction() const {
+  if (_compactionThread.joinable()) {
+    _compactionThread.join();
+  }
+}
+
+void XmlRepository::compactJournal(const std::string& source) {
+  std::string journal = source + ".journal";
+  std::string merging = journal + ".compacting";
+  {
+    // Move the journal aside so new entries can be appended while merging. If a previous
+    // compaction was interrupted, its leftover is merged first and the journal stays in place.
+    std::lock_guard<std::mutex> l(_journalMutex);
+    if (!core::fileExists(merging)) {
+      std::error_code ec;
+      std::filesystem::rename(journal, merging, ec);
+      if (ec) {
+        _compacting = false;
+        return;
+      }
+      _journalSize = 0;
+    }
+  }
+
+  pugi::xml_document xml;
+  if (core::fileExists(source) && !xml.load_file(source.c_str())) {
+    _compacting = false;
+    return;
+  }
+  applyJournal(xml, merging);
+
+  std::string tmp = source + ".tmp";
+  if (xml.save_file(tmp.c_str())) {
+    std::lock_guard<std::mutex> l(_journalMutex);
+    std::error_code ec;
+    std::filesystem::rename(tmp, source, ec);
+    if (!ec) {
+      core::deleteFile(merging);
+    }
+  }
+  _compacting = false;
+}
+
+void XmlRepository::applyJournal(pugi::xml_document& xml, const std::string& journalPath) {
+  std::ifstream journal(journalPath, std::ios::in | std::ios::binary);
+  if (!journal.good()) {
+    return;
+  }
+  pugi::xml_node root = xml.child("ASAP_Annotations");
+  if (root.empty()) {
+    root = xml.append_child("ASAP_Annotations");
+  }
+  pugi::xml_node nodeAnnotations = root.child("Annotations");
+  if (nodeAnnotations.empty()) {
+    nodeAnnotations = root.append_child("Annotations");
+  }
+  std::map<std::string, pugi::xml_node> nameToNode;
+  for (pugi::xml_node_iterator it = nodeAnnotations.begin(); it != nodeAnnotations.end(); ++it) {
+    nameToNode[it->attribute("Name").value()] = *it;
+  }
+
+  std::string line;
+  while (std::getline(journal, line)) {
+    pugi::xml_document entry;
+    if (!entry.load_string(line.c_str())) {
+      continue;
+    }
+    pugi::xml_node nodeEntry = entry.child("JournalEntry");
+    for (pugi::xml_node removed = nodeEntry.child("Removed"); removed; removed = removed.next_sibling("Removed")) {
+      std::map<std::string, pugi::xml_node>::iterator existing = nameToNode.find(removed.attribute("Name").value());
+      if (existing != nameToNode.end()) {
+        nodeAnnotations.remove_child(existing->second);
+        nameToNode.erase(existing);
+      }
+    }
+    pugi::xml_node groups = nodeEntry.child("AnnotationGroups");
+    if (groups) {
+      root.remove_child("AnnotationGroups");
+      root.append_copy(groups);
+    }
+    pugi::xml_node annotations = nodeEntry.child("Annotations");
+    for (pugi::xml_node_iterator it = annotations.begin(); it != annotations.end(); ++it) {
+      std::string name = it->attribute("Name").value();
+      std::map<std::string, pugi::xml_node>::iterator existing = nameToNode.find(name);
+      if (existing != nameToNode.end()) {
+        // Replace in place to keep the annotation order stable
+        pugi::xml_node replacement = nodeAnnotations.insert_copy_after(*it, existing->second);
+        nodeAnnotations.remove_child(existing->second);
+        existing->second = replacement;
+      }
+      else {
+        nameToNode[name] = nodeAnnotations.append_copy(*it);
+      }
+    }
+  }
 }
 
 void XmlRepository::saveAnnotation(const std::shared_ptr<Annotation>& annotation, pugi::xml_node* node) const
@@ -59,7 +306,7 @@ void XmlRepository::saveAnnotation(const std::shared_ptr<Annotation>& annotation
   attributeColor.set_value(annotation->getColor().c_str());
 
   pugi::xml_node nodeCoordinates = nodeAnnotation.append_child("Coordinates");
-  std::vector<Point> coordinates = annotation->getCoordinates();
+  const std::vector<Point>& coordinates = annotation->getCoordinates();
   for (std::vector<Point>::const_iterator it = coordinates.begin(); it != coordinates.end(); ++it) {
     pugi::xml_node nodeCoordinate = nodeCoordinates.append_child("Coordinate");
     pugi::xml_attribute attributeOrder = nodeCoordinate.append_attribute("Order");
@@ -104,8 +351,20 @@ bool XmlRepository::loadFromRepo()
   _list->removeAllAnnotations();
   _list->removeAllGroups();
 
+  waitForCompaction();
   pugi::xml_document xml_doc;
   pugi::xml_parse_result tree = xml_doc.load_file(_source.c_str());
+  {
+    std::lock_guard<std::mutex> l(_journalMutex);
+    std::string journal = journalPath();
+    if (core::fileExists(journal + ".compacting")) {
+      applyJournal(xml_doc, journal + ".compacting");
+    }
+    if (core::fileExists(journal)) {
+      applyJournal(xml_doc, journal);
+      _journalSize = core::fileSize(journal);
+    }
+  }
   pugi::xml_node root = xml_doc.child("ASAP_Annotations");
   if (root.empty()) {
     root = xml_doc.root();
@@ -184,5 +443,6 @@ bool XmlRepository::loadFromRepo()
     }
     _list->addAnnotation(annotation);
   }
+  updatePersistedState();
   return true;
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef ANNOTATIONXMLSERVICE_H
 #define ANNOTATIONXMLSERVICE_H
 
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
 #include "annotation_export.h"
 #include "Repository.h"
 
@@ -9,17 +13,59 @@ class AnnotationGroup;
 
 namespace pugi {
   class xml_node;
+  class xml_document;
 }
 
+//! Stores annotations in the ASAP XML format. Besides full saves, the repository
+//! supports incremental saves: only annotations which were added, changed or removed
+//! since the last load/save are appended to a journal next to the source file
+//! (<source>.journal). Once the journal grows beyond the compaction threshold it is
+//! merged into the source file on a background thread. Loading replays the journal,
+//! so the on-disk state is always the source file plus its journal.
 class ANNOTATION_EXPORT XmlRepository : public Repository {
 public:
   XmlRepository(const std::shared_ptr<AnnotationList>& list);
-  virtual bool save() const;  
+  virtual ~XmlRepository();
+  virtual bool save() const;
+
+  //! Appends the changes since the last load or save to the journal. This runs on the calling
+  //! thread: it serializes only the changed annotations and appends a single line, so its cost
+  //! is proportional to the edit rather than to the number of annotations. Doing it on a worker
+  //! would mean copying the annotations first, as the caller keeps modifying them, which costs
+  //! about as much as serializing them. Only the compaction, which rewrites the whole file, runs
+  //! in the background.
+  virtual bool saveIncremental();
+
+  //! Starts merging the journal into the source file on a background thread
+  void compact();
+
+  //! Blocks until a running compaction has finished
+  void waitForCompaction() const;
+
+  //! Journal size (in bytes) after which saveIncremental triggers a compaction
+  void setCompactionThreshold(const unsigned long long& compactionThreshold);
+  unsigned long long getCompactionThreshold() const;
 
 private :
   bool loadFromRepo();
   void saveAnnotation(const std::shared_ptr<Annotation>&, pugi::xml_node* node) const;
   void saveGroup(const std::shared_ptr<AnnotationGroup>& group, pugi::xml_node* node)  const;
+
+  std::string journalPath() const;
+  void updatePersistedState() const;
+  void compactJournal(const std::string& source);
+  static void applyJournal(pugi::xml_document& doc, const std::string& journalPath);
+
+  // State of the annotations and groups as last written to disk, used to determine
+  // what has to be written to the journal
+  mutable std::map<std::string, std::weak_ptr<Annotation> > _persistedAnnotations;
+  mutable std::vector<std::weak_ptr<AnnotationGroup> > _persistedGroups;
+
+  mutable std::mutex _journalMutex;
+  mutable std::thread _compactionThread;
+  std::atomic<bool> _compacting;
+  unsigned long long _journalSize;
+  unsigned long long _compactionThreshold;
 };
 
-#endif
\ No newline at end of file
+#endif
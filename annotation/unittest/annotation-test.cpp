@@ -0,0 +1,471 @@
+#include "UnitTest++/UnitTest++.h"
+#include "Annotation.h"
+#include "AnnotationList.h"
+#include "AnnotationGroup.h"
+#include "XmlRepository.h"
+#include "PatchSampler.h"
+#include "AnnotationToMaskBatch.h"
+#include "multiresolutionimageinterface/MultiResolutionImage.h"
+#include "multiresolutionimageinterface/MultiResolutionImageReader.h"
+#include "multiresolutionimageinterface/MultiResolutionImageWriter.h"
+#include "core/PathologyEnums.h"
+#include "TestData.h"
+#include "core/filetools.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace UnitTest;
+using namespace std;
+
+namespace
+{
+  shared_ptr<Annotation> createCircle(unsigned int nrPoints, float radius, float cx, float cy) {
+    shared_ptr<Annotation> annotation = make_shared<Annotation>();
+    annotation->setType(Annotation::Type::POLYGON);
+    vector<Point> coords;
+    coords.reserve(nrPoints);
+    for (unsigned int i = 0; i < nrPoints; ++i) {
+      double angle = 2 * 3.14159265358979 * i / nrPoints;
+      coords.push_back(Point(cx + radius * cos(angle), cy + radius * sin(angle)));
+    }
+    annotation->setCoordinates(std::move(coords));
+    return annotation;
+  }
+
+  // Names, groups and coordinates of all annotations and the names of all groups, sorted
+  vector<string> describe(const shared_ptr<AnnotationList>& list) {
+    vector<string> description;
+    vector<shared_ptr<Annotation> > annotations = list->getAnnotations();
+    for (unsigned int i = 0; i < annotations.size(); ++i) {
+      ostringstream line;
+      line << annotations[i]->getName() << " " << (annotations[i]->getGroup() ? annotations[i]->getGroup()->getName() : "None");
+      const vector<Point>& coordinates = annotations[i]->getCoordinates();
+      for (unsigned int j = 0; j < coordinates.size(); ++j) {
+        line << " " << coordinates[j].getX() << "," << coordinates[j].getY();
+      }
+      description.push_back(line.str());
+    }
+    vector<shared_ptr<AnnotationGroup> > groups = list->getGroups();
+    for (unsigned int i = 0; i < groups.size(); ++i) {
+      description.push_back("Group " + groups[i]->getName());
+    }
+    sort(description.begin(), description.end());
+    return description;
+  }
+
+  vector<string> loadAndDescribe(const string& path) {
+    shared_ptr<AnnotationList> list = make_shared<AnnotationList>();
+    XmlRepository repository(list);
+    repository.setSource(path);
+    repository.load();
+    return describe(list);
+  }
+
+  // A list with a group and three annotations, saved in full to path
+  shared_ptr<AnnotationList> createJournalTestList(const string& path) {
+    core::deleteFile(path + ".journal");
+    core::deleteFile(path + ".journal.compacting");
+    shared_ptr<AnnotationList> list = make_shared<AnnotationList>();
+    shared_ptr<AnnotationGroup> group = make_shared<AnnotationGroup>();
+    group->setName("Tumor");
+    list->addGroup(group);
+    for (int i = 0; i < 3; ++i) {
+      shared_ptr<Annotation> annotation = createCircle(8, 10.f + i, 100.f * i, 50.f);
+      annotation->setName("Annotation " + to_string(i));
+      if (i == 1) {
+        annotation->setGroup(group);
+      }
+      list->addAnnotation(annotation);
+    }
+    XmlRepository repository(list);
+    repository.setSource(path);
+    repository.save();
+    return list;
+  }
+
+  void writeMaskBatchTestImage(const string& path) {
+    MultiResolutionImageWriter writer;
+    writer.openFile(path);
+    writer.setTileSize(512);
+    writer.setCompression(pathology::Compression::LZW);
+    writer.setDataType(pathology::DataType::UChar);
+    writer.setColorType(pathology::ColorType::Monochrome);
+    vector<double> spacing(2, 0.5);
+    writer.setSpacing(spacing);
+    writer.writeImageInformation(1024, 1024);
+    vector<unsigned char> tile(512 * 512, 200);
+    for (unsigned int i = 0; i < 4; ++i) {
+      writer.writeBaseImagePart(tile.data());
+    }
+    writer.finishImage();
+  }
+
+  SUITE(Annotation)
+  {
+    TEST(TestBoundingBoxIsUpdatedAfterModification)
+    {
+      Annotation annotation;
+      annotation.addCoordinate(-10, -20);
+      annotation.addCoordinate(30, 40);
+      vector<Point> bbox = annotation.getImageBoundingBox();
+      CHECK_EQUAL(-10, bbox[0].getX());
+      CHECK_EQUAL(-20, bbox[0].getY());
+      CHECK_EQUAL(30, bbox[1].getX());
+      CHECK_EQUAL(40, bbox[1].getY());
+      annotation.addCoordinate(50, -30);
+      bbox = annotation.getImageBoundingBox();
+      CHECK_EQUAL(-30, bbox[0].getY());
+      CHECK_EQUAL(50, bbox[1].getX());
+      annotation.setCoordinate(0, Point(-15, 0));
+      bbox = annotation.getImageBoundingBox();
+      CHECK_EQUAL(-15, bbox[0].getX());
+    }
+
+    TEST(TestAreaIsUpdatedAfterModification)
+    {
+      Annotation annotation;
+      annotation.addCoordinate(0, 0);
+      annotation.addCoordinate(10, 0);
+      annotation.addCoordinate(10, 10);
+      annotation.addCoordinate(0, 10);
+      CHECK_CLOSE(100., annotation.getArea(), 1e-5);
+      annotation.setCoordinate(2, Point(20, 10));
+      CHECK_CLOSE(150., annotation.getArea(), 1e-5);
+      annotation.clearCoordinates();
+      CHECK_CLOSE(0., annotation.getArea(), 1e-5);
+    }
+
+    TEST(TestSimplifyInPlace)
+    {
+      shared_ptr<Annotation> annotation = createCircle(1000, 100, 500, 500);
+      annotation->resetModifiedStatus();
+      annotation->simplify(50);
+      CHECK_EQUAL(50, annotation->getNumberOfPoints());
+      CHECK(annotation->isModified());
+      annotation->simplify(0, 1.0);
+      CHECK(annotation->getNumberOfPoints() <= 50);
+      vector<Point> bbox = annotation->getImageBoundingBox();
+      CHECK_CLOSE(400., bbox[0].getX(), 1.);
+      CHECK_CLOSE(600., bbox[1].getX(), 1.);
+    }
+  }
+
+  SUITE(AnnotationBenchmark)
+  {
+    TEST(BenchmarkCoordinateAccess)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      vector<shared_ptr<Annotation> > annotations;
+      for (unsigned int i = 0; i < 100; ++i) {
+        annotations.push_back(createCircle(10000, 50 + i, 1000 + 10 * i, 1000));
+      }
+      const unsigned int iterations = 100;
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      double checksum = 0;
+      for (unsigned int it = 0; it < iterations; ++it) {
+        for (vector<shared_ptr<Annotation> >::const_iterator annotation = annotations.begin(); annotation != annotations.end(); ++annotation) {
+          const vector<Point>& coords = (*annotation)->getCoordinates();
+          checksum += coords[it].getX();
+        }
+      }
+      double getCoordinatesTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      start = chrono::steady_clock::now();
+      for (unsigned int it = 0; it < iterations; ++it) {
+        for (vector<shared_ptr<Annotation> >::const_iterator annotation = annotations.begin(); annotation != annotations.end(); ++annotation) {
+          checksum += (*annotation)->getImageBoundingBox()[1].getX();
+          checksum += (*annotation)->getArea();
+        }
+      }
+      double geometryTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      start = chrono::steady_clock::now();
+      for (vector<shared_ptr<Annotation> >::const_iterator annotation = annotations.begin(); annotation != annotations.end(); ++annotation) {
+        (*annotation)->simplify(0, 0.5);
+      }
+      double simplifyTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      std::cout << "Annotation benchmark (" << annotations.size() << " annotations, 10000 points, " << iterations << " iterations)" << std::endl;
+      std::cout << "  getCoordinates:           " << getCoordinatesTime << " ms" << std::endl;
+      std::cout << "  getImageBoundingBox/Area: " << geometryTime << " ms" << std::endl;
+      std::cout << "  simplify:                 " << simplifyTime << " ms" << std::endl;
+      CHECK(checksum != 0);
+    }
+  }
+
+  SUITE(PatchSampler)
+  {
+    TEST(TestPatchSamplerLabelsAndReproducibility)
+    {
+      // The red channel of the image is x / 8, two annotations have labels 1 and 2; the patches
+      // only depend on the seed, not on the number of threads
+      string path = g_dataPath + "/images/PatchSamplerTestImage.tif";
+      MultiResolutionImageWriter writer;
+      writer.openFile(path);
+      writer.setTileSize(512);
+      writer.setCompression(pathology::Compression::LZW);
+      writer.setDataType(pathology::DataType::UChar);
+      writer.setColorType(pathology::ColorType::RGB);
+      writer.writeImageInformation(2048, 2048);
+      vector<unsigned char> tile(512 * 512 * 3);
+      for (unsigned int ty = 0; ty < 2048; ty += 512) {
+        for (unsigned int tx = 0; tx < 2048; tx += 512) {
+          for (unsigned int i = 0; i < 512 * 512; ++i) {
+            tile[i * 3] = static_cast<unsigned char>(((tx + i % 512) / 8) % 256);
+            tile[i * 3 + 1] = static_cast<unsigned char>(((ty + i / 512) / 8) % 256);
+            tile[i * 3 + 2] = 128;
+          }
+          writer.writeBaseImagePart(tile.data());
+        }
+      }
+      writer.finishImage();
+
+      shared_ptr<AnnotationList> annotations = make_shared<AnnotationList>();
+      const float boxes[2][4] = { { 100, 100, 400, 400 }, { 1200, 200, 1800, 1000 } };
+      for (int i = 0; i < 2; ++i) {
+        shared_ptr<Annotation> annotation = make_shared<Annotation>();
+        annotation->setName(i == 0 ? "a" : "b");
+        annotation->addCoordinate(boxes[i][0], boxes[i][1]);
+        annotation->addCoordinate(boxes[i][2], boxes[i][1]);
+        annotation->addCoordinate(boxes[i][2], boxes[i][3]);
+        annotation->addCoordinate(boxes[i][0], boxes[i][3]);
+        annotations->addAnnotation(annotation);
+      }
+      map<string, int> nameToLabel = { { "a", 1 }, { "b", 2 } };
+
+      MultiResolutionImageReader reader;
+      unique_ptr<MultiResolutionImage> img(reader.open(path));
+      CHECK(img != NULL);
+      if (!img) {
+        return;
+      }
+      vector<tuple<long long, long long, int> > runs[2];
+      for (int run = 0; run < 2; ++run) {
+        PatchSampler sampler(img.get(), 0, 64);
+        sampler.setAnnotations(annotations, nameToLabel);
+        sampler.setSeed(3);
+        sampler.setNumberOfThreads(run == 0 ? 1 : 4);
+        sampler.setQueueSize(8);
+        sampler.setNumberOfPatches(40);
+        PatchSampler::TrainingPatch patch;
+        while (sampler.next(patch)) {
+          runs[run].push_back(make_tuple(patch.x, patch.y, patch.label));
+          CHECK(patch.label == 1 || patch.label == 2);
+          CHECK_EQUAL(64u * 64u * 3u, static_cast<unsigned int>(patch.pixels.size()));
+          CHECK_EQUAL(64u * 64u, static_cast<unsigned int>(patch.labels.size()));
+          if (patch.x >= 0 && patch.y >= 0) {
+            CHECK_EQUAL(static_cast<int>((patch.x / 8) % 256), static_cast<int>(patch.pixels[0]));
+          }
+        }
+        CHECK_EQUAL(40u, static_cast<unsigned int>(runs[run].size()));
+        map<int, unsigned long long> counts = sampler.getLabelCounts();
+        CHECK(counts[2] > counts[1]);
+      }
+      CHECK(runs[0] == runs[1]);
+    }
+  }
+
+  SUITE(AnnotationToMaskBatch)
+  {
+    TEST(TestSlideReaderPoolOpensSlidesOnce)
+    {
+      // Workers asking for the same slide at the same time share one reader
+      string path = g_dataPath + "/images/MaskBatchTestImage.tif";
+      writeMaskBatchTestImage(path);
+      SlideReaderPool pool(4);
+      vector<shared_ptr<MultiResolutionImage> > images(8);
+      vector<thread> threads;
+      for (unsigned int i = 0; i < images.size(); ++i) {
+        threads.push_back(thread([&pool, &images, &path, i]() {
+          images[i] = pool.get(path);
+        }));
+      }
+      for (vector<thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+      }
+      CHECK(images[0] != NULL);
+      for (unsigned int i = 1; i < images.size(); ++i) {
+        CHECK(images[i] == images[0]);
+      }
+      CHECK_EQUAL(1u, pool.size());
+      CHECK(!pool.get(g_dataPath + "/images/MaskBatchMissing.tif"));
+      CHECK_EQUAL(1u, pool.size());
+    }
+
+    TEST(TestBatchWritesMasksInParallel)
+    {
+      // Every job draws a box with label 2 at its own position, one job cannot be written
+      string imagePath = g_dataPath + "/images/MaskBatchTestImage.tif";
+      string outputDir = g_dataPath + "/images/MaskBatch";
+      writeMaskBatchTestImage(imagePath);
+      core::deleteDir(outputDir, true);
+      vector<AnnotationToMaskBatch::Job> jobs;
+      for (unsigned int i = 0; i < 6; ++i) {
+        shared_ptr<AnnotationList> list = make_shared<AnnotationList>();
+        shared_ptr<Annotation> box = make_shared<Annotation>();
+        box->setName("tumor");
+        float offset = 100.f * i;
+        box->addCoordinate(offset + 50, 300);
+        box->addCoordinate(offset + 150, 300);
+        box->addCoordinate(offset + 150, 700);
+        box->addCoordinate(offset + 50, 700);
+        list->addAnnotation(box);
+        AnnotationToMaskBatch::Job job;
+        job.imagePath = imagePath;
+        job.annotationPath = g_dataPath + "/images/MaskBatchAnnotation" + to_string(i) + ".xml";
+        job.outputPath = outputDir + "/mask" + to_string(i) + ".tif";
+        XmlRepository repository(list);
+        repository.setSource(job.annotationPath);
+        CHECK(repository.save());
+        jobs.push_back(job);
+      }
+      AnnotationToMaskBatch::Job unwritable = jobs[0];
+      unwritable.outputPath = imagePath + "/mask.tif";
+      jobs.push_back(unwritable);
+
+      AnnotationToMaskBatch batch;
+      batch.setNumberOfWorkers(4);
+      batch.setLabels({ { "tumor", 2 } });
+      vector<size_t> finished;
+      batch.setJobFinishedCallback([&finished](size_t jobIndex, size_t nrFinished, const AnnotationToMaskBatch::Result& result) {
+        finished.push_back(nrFinished);
+      });
+      vector<AnnotationToMaskBatch::Result> results = batch.run(jobs);
+      CHECK_EQUAL(4u, batch.getNumberOfWorkersUsed());
+      CHECK_EQUAL(jobs.size(), results.size());
+      CHECK_EQUAL(jobs.size(), finished.size());
+      sort(finished.begin(), finished.end());
+      for (size_t i = 0; i < finished.size(); ++i) {
+        CHECK_EQUAL(i + 1, finished[i]);
+      }
+      CHECK(results.back().status == AnnotationToMaskBatch::Result::Status::Failed);
+      CHECK(!results.back().message.empty());
+      CHECK(!core::fileExists(unwritable.outputPath));
+
+      MultiResolutionImageReader reader;
+      for (unsigned int i = 0; i < 6; ++i) {
+        CHECK(results[i].status == AnnotationToMaskBatch::Result::Status::Written);
+        unique_ptr<MultiResolutionImage> mask(reader.open(jobs[i].outputPath));
+        CHECK(mask != NULL);
+        if (!mask) {
+          continue;
+        }
+        CHECK_EQUAL(1024u, static_cast<unsigned int>(mask->getDimensions()[0]));
+        CHECK_CLOSE(0.5, mask->getSpacing()[0], 1e-6);
+        vector<unsigned char> row(1024);
+        mask->getRawRegionInto<unsigned char>(0, 500, 1024, 1, 0, row.data());
+        for (unsigned int x = 0; x < 1024; x += 10) {
+          bool inside = x > 100 * i + 50 && x < 100 * i + 150;
+          CHECK_EQUAL(inside ? 2 : 0, static_cast<int>(row[x]));
+        }
+      }
+
+      // The written masks are newer than their inputs, only the failed job is redone
+      results = batch.run(jobs);
+      for (unsigned int i = 0; i < 6; ++i) {
+        CHECK(results[i].status == AnnotationToMaskBatch::Result::Status::UpToDate);
+      }
+      CHECK(results.back().status == AnnotationToMaskBatch::Result::Status::Failed);
+    }
+  }
+
+  SUITE(AnnotationJournal)
+  {
+    TEST(TestJournalAppendAndReload)
+    {
+      // Changes, additions and removals appended to the journal load back as a full save would
+      string path = g_dataPath + "/images/JournalTest.xml";
+      string fullPath = g_dataPath + "/images/JournalTestFull.xml";
+      shared_ptr<AnnotationList> list = createJournalTestList(path);
+      XmlRepository repository(list);
+      repository.setSource(path);
+      repository.load();
+
+      list->getAnnotation("Annotation 0")->addCoordinate(1.f, 2.f);
+      list->removeAnnotation("Annotation 2");
+      shared_ptr<Annotation> added = createCircle(4, 5.f, 10.f, 10.f);
+      added->setName("Added");
+      added->setGroup(list->getGroup("Tumor"));
+      list->addAnnotation(added);
+      long int sourceSize = core::fileSize(path);
+      CHECK(repository.saveIncremental());
+      CHECK(core::fileExists(path + ".journal"));
+      CHECK_EQUAL(sourceSize, core::fileSize(path));
+
+      list->getAnnotation("Added")->addCoordinate(3.f, 4.f);
+      CHECK(repository.saveIncremental());
+
+      XmlRepository fullRepository(list);
+      fullRepository.setSource(fullPath);
+      CHECK(fullRepository.save());
+      vector<string> expected = describe(list);
+      CHECK(expected == loadAndDescribe(fullPath));
+      CHECK(expected == loadAndDescribe(path));
+    }
+
+    TEST(TestJournalCompaction)
+    {
+      // Compaction merges the journal into the source file and removes it
+      string path = g_dataPath + "/images/JournalCompactionTest.xml";
+      shared_ptr<AnnotationList> list = createJournalTestList(path);
+      XmlRepository repository(list);
+      repository.setSource(path);
+      repository.load();
+      for (int i = 0; i < 5; ++i) {
+        list->getAnnotation("Annotation 1")->addCoordinate(static_cast<float>(i), 0.f);
+        CHECK(repository.saveIncremental());
+      }
+      vector<string> expected = describe(list);
+      repository.compact();
+      repository.waitForCompaction();
+      CHECK(!core::fileExists(path + ".journal"));
+      CHECK(!core::fileExists(path + ".journal.compacting"));
+      CHECK(expected == loadAndDescribe(path));
+
+      // Appending continues on a new journal after the compaction
+      list->removeAnnotation("Annotation 0");
+      CHECK(repository.saveIncremental());
+      CHECK(describe(list) == loadAndDescribe(path));
+    }
+
+    TEST(TestJournalTruncatedEntry)
+    {
+      // An entry cut off by a crash is skipped, the entries before it are replayed
+      string path = g_dataPath + "/images/JournalTruncatedTest.xml";
+      shared_ptr<AnnotationList> list = createJournalTestList(path);
+      XmlRepository repository(list);
+      repository.setSource(path);
+      repository.load();
+      list->getAnnotation("Annotation 0")->addCoordinate(1.f, 2.f);
+      CHECK(repository.saveIncremental());
+      vector<string> expected = describe(list);
+      list->getAnnotation("Annotation 1")->addCoordinate(3.f, 4.f);
+      CHECK(repository.saveIncremental());
+
+      string journal;
+      {
+        ifstream in(path + ".journal", ios::binary);
+        journal.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+      }
+      CHECK(journal.size() > 20);
+      {
+        ofstream out(path + ".journal", ios::binary | ios::trunc);
+        out.write(journal.data(), journal.size() - 20);
+      }
+      CHECK(expected == loadAndDescribe(path));
+    }
+  }
+}
@@ -0,0 +1,329 @@
+#include "CompiledLUT.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMPILEDLUT_SSE2 1
+#endif
+
+namespace {
+
+  std::tuple<float, float, float> rgb2hsv(std::tuple<float, float, float> rgb)
+  {
+    std::tuple<float, float, float> hsv;
+    double min = std::get<0>(rgb) < std::get<1>(rgb) ? std::get<0>(rgb) : std::get<1>(rgb);
+    min = min < std::get<2>(rgb) ? min : std::get<2>(rgb);
+
+    double max = std::get<0>(rgb) > std::get<1>(rgb) ? std::get<0>(rgb) : std::get<1>(rgb);
+    max = max > std::get<2>(rgb) ? max : std::get<2>(rgb);
+
+    std::get<2>(hsv) = max;                                // v
+    double delta = max - min;
+    if (delta < 0.00001)
+    {
+      std::get<1>(hsv) = 0;
+      std::get<0>(hsv) = 0; // undefined, maybe nan?
+      return hsv;
+    }
+    if (max > 0.0) { // NOTE: if Max is == 0, this divide would cause a crash
+      std::get<1>(hsv) = (delta / max);                  // s
+    }
+    else {
+      // if max is 0, then r = g = b = 0
+      // s = 0, h is undefined
+      std::get<1>(hsv) = 0.0;
+      std::get<0>(hsv) = NAN;                            // its now undefined
+      return hsv;
+    }
+    if (std::get<0>(rgb) >= max)                           // > is bogus, just keeps compilor happy
+      std::get<0>(hsv) = (std::get<1>(rgb) - std::get<2>(rgb)) / delta;        // between yellow & magenta
+    else
+      if (std::get<1>(rgb) >= max)
+        std::get<0>(hsv) = 2.0 + (std::get<2>(rgb) - std::get<0>(rgb)) / delta;  // between cyan & yellow
+      else
+        std::get<0>(hsv) = 4.0 + (std::get<0>(rgb) - std::get<1>(rgb)) / delta;  // between magenta & cyan
+
+    std::get<0>(hsv) *= 60.0;                              // degrees
+
+    if (std::get<0>(hsv) < 0.0)
+      std::get<0>(hsv) += 360.0;
+
+    return hsv;
+  }
+
+  std::tuple<float, float, float> hsv2rgb(std::tuple<float, float, float> hsv)
+  {
+    std::tuple<float, float, float> out;
+
+    if (std::get<1>(hsv) <= 0.0) {       // < is bogus, just shuts up warnings
+      std::get<0>(out) = std::get<2>(hsv);
+      std::get<1>(out) = std::get<2>(hsv);
+      std::get<2>(out) = std::get<2>(hsv);
+      return out;
+    }
+    double  hh = std::get<0>(hsv);
+    if (hh >= 360.0) hh = 0.0;
+    hh /= 60.0;
+    long i = (long)hh;
+    double ff = hh - i;
+    double p = std::get<2>(hsv) * (1.0 - std::get<1>(hsv));
+    double q = std::get<2>(hsv) * (1.0 - (std::get<1>(hsv) * ff));
+    double t = std::get<2>(hsv) * (1.0 - (std::get<1>(hsv) * (1.0 - ff)));
+
+    switch (i) {
+    case 0:
+      std::get<0>(out) = std::get<2>(hsv);
+      std::get<1>(out) = t;
+      std::get<2>(out) = p;
+      break;
+    case 1:
+      std::get<0>(out) = q;
+      std::get<1>(out) = std::get<2>(hsv);
+      std::get<2>(out) = p;
+      break;
+    case 2:
+      std::get<0>(out) = p;
+      std::get<1>(out) = std::get<2>(hsv);
+      std::get<2>(out) = t;
+      break;
+
+    case 3:
+      std::get<0>(out) = p;
+      std::get<1>(out) = q;
+      std::get<2>(out) = std::get<2>(hsv);
+      break;
+    case 4:
+      std::get<0>(out) = t;
+      std::get<1>(out) = p;
+      std::get<2>(out) = std::get<2>(hsv);
+      break;
+    case 5:
+    default:
+      std::get<0>(out) = std::get<2>(hsv);
+      std::get<1>(out) = p;
+      std::get<2>(out) = q;
+      break;
+    }
+    return out;
+  }
+
+  // Same packing as qRgba, components are truncated to integers
+  inline unsigned int packARGB(const rgbaArray& color) {
+    return ((static_cast<int>(color[3]) & 0xffu) << 24) | ((static_cast<int>(color[0]) & 0xffu) << 16) |
+      ((static_cast<int>(color[1]) & 0xffu) << 8) | (static_cast<int>(color[2]) & 0xffu);
+  }
+
+  // Clamps a table position (already offset by 0.5 for rounding) to [0, maxPosition] and
+  // truncates it. Written as selects so it compiles without branches; NaN maps to 0.
+  inline unsigned int tableIndex(float position, const float& maxPosition) {
+    position = position > 0.f ? position : 0.f;
+    position = position < maxPosition ? position : maxPosition;
+    return static_cast<unsigned int>(position);
+  }
+
+}
+
+namespace pathology {
+
+  CompiledLUT::CompiledLUT() :
+    _sampledTableStart(0), _sampledTableStep(0)
+  {
+  }
+
+  CompiledLUT::CompiledLUT(const LUT& LUT) :
+    _LUT(LUT), _sampledTableStart(0), _sampledTableStep(0)
+  {
+    if (LUT.indices.empty() || LUT.colors.empty()) {
+      return;
+    }
+    float first = LUT.indices.front();
+    float last = LUT.indices.back();
+    _sampledTableStart = first;
+    if (last > first) {
+      _sampledTableStep = (last - first) / (SAMPLED_TABLE_SIZE - 1);
+      _sampledTable.resize(SAMPLED_TABLE_SIZE);
+      for (unsigned int i = 0; i < SAMPLED_TABLE_SIZE; ++i) {
+        _sampledTable[i] = evaluate(first + i * _sampledTableStep, LUT);
+      }
+    }
+    else {
+      _sampledTable.push_back(evaluate(first, LUT));
+    }
+    if (!LUT.relative && last < MAX_INDEX_TABLE_SIZE - 1) {
+      // Values beyond the last index all get the last color, so the table can stop there
+      unsigned int tableSize = last > 0 ? static_cast<unsigned int>(std::ceil(last)) + 1 : 1;
+      _indexTable.resize(tableSize);
+      for (unsigned int i = 0; i < tableSize; ++i) {
+        _indexTable[i] = evaluate(static_cast<float>(i), LUT);
+      }
+    }
+  }
+
+  unsigned int CompiledLUT::evaluate(const float& val, const LUT& LUT) {
+    const std::vector<float>& LUTindices = LUT.indices;
+    const std::vector<rgbaArray>& LUTcolors = LUT.colors;
+    if (LUTcolors.size() == 0 || LUTindices.size() == 0) {
+      return 0;
+    }
+    auto larger = std::upper_bound(LUTindices.begin(), LUTindices.end(), val);
+    rgbaArray currentColor;
+    if (larger == LUTindices.begin()) {
+      currentColor = LUTcolors[0];
+    }
+    else if (larger == LUTindices.end()) {
+      currentColor = LUTcolors.back();
+    }
+    else if (val - 0.0001 <= *(larger - 1) && *(larger - 1) <= val + 0.0001) {
+      currentColor = LUTcolors[(larger - LUTindices.begin()) - 1];
+    }
+    else {
+      auto index_next = larger - LUTindices.begin();
+      float index_next_val = *larger;
+      float index_prev_val = *(larger - 1);
+      float index_range = index_next_val - index_prev_val;
+      float val_normalized = (val - index_prev_val) / index_range;
+      rgbaArray rgba_prev = LUTcolors[index_next - 1];
+      rgbaArray rgba_next = LUTcolors[index_next];
+      std::tuple<float, float, float> rgb_prev = std::make_tuple(rgba_prev[0] / 255., rgba_prev[1] / 255., rgba_prev[2] / 255.);
+      std::tuple<float, float, float> rgb_next = std::make_tuple(rgba_next[0] / 255., rgba_next[1] / 255., rgba_next[2] / 255.);
+      std::tuple<float, float, float> hsv_prev = rgb2hsv(rgb_prev);
+      std::tuple<float, float, float> hsv_next = rgb2hsv(rgb_next);
+      std::tuple<float, float, float> hsv_interp;
+      std::get<0>(hsv_interp) = std::get<0>(hsv_prev) * (1 - val_normalized) + std::get<0>(hsv_next) * val_normalized;
+      std::get<1>(hsv_interp) = std::get<1>(hsv_prev) * (1 - val_normalized) + std::get<1>(hsv_next) * val_normalized;
+      std::get<2>(hsv_interp) = std::get<2>(hsv_prev) * (1 - val_normalized) + std::get<2>(hsv_next) * val_normalized;
+      std::tuple<float, float, float> rgb_interp = hsv2rgb(hsv_interp);
+      currentColor[0] = std::get<0>(rgb_interp) * 255;
+      currentColor[1] = std::get<1>(rgb_interp) * 255;
+      currentColor[2] = std::get<2>(rgb_interp) * 255;
+      currentColor[3] = rgba_prev[3] * (1 - val_normalized) + rgba_next[3] * val_normalized;
+    }
+    return packARGB(currentColor);
+  }
+
+  const LUT& CompiledLUT::getLUT() const {
+    return _LUT;
+  }
+
+  void CompiledLUT::getSampledTableTransform(const double& channelMin, const double& channelMax, float& multiplier, float& addend) const {
+    // Table position as a single multiply-add per value, including the normalization of
+    // relative LUTs and the offset to round to the nearest sample
+    double scale = _sampledTableStep > 0 ? 1. / _sampledTableStep : 0.;
+    double offset = -_sampledTableStart * scale;
+    if (_LUT.relative) {
+      double range = channelMax - channelMin;
+      double normalization = range > 0 ? 1. / range : 0.;
+      offset -= channelMin * normalization * scale;
+      scale *= normalization;
+    }
+    multiplier = static_cast<float>(scale);
+    addend = static_cast<float>(offset + 0.5);
+  }
+
+  template<typename T> void CompiledLUT::applyIndexed(const T* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const std::vector<unsigned int>& table, unsigned int* argb) const {
+    unsigned long long last = table.size() - 1;
+    const T* values = data + channel;
+    for (unsigned long long j = 0; j < nrPixels; ++j) {
+      unsigned long long value = values[j * numberOfChannels];
+      argb[j] = table[value < last ? value : last];
+    }
+  }
+
+  template<typename T> void CompiledLUT::applySampled(const T* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+    if (_sampledTable.empty()) {
+      std::fill(argb, argb + nrPixels, 0u);
+      return;
+    }
+    float multiplier = 0, addend = 0;
+    getSampledTableTransform(channelMin, channelMax, multiplier, addend);
+    const float maxPosition = static_cast<float>(_sampledTable.size() - 1) + 0.5f;
+    const unsigned int* table = _sampledTable.data();
+    const T* values = data + channel;
+    for (unsigned long long j = 0; j < nrPixels; ++j) {
+      argb[j] = table[tableIndex(static_cast<float>(values[j * numberOfChannels]) * multiplier + addend, maxPosition)];
+    }
+  }
+
+  void CompiledLUT::apply(const unsigned char* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+    if (!_LUT.relative && !_indexTable.empty()) {
+      applyIndexed(data, nrPixels, channel, numberOfChannels, _indexTable, argb);
+    }
+    else if (_LUT.relative && !_sampledTable.empty()) {
+      // 8-bit data only has 256 values, evaluate these exactly for the current min/max
+      std::vector<unsigned int> table(256);
+      double range = channelMax - channelMin;
+      for (unsigned int i = 0; i < 256; ++i) {
+        table[i] = evaluate(range > 0 ? static_cast<float>((i - channelMin) / range) : 0.f, _LUT);
+      }
+      applyIndexed(data, nrPixels, channel, numberOfChannels, table, argb);
+    }
+    else {
+      applySampled(data, nrPixels, channel, numberOfChannels, channelMin, channelMax, argb);
+    }
+  }
+
+  void CompiledLUT::apply(const unsigned short* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+    if (!_LUT.relative && !_indexTable.empty()) {
+      applyIndexed(data, nrPixels, channel, numberOfChannels, _indexTable, argb);
+    }
+    else {
+      applySampled(data, nrPixels, channel, numberOfChannels, channelMin, channelMax, argb);
+    }
+  }
+
+  void CompiledLUT::apply(const unsigned int* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+    if (!_LUT.relative && !_indexTable.empty()) {
+      applyIndexed(data, nrPixels, channel, numberOfChannels, _indexTable, argb);
+    }
+    else {
+      applySampled(data, nrPixels, channel, numberOfChannels, channelMin, channelMax, argb);
+    }
+  }
+
+  void CompiledLUT::apply(const float* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+#ifdef COMPILEDLUT_SSE2
+    if (numberOfChannels == 1 && !_sampledTable.empty()) {
+      // Same computation as applySampled, four positions at a time. MAXPS returns its second
+      // operand for NaN, so NaN values map to the first color as in the scalar code.
+      float scalarMultiplier = 0, scalarAddend = 0;
+      getSampledTableTransform(channelMin, channelMax, scalarMultiplier, scalarAddend);
+      const __m128 multiplier = _mm_set1_ps(scalarMultiplier);
+      const __m128 addend = _mm_set1_ps(scalarAddend);
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 maxPosition = _mm_set1_ps(static_cast<float>(_sampledTable.size() - 1) + 0.5f);
+      const unsigned int* table = _sampledTable.data();
+      unsigned long long j = 0;
+      alignas(16) int indices[4];
+      for (; j + 4 <= nrPixels; j += 4) {
+        __m128 position = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(data + channel + j), multiplier), addend);
+        position = _mm_min_ps(_mm_max_ps(position, zero), maxPosition);
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(position));
+        argb[j] = table[indices[0]];
+        argb[j + 1] = table[indices[1]];
+        argb[j + 2] = table[indices[2]];
+        argb[j + 3] = table[indices[3]];
+      }
+      if (j < nrPixels) {
+        applySampled(data + channel + j, nrPixels - j, 0, 1, channelMin, channelMax, argb + j);
+      }
+      return;
+    }
+#endif
+    applySampled(data, nrPixels, channel, numberOfChannels, channelMin, channelMax, argb);
+  }
+
+  void CompiledLUT::apply(const double* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+    const double& channelMin, const double& channelMax, unsigned int* argb) const {
+    applySampled(data, nrPixels, channel, numberOfChannels, channelMin, channelMax, argb);
+  }
+
+}
@@ -0,0 +1,63 @@
+#ifndef CompiledLUTH
+#define CompiledLUTH
+
+#include <vector>
+
+#include "core_export.h"
+#include "PathologyEnums.h"
+
+namespace pathology {
+
+  //! A LUT evaluated once into tables of colors, so rendering a tile is a table lookup per
+  //! pixel instead of a search and HSV interpolation per distinct value. Colors are 32-bit
+  //! ARGB (0xAARRGGBB, the layout of QRgb).
+  //! Floating point data and relative LUTs use a table of SAMPLED_TABLE_SIZE colors spanning
+  //! the LUT indices. Integer data with an absolute LUT (e.g. label maps) is looked up exactly
+  //! in a table with a color per integer value, 8-bit data always is.
+  class CORE_EXPORT CompiledLUT {
+  public:
+    static const unsigned int SAMPLED_TABLE_SIZE = 4096;
+    static const unsigned int MAX_INDEX_TABLE_SIZE = 65536;
+
+    CompiledLUT();
+    explicit CompiledLUT(const LUT& LUT);
+
+    //! Exact color of the LUT for a value, interpolating in HSV between the indices
+    static unsigned int evaluate(const float& value, const LUT& LUT);
+
+    //! Colors every numberOfChannels-th value of data starting at channel into nrPixels ARGB
+    //! values. For relative LUTs the values are first normalized with channelMin and channelMax.
+    void apply(const unsigned char* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+    void apply(const unsigned short* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+    void apply(const unsigned int* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+    void apply(const float* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+    void apply(const double* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+
+    const LUT& getLUT() const;
+
+  private:
+    void getSampledTableTransform(const double& channelMin, const double& channelMax, float& multiplier, float& addend) const;
+    template<typename T> void applySampled(const T* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const double& channelMin, const double& channelMax, unsigned int* argb) const;
+    template<typename T> void applyIndexed(const T* data, const unsigned long long& nrPixels, const unsigned int& channel, const unsigned int& numberOfChannels,
+      const std::vector<unsigned int>& table, unsigned int* argb) const;
+
+    LUT _LUT;
+
+    //! Colors sampled uniformly between the first and last LUT index
+    std::vector<unsigned int> _sampledTable;
+    float _sampledTableStart;
+    float _sampledTableStep;
+
+    //! Color per integer value, only for absolute LUTs whose indices fit MAX_INDEX_TABLE_SIZE
+    std::vector<unsigned int> _indexTable;
+  };
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "MemoryMappedFile.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MemoryMappedFile::MemoryMappedFile(const std::string& filePath) :
+  _data(nullptr), _size(0)
+{
+#ifdef WIN32
+  _mappingHandle = nullptr;
+  _fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+  if (_fileHandle == INVALID_HANDLE_VALUE) {
+    _fileHandle = nullptr;
+    return;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(static_cast<HANDLE>(_fileHandle), &size) || size.QuadPart == 0) {
+    return;
+  }
+  _mappingHandle = CreateFileMappingA(static_cast<HANDLE>(_fileHandle), NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!_mappingHandle) {
+    return;
+  }
+  _data = static_cast<const unsigned char*>(MapViewOfFile(static_cast<HANDLE>(_mappingHandle), FILE_MAP_READ, 0, 0, 0));
+  if (_data) {
+    _size = size.QuadPart;
+  }
+#else
+  int fileDescriptor = open(filePath.c_str(), O_RDONLY);
+  if (fileDescriptor < 0) {
+    return;
+  }
+  struct stat fileInfo;
+  if (fstat(fileDescriptor, &fileInfo) == 0 && fileInfo.st_size > 0) {
+    void* mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if (mapping != MAP_FAILED) {
+      _data = static_cast<const unsigned char*>(mapping);
+      _size = fileInfo.st_size;
+    }
+  }
+  // The mapping keeps its own reference to the file
+  close(fileDescriptor);
+#endif
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+#ifdef WIN32
+  if (_data) {
+    UnmapViewOfFile(_data);
+  }
+  if (_mappingHandle) {
+    CloseHandle(static_cast<HANDLE>(_mappingHandle));
+  }
+  if (_fileHandle) {
+    CloseHandle(static_cast<HANDLE>(_fileHandle));
+  }
+#else
+  if (_data) {
+    munmap(const_cast<unsigned char*>(_data), _size);
+  }
+#endif
+}
+
+bool MemoryMappedFile::valid() const
+{
+  return _data != nullptr;
+}
+
+const unsigned char* MemoryMappedFile::data() const
+{
+  return _data;
+}
+
+unsigned long long MemoryMappedFile::size() const
+{
+  return _size;
+}
@@ -0,0 +1,34 @@
+#ifndef MemoryMappedFileH
+#define MemoryMappedFileH
+
+#include <string>
+
+#include "core_export.h"
+
+//! Read-only memory mapping of a complete file. The mapping stays valid for the lifetime of
+//! the object and can be read from multiple threads; the operating system pages in only the
+//! parts that are accessed.
+class CORE_EXPORT MemoryMappedFile {
+public:
+  MemoryMappedFile(const std::string& filePath);
+  ~MemoryMappedFile();
+
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  //! Whether the file could be opened and mapped
+  bool valid() const;
+
+  const unsigned char* data() const;
+  unsigned long long size() const;
+
+private:
+  const unsigned char* _data;
+  unsigned long long _size;
+#ifdef WIN32
+  void* _fileHandle;
+  void* _mappingHandle;
+#endif
+};
+
+#endif
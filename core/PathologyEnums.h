@@ -32,14 +32,21 @@ namespace pathology {
     UChar,
     UInt16,
     UInt32,
-    Float
+    Float,
+    //! Half-precision float, read as and written from float
+    Float16,
+    //! Packed 1-bit samples, read as and written from unsigned char 0/1
+    Bit
   };
 
   enum class Compression {
     RAW,
     JPEG,
     LZW,
-    JPEG2000
+    JPEG2000,
+    ZSTD,
+    //! Lossless when the quality is 100
+    WEBP
   };
 
   enum class Interpolation {
@@ -47,6 +54,13 @@ namespace pathology {
     Linear
   };
 
+  //! Order in which the tiles of a level are stored in a file
+  enum class TileOrder {
+    Raster,
+    ZOrder,
+    Hilbert
+  };
+
 }
 
 #endif
@@ -0,0 +1,106 @@
+#include "PositionalFileReader.h"
+
+#include <algorithm>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+PositionalFileReader::PositionalFileReader(const std::string& filePath) :
+  _filePath(filePath), _fileSize(0)
+{
+#ifdef WIN32
+  HANDLE handle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+  _fileHandle = nullptr;
+  if (handle != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(handle, &size)) {
+      _fileHandle = handle;
+      _fileSize = size.QuadPart;
+    }
+    else {
+      CloseHandle(handle);
+    }
+  }
+#else
+  _fileDescriptor = open(filePath.c_str(), O_RDONLY);
+  if (_fileDescriptor >= 0) {
+    struct stat fileInfo;
+    if (fstat(_fileDescriptor, &fileInfo) == 0) {
+      _fileSize = fileInfo.st_size;
+    }
+    else {
+      close(_fileDescriptor);
+      _fileDescriptor = -1;
+    }
+  }
+#endif
+}
+
+PositionalFileReader::~PositionalFileReader()
+{
+#ifdef WIN32
+  if (_fileHandle) {
+    CloseHandle(static_cast<HANDLE>(_fileHandle));
+  }
+#else
+  if (_fileDescriptor >= 0) {
+    close(_fileDescriptor);
+  }
+#endif
+}
+
+bool PositionalFileReader::valid() const
+{
+#ifdef WIN32
+  return _fileHandle != nullptr;
+#else
+  return _fileDescriptor >= 0;
+#endif
+}
+
+unsigned long long PositionalFileReader::getFileSize() const
+{
+  return _fileSize;
+}
+
+const std::string& PositionalFileReader::getFilePath() const
+{
+  return _filePath;
+}
+
+bool PositionalFileReader::read(const unsigned long long& offset, const unsigned long long& size, void* buffer) const
+{
+  if (!valid() || offset > _fileSize || size > _fileSize - offset) {
+    return false;
+  }
+  unsigned char* target = static_cast<unsigned char*>(buffer);
+  unsigned long long done = 0;
+  while (done < size) {
+#ifdef WIN32
+    DWORD chunk = static_cast<DWORD>(std::min<unsigned long long>(size - done, 1 << 30));
+    OVERLAPPED position = {};
+    position.Offset = static_cast<DWORD>((offset + done) & 0xFFFFFFFF);
+    position.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+    DWORD nrRead = 0;
+    if (!ReadFile(static_cast<HANDLE>(_fileHandle), target + done, chunk, &nrRead, &position) || nrRead == 0) {
+      return false;
+    }
+#else
+    ssize_t nrRead = pread(_fileDescriptor, target + done, size - done, offset + done);
+    if (nrRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nrRead <= 0) {
+      return false;
+    }
+#endif
+    done += nrRead;
+  }
+  return true;
+}
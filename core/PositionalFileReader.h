@@ -0,0 +1,38 @@
+#ifndef PositionalFileReaderH
+#define PositionalFileReaderH
+
+#include <string>
+
+#include "core_export.h"
+
+//! Read-only file handle which reads at explicit offsets (pread, or ReadFile with an offset on
+//! Windows) instead of through a shared file position. A single instance can therefore be
+//! kept open for the lifetime of an image and be read from multiple threads at once.
+class CORE_EXPORT PositionalFileReader {
+public:
+  PositionalFileReader(const std::string& filePath);
+  ~PositionalFileReader();
+
+  PositionalFileReader(const PositionalFileReader&) = delete;
+  PositionalFileReader& operator=(const PositionalFileReader&) = delete;
+
+  //! Whether the file could be opened
+  bool valid() const;
+
+  //! Reads size bytes starting at offset into buffer, fails if the range is not within the file
+  bool read(const unsigned long long& offset, const unsigned long long& size, void* buffer) const;
+
+  unsigned long long getFileSize() const;
+  const std::string& getFilePath() const;
+
+private:
+  std::string _filePath;
+  unsigned long long _fileSize;
+#ifdef WIN32
+  void* _fileHandle;
+#else
+  int _fileDescriptor;
+#endif
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "multiresolutionimageinterface/MultiResolutionImageReader.h"
 #include "multiresolutionimageinterface/MultiResolutionImage.h"
 #include "multiresolutionimageinterface/OpenSlideImage.h"
+#include "multiresolutionimageinterface/TIFFImage.h"
 #include "multiresolutionimageinterface/MultiResolutionImageWriter.h"
 #include "multiresolutionimageinterface/AperioSVSWriter.h"
 #include "core/filetools.h"
@@ -18,7 +19,7 @@
 using namespace std;
 using namespace pathology;
 
-void convertImage(std::string fileIn, std::string fileOut, bool svs = false, std::string compression = "LZW", double quality = 70., double spacingX = -1.0, double spacingY = -1.0, unsigned int tileSize = 512, int maxPyramidLevels = -1, int downsamplePerLevel =2) {
+void convertImage(std::string fileIn, std::string fileOut, bool svs = false, std::string compression = "LZW", double quality = 70., double spacingX = -1.0, double spacingY = -1.0, unsigned int tileSize = 512, int maxPyramidLevels = -1, int downsamplePerLevel =2, bool reencode = false) {
   MultiResolutionImageReader read;
   MultiResolutionImageWriter* writer;
   if (svs) {
@@ -44,12 +45,18 @@ void convertImage(std::string fileIn, std::string fileOut, bool svs = false, std
         else if (compression == string("JPEG2000")) {
           writer->setCompression(Compression::JPEG2000);
         }
+        else if (compression == string("ZSTD")) {
+          writer->setCompression(Compression::ZSTD);
+        }
+        else if (compression == string("WEBP")) {
+          writer->setCompression(Compression::WEBP);
+        }
         else {
           cout << "Invalid compression, setting default LZW as compression" << endl;
           writer->setCompression(Compression::LZW);
         }
         if (quality > 100) {
-          cout << "Too high rate, maximum is 100, setting to 100 (for JPEG2000 this is equal to lossless)" << endl; 
+          cout << "Too high rate, maximum is 100, setting to 100 (for JPEG2000 and WEBP this is equal to lossless)" << endl; 
           writer->setJPEGQuality(100);
         } else if (quality <= 0.001) {
           cout << "Too low rate, minimum is 0.001, setting to 1" << endl;
@@ -58,6 +65,28 @@ void convertImage(std::string fileIn, std::string fileOut, bool svs = false, std
           writer->setJPEGQuality(quality);
         }
 
+        writer->setTilePassthrough(!reencode);
+        EncodedTileInfo info;
+        if (!reencode && !img->getEncodedTileInfo(0, info)) {
+          // SVS files are opened through OpenSlide, which only provides decoded pixels. Their tiles
+          // can be copied when the file is also readable as a tiled TIFF with the codec and tile
+          // size chosen for the output, otherwise the pixels from OpenSlide are re-encoded.
+          TIFFImage* tiffImg = new TIFFImage();
+          if (tiffImg->initialize(fileIn) && tiffImg->valid() && tiffImg->getDimensions() == img->getDimensions() && tiffImg->getColorType() == img->getColorType() && writer->canCopyEncodedTiles(tiffImg)) {
+            // TIFFImage only reads the spacing from the resolution tags, OpenSlide also reads the
+            // MPP from the SVS description. A spacing given on the command line still overrides it.
+            std::vector<double> spacing = img->getSpacing();
+            if (!spacing.empty()) {
+              writer->setOverrideSpacing(spacing);
+            }
+            delete img;
+            img = tiffImg;
+          }
+          else {
+            delete tiffImg;
+          }
+        }
+
         writer->setDownsamplePerLevel(downsamplePerLevel);
         writer->setMaxNumberOfPyramidLevels(maxPyramidLevels);
 
@@ -97,11 +126,11 @@ int main(int argc, char *argv[]) {
         .implicit_value(bool(true));
 
     desc.add_argument("-c", "--codec")
-        .help("Set compression codec. Can be one of the following: RAW, LZW, JPEG, JPEG2000")
+        .help("Set compression codec. Can be one of the following: RAW, LZW, JPEG, JPEG2000, ZSTD, WEBP")
         .default_value(std::string("LZW"));
 
     desc.add_argument("-r", "--rate")
-        .help("Set compression rate for JPEG and JPEG2000")
+        .help("Set compression rate for JPEG, JPEG2000 and WEBP")
         .default_value(double(70.))
         .scan<'g', double>();
 
@@ -130,6 +159,11 @@ int main(int argc, char *argv[]) {
         .default_value((unsigned int)2)
         .scan<'i', unsigned int>();
 
+    desc.add_argument("-e", "--reencode")
+        .help("Always decode and re-encode tiles, instead of copying compressed tiles when the input uses the same codec and tile size")
+        .default_value(bool(false))
+        .implicit_value(bool(true));
+
     desc.add_argument("input")
         .help("Path to the input image")
         .required();
@@ -161,13 +195,14 @@ int main(int argc, char *argv[]) {
     unsigned int tileSize = desc.get<unsigned int>("--tileSize");
     unsigned int downsamplePerLevel = desc.get<unsigned int>("--downsample");
     int pyramidLevels = desc.get<int>("--pyramidLevels");
+    bool reencode = desc["--reencode"] == true;
 
     if (core::fileExists(inputPth) && !core::dirExists(outputPth)) {
       if (desc.is_used("--spacingX") || desc.is_used("--spacingY")) {
-        convertImage(inputPth, outputPth, svs, codec, rate, spacingX, spacingY, tileSize, pyramidLevels, downsamplePerLevel);
+        convertImage(inputPth, outputPth, svs, codec, rate, spacingX, spacingY, tileSize, pyramidLevels, downsamplePerLevel, reencode);
       }
       else {
-        convertImage(inputPth, outputPth, svs, codec, rate, -1., -1., tileSize, pyramidLevels, downsamplePerLevel);
+        convertImage(inputPth, outputPth, svs, codec, rate, -1., -1., tileSize, pyramidLevels, downsamplePerLevel, reencode);
       }
     } 
     else if (core::dirExists(outputPth)) { //Could be wildcards and output dir 
@@ -185,10 +220,10 @@ int main(int argc, char *argv[]) {
           core::changeExtension(outPth, "tif");
         }
         if (desc.is_used("--spacingX") || desc.is_used("--spacingY")) {
-          convertImage(fls[i], outPth, svs, codec, rate, spacingX, spacingY, tileSize, pyramidLevels, downsamplePerLevel);
+          convertImage(fls[i], outPth, svs, codec, rate, spacingX, spacingY, tileSize, pyramidLevels, downsamplePerLevel, reencode);
         }
         else {
-          convertImage(fls[i], outPth, svs, codec, rate, -1., -1., tileSize, pyramidLevels, downsamplePerLevel);
+          convertImage(fls[i], outPth, svs, codec, rate, -1., -1., tileSize, pyramidLevels, downsamplePerLevel, reencode);
         }
       }
     }
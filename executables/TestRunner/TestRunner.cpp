@@ -27,6 +27,13 @@ int main(int argc, char* argv[])
 	suite = argv[3];
 	std::cout << "Testing only suite " << suite << endl;
   }
+  if (argc >= 5)
+  {
+    g_runTimeIntensiveTests = std::string(argv[4]) == "1";
+    if (g_runTimeIntensiveTests) {
+      std::cout << "Running time intensive tests and benchmarks" << endl;
+    }
+  }
   g_dataPath = argv[1];
   if (xmlOutput.empty()) {
     UnitTest::TestReporterStdout reporter;
@@ -0,0 +1,205 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "annotation/AnnotationToMaskBatch.h"
+#include "core/filetools.h"
+#include "config/ASAPMacros.h"
+
+#include "core/argparse.hpp"
+
+using namespace std;
+
+namespace {
+
+  std::string trim(const std::string& str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+      return std::string();
+    }
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(start, end - start + 1);
+  }
+
+  std::vector<std::string> split(const std::string& str, const std::string& delimiters) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    size_t end = str.find_first_of(delimiters);
+    while (end != std::string::npos) {
+      parts.push_back(trim(str.substr(start, end - start)));
+      start = end + 1;
+      end = str.find_first_of(delimiters, start);
+    }
+    parts.push_back(trim(str.substr(start)));
+    return parts;
+  }
+
+  bool readManifest(const std::string& manifestPath, std::vector<AnnotationToMaskBatch::Job>& jobs) {
+    std::vector<std::string> lines;
+    if (!core::readFile(manifestPath, lines)) {
+      return false;
+    }
+    for (unsigned int i = 0; i < lines.size(); ++i) {
+      std::string line = trim(lines[i]);
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      std::vector<std::string> fields = split(line, ",\t");
+      if (fields.size() != 3) {
+        std::cerr << "WARNING: Skipping line " << i + 1 << " of the manifest, expected <image>,<annotation>,<output>" << std::endl;
+        continue;
+      }
+      AnnotationToMaskBatch::Job job;
+      job.imagePath = fields[0];
+      job.annotationPath = fields[1];
+      job.outputPath = fields[2];
+      jobs.push_back(job);
+    }
+    return true;
+  }
+
+  double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  try {
+
+    argparse::ArgumentParser desc("WSI Annotation To Mask", ASAP_VERSION_STRING);
+
+    desc.add_argument("-w", "--workers")
+        .help("Number of slides which are processed concurrently (0 uses all cores)")
+        .default_value((unsigned int)0)
+        .scan<'i', unsigned int>();
+
+    desc.add_argument("-l", "--level")
+        .help("Pyramid level of the source slide the mask should be aligned to")
+        .default_value((unsigned int)0)
+        .scan<'i', unsigned int>();
+
+    desc.add_argument("-m", "--mapping")
+        .help("Mapping of annotation (group) names to labels, e.g. tumor=1,stroma=2. If omitted all annotations get label 1")
+        .default_value(std::string(""));
+
+    desc.add_argument("-o", "--ordered")
+        .help("Draw the annotations in the order of the mapping, later labels overwrite earlier ones instead of the highest label winning")
+        .default_value(bool(false))
+        .implicit_value(bool(true));
+
+    desc.add_argument("-s", "--skip")
+        .help("When to skip existing outputs: timestamp (output newer than its inputs), hash (inputs and settings unchanged) or none")
+        .default_value(std::string("timestamp"));
+
+    desc.add_argument("manifest")
+        .help("Path to the manifest, each line contains <image>,<annotation>,<output> (comma or tab separated)")
+        .required();
+
+    try {
+        desc.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << desc;
+        std::exit(1);
+    }
+
+    std::string manifestPth = desc.get<std::string>("manifest");
+    unsigned int nrWorkers = desc.get<unsigned int>("--workers");
+    unsigned int level = desc.get<unsigned int>("--level");
+    std::string mapping = desc.get<std::string>("--mapping");
+    bool ordered = desc.get<bool>("--ordered");
+    std::string skipMode = desc.get<std::string>("--skip");
+
+    if (skipMode != "timestamp" && skipMode != "hash" && skipMode != "none") {
+      std::cerr << "ERROR: Invalid skip mode " << skipMode << ", should be timestamp, hash or none" << std::endl;
+      return 1;
+    }
+
+    std::map<std::string, int> nameToLabel;
+    std::vector<std::string> nameOrder;
+    if (!mapping.empty()) {
+      std::vector<std::string> entries = split(mapping, ",");
+      for (std::vector<std::string>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        size_t separator = it->rfind('=');
+        if (separator == std::string::npos) {
+          std::cerr << "ERROR: Invalid mapping entry " << *it << ", should be <name>=<label>" << std::endl;
+          return 1;
+        }
+        std::string name = trim(it->substr(0, separator));
+        nameToLabel[name] = std::stoi(it->substr(separator + 1));
+        if (ordered) {
+          nameOrder.push_back(name);
+        }
+      }
+    }
+
+    std::vector<AnnotationToMaskBatch::Job> jobs;
+    if (!readManifest(manifestPth, jobs)) {
+      std::cerr << "ERROR: Could not read manifest " << manifestPth << std::endl;
+      return 1;
+    }
+
+    AnnotationToMaskBatch batch;
+    batch.setNumberOfWorkers(nrWorkers);
+    batch.setLevel(level);
+    batch.setLabels(nameToLabel, nameOrder);
+    if (skipMode == "hash") {
+      batch.setSkipMode(AnnotationToMaskBatch::SkipMode::Hash);
+    }
+    else if (skipMode == "none") {
+      batch.setSkipMode(AnnotationToMaskBatch::SkipMode::None);
+    }
+    batch.setJobFinishedCallback([&jobs](size_t jobIndex, size_t finished, const AnnotationToMaskBatch::Result& result) {
+      std::cout << "[" << finished << "/" << jobs.size() << "] " << jobs[jobIndex].outputPath;
+      if (result.status == AnnotationToMaskBatch::Result::Status::UpToDate) {
+        std::cout << " is up to date" << std::endl;
+      }
+      else if (result.status == AnnotationToMaskBatch::Result::Status::Written) {
+        std::cout << " written in " << result.totalTime / 1000. << " s" << std::endl;
+      }
+      else {
+        std::cout << " FAILED: " << result.message << std::endl;
+      }
+    });
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<AnnotationToMaskBatch::Result> results = batch.run(jobs);
+    double totalTime = elapsedMs(start);
+
+    unsigned int nrWritten = 0, nrUpToDate = 0, nrFailed = 0;
+    std::cout << std::endl << "Summary (times in ms)" << std::endl;
+    std::cout << "status\topen\tload\trasterize\ttotal\toutput" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      const AnnotationToMaskBatch::Result& result = results[i];
+      if (result.status == AnnotationToMaskBatch::Result::Status::Written) {
+        std::cout << "written";
+        ++nrWritten;
+      }
+      else if (result.status == AnnotationToMaskBatch::Result::Status::UpToDate) {
+        std::cout << "skipped";
+        ++nrUpToDate;
+      }
+      else {
+        std::cout << "failed";
+        ++nrFailed;
+      }
+      std::cout << "\t" << result.openTime << "\t" << result.loadTime << "\t" << result.rasterizeTime << "\t" << result.totalTime << "\t" << jobs[i].outputPath << std::endl;
+    }
+    std::cout << std::endl << nrWritten << " written, " << nrUpToDate << " up to date, " << nrFailed << " failed in " << totalTime / 1000. << " s using " << batch.getNumberOfWorkersUsed() << " workers" << std::endl;
+    if (nrFailed > 0) {
+      return 1;
+    }
+  } 
+  catch (std::exception& e) {
+    std::cerr << "Unhandled exception: "
+      << e.what() << ", application will now exit" << std::endl;
+    return 2;
+  }
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include "WorkstationTester.h"
+#include "TileManager.h"
+#include "IOThread.h"
+#include "WSITileGraphicsItemCache.h"
+#include "multiresolutionimageinterface/MultiResolutionImageReader.h"
+#include "multiresolutionimageinterface/MultiResolutionImage.h"
+#include "config/ASAPMacros.h"
+
+#include <QApplication>
+#include <QGraphicsScene>
+#include <QElapsedTimer>
+#include <iostream>
+#include <random>
+#include <utility>
+
+#include "core/argparse.hpp"
+
+WorkstationTester::WorkstationTester(std::shared_ptr<MultiResolutionImage> img, unsigned int tileSize) :
+  _img(img),
+  _tileSize(tileSize)
+{
+}
+
+double WorkstationTester::benchmarkLoadTilesForFieldOfView(unsigned int nrCalls, unsigned int viewportWidth, unsigned int viewportHeight) {
+  // Same last render level as the viewer uses
+  unsigned int lastLevel = _img->getNumberOfLevels() - 1;
+  for (int i = _img->getNumberOfLevels() - 1; i >= 0; --i) {
+    std::vector<unsigned long long> lastLevelDimensions = _img->getLevelDimensions(i);
+    if (lastLevelDimensions[0] > 1024 && lastLevelDimensions[1] > 1024) {
+      lastLevel = i;
+      break;
+    }
+  }
+
+  // Without workers the jobs are only queued, so the tile manager and queue are measured in isolation
+  IOThread ioThread(NULL, 0);
+  ioThread.setBackgroundImage(_img);
+  WSITileGraphicsItemCache cache;
+  cache.setMaxCacheSize(1000 * 1024 * 1024);
+  QGraphicsScene scene;
+  TileManager manager(_img, _tileSize, lastLevel, &ioThread, &cache, &scene);
+
+  std::vector<unsigned long long> dims = _img->getDimensions();
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<double> position(0., 1.);
+  std::uniform_int_distribution<int> pan(-viewportWidth / 2, viewportWidth / 2);
+  std::uniform_int_distribution<unsigned int> levelSelector(0, lastLevel);
+  double centerX = dims[0] / 2.;
+  double centerY = dims[1] / 2.;
+  unsigned int level = 0;
+  unsigned long long nrQueuedJobs = 0;
+
+  QElapsedTimer timer;
+  timer.start();
+  for (unsigned int i = 0; i < nrCalls; ++i) {
+    // Mostly pans at the current level, with an occasional jump to another location and level
+    if (i % 50 == 0) {
+      level = levelSelector(generator);
+      centerX = position(generator) * dims[0];
+      centerY = position(generator) * dims[1];
+    }
+    else {
+      double downsample = _img->getLevelDownsample(level);
+      centerX += pan(generator) * downsample;
+      centerY += pan(generator) * downsample;
+    }
+    double downsample = _img->getLevelDownsample(level);
+    QRectF FOV(centerX - viewportWidth * downsample / 2., centerY - viewportHeight * downsample / 2., viewportWidth * downsample, viewportHeight * downsample);
+    manager.loadTilesForFieldOfView(FOV, level);
+
+    // Tiles stay pending as no worker loads them, so forget them regularly to keep queueing new tiles
+    if (i % 50 == 49) {
+      nrQueuedJobs += ioThread.numberOfJobs();
+      ioThread.clearJobs();
+      for (unsigned int l = 0; l <= lastLevel; ++l) {
+        manager.resetCoverage(l);
+      }
+    }
+  }
+  qint64 elapsed = timer.nsecsElapsed();
+  nrQueuedJobs += ioThread.numberOfJobs();
+  ioThread.clearJobs();
+  ioThread.shutdown();
+
+  double callsPerSecond = nrCalls / (elapsed / 1e9);
+  std::cout << "loadTilesForFieldOfView: " << nrCalls << " calls in " << elapsed / 1e6 << " ms (" << callsPerSecond << " calls/s, " << nrQueuedJobs << " tiles queued)" << std::endl;
+  return callsPerSecond;
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    argparse::ArgumentParser desc("Workstation tests", ASAP_VERSION_STRING);
+
+    desc.add_argument("-n", "--calls")
+        .help("Number of field of view changes to simulate")
+        .default_value((unsigned int)100000)
+        .scan<'i', unsigned int>();
+
+    desc.add_argument("-t", "--tileSize")
+        .help("Tile size used by the viewer")
+        .default_value((unsigned int)512)
+        .scan<'i', unsigned int>();
+
+    desc.add_argument("input")
+        .help("Path to the image to run the benchmarks on")
+        .required();
+
+    try {
+      desc.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error& err) {
+      std::cerr << err.what() << std::endl;
+      std::cerr << desc;
+      std::exit(1);
+    }
+
+    // The benchmarks do not show any windows
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+      qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
+    MultiResolutionImageReader reader;
+    std::shared_ptr<MultiResolutionImage> img(reader.open(desc.get<std::string>("input")));
+    if (!img || !img->valid()) {
+      std::cerr << "ERROR: Invalid input image" << std::endl;
+      return 1;
+    }
+    WorkstationTester tester(img, desc.get<unsigned int>("--tileSize"));
+    tester.benchmarkLoadTilesForFieldOfView(desc.get<unsigned int>("--calls"));
+  }
+  catch (std::exception& e) {
+    std::cerr << "Unhandled exception: "
+      << e.what() << ", application will now exit" << std::endl;
+    return 2;
+  }
+  return 0;
+}
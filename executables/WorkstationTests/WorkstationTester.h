@@ -0,0 +1,24 @@
+#ifndef WORKSTATIONTESTER_H
+#define WORKSTATIONTESTER_H
+
+#include <memory>
+#include <string>
+
+class MultiResolutionImage;
+
+//! Benchmarks for the tile management of the viewer, which can be run without showing a window.
+class WorkstationTester {
+public:
+  WorkstationTester(std::shared_ptr<MultiResolutionImage> img, unsigned int tileSize = 512);
+
+  //! Simulates random pans and zooms with a viewport of viewportWidth x viewportHeight screen
+  //! pixels and returns the number of TileManager::loadTilesForFieldOfView calls per second.
+  //! No tiles are decoded, this only measures the bookkeeping of the tile manager and IO queue.
+  double benchmarkLoadTilesForFieldOfView(unsigned int nrCalls, unsigned int viewportWidth = 1920, unsigned int viewportHeight = 1080);
+
+private:
+  std::shared_ptr<MultiResolutionImage> _img;
+  unsigned int _tileSize;
+};
+
+#endif
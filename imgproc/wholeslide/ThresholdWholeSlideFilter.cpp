@@ -90,7 +90,8 @@ bool ThresholdWholeSlideFilter::process() {
     writer.setNumberOfIndexedColors(img->getSamplesPerPixel());
   }
   writer.setCompression(pathology::Compression::LZW);
-  writer.setDataType(pathology::DataType::UChar);
+  // The mask only holds 0 and 1, which are stored as packed bits
+  writer.setDataType(pathology::DataType::Bit);
   writer.setInterpolation(pathology::Interpolation::NearestNeighbor);
   writer.setTileSize(512);
   std::vector<double> spacing = img->getSpacing();
@@ -35,6 +35,9 @@ int AperioSVSWriter::finishImage() {
     writeThumbnail<float>();
   }
   for (std::vector<std::string>::const_iterator it = _levelFiles.begin(); it != _levelFiles.end(); ++it) {
+    if (it->empty()) {
+      continue;
+    }
     for (int i = 0; i < 5; ++i) {
       if (remove(it->c_str()) == 0) {
         break;
@@ -44,6 +47,7 @@ int AperioSVSWriter::finishImage() {
   TIFFClose(_tiff);
   _tiff = NULL;
   _levelFiles.clear();
+  _nonEmptyTiles.clear();
   _fileName = "";
   _pos = 0;
   return 0;
@@ -74,12 +78,20 @@ void AperioSVSWriter::writeThumbnail() {
   TIFFGetField(lowestResTiff, TIFFTAG_TILELENGTH, &tileH);
   T* tile = (T*)_TIFFmalloc(tileW * tileH * nrsamples * sizeof(T));
   JPEG2000Codec cod;
+  cod.setNumberOfThreadsPerTile(0);
   for (unsigned int tileY = 0; tileY < h; tileY += tileH) {
     for (unsigned int tileX = 0; tileX < w; tileX += tileW) {
-      if (getCompression() == Compression::JPEG2000) {
-        unsigned int no = TIFFComputeTile(lowestResTiff, tileX, tileY, 0, 0);
+      // Empty tiles are not written to the level file
+      unsigned int no = TIFFComputeTile(lowestResTiff, tileX, tileY, 0, 0);
+      const std::vector<bool>& nonEmptyTiles = _nonEmptyTiles.back();
+      if (no < nonEmptyTiles.size() && !nonEmptyTiles[no]) {
+        std::fill_n(tile, tileW * tileH * nrsamples, static_cast<T>(0));
+      }
+      else if (getCompression() == Compression::JPEG2000) {
         unsigned int rawSize = TIFFReadRawTile(lowestResTiff, no, tile, tileW*tileH*nrsamples*sizeof(T));
-        cod.decode((unsigned char*)tile, rawSize, tileW*tileH*nrsamples*sizeof(T));
+        if (!cod.decode((unsigned char*)tile, rawSize, tileW*tileH*nrsamples*sizeof(T))) {
+          std::fill_n(tile, tileW * tileH * nrsamples, static_cast<T>(0));
+        }
       }
       else {
         TIFFReadTile(lowestResTiff, tile, tileX, tileY, 0, 0);
@@ -1,12 +1,41 @@
 #include "DICOMImage.h"
 #include <mutex>
+#include <cmath>
+#include <algorithm>
 #include <sstream>
 #include "core/filetools.h"
 #include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
 #include "WSIDicomInstance.h"
+#include "DecodePool.h"
 using namespace pathology;
 
-DICOMImage::DICOMImage() : MultiResolutionImage() {
+namespace {
+  // Reads the luma sampling factors from the start of frame marker of a JPEG stream, these equal
+  // the chroma subsampling when the chroma components are not upsampled
+  bool getJPEGSubsampling(const std::vector<unsigned char>& jpeg, unsigned short& subsamplingX, unsigned short& subsamplingY) {
+    size_t pos = 2;
+    while (pos + 4 <= jpeg.size()) {
+      if (jpeg[pos] != 0xFF) {
+        return false;
+      }
+      unsigned char marker = jpeg[pos + 1];
+      size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+      if (marker >= 0xC0 && marker <= 0xC2) {
+        if (pos + 11 >= jpeg.size() || jpeg[pos + 9] < 3) {
+          return false;
+        }
+        subsamplingX = jpeg[pos + 11] >> 4;
+        subsamplingY = jpeg[pos + 11] & 0x0F;
+        return subsamplingX > 0 && subsamplingY > 0;
+      }
+      pos += 2 + length;
+    }
+    return false;
+  }
+}
+
+DICOMImage::DICOMImage() : MultiResolutionImage(), _label(nullptr), _overview(nullptr) {
 }
 
 DICOMImage::~DICOMImage() {
@@ -15,9 +44,20 @@ DICOMImage::~DICOMImage() {
   MultiResolutionImage::cleanup();
 }
 
-// We are using OpenSlides caching system instead of our own.
-void DICOMImage::setCacheSize(const unsigned long long cacheSize) {
+const unsigned long long DICOMImage::getCacheSize() {
+  std::unique_lock<std::mutex> l(*_cacheMutex);
+  if (_cache && _isValid) {
+    return std::static_pointer_cast<FrameCache>(_cache)->maxCacheSize();
+  }
+  return _cacheSize;
+}
 
+void DICOMImage::setCacheSize(const unsigned long long cacheSize) {
+  std::unique_lock<std::mutex> l(*_cacheMutex);
+  _cacheSize = cacheSize;
+  if (_cache && _isValid) {
+    std::static_pointer_cast<FrameCache>(_cache)->setMaxCacheSize(cacheSize);
+  }
 }
 
 bool DICOMImage::initializeType(const std::string& imagePath) {
@@ -28,15 +68,18 @@ bool DICOMImage::initializeType(const std::string& imagePath) {
   core::getFiles(dirPath, "*.dcm", dcmFilePaths);
   std::vector<WSIDicomInstance*> dcmInstances;
   for (auto dcmFilePath : dcmFilePaths) {
+      // Only the header is parsed, frames are read from the file on demand by the instance
       DcmFileFormat* dcm = new DcmFileFormat();
-      OFCondition status = dcm->loadFile(OFFilename(dcmFilePath.c_str()));
+      OFCondition status = dcm->loadFileUntilTag(OFFilename(dcmFilePath.c_str()), EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData);
       if (status.good()) {
-          WSIDicomInstance* instance = new WSIDicomInstance(dcm);
+          WSIDicomInstance* instance = new WSIDicomInstance(dcm, dcmFilePath);
+          _instances.push_back(instance);
           if (instance->valid()) {
               dcmInstances.push_back(instance);
           }
       }
       else {
+          delete dcm;
           return _isValid;
       }
   }
@@ -46,17 +89,24 @@ bool DICOMImage::initializeType(const std::string& imagePath) {
   WSIDicomInstance* baseLevel = nullptr;
   for (auto instance : dcmInstances) {
       std::vector<unsigned int> instanceSize = instance->getSize();
-      unsigned long long nrPixels = instanceSize[0] * instanceSize[1];
+      unsigned long long nrPixels = static_cast<unsigned long long>(instanceSize[0]) * instanceSize[1];
       if (nrPixels > largestNrPixels) {
           baseLevel = instance;
           largestNrPixels = nrPixels;
       }
   }
 
+  if (!baseLevel) {
+      return _isValid;
+  }
+
   // Filter out all instances that do not have the same UIDs and order them according to the right level
   std::map<int, std::vector<WSIDicomInstance*> > downsampleToLevel;
   downsampleToLevel[1] = { baseLevel };
   for (auto instance : dcmInstances) {
+      if (instance == baseLevel) {
+          continue;
+      }
       if (instance->getUID("StudyInstanceUID") == baseLevel->getUID("StudyInstanceUID") &&
           instance->getUID("SeriesInstanceUID") == baseLevel->getUID("SeriesInstanceUID") /* &&
           instance->getUID("FrameOfReferenceUID") == baseLevel->getUID("FrameOfReferenceUID")*/) {
@@ -90,8 +140,34 @@ bool DICOMImage::initializeType(const std::string& imagePath) {
       }
   }
   for (auto it = downsampleToLevel.begin(); it != downsampleToLevel.end(); it++) {
-      _levels.push_back(it->second);
-      _levelDimensions.push_back({ it->second[0]->getSize()[0], it->second[0]->getSize()[1] });
+      std::vector<WSIDicomInstance*> levelInstances = it->second;
+      std::sort(levelInstances.begin(), levelInstances.end(), [](const WSIDicomInstance* a, const WSIDicomInstance* b) {
+          return a->getConcatenationFrameOffset() < b->getConcatenationFrameOffset();
+      });
+      _levels.push_back(levelInstances);
+      _levelDimensions.push_back({ levelInstances[0]->getSize()[0], levelInstances[0]->getSize()[1] });
+
+      // Level-wide frame index, so a tile can be located without asking every instance
+      std::vector<unsigned short> tileSize = levelInstances[0]->getTileSize();
+      unsigned long long tilesPerRow = (_levelDimensions.back()[0] + tileSize[0] - 1) / tileSize[0];
+      unsigned long long tilesPerColumn = (_levelDimensions.back()[1] + tileSize[1] - 1) / tileSize[1];
+      std::vector<FrameLocation> frameTable(tilesPerRow * tilesPerColumn, FrameLocation{ -1, 0 });
+      for (unsigned int i = 0; i < levelInstances.size(); ++i) {
+          for (unsigned long long ty = 0; ty < tilesPerColumn; ++ty) {
+              for (unsigned long long tx = 0; tx < tilesPerRow; ++tx) {
+                  FrameLocation& location = frameTable[ty * tilesPerRow + tx];
+                  if (location.instance < 0) {
+                      long long frameIndex = levelInstances[i]->getFrameIndex(tx * tileSize[0], ty * tileSize[1]);
+                      if (frameIndex >= 0) {
+                          location.instance = i;
+                          location.frame = static_cast<unsigned int>(frameIndex);
+                      }
+                  }
+              }
+          }
+      }
+      _frameTables.push_back(std::move(frameTable));
+      _tilesPerRow.push_back(tilesPerRow);
   }
   _numberOfLevels = _levels.size();
   _spacing = _levels[0][0]->getPixelSpacing();
@@ -99,7 +175,24 @@ bool DICOMImage::initializeType(const std::string& imagePath) {
   _dataType = pathology::DataType::UChar;
   _samplesPerPixel = 3;
 
+  // Release the headers of instances which are not part of this slide
+  std::vector<WSIDicomInstance*> usedInstances;
+  for (auto instance : _instances) {
+      bool used = instance == _label || instance == _overview;
+      for (auto level = _levels.begin(); level != _levels.end() && !used; ++level) {
+          used = std::find(level->begin(), level->end(), instance) != level->end();
+      }
+      if (used) {
+          usedInstances.push_back(instance);
+      }
+      else {
+          delete instance;
+      }
+  }
+  _instances = usedInstances;
+
   _isValid = true;
+  _cache.reset(new FrameCache(_cacheSize));
   return _isValid;
 }
 std::string DICOMImage::getProperty(const std::string& propertyName) {
@@ -107,63 +200,167 @@ std::string DICOMImage::getProperty(const std::string& propertyName) {
   return propertyValue;
 }
 
+void DICOMImage::copyFrameToRegion(const unsigned char* frame, const long long& frameX, const long long& frameY, const unsigned short& frameW, const unsigned short& frameH,
+    const long long& regionX, const long long& regionY, const unsigned long long& width, const unsigned long long& height, unsigned char* region) const {
+  long long startX = std::max(frameX, regionX);
+  long long endX = std::min(frameX + static_cast<long long>(frameW), regionX + static_cast<long long>(width));
+  long long startY = std::max(frameY, regionY);
+  long long endY = std::min(frameY + static_cast<long long>(frameH), regionY + static_cast<long long>(height));
+  if (startX >= endX || startY >= endY) {
+    return;
+  }
+  long long rowLength = (endX - startX) * _samplesPerPixel;
+  for (long long y = startY; y < endY; ++y) {
+    const unsigned char* source = frame + ((y - frameY) * frameW + (startX - frameX)) * _samplesPerPixel;
+    std::copy(source, source + rowLength, region + ((y - regionY) * width + (startX - regionX)) * _samplesPerPixel);
+  }
+}
+
 void* DICOMImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level) {
-  std::unique_lock<std::mutex> l(*_cacheMutex);
-  std::vector<WSIDicomInstance*> currentLevel = _levels[level];
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  const std::vector<WSIDicomInstance*>& currentLevel = _levels[level];
+  const std::vector<FrameLocation>& frameTable = _frameTables[level];
+  unsigned long long tilesPerRow = _tilesPerRow[level];
   long long levelW = _levelDimensions[level][0];
   long long levelH = _levelDimensions[level][1];
-  unsigned short tileW = currentLevel[0]->getTileSize()[0];
-  unsigned short tileH = currentLevel[0]->getTileSize()[1];
+  std::vector<unsigned short> tileSize = currentLevel[0]->getTileSize();
+  unsigned short tileW = tileSize[0];
+  unsigned short tileH = tileSize[1];
   double downsample = this->getLevelDownsample(level);
 
   unsigned char* temp = new unsigned char[width * height * _samplesPerPixel];
   std::fill(temp, temp + width * height * _samplesPerPixel, static_cast<unsigned char>(0));
 
-  if (currentLevel.size() == 1) {
-      long long levelStartX = std::floor(startX / downsample + 0.5);
-      long long levelStartY = std::floor(startY / downsample + 0.5);
-      long long startTileY = levelStartY - (levelStartY - ((levelStartY / tileH) * tileH));
-      long long startTileX = levelStartX - (levelStartX - ((levelStartX / tileW) * tileW));
-      long long finalX = levelStartX + width >= levelW ? levelW : levelStartX + width;
-      long long finalY = levelStartY + height >= levelH ? levelH : levelStartY + height;
-
-      for (long long iy = startTileY; iy < finalY; iy += tileH) {
-          if (iy < 0) {
-              continue;
-          }
-          for (long long ix = startTileX; ix < finalX; ix += tileW) {
-              if (ix < 0) {
-                  continue;
-              }
-              unsigned char* tile = (unsigned char*)(currentLevel[0]->getFrame(ix, iy, 0, 0));
-
-              long long ixx = (ix - levelStartX);
-              long long iyy = (iy - levelStartY);
-              long long lyh = levelStartY + height;
-              long long lxw = levelStartX + width;
-              long long ixw = ixx + tileW;
-              long long rowLength = ixw > static_cast<long long>(width) ? (tileW - (ixw - width)) * _samplesPerPixel : tileW * _samplesPerPixel;
-              long long tileDeltaX = 0;
-              if (ixx < 0) {
-                  rowLength += ixx * _samplesPerPixel;
-                  tileDeltaX -= ixx * _samplesPerPixel;
-                  ixx = 0;
-              }
-              for (unsigned int ty = 0; ty < tileH; ++ty) {
-                  if ((iyy + ty >= 0) && (ixx >= 0) && (iyy + ty < static_cast<long long>(height)) && lxw > 0) {
-                      long long idx = (ty + iyy) * width * _samplesPerPixel + ixx * _samplesPerPixel;
-                      long long tids = (ty * tileW) * _samplesPerPixel;
-                      std::copy(tile + tids + tileDeltaX, tile + tids + rowLength + tileDeltaX, temp + idx);
-                  }
-              }
-              delete[] tile;
-          }
+  long long levelStartX = std::floor(startX / downsample + 0.5);
+  long long levelStartY = std::floor(startY / downsample + 0.5);
+  long long startTileY = levelStartY - (levelStartY - ((levelStartY / tileH) * tileH));
+  long long startTileX = levelStartX - (levelStartX - ((levelStartX / tileW) * tileW));
+  long long finalX = levelStartX + width >= levelW ? levelW : levelStartX + width;
+  long long finalY = levelStartY + height >= levelH ? levelH : levelStartY + height;
+
+  // Copy the cached frames and collect the ones that have to be decoded per instance. Cached
+  // frames are copied while holding the lock, so they cannot be evicted by another thread meanwhile.
+  struct FrameRequest {
+    long long x;
+    long long y;
+    unsigned int frame;
+  };
+  std::vector<std::vector<FrameRequest> > framesToDecode(currentLevel.size());
+  {
+    std::unique_lock<std::mutex> cl(*_cacheMutex);
+    std::shared_ptr<FrameCache> cache = std::static_pointer_cast<FrameCache>(_cache);
+    for (long long iy = startTileY; iy < finalY; iy += tileH) {
+      if (iy < 0) {
+        continue;
+      }
+      for (long long ix = startTileX; ix < finalX; ix += tileW) {
+        if (ix < 0) {
+          continue;
+        }
+        const FrameLocation& location = frameTable[(iy / tileH) * tilesPerRow + ix / tileW];
+        if (location.instance < 0) {
+          continue;
+        }
+        unsigned char* frame = NULL;
+        unsigned int cachedFrameSize = 0;
+        cache->get(frameKey(level, location.instance, location.frame), frame, cachedFrameSize);
+        if (frame) {
+          copyFrameToRegion(frame, ix, iy, tileW, tileH, levelStartX, levelStartY, width, height, temp);
+        }
+        else {
+          framesToDecode[location.instance].push_back({ ix, iy, location.frame });
+        }
       }
+    }
+  }
 
+  // Decoding happens outside of the cache lock; frames cover disjoint parts of the region. Frames
+  // from different instances are read from different files, so instances are decoded in parallel
+  // on the shared decode pool.
+  std::vector<unsigned int> instancesToDecode;
+  for (unsigned int i = 0; i < framesToDecode.size(); ++i) {
+    if (!framesToDecode[i].empty()) {
+      instancesToDecode.push_back(i);
+    }
   }
+  DecodePool::instance().run(instancesToDecode.size(), [&](size_t i) {
+    unsigned int instanceIndex = instancesToDecode[i];
+    WSIDicomInstance* instance = currentLevel[instanceIndex];
+    unsigned int frameSize = instance->getFrameSize();
+    for (const FrameRequest& request : framesToDecode[instanceIndex]) {
+      unsigned char* frame = new unsigned char[frameSize];
+      if (!instance->readFrame(request.frame, frame)) {
+        delete[] frame;
+        continue;
+      }
+      copyFrameToRegion(frame, request.x, request.y, tileW, tileH, levelStartX, levelStartY, width, height, temp);
+      std::unique_lock<std::mutex> cl(*_cacheMutex);
+      if (std::static_pointer_cast<FrameCache>(_cache)->set(frameKey(level, instanceIndex, request.frame), frame, frameSize)) {
+        delete[] frame;
+      }
+    }
+  });
   return temp;
 }
 
+bool DICOMImage::getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_isValid || level >= _levels.size()) {
+    return false;
+  }
+  WSIDicomInstance* instance = _levels[level][0];
+  std::vector<unsigned short> tileSize = instance->getTileSize();
+  info.tileWidth = tileSize[0];
+  info.tileHeight = tileSize[1];
+  info.compression = instance->isJPEG2000() ? Compression::JPEG2000 : Compression::JPEG;
+  info.ycbcr = !instance->isJPEG2000() && instance->getPhotometricInterpretation().compare(0, 3, "YBR") == 0;
+  info.ycbcrSubsamplingX = 1;
+  info.ycbcrSubsamplingY = 1;
+  info.jpegTables.clear();
+  if (info.ycbcr) {
+    // The subsampling is not part of the DICOM header, take it from the first available frame
+    const std::vector<FrameLocation>& frameTable = _frameTables[level];
+    for (const FrameLocation& location : frameTable) {
+      if (location.instance >= 0) {
+        std::vector<unsigned char> frame;
+        if (!_levels[level][location.instance]->readCompressedFrame(location.frame, frame) ||
+          !getJPEGSubsampling(frame, info.ycbcrSubsamplingX, info.ycbcrSubsamplingY)) {
+          return false;
+        }
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+bool DICOMImage::readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  data.clear();
+  if (!_isValid || level >= _levels.size() || tileX >= _tilesPerRow[level]) {
+    return false;
+  }
+  unsigned long long tileIndex = tileY * _tilesPerRow[level] + tileX;
+  if (tileIndex >= _frameTables[level].size()) {
+    return false;
+  }
+  const FrameLocation& location = _frameTables[level][tileIndex];
+  if (location.instance < 0) {
+    return false;
+  }
+  return _levels[level][location.instance]->readCompressedFrame(location.frame, data);
+}
+
 void DICOMImage::cleanup() {
+  _cache.reset();
+  _levels.clear();
+  _frameTables.clear();
+  _tilesPerRow.clear();
+  _label = nullptr;
+  _overview = nullptr;
+  for (auto instance : _instances) {
+    delete instance;
+  }
+  _instances.clear();
 }
\ No newline at end of file
@@ -20,8 +20,14 @@ public:
 
   std::string getProperty(const std::string& propertyName);
   
+  //! Decoded frames are cached per (level, instance, frame) instead of per region position
+  const unsigned long long getCacheSize();
   void setCacheSize(const unsigned long long cacheSize);
 
+  //! Frames are stored as JPEG or JPEG2000 codestreams, which can be copied as-is into TIFF tiles
+  bool getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info);
+  bool readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data);
+
 protected :
   void cleanup();
   
@@ -29,7 +35,28 @@ protected :
     const unsigned long long& height, const unsigned int& level);
 
 private:
+    typedef TileCache<unsigned char, unsigned long long> FrameCache;
+    static unsigned long long frameKey(const unsigned int& level, const unsigned int& instance, const long long& frame) {
+      return (static_cast<unsigned long long>(level) << 56) | (static_cast<unsigned long long>(instance & 0xFFFF) << 40) | (static_cast<unsigned long long>(frame) & 0xFFFFFFFFFFULL);
+    }
+
+    // Location of a frame within a level, which can be split over several (concatenated) instances
+    struct FrameLocation {
+      int instance;
+      unsigned int frame;
+    };
+
+    // Copies the part of a decoded frame that overlaps the requested region
+    void copyFrameToRegion(const unsigned char* frame, const long long& frameX, const long long& frameY, const unsigned short& frameW, const unsigned short& frameH,
+      const long long& regionX, const long long& regionY, const unsigned long long& width, const unsigned long long& height, unsigned char* region) const;
+
+    // Owns all loaded instances, _levels, _label and _overview refer into it
+    std::vector<WSIDicomInstance*> _instances;
     std::vector<std::vector<WSIDicomInstance*> > _levels;
+
+    // Per level the instance and frame for each tile position (row-major), instance is -1 for missing tiles
+    std::vector<std::vector<FrameLocation> > _frameTables;
+    std::vector<unsigned long long> _tilesPerRow;
     WSIDicomInstance* _label;
     WSIDicomInstance* _overview;
 
@@ -0,0 +1,74 @@
+#include "DecodePool.h"
+#include <algorithm>
+
+DecodePool& DecodePool::instance() {
+  // Never destroyed: joining threads while the library is unloaded can deadlock (e.g. under the
+  // loader lock on Windows), and idle threads do not keep the process alive
+  static DecodePool* pool = new DecodePool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+  return *pool;
+}
+
+DecodePool::DecodePool(const unsigned int& numberOfThreads) {
+  for (unsigned int i = 0; i < numberOfThreads; ++i) {
+    _threads.push_back(std::thread(&DecodePool::work, this));
+  }
+}
+
+unsigned int DecodePool::getNumberOfThreads() const {
+  return static_cast<unsigned int>(_threads.size());
+}
+
+void DecodePool::run(const size_t& count, const std::function<void(size_t)>& task) {
+  if (count < 2 || _threads.empty()) {
+    for (size_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->task = &task;
+  job->count = count;
+  job->next = 0;
+  job->finished = 0;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _jobs.push_back(job);
+  }
+  // The calling thread takes one of the tasks itself
+  size_t nrToWake = std::min<size_t>(count - 1, _threads.size());
+  for (size_t i = 0; i < nrToWake; ++i) {
+    _jobAvailable.notify_one();
+  }
+  runTasks(*job);
+  std::unique_lock<std::mutex> lock(_mutex);
+  std::deque<std::shared_ptr<Job> >::iterator it = std::find(_jobs.begin(), _jobs.end(), job);
+  if (it != _jobs.end()) {
+    _jobs.erase(it);
+  }
+  _jobFinished.wait(lock, [&job]() { return job->finished == job->count; });
+}
+
+void DecodePool::runTasks(Job& job) {
+  for (size_t i = job.next++; i < job.count; i = job.next++) {
+    (*job.task)(i);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (++job.finished == job.count) {
+      _jobFinished.notify_all();
+    }
+  }
+}
+
+void DecodePool::work() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _jobAvailable.wait(lock, [this]() { return !_jobs.empty(); });
+    std::shared_ptr<Job> job = _jobs.front();
+    if (job->next >= job->count) {
+      _jobs.pop_front();
+      continue;
+    }
+    lock.unlock();
+    runTasks(*job);
+    lock.lock();
+  }
+}
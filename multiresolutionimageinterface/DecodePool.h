@@ -0,0 +1,54 @@
+#ifndef _DecodePool
+#define _DecodePool
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multiresolutionimageinterface_export.h"
+
+//! Threads shared by all images to decode the tiles of a region in parallel. The pool has one
+//! thread less than the machine has cores and the thread which reads the region decodes as well,
+//! so reads from several threads at the same time (e.g. the viewer's IO threads) share the same
+//! cores instead of each starting threads of their own.
+class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT DecodePool {
+
+public:
+  //! The pool shared by all images
+  static DecodePool& instance();
+
+  //! Calls task(i) for every i in [0, count) on the pool and the calling thread and returns when
+  //! all calls have finished. Tasks must not throw. Nested calls from within a task are allowed,
+  //! the calling thread always works on its own tasks.
+  void run(const size_t& count, const std::function<void(size_t)>& task);
+
+  unsigned int getNumberOfThreads() const;
+
+private:
+  struct Job {
+    const std::function<void(size_t)>* task;
+    size_t count;
+    std::atomic<size_t> next;
+    size_t finished;
+  };
+
+  DecodePool(const unsigned int& numberOfThreads);
+  DecodePool(const DecodePool&) = delete;
+  DecodePool& operator=(const DecodePool&) = delete;
+
+  void work();
+  //! Runs tasks of the job until none are left to claim
+  void runTasks(Job& job);
+
+  std::vector<std::thread> _threads;
+  std::deque<std::shared_ptr<Job> > _jobs;
+  std::mutex _mutex;
+  std::condition_variable _jobAvailable;
+  std::condition_variable _jobFinished;
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include "core/PathologyEnums.h"
 #include <string>
 #include <cstring>
+#include <algorithm>
+#include <thread>
 #include <vector>
 #include <sstream>
 
@@ -148,132 +150,116 @@ opj_stream_t* opj_stream_create_default_memory_stream(opj_memory_stream* p_memor
 }
 
 
-JPEG2000Codec::JPEG2000Codec()
+namespace {
+
+  unsigned int resolveNumberOfThreads(const unsigned int& nrThreads) {
+    if (nrThreads == 0) {
+      return std::max(1u, std::thread::hardware_concurrency());
+    }
+    return nrThreads;
+  }
+
+  void setCodecThreads(opj_codec_t* codec, const unsigned int& nrThreads) {
+#if OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 3)
+    if (nrThreads > 1) {
+      opj_codec_set_threads(codec, nrThreads);
+    }
+#endif
+  }
+
+  // Buffers which are reused by all encode/decode calls of a thread
+  thread_local std::vector<OPJ_INT32*> componentPointers;
+  thread_local std::vector<OPJ_UINT8> encodeBuffer;
+
+}
+
+JPEG2000Codec::JPEG2000Codec() : _nrThreadsPerTile(1)
 {
 }
 
 JPEG2000Codec::~JPEG2000Codec() {
 }
 
-void JPEG2000Codec::decode(unsigned char* buf, const unsigned int& inSize, const unsigned int& outSize)
+void JPEG2000Codec::setNumberOfThreadsPerTile(const unsigned int& nrThreads) {
+  _nrThreadsPerTile = nrThreads;
+}
+
+unsigned int JPEG2000Codec::getNumberOfThreadsPerTile() const {
+  return _nrThreadsPerTile;
+}
+
+bool JPEG2000Codec::decode(unsigned char* buf, const unsigned int& inSize, const unsigned int& outSize) const
 {
-  opj_memory_stream decodeStream;
-  // OpenJPEG stuff.
-  opj_image_t		*decompImage = NULL;
-  opj_stream_t		*l_stream = NULL;
+  // The compressed data is fully consumed before the output is written
+  return decode(buf, inSize, buf, outSize);
+}
 
+bool JPEG2000Codec::decode(const unsigned char* inBuf, const unsigned int& inSize, unsigned char* outBuf, const unsigned int& outSize, const unsigned int& reduction) const
+{
   //Set up the input buffer as a stream
-  decodeStream.data = (OPJ_UINT8 *)buf;
+  opj_memory_stream decodeStream;
+  decodeStream.data = const_cast<OPJ_UINT8*>(inBuf);
   decodeStream.size = inSize;
   decodeStream.offset = 0;
-    //Open the memory as a stream.
-  l_stream = opj_stream_create_default_memory_stream(&decodeStream, OPJ_TRUE);
+  opj_stream_t* l_stream = opj_stream_create_default_memory_stream(&decodeStream, OPJ_TRUE);
 
   opj_dparameters_t decodeParameters;
   opj_set_default_decoder_parameters(&decodeParameters);
-  opj_codec_t* decoder = opj_create_decompress(OPJ_CODEC_FORMAT::OPJ_CODEC_J2K);//Bad openjpeg, can't be reused!
+  opj_codec_t* decoder = opj_create_decompress(OPJ_CODEC_FORMAT::OPJ_CODEC_J2K);
   //Catch events using our callbacks and give a local context.
   opj_set_info_handler(decoder, info_callback, NULL);
   opj_set_warning_handler(decoder, warning_callback, NULL);
   opj_set_error_handler(decoder, error_callback, NULL);
-
-  //Setup the decoder decoding parameters using user parameters.
   opj_setup_decoder(decoder, &decodeParameters);
-#if OPJ_VERSION_MAJOR >= 2 && OPJ_VERSION_MINOR >= 3
-  opj_codec_set_threads(decoder, 4);
-#endif
+  setCodecThreads(decoder, resolveNumberOfThreads(_nrThreadsPerTile));
+
+  // Read the main header of the codestream and only decode the resolutions which are needed
+  opj_image_t* decompImage = NULL;
+  bool success = opj_read_header(l_stream, decoder, &decompImage) &&
+    (reduction == 0 || opj_set_decoded_resolution_factor(decoder, reduction)) &&
+    opj_decode(decoder, l_stream, decompImage) &&
+    opj_end_decompress(decoder, l_stream);
 
-  // Read the main header of the codestream, if necessary the JP2 boxes, and create decompImage.
-  OPJ_BOOL headerSucces = opj_read_header(l_stream, decoder, &decompImage);
-  OPJ_BOOL setAreaSucces = opj_set_decode_area(decoder, decompImage, decodeParameters.DA_x0,
-      decodeParameters.DA_y0, decodeParameters.DA_x1, decodeParameters.DA_y1);
-  OPJ_BOOL decodeSucces = opj_decode(decoder, l_stream, decompImage);
-  OPJ_BOOL decompressSuccess = opj_end_decompress(decoder, l_stream);
-  
   //Done with the input stream and the decoder.
   opj_stream_destroy(l_stream);
   opj_destroy_codec(decoder);
+  if (!success || !decompImage || decompImage->numcomps == 0) {
+    if (decompImage) {
+      opj_image_destroy(decompImage);
+    }
+    return false;
+  }
 
-  //Get the total uncompressed length.
-  int prec_jpc = decompImage->comps[0].prec; //Need it at the end
-  int bytes_jpc= (prec_jpc + 7) / 8;// Bytes or words.
-  int stream_len = (decompImage->comps[0].w * decompImage->comps[0].h);
-
-  OPJ_INT32 ** compPointers = new OPJ_INT32*[decompImage->numcomps];
-  for (unsigned int cmp = 0; cmp < decompImage->numcomps; cmp++) {
-    compPointers[cmp] = decompImage->comps[cmp].data;
+  // Interleave the components, never write beyond the output buffer
+  const unsigned int nrComponents = decompImage->numcomps;
+  const unsigned int bytesPerComponent = (decompImage->comps[0].prec + 7) / 8;
+  unsigned long long nrPixels = static_cast<unsigned long long>(decompImage->comps[0].w) * decompImage->comps[0].h;
+  nrPixels = std::min<unsigned long long>(nrPixels, outSize / (nrComponents * bytesPerComponent));
+  componentPointers.resize(nrComponents);
+  for (unsigned int cmp = 0; cmp < nrComponents; cmp++) {
+    componentPointers[cmp] = decompImage->comps[cmp].data;
   }
-  std::fill(buf, buf + outSize, 0);
-  for (int index = 0; index < stream_len; index++) {
-    for (unsigned int cmp = 0; cmp < decompImage->numcomps; cmp++) {
-      for (int byteCnt = 0; byteCnt < bytes_jpc; byteCnt++)
-      {
-        *(buf)++ |= (unsigned char)((*compPointers[cmp] >> (8 * byteCnt)) & 0xFF);
+  unsigned char* out = outBuf;
+  if (bytesPerComponent == 1) {
+    for (unsigned long long index = 0; index < nrPixels; index++) {
+      for (unsigned int cmp = 0; cmp < nrComponents; cmp++) {
+        *out++ = static_cast<unsigned char>(componentPointers[cmp][index]);
       }
-      *compPointers[cmp]++;
     }
   }
-  opj_image_destroy(decompImage);
-  delete[] compPointers;
-}
-
-void JPEG2000Codec::decode(unsigned char* inBuf, const unsigned int& inSize, unsigned char* outBuf, const unsigned int& outSize)
-{
-    opj_memory_stream decodeStream;
-    // OpenJPEG stuff.
-    opj_image_t* decompImage = NULL;
-    opj_stream_t* l_stream = NULL;
-
-    //Set up the input buffer as a stream
-    decodeStream.data = (OPJ_UINT8*)inBuf;
-    decodeStream.size = inSize;
-    decodeStream.offset = 0;
-    //Open the memory as a stream.
-    l_stream = opj_stream_create_default_memory_stream(&decodeStream, OPJ_TRUE);
-
-    opj_dparameters_t decodeParameters;
-    opj_set_default_decoder_parameters(&decodeParameters);
-    opj_codec_t* decoder = opj_create_decompress(OPJ_CODEC_FORMAT::OPJ_CODEC_J2K);//Bad openjpeg, can't be reused!
-    //Catch events using our callbacks and give a local context.
-    opj_set_info_handler(decoder, info_callback, NULL);
-    opj_set_warning_handler(decoder, warning_callback, NULL);
-    opj_set_error_handler(decoder, error_callback, NULL);
-
-    //Setup the decoder decoding parameters using user parameters.
-    opj_setup_decoder(decoder, &decodeParameters);
-#if OPJ_VERSION_MAJOR >= 2 && OPJ_VERSION_MINOR >= 3
-    opj_codec_set_threads(decoder, 4);
-#endif
-
-    // Read the main header of the codestream, if necessary the JP2 boxes, and create decompImage.
-    OPJ_BOOL headerSucces = opj_read_header(l_stream, decoder, &decompImage);
-    OPJ_BOOL decodeSucces = opj_decode(decoder, l_stream, decompImage);
-    OPJ_BOOL decompressSuccess = opj_end_decompress(decoder, l_stream);
-
-    //Done with the input stream and the decoder.
-    opj_stream_destroy(l_stream);
-    opj_destroy_codec(decoder);
-
-    //Get the total uncompressed length.
-    int prec_jpc = decompImage->comps[0].prec; //Need it at the end
-    int bytes_jpc = (prec_jpc + 7) / 8;// Bytes or words.
-    int stream_len = (decompImage->comps[0].w * decompImage->comps[0].h);
-
-    OPJ_INT32** compPointers = new OPJ_INT32 * [decompImage->numcomps];
-    for (unsigned int cmp = 0; cmp < decompImage->numcomps; cmp++) {
-        compPointers[cmp] = decompImage->comps[cmp].data;
-    }
-    for (int index = 0; index < stream_len; index++) {
-        for (unsigned int cmp = 0; cmp < decompImage->numcomps; cmp++) {
-            for (int byteCnt = 0; byteCnt < bytes_jpc; byteCnt++)
-            {
-                *(outBuf)++ |= (unsigned char)((*compPointers[cmp] >> (8 * byteCnt)) & 0xFF);
-            }
-            *compPointers[cmp]++;
+  else {
+    for (unsigned long long index = 0; index < nrPixels; index++) {
+      for (unsigned int cmp = 0; cmp < nrComponents; cmp++) {
+        OPJ_INT32 value = componentPointers[cmp][index];
+        for (unsigned int byteCnt = 0; byteCnt < bytesPerComponent; byteCnt++) {
+          *out++ = static_cast<unsigned char>((value >> (8 * byteCnt)) & 0xFF);
         }
+      }
     }
-    opj_image_destroy(decompImage);
-    delete[] compPointers;
+  }
+  std::fill(out, outBuf + outSize, 0);
+  opj_image_destroy(decompImage);
+  return true;
 }
 
 void JPEG2000Codec::encode(char* data, unsigned int& size, const unsigned int& tileSize, const unsigned int& rate, const unsigned int& nrComponents, const pathology::DataType& dataType, const pathology::ColorType& colorSpace) const
@@ -326,6 +312,7 @@ void JPEG2000Codec::encode(char* data, unsigned int& size, const unsigned int& t
 
   // Get a J2K compressor handle.
   opj_codec_t* encoder = opj_create_compress(OPJ_CODEC_J2K);
+  setCodecThreads(encoder, resolveNumberOfThreads(_nrThreadsPerTile));
 
   //Catch events using our callbacks and give a local context.
   opj_set_info_handler(encoder, info_callback, NULL);
@@ -334,7 +321,10 @@ void JPEG2000Codec::encode(char* data, unsigned int& size, const unsigned int& t
 
   //Set the "OpenJpeg like" stream data.
   opj_memory_stream encodingBuffer;
-  encodingBuffer.data = (OPJ_UINT8 *) new char[size];
+  if (encodeBuffer.size() < size) {
+    encodeBuffer.resize(size);
+  }
+  encodingBuffer.data = encodeBuffer.data();
   encodingBuffer.size = size;
   encodingBuffer.offset = 0;
 
@@ -351,7 +341,8 @@ void JPEG2000Codec::encode(char* data, unsigned int& size, const unsigned int& t
   OPJ_BOOL setupSuccess = opj_setup_encoder(encoder, &encodeParameters, encodedImage);
  
   //(Re)set the buffer pointerss.
-  OPJ_INT32 **componentBuffer_ptr = new OPJ_INT32*[encodedImage->numcomps];
+  componentPointers.resize(encodedImage->numcomps);
+  OPJ_INT32 **componentBuffer_ptr = componentPointers.data();
   for (unsigned int cnt = 0; cnt < encodedImage->numcomps; cnt++) {
     componentBuffer_ptr[cnt] = (OPJ_INT32*)(encodedImage->comps[cnt].data);
   }
@@ -391,6 +382,5 @@ void JPEG2000Codec::encode(char* data, unsigned int& size, const unsigned int& t
   for (int cnt = 0; cnt <= encodingBuffer.offset; cnt++) {
     *movingDataPointer++ = *enc_bytes_ptr++;
   }
-  delete[] encodingBuffer.data;
   delete[] componentParameters;
 }
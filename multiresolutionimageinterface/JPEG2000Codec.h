@@ -7,16 +7,33 @@ namespace pathology {
   enum class ColorType;
 }
 
+//! Encodes and decodes single JPEG2000 code streams (tiles). OpenJPEG codec objects can only
+//! handle a single code stream, so these are created per tile; the intermediate buffers are kept
+//! per thread and reused. The codec itself holds no state besides its settings, so one instance
+//! can be shared by all threads decoding tiles of an image.
 class JPEG2KCODEC_EXPORT JPEG2000Codec
 {  
 public:
   JPEG2000Codec();
   ~JPEG2000Codec();
 
+  //! Threading policy: the number of threads OpenJPEG uses within a single tile. The default of 1
+  //! suits callers which decode tiles in parallel (across-tile); increase it when tiles are
+  //! decoded or encoded one at a time (intra-tile). 0 uses all available cores.
+  void setNumberOfThreadsPerTile(const unsigned int& nrThreads);
+  unsigned int getNumberOfThreadsPerTile() const;
+
   void encode(char* data, unsigned int& size, const unsigned int& tileSize, const unsigned int& rate, const unsigned int& nrComponents, const pathology::DataType& dataType, const pathology::ColorType& colorSpace) const;
-  void decode(unsigned char* buf, const unsigned int& inSize, const unsigned int& outSize);
-  void decode(unsigned char* inBuf, const unsigned int& inSize, unsigned char* outBuf, const unsigned int& outSize);
+  
+  //! Decodes in place, buf holds inSize bytes of compressed data and has room for outSize bytes
+  bool decode(unsigned char* buf, const unsigned int& inSize, const unsigned int& outSize) const;
+
+  //! Decodes inBuf to outBuf. With a reduction r > 0 only the resolution levels needed for an
+  //! image downsampled by 2^r are decoded, resulting in a tile of ceil(size / 2^r) pixels.
+  bool decode(const unsigned char* inBuf, const unsigned int& inSize, unsigned char* outBuf, const unsigned int& outSize, const unsigned int& reduction = 0) const;
 
+private:
+  unsigned int _nrThreadsPerTile;
 };
 
-#endif
\ No newline at end of file
+#endif
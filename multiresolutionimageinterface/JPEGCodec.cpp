@@ -0,0 +1,161 @@
+#include "JPEGCodec.h"
+#include <cstdio>
+#include <csetjmp>
+
+extern "C" {
+#include "jpeglib.h"
+}
+
+namespace {
+
+  // libjpeg calls exit() on errors by default, errors jump back to decode instead
+  struct ErrorManager {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+  };
+
+  void errorExit(j_common_ptr cinfo) {
+    std::longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+  }
+
+  void outputMessage(j_common_ptr cinfo) {
+    // Warnings about recoverable corrupt data are not printed
+  }
+
+  // Source manager reading a stream from memory, jpeg_mem_src is missing in libjpeg before version 8
+  void initSource(j_decompress_ptr cinfo) {
+  }
+
+  boolean fillInputBuffer(j_decompress_ptr cinfo) {
+    // Only called when the data is truncated; end the stream so the decoder finishes the image
+    static const JOCTET endOfImage[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = endOfImage;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+  }
+
+  void skipInputData(j_decompress_ptr cinfo, long nrBytes) {
+    if (nrBytes <= 0) {
+      return;
+    }
+    if (static_cast<size_t>(nrBytes) > cinfo->src->bytes_in_buffer) {
+      fillInputBuffer(cinfo);
+    }
+    else {
+      cinfo->src->next_input_byte += nrBytes;
+      cinfo->src->bytes_in_buffer -= nrBytes;
+    }
+  }
+
+  void termSource(j_decompress_ptr cinfo) {
+  }
+
+  void setMemorySource(j_decompress_ptr cinfo, jpeg_source_mgr& source, const unsigned char* data, const unsigned long long& size) {
+    source.init_source = initSource;
+    source.fill_input_buffer = fillInputBuffer;
+    source.skip_input_data = skipInputData;
+    source.resync_to_restart = jpeg_resync_to_restart;
+    source.term_source = termSource;
+    source.next_input_byte = data;
+    source.bytes_in_buffer = size;
+    cinfo->src = &source;
+  }
+
+  // Abbreviated streams refer to the quantization and Huffman tables of a separate tables-only
+  // stream, which are kept by the decompressor when read first
+  bool readHeaders(j_decompress_ptr cinfo, jpeg_source_mgr& source, const unsigned char* data, const unsigned long long& size,
+    const std::vector<unsigned char>& jpegTables) {
+    if (!jpegTables.empty()) {
+      setMemorySource(cinfo, source, jpegTables.data(), jpegTables.size());
+      jpeg_read_header(cinfo, FALSE);
+    }
+    setMemorySource(cinfo, source, data, size);
+    return jpeg_read_header(cinfo, TRUE) == JPEG_HEADER_OK;
+  }
+
+}
+
+bool JPEGCodec::decode(const unsigned char* inBuf, const unsigned long long& inSize, std::vector<unsigned char>& outBuf,
+  unsigned int& width, unsigned int& height, unsigned int& nrComponents, const unsigned int& reduction,
+  const bool& ycbcr, const std::vector<unsigned char>& jpegTables) const {
+  width = 0;
+  height = 0;
+  nrComponents = 0;
+  if (!inBuf || inSize == 0 || reduction > MAX_REDUCTION) {
+    return false;
+  }
+
+  // No objects with destructors may be created between setjmp and the end of the decode, the
+  // jump on an error would skip them
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  jpeg_source_mgr source;
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = errorExit;
+  error.manager.output_message = outputMessage;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  if (!readHeaders(&cinfo, source, inBuf, inSize, jpegTables)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  if (cinfo.num_components == 3) {
+    cinfo.jpeg_color_space = ycbcr ? JCS_YCbCr : JCS_RGB;
+    cinfo.out_color_space = JCS_RGB;
+  }
+  else if (cinfo.num_components == 1) {
+    cinfo.out_color_space = JCS_GRAYSCALE;
+  }
+  else {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1 << reduction;
+  jpeg_start_decompress(&cinfo);
+
+  unsigned long long rowSize = static_cast<unsigned long long>(cinfo.output_width) * cinfo.output_components;
+  outBuf.resize(rowSize * cinfo.output_height);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = outBuf.data() + cinfo.output_scanline * rowSize;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  width = cinfo.output_width;
+  height = cinfo.output_height;
+  nrComponents = cinfo.output_components;
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+bool JPEGCodec::readHeader(const unsigned char* inBuf, const unsigned long long& inSize, unsigned int& width, unsigned int& height,
+  unsigned int& nrComponents, unsigned short& subsamplingX, unsigned short& subsamplingY,
+  const std::vector<unsigned char>& jpegTables) const {
+  if (!inBuf || inSize == 0) {
+    return false;
+  }
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  jpeg_source_mgr source;
+  cinfo.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = errorExit;
+  error.manager.output_message = outputMessage;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  bool valid = readHeaders(&cinfo, source, inBuf, inSize, jpegTables);
+  if (valid) {
+    width = cinfo.image_width;
+    height = cinfo.image_height;
+    nrComponents = cinfo.num_components;
+    subsamplingX = cinfo.comp_info[0].h_samp_factor;
+    subsamplingY = cinfo.comp_info[0].v_samp_factor;
+  }
+  jpeg_destroy_decompress(&cinfo);
+  return valid;
+}
@@ -0,0 +1,32 @@
+#ifndef _JPEGCodec
+#define _JPEGCodec
+#include <vector>
+#include "multiresolutionimageinterface_export.h"
+
+//! Decodes single JPEG streams (tiles) with libjpeg. Like the JPEG2000Codec it holds no state, so
+//! one instance can be shared by all threads decoding tiles of an image.
+class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT JPEGCodec
+{
+public:
+  //! Largest supported reduction, libjpeg scales the inverse DCT by at most 1/8
+  static const unsigned int MAX_REDUCTION = 3;
+
+  //! Decodes inBuf to interleaved 8-bit samples in outBuf, which is resized to width * height *
+  //! nrComponents. With a reduction r > 0 the scaled inverse DCT directly produces the image
+  //! downsampled by 2^r, of ceil(size / 2^r) pixels, which skips most of the IDCT, upsampling
+  //! and color conversion work. Three component streams are converted to RGB; ycbcr indicates
+  //! whether they are stored as YCbCr, as streams in TIFF or VSI files often lack the markers
+  //! telling so. Abbreviated streams (e.g. tiles of a TIFF file) are decoded with the tables in
+  //! jpegTables.
+  bool decode(const unsigned char* inBuf, const unsigned long long& inSize, std::vector<unsigned char>& outBuf,
+    unsigned int& width, unsigned int& height, unsigned int& nrComponents, const unsigned int& reduction = 0,
+    const bool& ycbcr = true, const std::vector<unsigned char>& jpegTables = std::vector<unsigned char>()) const;
+
+  //! Reads the dimensions and the chroma subsampling (the sampling factors of the first
+  //! component) of a stream without decoding it
+  bool readHeader(const unsigned char* inBuf, const unsigned long long& inSize, unsigned int& width, unsigned int& height,
+    unsigned int& nrComponents, unsigned short& subsamplingX, unsigned short& subsamplingY,
+    const std::vector<unsigned char>& jpegTables = std::vector<unsigned char>()) const;
+};
+
+#endif
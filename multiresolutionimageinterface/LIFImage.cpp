@@ -2,7 +2,11 @@
 #include <fstream>
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
 #include "core/filetools.h"
+#include "core/MemoryMappedFile.h"
 #include "core/stringconversion.h"
 #include "core/PathologyEnums.h"
 #include "pugixml.hpp"
@@ -12,15 +16,24 @@ using namespace pathology;
 
 const char LIFImage::LIF_MAGIC_BYTE = 0x70;
 const char LIFImage::LIF_MEMORY_BYTE = 0x2a;
+const unsigned long long LIFImage::MIN_LEVEL_SIZE = 512;
+const unsigned long long LIFImage::TILE_SIZE = 512;
 
-LIFImage::LIFImage() : MultiResolutionImage(), _lastChannel(0), _alternateCenter(false), _selectedSeries(-1), _fileSize(0), _fileName("") {
+LIFImage::LIFImage() : MultiResolutionImage(), _lastChannel(0), _alternateCenter(false), _selectedSeries(-1), _fileSize(0), _fileName(""),
+  _file(), _planeOffset(0), _rowStride(0), _channelStride(0), _bytesPerSample(0) {
 }
 
 LIFImage::~LIFImage() {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
   cleanup();
 }
 
 void LIFImage::cleanup() {
+  _file.reset();
+  _planeOffset = 0;
+  _rowStride = 0;
+  _channelStride = 0;
+  _bytesPerSample = 0;
   _fileSize = 0;
   _fileName = "";
   _realChannel.clear();
@@ -73,11 +86,13 @@ void LIFImage::cleanup() {
   _dimensionOrder.clear();
   _seriesDimensions.clear();
   _imageCount.clear();
+  _offsets.clear();
 
   MultiResolutionImage::cleanup();
 }
 
 bool LIFImage::initializeType(const std::string& imagePath) {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
 	cleanup();
 	if (!core::fileExists(imagePath)) {
 		return false;
@@ -143,12 +158,12 @@ bool LIFImage::initializeType(const std::string& imagePath) {
       }
 
       lif.read(memblock,4);
-      long blockLength = *reinterpret_cast<int*>(memblock);
+      long long blockLength = *reinterpret_cast<int*>(memblock);
       lif.read(&checkTwo, 1);
       if (checkTwo != LIF_MEMORY_BYTE) {
         lif.seekg(-5, std::ios::cur);
         lif.read(memblockLong,8);
-        blockLength = *reinterpret_cast<long*>(memblock);
+        blockLength = *reinterpret_cast<long long*>(memblockLong);
         lif.read(&checkTwo,1);
         if (checkTwo != LIF_MEMORY_BYTE) {
           return false;
@@ -158,8 +173,8 @@ bool LIFImage::initializeType(const std::string& imagePath) {
       int descrLength =  (*reinterpret_cast<int*>(memblock)) * 2;
 
       if (blockLength > 0) {
-        long curPos = lif.tellg();
-        long offset = curPos + descrLength;
+        long long curPos = lif.tellg();
+        long long offset = curPos + descrLength;
         _offsets.push_back(offset);
       }
 
@@ -169,23 +184,49 @@ bool LIFImage::initializeType(const std::string& imagePath) {
     pugi::xml_document doc;
     doc.load(xml.c_str());    
     translateMetaData(doc);
-    // Set the internals
-    _numberOfLevels = 1;
+    lif.close();
+    if (_selectedSeries < 0) {
+      return false;
+    }
+    _colorType = _colorTypes[_selectedSeries];
+    _dataType = _dataTypes[_selectedSeries];
+    _samplesPerPixel = _seriesDimensions[_selectedSeries]["c"];
+    _file.reset(new MemoryMappedFile(imagePath));
+    if (!_file->valid() || !locatePlanes()) {
+      cleanup();
+      return false;
+    }
+
+    // Set the internals, add synthetic levels until the image fits in a single overview
     std::vector<unsigned long long> dims;
     dims.push_back(_seriesDimensions[_selectedSeries]["x"]);
     dims.push_back(_seriesDimensions[_selectedSeries]["y"]);
-    dims.push_back(_seriesDimensions[_selectedSeries]["x"]);
+    _levelDimensions.push_back(dims);
+    while (std::max(dims[0], dims[1]) > MIN_LEVEL_SIZE) {
+      dims[0] = (dims[0] + 1) / 2;
+      dims[1] = (dims[1] + 1) / 2;
+      _levelDimensions.push_back(dims);
+    }
+    _numberOfLevels = _levelDimensions.size();
     _spacing.clear();
     if (!_physicalSizeXs.empty() && !_physicalSizeYs.empty()) {
       _spacing.push_back(_physicalSizeXs[0]);
       _spacing.push_back(_physicalSizeYs[0]);
     }
-    _levelDimensions.push_back(dims);
-    _colorType = _colorTypes[_selectedSeries];
-    _dataType = _dataTypes[_selectedSeries];
-    _samplesPerPixel = _seriesDimensions[_selectedSeries]["c"];
     _isValid = true;
     _fileType = "lif";
+    if (_dataType == DataType::UInt16) {
+      createCache<unsigned short>();
+    }
+    else if (_dataType == DataType::UInt32) {
+      createCache<unsigned int>();
+    }
+    else if (_dataType == DataType::Float) {
+      createCache<float>();
+    }
+    else {
+      createCache<unsigned char>();
+    }
 
     return _isValid;
   }
@@ -299,88 +340,165 @@ int LIFImage::getTileIndex(int index) {
   return -1;
 }
 
-void* LIFImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
-    const unsigned long long& height, const unsigned int& level) {
-
-    int index = getTileIndex(_selectedSeries);
-    if (index < 0) {
-      return NULL;
-    }
-    unsigned int nrChannels = _seriesDimensions[_selectedSeries]["c"];
-    unsigned long long offset = _offsets[index];
-    int bytes = 4;
-    if (_dataTypes[_selectedSeries] == DataType::UInt16) {
-      bytes = 2;
-    } else if (_dataTypes[_selectedSeries] == DataType::UChar) {
-      bytes = 1;
-    }
-    int bpp = bytes;
-
-    long planeSize = _seriesDimensions[_selectedSeries]["x"] * _seriesDimensions[_selectedSeries]["y"] * bpp;
-    unsigned long long nextOffset = index + 1 < _offsets.size() ? _offsets[index + 1] : _fileSize;
-    int bytesToSkip = (int) (nextOffset - offset - planeSize * _imageCount[_selectedSeries]);
-    bytesToSkip /= _seriesDimensions[_selectedSeries]["y"];
-    if ((_seriesDimensions[_selectedSeries]["x"] % 4) == 0) {
-      bytesToSkip = 0;
-    }
+bool LIFImage::locatePlanes() {
+  int index = getTileIndex(_selectedSeries);
+  if (index < 0 || index >= static_cast<int>(_offsets.size())) {
+    return false;
+  }
+  unsigned long long sizeX = _seriesDimensions[_selectedSeries]["x"];
+  unsigned long long sizeY = _seriesDimensions[_selectedSeries]["y"];
+  unsigned long long nrChannels = _seriesDimensions[_selectedSeries]["c"];
+  if (sizeX == 0 || sizeY == 0 || nrChannels == 0) {
+    return false;
+  }
+  _bytesPerSample = 4;
+  if (_dataTypes[_selectedSeries] == DataType::UInt16) {
+    _bytesPerSample = 2;
+  } else if (_dataTypes[_selectedSeries] == DataType::UChar) {
+    _bytesPerSample = 1;
+  }
 
-    if (offset + (planeSize + bytesToSkip * _seriesDimensions[_selectedSeries]["y"]) >= _fileSize) {
-       return NULL;
-    }
+  // Rows are padded when the width is not a multiple of four, the padding is derived from the
+  // size of the memory block
+  unsigned long long offset = _offsets[index];
+  unsigned long long planeSize = sizeX * sizeY * _bytesPerSample;
+  unsigned long long nextOffset = index + 1 < static_cast<int>(_offsets.size()) ? _offsets[index + 1] : _fileSize;
+  unsigned long long bytesToSkip = 0;
+  if ((sizeX % 4) != 0 && nextOffset > offset + planeSize * _imageCount[_selectedSeries]) {
+    bytesToSkip = (nextOffset - offset - planeSize * _imageCount[_selectedSeries]) / sizeY;
+  }
 
-    std::ifstream in;
-    in.open(_fileName.c_str(), std::ios::in | std::ios::binary);
-    in.seekg(offset);
+  int tile = _selectedSeries;
+  for (int i = 0; i < index; i++) {
+    tile -= _tileCount[i];
+  }
+  _planeOffset = offset + tile * planeSize * _imageCount[_selectedSeries] + bytesToSkip * sizeY;
+  _rowStride = sizeX * _bytesPerSample + bytesToSkip;
+  _channelStride = _rowStride * sizeY;
+  return _planeOffset + _channelStride * nrChannels <= _file->size() + bytesToSkip;
+}
 
-    int tile = _selectedSeries;
-    for (int i=0; i<index; i++) {
-      tile -= _tileCount[i];
-    }
+template <typename T> void LIFImage::readRegion(const unsigned int& level, const long long& levelX, const long long& levelY,
+  const unsigned long long& width, const unsigned long long& height, T* data) {
+  const unsigned int nrChannels = _samplesPerPixel;
+  long long levelWidth = _levelDimensions[level][0];
+  long long levelHeight = _levelDimensions[level][1];
+  long long levelEndX = levelX + static_cast<long long>(width);
+  long long levelEndY = levelY + static_cast<long long>(height);
+  long long firstX = std::max(0LL, levelX);
+  long long firstY = std::max(0LL, levelY);
+  long long lastX = std::min(levelWidth, levelEndX);
+  long long lastY = std::min(levelHeight, levelEndY);
+  if (firstX >= lastX || firstY >= lastY) {
+    return;
+  }
 
-    char* buf = new char[width*height*bpp*nrChannels];
-    in.seekg((tile * planeSize * _imageCount[_selectedSeries]), std::ios::cur);
-    in.seekg(bytesToSkip * _seriesDimensions[_selectedSeries]["y"], std::ios::cur);
-
-    if (bytesToSkip == 0) {
-      int seriesWidth = _seriesDimensions[_selectedSeries]["x"];
-      for (int channel=0; channel < nrChannels; channel++) {
-        in.seekg(startY * seriesWidth * bpp, std::ios::cur);
-        for (int row=0; row < height; row++) {
-          in.seekg(startX * bpp, std::ios::cur);
-          in.read(buf + channel * width * height * bpp + row * width * bpp, width * bpp);
-          if (row < height - 1 || channel < nrChannels - 1) {
-            // no need to skip bytes after reading final row of final channel
-            in.seekg(bpp * (seriesWidth - width - startX), std::ios::cur);
-          }
-        }
-        if (channel < nrChannels - 1) {
-          // no need to skip bytes after reading final channel
-          in.seekg(seriesWidth * bpp * (_seriesDimensions[_selectedSeries]["y"] - startY - height), std::ios::cur);
+  if (level == 0) {
+    // Strided copy from the planar channels in the mapping to interleaved rows
+    const unsigned long long copyWidth = lastX - firstX;
+    const unsigned char* plane = _file->data() + _planeOffset;
+    for (unsigned int c = 0; c < nrChannels; ++c) {
+      for (long long y = firstY; y < lastY; ++y) {
+        const unsigned char* src = plane + c * _channelStride + y * _rowStride + firstX * sizeof(T);
+        T* dst = data + ((y - levelY) * width + (firstX - levelX)) * nrChannels + c;
+        for (unsigned long long x = 0; x < copyWidth; ++x, src += sizeof(T), dst += nrChannels) {
+          std::memcpy(dst, src, sizeof(T));
         }
       }
     }
-    else {
-      in.seekg(startY * (_seriesDimensions[_selectedSeries]["x"] * bpp + bytesToSkip));
-      for (int row=0; row < height; row++) {
-        in.seekg(startX * bpp, std::ios::cur);
-        in.read(buf + (row * width * bpp), width * bpp);
-        in.seekg(bpp * (_seriesDimensions[_selectedSeries]["x"] - width - startX) + bytesToSkip, std::ios::cur);
-      }
+    return;
+  }
+
+  // Tiles are stored without padding, edge tiles are smaller
+  const long long tileSize = TILE_SIZE;
+  auto copyTile = [&](const T* tile, long long col, long long row) {
+    long long tileX = col * tileSize;
+    long long tileY = row * tileSize;
+    long long tileWidth = std::min(tileSize, levelWidth - tileX);
+    long long tileHeight = std::min(tileSize, levelHeight - tileY);
+    long long x0 = std::max(tileX, levelX);
+    long long x1 = std::min(tileX + tileWidth, levelEndX);
+    long long y0 = std::max(tileY, levelY);
+    long long y1 = std::min(tileY + tileHeight, levelEndY);
+    for (long long y = y0; y < y1 && x0 < x1; ++y) {
+      const T* src = tile + nrChannels * ((y - tileY) * tileWidth + (x0 - tileX));
+      std::copy(src, src + nrChannels * (x1 - x0), data + nrChannels * ((y - levelY) * width + (x0 - levelX)));
     }
-    in.close();
-
-    // Change planar to interleaved 
-    char* interLeavedbuf = new char[width*height*bpp*nrChannels];
-    for (unsigned int i = 0; i < width*height; ++i) {
-      for (unsigned int c = 0; c < nrChannels; ++c) {
-        unsigned int cStride = width*height*bpp*c;
-        for (unsigned int b = 0; b < bpp; ++b) {
-          interLeavedbuf[i*bpp*nrChannels+c*bpp+b] = buf[i*bpp + cStride + b];
+  };
+
+  for (long long row = firstY / tileSize; row <= (lastY - 1) / tileSize; ++row) {
+    for (long long col = firstX / tileSize; col <= (lastX - 1) / tileSize; ++col) {
+      std::string key = std::to_string(col) + "-" + std::to_string(row) + "-" + std::to_string(level);
+      {
+        // Copy under the lock, so the tile cannot be evicted meanwhile
+        std::unique_lock<std::mutex> cl(*_cacheMutex);
+        T* tile = NULL;
+        unsigned int cachedSize = 0;
+        std::static_pointer_cast<TileCache<T> >(_cache)->get(key, tile, cachedSize);
+        if (tile) {
+          copyTile(tile, col, row);
+          continue;
         }
       }
+      // Built without holding the lock, so other readers are not blocked
+      T* tile = synthesizeTile<T>(level, col, row);
+      copyTile(tile, col, row);
+      unsigned long long tileWidth = std::min(tileSize, levelWidth - col * tileSize);
+      unsigned long long tileHeight = std::min(tileSize, levelHeight - row * tileSize);
+      std::unique_lock<std::mutex> cl(*_cacheMutex);
+      if (std::static_pointer_cast<TileCache<T> >(_cache)->set(key, tile, tileWidth * tileHeight * nrChannels * sizeof(T))) {
+        delete[] tile;
+      }
     }
-    delete[] buf;
-    return interLeavedbuf;
+  }
+}
+
+template <typename T> T* LIFImage::synthesizeTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY) {
+  // A tile halves (at most) 2x2 tiles of the previous level, which are read from the file or
+  // synthesized (and cached) themselves
+  const std::vector<unsigned long long>& dims = _levelDimensions[level];
+  const std::vector<unsigned long long>& finerDims = _levelDimensions[level - 1];
+  unsigned long long tileWidth = std::min(TILE_SIZE, dims[0] - tileX * TILE_SIZE);
+  unsigned long long tileHeight = std::min(TILE_SIZE, dims[1] - tileY * TILE_SIZE);
+  unsigned long long finerX = 2 * tileX * TILE_SIZE;
+  unsigned long long finerY = 2 * tileY * TILE_SIZE;
+  unsigned long long finerWidth = std::min(2 * TILE_SIZE, finerDims[0] - finerX);
+  unsigned long long finerHeight = std::min(2 * TILE_SIZE, finerDims[1] - finerY);
+  std::vector<T> finer(finerWidth * finerHeight * _samplesPerPixel);
+  readRegion<T>(level - 1, finerX, finerY, finerWidth, finerHeight, finer.data());
+  T* tile = new T[tileWidth * tileHeight * _samplesPerPixel];
+  downsampleByTwo(finer.data(), finerWidth, finerHeight, _samplesPerPixel, tile);
+  return tile;
+}
+
+void* LIFImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
+    const unsigned long long& height, const unsigned int& level) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_isValid || level >= _numberOfLevels) {
+    return NULL;
+  }
+  double downsample = getLevelDownsample(level);
+  long long levelStartX = std::floor(startX / downsample + 0.5);
+  long long levelStartY = std::floor(startY / downsample + 0.5);
+  unsigned long long size = width * height * _samplesPerPixel;
+  if (_dataType == DataType::UInt16) {
+    unsigned short* data = new unsigned short[size]();
+    readRegion<unsigned short>(level, levelStartX, levelStartY, width, height, data);
+    return data;
+  }
+  else if (_dataType == DataType::UInt32) {
+    unsigned int* data = new unsigned int[size]();
+    readRegion<unsigned int>(level, levelStartX, levelStartY, width, height, data);
+    return data;
+  }
+  else if (_dataType == DataType::Float) {
+    float* data = new float[size]();
+    readRegion<float>(level, levelStartX, levelStartY, width, height, data);
+    return data;
+  }
+  unsigned char* data = new unsigned char[size]();
+  readRegion<unsigned char>(level, levelStartX, levelStartY, width, height, data);
+  return data;
 }
 
 void LIFImage::translateImageNames(pugi::xpath_node& imageNode, int imageNr) {
@@ -2,9 +2,12 @@
 #define _LIFImage
 
 #include <vector>
+#include <memory>
 #include "MultiResolutionImage.h"
 #include "multiresolutionimageinterface_export.h"
 
+class MemoryMappedFile;
+
 namespace pugi {
   class xml_document;
   class xpath_node;
@@ -33,6 +36,23 @@ private :
   static const char LIF_MAGIC_BYTE;
   static const char LIF_MEMORY_BYTE;
 
+  //! Dimensions at which no further synthetic levels are added
+  static const unsigned long long MIN_LEVEL_SIZE;
+
+  //! Size of the tiles in which synthetic levels are built and cached
+  static const unsigned long long TILE_SIZE;
+
+  // The file is memory mapped on open; the planes of the selected series are copied directly
+  // from the mapping. Channels are stored planar, rows may be padded.
+  std::unique_ptr<MemoryMappedFile> _file;
+  unsigned long long _planeOffset;
+  unsigned long long _rowStride;
+  unsigned long long _channelStride;
+  unsigned int _bytesPerSample;
+
+  // LIF files only contain the full resolution; lower levels are generated by 2x2 averaging
+  // the previous level, tile by tile as they are read, and the tiles are kept in the tile cache.
+
   std::vector<std::vector<int> > _realChannel;
   int _lastChannel;
   int _selectedSeries;
@@ -82,6 +102,12 @@ private :
   void translateLaserLines(pugi::xpath_node& imageNode, int imageNr) {};
   void translateDetectors(pugi::xpath_node& imageNode, int imageNr) {};
   int getTileIndex(int index);
+  bool locatePlanes();
+
+  // Copies a region in the coordinates of the level into data, which is zero outside the level
+  template <typename T> void readRegion(const unsigned int& level, const long long& levelX, const long long& levelY,
+    const unsigned long long& width, const unsigned long long& height, T* data);
+  template <typename T> T* synthesizeTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY);
 
 };
 
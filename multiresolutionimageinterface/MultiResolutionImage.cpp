@@ -1,8 +1,121 @@
 #include "MultiResolutionImage.h"
+#include "JPEGCodec.h"
+#include "JPEG2000Codec.h"
 #include <cmath>
+#include <algorithm>
 
 using namespace pathology;
 
+namespace {
+
+  // Box filters an image into a thumbnail by adding every pixel to the thumbnail pixel it falls
+  // in, so the image can be added piece by piece (tiles or bands of rows) in any order
+  class ThumbnailAccumulator {
+  public:
+    ThumbnailAccumulator(const unsigned long long& width, const unsigned long long& height, const unsigned long long& thumbnailWidth,
+      const unsigned long long& thumbnailHeight, const unsigned int& nrSamples) :
+      _width(width), _height(height), _thumbnailWidth(thumbnailWidth), _thumbnailHeight(thumbnailHeight), _nrSamples(nrSamples),
+      _columns(width), _sums(thumbnailWidth * thumbnailHeight * nrSamples, 0), _counts(thumbnailWidth * thumbnailHeight, 0)
+    {
+      for (unsigned long long x = 0; x < width; ++x) {
+        _columns[x] = x * thumbnailWidth / width;
+      }
+    }
+
+    unsigned long long getWidth() const { return _width; }
+    unsigned long long getHeight() const { return _height; }
+
+    // Adds a block of w x h pixels at (x, y), rows in pixels are rowLength pixels apart
+    void add(const unsigned char* pixels, const unsigned long long& rowLength, const unsigned long long& x, const unsigned long long& y,
+      const unsigned long long& w, const unsigned long long& h) {
+      for (unsigned long long row = 0; row < h; ++row) {
+        unsigned long long thumbnailRow = (y + row) * _thumbnailHeight / _height;
+        const unsigned char* pixel = pixels + row * rowLength * _nrSamples;
+        for (unsigned long long col = 0; col < w; ++col) {
+          unsigned long long index = thumbnailRow * _thumbnailWidth + _columns[x + col];
+          unsigned long long* sum = &_sums[index * _nrSamples];
+          for (unsigned int s = 0; s < _nrSamples; ++s) {
+            sum[s] += pixel[s];
+          }
+          ++_counts[index];
+          pixel += _nrSamples;
+        }
+      }
+    }
+
+    // Pixels to which nothing was added (e.g. missing tiles) are 0, like in regions read from the image
+    unsigned char* getThumbnail() const {
+      unsigned char* thumbnail = new unsigned char[_sums.size()];
+      for (unsigned long long i = 0; i < _counts.size(); ++i) {
+        for (unsigned int s = 0; s < _nrSamples; ++s) {
+          thumbnail[i * _nrSamples + s] = _counts[i] > 0 ? static_cast<unsigned char>((_sums[i * _nrSamples + s] + _counts[i] / 2) / _counts[i]) : 0;
+        }
+      }
+      return thumbnail;
+    }
+
+  private:
+    unsigned long long _width;
+    unsigned long long _height;
+    unsigned long long _thumbnailWidth;
+    unsigned long long _thumbnailHeight;
+    unsigned int _nrSamples;
+    std::vector<unsigned long long> _columns;
+    std::vector<unsigned long long> _sums;
+    std::vector<unsigned long long> _counts;
+  };
+
+  // Decodes all tiles of a JPEG or JPEG2000 level at 1 / 2^reduction of its resolution into the
+  // accumulator. Returns false when a tile cannot be decoded as such.
+  bool accumulateEncodedTiles(MultiResolutionImage& image, const unsigned int& level, const unsigned int& reduction,
+    const EncodedTileInfo& info, ThumbnailAccumulator& accumulator) {
+    std::vector<unsigned long long> dims = image.getLevelDimensions(level);
+    unsigned long long nrTilesX = (dims[0] + info.tileWidth - 1) / info.tileWidth;
+    unsigned long long nrTilesY = (dims[1] + info.tileHeight - 1) / info.tileHeight;
+    unsigned int nrSamples = image.getSamplesPerPixel();
+    unsigned int reducedTileWidth = info.tileWidth >> reduction;
+    unsigned int reducedTileHeight = info.tileHeight >> reduction;
+    JPEGCodec jpegCodec;
+    JPEG2000Codec jpeg2000Codec;
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> decoded;
+    for (unsigned long long tileY = 0; tileY < nrTilesY; ++tileY) {
+      for (unsigned long long tileX = 0; tileX < nrTilesX; ++tileX) {
+        if (!image.readEncodedTile(level, tileX, tileY, encoded)) {
+          continue;
+        }
+        unsigned int width = reducedTileWidth;
+        unsigned int height = reducedTileHeight;
+        if (info.compression == Compression::JPEG) {
+          unsigned int nrComponents = 0;
+          if (!jpegCodec.decode(encoded.data(), encoded.size(), decoded, width, height, nrComponents, reduction, info.ycbcr, info.jpegTables) ||
+              nrComponents != nrSamples) {
+            return false;
+          }
+        }
+        else if (info.compression == Compression::JPEG2000) {
+          unsigned int outSize = width * height * nrSamples;
+          decoded.resize(outSize);
+          if (!jpeg2000Codec.decode(encoded.data(), encoded.size(), decoded.data(), outSize, reduction)) {
+            return false;
+          }
+        }
+        else {
+          return false;
+        }
+        unsigned long long x = tileX * reducedTileWidth;
+        unsigned long long y = tileY * reducedTileHeight;
+        if (x < accumulator.getWidth() && y < accumulator.getHeight()) {
+          accumulator.add(decoded.data(), width, x, y, std::min<unsigned long long>(width, accumulator.getWidth() - x),
+            std::min<unsigned long long>(height, accumulator.getHeight() - y));
+        }
+      }
+    }
+    return true;
+  }
+
+}
+
 // Subsequent specialization to not re-copy data when datatypes are the same
 //ԭʼ
 template <> void MultiResolutionImage::getRawRegion(const long long& startX, const long long& startY, const unsigned long long& width, 
@@ -11,21 +124,22 @@ template <> void MultiResolutionImage::getRawRegion(const long long& startX, con
       return;
     }
     unsigned int nrSamples = getSamplesPerPixel();
-    if (this->getDataType()==pathology::DataType::Float) {
+    pathology::DataType dataType = pathology::decodedDataType(this->getDataType());
+    if (dataType==pathology::DataType::Float) {
       delete[] data;
       data = (float*)readDataFromImage(startX, startY, width, height, level);
     }
-    else if (this->getDataType()==pathology::DataType::UChar) {
+    else if (dataType==pathology::DataType::UChar) {
       unsigned char * temp = (unsigned char*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt16) {
+    else if (dataType==pathology::DataType::UInt16) {
       unsigned short * temp = (unsigned short*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt32) {
+    else if (dataType==pathology::DataType::UInt32) {
       unsigned int * temp = (unsigned int*)readDataFromImage(startX, startY, width, height, level);
       std::transform(temp, temp + width * height * nrSamples, data, [](unsigned int a) { return static_cast<float>(a); });
       delete[] temp;
@@ -38,21 +152,22 @@ template <> void MultiResolutionImage::getRawRegion(const long long& startX, con
       return;
     }
     unsigned int nrSamples = getSamplesPerPixel();
-    if (this->getDataType()==pathology::DataType::Float) {
+    pathology::DataType dataType = pathology::decodedDataType(this->getDataType());
+    if (dataType==pathology::DataType::Float) {
       float * temp = (float*)readDataFromImage(startX, startY, width, height, level);
       std::transform(temp, temp + width * height * nrSamples, data, [](float a) { return static_cast<unsigned char>(a); });
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UChar) {
+    else if (dataType==pathology::DataType::UChar) {
       delete[] data;
       data = (unsigned char*)readDataFromImage(startX, startY, width, height, level);
     }
-    else if (this->getDataType()==pathology::DataType::UInt16) {
+    else if (dataType==pathology::DataType::UInt16) {
       unsigned short * temp = (unsigned short*)readDataFromImage(startX, startY, width, height, level);
       std::transform(temp, temp + width * height * nrSamples, data, [](unsigned short a) { return static_cast<unsigned char>(a); });
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt32) {
+    else if (dataType==pathology::DataType::UInt32) {
       unsigned int * temp = (unsigned int*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
@@ -65,21 +180,22 @@ template <> void MultiResolutionImage::getRawRegion(const long long& startX, con
       return;
     }
     unsigned int nrSamples = getSamplesPerPixel();
-    if (this->getDataType()==pathology::DataType::Float) {
+    pathology::DataType dataType = pathology::decodedDataType(this->getDataType());
+    if (dataType==pathology::DataType::Float) {
       float* temp = (float*)readDataFromImage(startX, startY, width, height, level);
       std::transform(temp, temp + width*height*nrSamples, data, [](float a) { return static_cast<unsigned short>(a); });
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UChar) {
+    else if (dataType==pathology::DataType::UChar) {
       unsigned char * temp = (unsigned char*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt16) {
+    else if (dataType==pathology::DataType::UInt16) {
       delete[] data;
       data = (unsigned short*)readDataFromImage(startX, startY, width, height, level);
     }
-    else if (this->getDataType()==pathology::DataType::UInt32) {
+    else if (dataType==pathology::DataType::UInt32) {
       unsigned int* temp = (unsigned int*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
@@ -92,22 +208,23 @@ template <> void MultiResolutionImage::getRawRegion(const long long& startX, con
       return;
     }
     unsigned int nrSamples = getSamplesPerPixel();
-    if (this->getDataType()==pathology::DataType::Float) {
+    pathology::DataType dataType = pathology::decodedDataType(this->getDataType());
+    if (dataType==pathology::DataType::Float) {
       float * temp = (float*)readDataFromImage(startX, startY, width, height, level);
       std::transform(temp, temp + width * height * nrSamples, data, [](float a) { return static_cast<unsigned int>(a); });
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UChar) {
+    else if (dataType==pathology::DataType::UChar) {
       unsigned char * temp = (unsigned char*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt16) {
+    else if (dataType==pathology::DataType::UInt16) {
       unsigned short * temp = (unsigned short*)readDataFromImage(startX, startY, width, height, level);
       std::copy(temp, temp + width*height*nrSamples, data);
       delete[] temp;
     }
-    else if (this->getDataType()==pathology::DataType::UInt32) {
+    else if (dataType==pathology::DataType::UInt32) {
       delete[] data;
       data = (unsigned int*)readDataFromImage(startX, startY, width, height, level);
     }
@@ -238,6 +355,73 @@ void MultiResolutionImage::cleanup() {
   _filePath = "";
 }
 
+Patch<unsigned char> MultiResolutionImage::getThumbnail(const unsigned int& maxSize) {
+  if (!_isValid || maxSize == 0) {
+    return Patch<unsigned char>();
+  }
+  // Coarsest level which is at least as large as the thumbnail
+  unsigned int level = getNumberOfLevels() - 1;
+  while (level > 0 && std::max(_levelDimensions[level][0], _levelDimensions[level][1]) < maxSize) {
+    --level;
+  }
+  std::vector<unsigned long long> dims = getLevelDimensions(level);
+  unsigned long long largest = std::max(dims[0], dims[1]);
+  double scale = std::min(1.0, static_cast<double>(maxSize) / largest);
+  unsigned long long thumbnailWidth = std::max(1ULL, static_cast<unsigned long long>(dims[0] * scale + 0.5));
+  unsigned long long thumbnailHeight = std::max(1ULL, static_cast<unsigned long long>(dims[1] * scale + 0.5));
+  unsigned int nrSamples = getSamplesPerPixel();
+  unsigned char* thumbnail = NULL;
+
+  // Compressed levels are decoded at the lowest resolution which is still at least as large as
+  // the thumbnail, which for JPEG is limited to 1/8 and requires tiles which are a multiple of it
+  EncodedTileInfo info;
+  if (getDataType() == DataType::UChar && getEncodedTileInfo(level, info)) {
+    unsigned int reduction = 0;
+    while (reduction < JPEGCodec::MAX_REDUCTION && (largest >> (reduction + 1)) >= maxSize &&
+           info.tileWidth % (2 << reduction) == 0 && info.tileHeight % (2 << reduction) == 0) {
+      ++reduction;
+    }
+    unsigned long long reducedWidth = (dims[0] + (1ULL << reduction) - 1) >> reduction;
+    unsigned long long reducedHeight = (dims[1] + (1ULL << reduction) - 1) >> reduction;
+    ThumbnailAccumulator accumulator(reducedWidth, reducedHeight, thumbnailWidth, thumbnailHeight, nrSamples);
+    if (accumulateEncodedTiles(*this, level, reduction, info, accumulator)) {
+      thumbnail = accumulator.getThumbnail();
+    }
+  }
+
+  // Otherwise the level is read in bands of rows, which bounds the memory needed for large levels
+  if (!thumbnail) {
+    ThumbnailAccumulator accumulator(dims[0], dims[1], thumbnailWidth, thumbnailHeight, nrSamples);
+    unsigned long long bandHeight = std::max(1ULL, (16ULL * 1024 * 1024) / (dims[0] * nrSamples));
+    double downsample = getLevelDownsample(level);
+    unsigned char* band = new unsigned char[dims[0] * std::min(bandHeight, dims[1]) * nrSamples];
+    for (unsigned long long y = 0; y < dims[1]; y += bandHeight) {
+      unsigned long long height = std::min(bandHeight, dims[1] - y);
+      getRawRegion<unsigned char>(0, static_cast<long long>(y * downsample), dims[0], height, level, band);
+      // For 8-bit images the band is replaced by the buffer of the reader, which fails without one
+      if (!band) {
+        return Patch<unsigned char>();
+      }
+      accumulator.add(band, dims[0], 0, y, dims[0], height);
+    }
+    delete[] band;
+    thumbnail = accumulator.getThumbnail();
+  }
+
+  std::vector<unsigned long long> thumbnailDims(3, 0);
+  thumbnailDims[0] = thumbnailWidth;
+  thumbnailDims[1] = thumbnailHeight;
+  thumbnailDims[2] = nrSamples;
+  Patch<unsigned char> patch(thumbnailDims, getColorType(), thumbnail, true);
+  std::vector<double> thumbnailSpacing = _spacing;
+  if (thumbnailSpacing.size() > 1) {
+    thumbnailSpacing[0] *= static_cast<double>(_levelDimensions[0][0]) / thumbnailWidth;
+    thumbnailSpacing[1] *= static_cast<double>(_levelDimensions[0][1]) / thumbnailHeight;
+  }
+  patch.setSpacing(thumbnailSpacing);
+  return patch;
+}
+
 const unsigned long long MultiResolutionImage::getCacheSize() {
   unsigned long long cacheSize = 0;
   _cacheMutex->lock();
@@ -245,10 +429,10 @@ const unsigned long long MultiResolutionImage::getCacheSize() {
     if (_dataType == DataType::UInt32) {
       cacheSize = (std::static_pointer_cast<TileCache<unsigned int> >(_cache))->maxCacheSize();
     }
-    else if (_dataType == DataType::UInt16) {
+    else if (_dataType == DataType::UInt16 || _dataType == DataType::Float16) {
       cacheSize = (std::static_pointer_cast<TileCache<unsigned short> >(_cache))->maxCacheSize();
     }
-    else if (_dataType == DataType::UChar) {
+    else if (_dataType == DataType::UChar || _dataType == DataType::Bit) {
       cacheSize = (std::static_pointer_cast<TileCache<unsigned char> >(_cache))->maxCacheSize();
     }
     else if (_dataType == DataType::Float) {
@@ -265,10 +449,10 @@ void MultiResolutionImage::setCacheSize(const unsigned long long cacheSize) {
     if (_dataType == DataType::UInt32) {
       (std::static_pointer_cast<TileCache<unsigned int> >(_cache))->setMaxCacheSize(cacheSize);
     }
-    else if (_dataType == DataType::UInt16) {
+    else if (_dataType == DataType::UInt16 || _dataType == DataType::Float16) {
       (std::static_pointer_cast<TileCache<unsigned short> >(_cache))->setMaxCacheSize(cacheSize);
     }
-    else if (_dataType == DataType::UChar) {
+    else if (_dataType == DataType::UChar || _dataType == DataType::Bit) {
       (std::static_pointer_cast<TileCache<unsigned char> >(_cache))->setMaxCacheSize(cacheSize);
     }
     else if (_dataType == DataType::Float) {
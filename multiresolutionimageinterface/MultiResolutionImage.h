@@ -1,15 +1,33 @@
 #ifndef _MultiResolutionImage
 #define _MultiResolutionImage
 #include <string>
+#include <vector>
 #include <memory>
+#include <cmath>
+#include <algorithm>
 #include <mutex>
 #include <shared_mutex>
 #include "multiresolutionimageinterface_export.h"
 #include "TileCache.h"
+#include "PixelConversion.h"
 #include "core/PathologyEnums.h"
 #include "core/ImageSource.h"
 #include "core/Patch.h"
 
+//! Describes how the tiles of a pyramid level are stored in the file, so compressed tiles can be
+//! copied to another file without decoding them
+struct EncodedTileInfo {
+  unsigned int tileWidth;
+  unsigned int tileHeight;
+  pathology::Compression compression;
+  //! JPEG data is stored as YCbCr with the given chroma subsampling
+  bool ycbcr;
+  unsigned short ycbcrSubsamplingX;
+  unsigned short ycbcrSubsamplingY;
+  //! Abbreviated JPEG tables shared by all tiles, empty when every tile is a complete JPEG stream
+  std::vector<unsigned char> jpegTables;
+};
+
 class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT MultiResolutionImage : public ImageSource {
 
 public :
@@ -88,6 +106,84 @@ public :
     return patch;
   }
 
+  //! Gets a region of width x height pixels at the given downsample relative to the base level,
+  //! with (startX, startY) in base level coordinates. It is resampled from the coarsest level which
+  //! is at least as fine as requested, block by block straight into the patch, so no region at the
+  //! resolution of that level is read as a whole.
+  template <typename T>
+  Patch<T> getRegionAtDownsample(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const double& downsample, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear)
+  {
+    if (!_isValid || downsample <= 0 || width == 0 || height == 0) {
+      return Patch<T>();
+    }
+    int level = 0;
+    for (int i = 1; i < getNumberOfLevels(); ++i) {
+      if (getLevelDownsample(i) <= downsample * 1.0001) {
+        level = i;
+      }
+    }
+    double levelDownsample = getLevelDownsample(level);
+    double scale = downsample / levelDownsample;
+    unsigned int nrSamples = getSamplesPerPixel();
+    T* data = new T[width * height * nrSamples];
+    if (std::abs(scale - 1.) < 1e-6) {
+      getRawRegion<T>(startX, startY, width, height, level, data);
+    }
+    else {
+      std::vector<unsigned long long> levelDimensions = getLevelDimensions(level);
+      pathology::ResamplingAxis axisX = pathology::createResamplingAxis(startX / levelDownsample, scale, width, levelDimensions[0], interpolation);
+      pathology::ResamplingAxis axisY = pathology::createResamplingAxis(startY / levelDownsample, scale, height, levelDimensions[1], interpolation);
+      // Blocks of at most about 1024 x 1024 source pixels
+      unsigned long long blockSize = std::max<unsigned long long>(16, std::min<unsigned long long>(512, static_cast<unsigned long long>(1024 / scale)));
+      for (unsigned long long blockY = 0; blockY < height; blockY += blockSize) {
+        unsigned long long blockEndY = std::min(height, blockY + blockSize);
+        long long sourceY = axisY.first[blockY];
+        unsigned long long sourceHeight = axisY.first[blockEndY - 1] + axisY.nrTaps[blockEndY - 1] - sourceY;
+        for (unsigned long long blockX = 0; blockX < width; blockX += blockSize) {
+          unsigned long long blockEndX = std::min(width, blockX + blockSize);
+          long long sourceX = axisX.first[blockX];
+          unsigned long long sourceWidth = axisX.first[blockEndX - 1] + axisX.nrTaps[blockEndX - 1] - sourceX;
+          T* source = new T[sourceWidth * sourceHeight * nrSamples];
+          getRawRegion<T>(static_cast<long long>(std::floor(sourceX * levelDownsample + 0.5)), static_cast<long long>(std::floor(sourceY * levelDownsample + 0.5)),
+            sourceWidth, sourceHeight, level, source);
+          if (source) {
+            pathology::resample(source, sourceX, sourceY, sourceWidth, sourceHeight, nrSamples, axisX, axisY, blockX, blockEndX, blockY, blockEndY, data, width);
+          }
+          delete[] source;
+        }
+      }
+    }
+    std::vector<unsigned long long> dims(3, 0);
+    dims[0] = width;
+    dims[1] = height;
+    dims[2] = nrSamples;
+    std::vector<double> patchSpacing(_spacing.size(), 1.0);
+    for (unsigned int i = 0; i < _spacing.size(); ++i) {
+      patchSpacing[i] = _spacing[i] * downsample;
+    }
+    std::vector<double> minValues, maxValues;
+    for (unsigned int i = 0; i < nrSamples; ++i) {
+      minValues.push_back(this->getMinValue(i));
+      maxValues.push_back(this->getMaxValue(i));
+    }
+    Patch<T> patch = Patch<T>(dims, this->getColorType(), data, true, minValues, maxValues);
+    patch.setSpacing(patchSpacing);
+    return patch;
+  }
+
+  //! Gets a region of width x height pixels at the given spacing (micrometer per pixel), see
+  //! getRegionAtDownsample. Returns an empty patch when the spacing of the image is unknown.
+  template <typename T>
+  Patch<T> getRegionAtSpacing(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const double& spacing, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear)
+  {
+    if (_spacing.empty() || _spacing[0] <= 0 || spacing <= 0) {
+      return Patch<T>();
+    }
+    return getRegionAtDownsample<T>(startX, startY, width, height, spacing / _spacing[0], interpolation);
+  }
+
   //ȡݡû㹻ڴ鲢ڴ档
   //ע⣬int32 ARGBݣOpenSlideУɫ˳ȡĻĶ(Windows͵BGRA)
   template <typename T> 
@@ -97,28 +193,63 @@ public :
         return;
       }
       unsigned int nrSamples = getSamplesPerPixel();
-      if (this->getDataType()==pathology::DataType::Float) {
+      pathology::DataType dataType = pathology::decodedDataType(this->getDataType());
+      if (dataType==pathology::DataType::Float) {
         float * temp = (float*)readDataFromImage(startX, startY, width, height, level);
         std::copy(temp, temp + width*height*nrSamples, data);
         delete[] temp;
       }
-      else if (this->getDataType()==pathology::DataType::UChar) {
+      else if (dataType==pathology::DataType::UChar) {
         unsigned char * temp = (unsigned char*)readDataFromImage(startX, startY, width, height, level);
         std::copy(temp, temp + width*height*nrSamples, data);
         delete[] temp;
       }
-      else if (this->getDataType()==pathology::DataType::UInt16) {
+      else if (dataType==pathology::DataType::UInt16) {
         unsigned short * temp = (unsigned short*)readDataFromImage(startX, startY, width, height, level);
         std::copy(temp, temp + width*height*nrSamples, data);
         delete[] temp;
       }
-      else if (this->getDataType()==pathology::DataType::UInt32) {
+      else if (dataType==pathology::DataType::UInt32) {
         unsigned int * temp = (unsigned int*)readDataFromImage(startX, startY, width, height, level);
         std::copy(temp, temp + width*height*nrSamples, data);
         delete[] temp;
       }
     }
 
+  //! Reads a region into data, which holds width * height * samples values and is owned by the
+  //! caller. Unlike getRawRegion data is never replaced, so it may point into memory managed
+  //! elsewhere (e.g. a NumPy array). When T is the decoded data type of the image and the
+  //! format supports it, the region is decoded directly into data without an intermediate copy.
+  template <typename T>
+  void getRawRegionInto(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level, T* data) {
+    if (level >= getNumberOfLevels()) {
+      return;
+    }
+    if (pathology::decodedDataType(this->getDataType()) == pathology::dataTypeOf<T>() && readDataFromImageInto(startX, startY, width, height, level, data)) {
+      return;
+    }
+    unsigned long long size = width * height * getSamplesPerPixel();
+    T* temp = new T[size];
+    getRawRegion<T>(startX, startY, width, height, level, temp);
+    std::copy(temp, temp + size, data);
+    delete[] temp;
+  }
+
+  //! Gets an 8-bit thumbnail of which the largest dimension is maxSize pixels, or the size of the
+  //! image when it is smaller. It is made from the coarsest level which is large enough; when
+  //! that level is stored as JPEG or JPEG2000, its tiles are decoded at a reduced resolution
+  //! (scaled IDCT or discarded resolution levels) instead of in full.
+  Patch<unsigned char> getThumbnail(const unsigned int& maxSize);
+
+  //! Fills info and returns true when the tiles of the level are stored as JPEG or JPEG2000 and
+  //! can be read with readEncodedTile; false when the format does not support this
+  virtual bool getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info) { return false; }
+
+  //! Reads the compressed data of the tile at column tileX and row tileY of a level as stored in
+  //! the file. Returns false when the tile is not present.
+  virtual bool readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data) { return false; }
+
 protected :
 
   //! To make MultiResolutionImage thread-safe  ʹMultiResolutionImagḛ߳ȫ
@@ -144,6 +275,11 @@ protected :
   virtual void* readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level) = 0;
 
+  //! Reads a region of the decoded data type into data owned by the caller, returns false when
+  //! the format does not support this and the region has to be read with readDataFromImage
+  virtual bool readDataFromImageInto(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level, void* data) { return false; }
+
   template <typename T> void createCache() {
     if (_isValid) {
       _cache.reset(new TileCache<T>(_cacheSize));
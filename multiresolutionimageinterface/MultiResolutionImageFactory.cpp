@@ -1,11 +1,8 @@
 #include "MultiResolutionImageFactory.h"
 #include "MultiResolutionImage.h"
+#include "VirtualPyramidImage.h"
 #include "core/filetools.h"
 
-#ifdef HAS_MULTIRESOLUTIONIMAGEINTERFACE_VSI_SUPPORT
-#include "VSIImage.h"
-#endif
-
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -89,11 +86,16 @@ MultiResolutionImage* MultiResolutionImageFactory::openImageWithFactory(const st
 {
   MultiResolutionImage* img = factory->readImage(fileName);
   if (img) {
-#ifdef HAS_MULTIRESOLUTIONIMAGEINTERFACE_VSI_SUPPORT
-    if ((img->getNumberOfLevels() > 1 || dynamic_cast<VSIImage*>(img) != NULL) || (img->getNumberOfLevels() == 1 && img->getLevelDimensions(0)[0] < 4096)) {
-#else
-    if ((img->getNumberOfLevels() > 1) || (img->getNumberOfLevels() == 1 && img->getLevelDimensions(0)[0] < 4096)) {
-#endif
+    // Large single-level images and pyramids with levels far apart get the missing levels
+    // synthesized on demand, so they can be viewed at every magnification
+    if (VirtualPyramidImage::needsVirtualLevels(img)) {
+      VirtualPyramidImage* pyramid = new VirtualPyramidImage(img);
+      if (pyramid->initialize(fileName)) {
+        return pyramid;
+      }
+      delete pyramid;
+    }
+    else if (img->getNumberOfLevels() > 0) {
       return img;
     }
     else {
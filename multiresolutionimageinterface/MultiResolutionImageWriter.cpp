@@ -12,6 +12,7 @@ extern "C" {
 };
 
 #include "JPEG2000Codec.h"
+#include "PixelConversion.h"
 #include "core/ProgressMonitor.h"
 #include "core/PathologyEnums.h"
 
@@ -24,7 +25,8 @@ _interpolation(Interpolation::Linear), _monitor(NULL), _cType(ColorType::Invalid
 _dType(pathology::DataType::InvalidDataType), _min_vals(NULL), _max_vals(NULL), _jpeg2000Codec(NULL),
 _totalWritingTime(0), _totalReadingTime(0), _jpeg2kCompressionTime(0), _totalBaseWritingTime(0),
 _totalDownsamplingtime(0), _totalPyramidTime(0), _totalMinMaxTime(0), _downsamplePerLevel(2),
-_maxPyramidLevels(-1)
+_maxPyramidLevels(-1), _tilePassthrough(true), _passthroughSource(NULL), _skipEmptyTiles(false),
+_compressionLevel(9), _usePredictor(false), _tileOrder(TileOrder::Raster)
 {
 	TIFFSetWarningHandler(NULL);
 }
@@ -71,7 +73,7 @@ void MultiResolutionImageWriter::writeImageToFile(MultiResolutionImage* img, con
 		setNumberOfIndexedColors(cDepth);
 	}
 	unsigned int nrBits = 8;
-	if (_dType == DataType::UInt32 || _dType == DataType::Float) {
+	if (_dType == DataType::UInt32 || _dType == DataType::Float || _dType == DataType::Float16) {
 		nrBits = 32;
 	}
 	else if (_dType == DataType::UInt16) {
@@ -85,9 +87,33 @@ void MultiResolutionImageWriter::writeImageToFile(MultiResolutionImage* img, con
 			spacing = _overrideSpacing;
 		}
 		setSpacing(spacing);
+		EncodedTileInfo info;
+		_passthroughSource = NULL;
+		if (canCopyEncodedTiles(img)) {
+			img->getEncodedTileInfo(0, info);
+			_passthroughSource = img;
+		}
 		if (writeImageInformation(dims[0], dims[1]) == 0) {
-			for (int y = 0; y < dims[1]; y += _tileSize) {
-				for (int x = 0; x < dims[0]; x += _tileSize) {
+			if (_passthroughSource) {
+				// Copy the compressed base tiles, the min/max values are taken from the source as the
+				// pixels are never decoded
+				setEncodedTileTags(_tiff, info);
+				for (unsigned int i = 0; i < cDepth; ++i) {
+					_min_vals[i] = img->getMinValue(i);
+					_max_vals[i] = img->getMaxValue(i);
+				}
+				copyEncodedTiles(img, 0, dims[0], dims[1]);
+				if (_monitor) {
+					_monitor->setProgress(_monitor->maximumProgress() / 2);
+				}
+			}
+			else {
+				unsigned long long nrTilesX = (dims[0] + _tileSize - 1) / _tileSize;
+				unsigned long long nrTilesY = (dims[1] + _tileSize - 1) / _tileSize;
+				std::vector<unsigned int> tileNumbers = getOrderedTileNumbers(nrTilesX, nrTilesY);
+				for (unsigned int tileNr : tileNumbers) {
+					unsigned long long x = (tileNr % nrTilesX) * _tileSize;
+					unsigned long long y = (tileNr / nrTilesX) * _tileSize;
 					auto startReadingTime = std::chrono::steady_clock::now();
 					unsigned char* data = new unsigned char[_tileSize * _tileSize * cDepth * (nrBits / 8)];
 					if (_dType == DataType::UInt32) {
@@ -96,15 +122,15 @@ void MultiResolutionImageWriter::writeImageToFile(MultiResolutionImage* img, con
 					else if (_dType == DataType::UInt16) {
 						img->getRawRegion(x, y, _tileSize, _tileSize, 0, (unsigned short*&)data);
 					}
-					else if (_dType == DataType::Float) {
+					else if (_dType == DataType::Float || _dType == DataType::Float16) {
 						img->getRawRegion(x, y, _tileSize, _tileSize, 0, (float*&)data);
 					}
-					else if (_dType == DataType::UChar) {
+					else if (_dType == DataType::UChar || _dType == DataType::Bit) {
 						img->getRawRegion(x, y, _tileSize, _tileSize, 0, data);
 					}
 					auto endReadingTime = std::chrono::steady_clock::now();
 					_totalReadingTime += std::chrono::duration<double, milli>(endReadingTime - startReadingTime).count();
-					writeBaseImagePart((void*)data);
+					writeBaseImagePartToLocation((void*)data, x, y);
 					delete[] data;
 					data = NULL;
 				}
@@ -114,12 +140,138 @@ void MultiResolutionImageWriter::writeImageToFile(MultiResolutionImage* img, con
 		else {
 			cerr << "Could not write image information" << endl;
 		}
+		_passthroughSource = NULL;
 	}
 	else {
 		cerr << "Failed to open TIFF file for writing" << endl;
 	}
 }
 
+bool MultiResolutionImageWriter::canCopyEncodedTiles(MultiResolutionImage* img) const {
+	if (!_tilePassthrough || img->getDataType() != DataType::UChar || img->getColorType() != ColorType::RGB) {
+		return false;
+	}
+	EncodedTileInfo info;
+	return img->getEncodedTileInfo(0, info) && isPassthroughCompatible(info);
+}
+
+bool MultiResolutionImageWriter::isPassthroughCompatible(const EncodedTileInfo& info) const {
+	if (info.compression != _codec) {
+		return false;
+	}
+	if (info.compression != Compression::JPEG && info.compression != Compression::JPEG2000) {
+		return false;
+	}
+	return info.tileWidth == _tileSize && info.tileHeight == _tileSize;
+}
+
+int MultiResolutionImageWriter::findPassthroughSourceLevel(const unsigned long long& width, const unsigned long long& height) const {
+	if (!_passthroughSource) {
+		return -1;
+	}
+	// Level sizes are rounded differently between formats, allow them to differ by a pixel
+	for (int level = 1; level < _passthroughSource->getNumberOfLevels(); ++level) {
+		std::vector<unsigned long long> dims = _passthroughSource->getLevelDimensions(level);
+		if (std::abs(static_cast<long long>(dims[0]) - static_cast<long long>(width)) <= 1 &&
+			std::abs(static_cast<long long>(dims[1]) - static_cast<long long>(height)) <= 1) {
+			EncodedTileInfo info;
+			if (_passthroughSource->getEncodedTileInfo(level, info) && isPassthroughCompatible(info)) {
+				return level;
+			}
+			return -1;
+		}
+	}
+	return -1;
+}
+
+void MultiResolutionImageWriter::setEncodedTileTags(TIFF* levelTiff, const EncodedTileInfo& info) {
+	if (info.compression == Compression::JPEG2000) {
+		TIFFSetField(levelTiff, TIFFTAG_COMPRESSION, 33005);
+		return;
+	}
+	TIFFSetField(levelTiff, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
+	if (info.ycbcr) {
+		TIFFSetField(levelTiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR);
+		TIFFSetField(levelTiff, TIFFTAG_YCBCRSUBSAMPLING, info.ycbcrSubsamplingX, info.ycbcrSubsamplingY);
+	}
+	else {
+		TIFFSetField(levelTiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	}
+	if (!info.jpegTables.empty()) {
+		TIFFSetField(levelTiff, TIFFTAG_JPEGTABLES, static_cast<uint32_t>(info.jpegTables.size()), info.jpegTables.data());
+	}
+	else {
+		// libtiff reserves space for tables it would generate itself, tiles are complete JPEG streams here
+		TIFFUnsetField(levelTiff, TIFFTAG_JPEGTABLES);
+	}
+}
+
+void MultiResolutionImageWriter::copyEncodedTiles(MultiResolutionImage* source, const unsigned int& level, const unsigned long long& width, const unsigned long long& height) {
+	std::vector<unsigned char> tile;
+	unsigned long long nrTilesX = (width + _tileSize - 1) / _tileSize;
+	unsigned long long nrTilesY = (height + _tileSize - 1) / _tileSize;
+	std::vector<unsigned int> tileNumbers = getOrderedTileNumbers(nrTilesX, nrTilesY);
+	for (unsigned int tileNr : tileNumbers) {
+		unsigned long long tileX = tileNr % nrTilesX, tileY = tileNr / nrTilesX;
+		auto startReadingTime = std::chrono::steady_clock::now();
+		// Tiles missing in the source (e.g. sparse DICOM) are left empty
+		bool hasTile = source->readEncodedTile(level, tileX, tileY, tile);
+		auto startTileWrite = std::chrono::steady_clock::now();
+		_totalReadingTime += std::chrono::duration<double, milli>(startTileWrite - startReadingTime).count();
+		if (hasTile) {
+			TIFFWriteRawTile(_tiff, TIFFComputeTile(_tiff, tileX * _tileSize, tileY * _tileSize, 0, 0), tile.data(), tile.size());
+			_totalBaseWritingTime += std::chrono::duration<double, milli>(std::chrono::steady_clock::now() - startTileWrite).count();
+		}
+	}
+}
+
+std::vector<unsigned int> MultiResolutionImageWriter::getOrderedTileNumbers(const unsigned long long& nrTilesX, const unsigned long long& nrTilesY) const {
+	std::vector<unsigned int> tileNumbers;
+	tileNumbers.reserve(nrTilesX * nrTilesY);
+	if (_tileOrder == TileOrder::Raster) {
+		for (unsigned long long i = 0; i < nrTilesX * nrTilesY; ++i) {
+			tileNumbers.push_back(i);
+		}
+		return tileNumbers;
+	}
+	// Walk the curve over the smallest power of two square covering the level and keep the
+	// positions which fall inside it
+	unsigned long long side = 1;
+	while (side < nrTilesX || side < nrTilesY) {
+		side *= 2;
+	}
+	for (unsigned long long d = 0; d < side * side; ++d) {
+		unsigned long long x = 0, y = 0;
+		if (_tileOrder == TileOrder::ZOrder) {
+			for (unsigned long long bit = 0; (1ULL << (2 * bit)) < side * side; ++bit) {
+				x |= ((d >> (2 * bit)) & 1) << bit;
+				y |= ((d >> (2 * bit + 1)) & 1) << bit;
+			}
+		}
+		else {
+			unsigned long long t = d;
+			for (unsigned long long s = 1; s < side; s *= 2) {
+				unsigned long long rx = 1 & (t / 2);
+				unsigned long long ry = 1 & (t ^ rx);
+				if (ry == 0) {
+					if (rx == 1) {
+						x = s - 1 - x;
+						y = s - 1 - y;
+					}
+					std::swap(x, y);
+				}
+				x += s * rx;
+				y += s * ry;
+				t /= 4;
+			}
+		}
+		if (x < nrTilesX && y < nrTilesY) {
+			tileNumbers.push_back(y * nrTilesX + x);
+		}
+	}
+	return tileNumbers;
+}
+
 int MultiResolutionImageWriter::openFile(const std::string& fileName) {
 	_tiff = TIFFOpen(fileName.c_str(), "w8");
 	if (!_tiff) {
@@ -129,6 +281,7 @@ int MultiResolutionImageWriter::openFile(const std::string& fileName) {
 	_fileName = fileName;
 	_pos = 0;
 	_levelFiles.clear();
+	_nonEmptyTiles.clear();
 	return 0;
 }
 
@@ -150,7 +303,20 @@ int MultiResolutionImageWriter::writeImageInformation(const unsigned long long&
 			_min_vals[i] = std::numeric_limits<double>::max();
 			_max_vals[i] = std::numeric_limits<double>::min();
 		}
+		if ((_dType == DataType::Float16 || _dType == DataType::Bit) && (_codec == Compression::JPEG || _codec == Compression::JPEG2000)) {
+			std::cout << "JPEG and JPEG2000 do not support Float16 or Bit data, using LZW compression instead." << std::endl;
+			_codec = Compression::LZW;
+		}
+		if (_codec == Compression::WEBP && (_dType != DataType::UChar || (_cType != ColorType::RGB && _cType != ColorType::RGBA))) {
+			std::cout << "WebP only supports 8-bit RGB and RGBA data, using LZW compression instead." << std::endl;
+			_codec = Compression::LZW;
+		}
+		if ((_codec == Compression::ZSTD && !TIFFIsCODECConfigured(COMPRESSION_ZSTD)) || (_codec == Compression::WEBP && !TIFFIsCODECConfigured(COMPRESSION_WEBP))) {
+			std::cout << "libtiff does not support the selected compression, using LZW compression instead." << std::endl;
+			_codec = Compression::LZW;
+		}
 		setPyramidTags(_tiff, sizeX, sizeY);
+		_nonEmptyTiles.assign(1, std::vector<bool>(TIFFNumberOfTiles(_tiff), false));
 		unsigned int totalSteps = (sizeX * sizeY) / (_tileSize * _tileSize);
 		if (_monitor) {
 			_monitor->setMaximumProgress(2 * totalSteps);
@@ -158,6 +324,8 @@ int MultiResolutionImageWriter::writeImageInformation(const unsigned long long&
 		}
 		if (_codec == Compression::JPEG2000) {
 			_jpeg2000Codec = new JPEG2000Codec();
+			// Tiles are encoded one at a time, so let OpenJPEG use all cores within a tile
+			_jpeg2000Codec->setNumberOfThreadsPerTile(0);
 		}
 		_totalWritingTime = 0;
 		_totalReadingTime = 0;
@@ -201,6 +369,28 @@ void MultiResolutionImageWriter::writeBaseImagePartToTIFFTile(void* data, unsign
 
 	//Determine min/max of tile part
 	auto startMinMax = std::chrono::steady_clock::now();
+	unsigned int bytesPerSample = 1;
+	if (_dType == DataType::UInt32 || _dType == DataType::Float || _dType == DataType::Float16) {
+		bytesPerSample = 4;
+	}
+	else if (_dType == DataType::UInt16) {
+		bytesPerSample = 2;
+	}
+	if (_skipEmptyTiles && isAllZero(data, npixels * bytesPerSample)) {
+		// The tile is left out of the file, it only adds 0 to the min/max values
+		for (unsigned int j = 0; j < cDepth; ++j) {
+			_max_vals[j] = std::max(_max_vals[j], 0.);
+			_min_vals[j] = std::min(_min_vals[j], 0.);
+		}
+		_totalMinMaxTime += std::chrono::duration<double, milli>(std::chrono::steady_clock::now() - startMinMax).count();
+		if (_monitor) {
+			++(*_monitor);
+		}
+		return;
+	}
+	if (!_nonEmptyTiles.empty() && pos < _nonEmptyTiles[0].size()) {
+		_nonEmptyTiles[0][pos] = true;
+	}
 	if (_dType == DataType::UInt32) {
 		unsigned int* temp = (unsigned int*)data;
 		for (unsigned int i = 0; i < _tileSize * _tileSize * cDepth; i += cDepth) {
@@ -229,7 +419,7 @@ void MultiResolutionImageWriter::writeBaseImagePartToTIFFTile(void* data, unsign
 			}
 		}
 	}
-	else if (_dType == DataType::Float) {
+	else if (_dType == DataType::Float || _dType == DataType::Float16) {
 		float* temp = (float*)data;
 		for (unsigned int i = 0; i < _tileSize * _tileSize * cDepth; i += cDepth) {
 			for (unsigned int j = 0; j < cDepth; ++j) {
@@ -243,11 +433,12 @@ void MultiResolutionImageWriter::writeBaseImagePartToTIFFTile(void* data, unsign
 			}
 		}
 	}
-	else if (_dType == DataType::UChar) {
+	else if (_dType == DataType::UChar || _dType == DataType::Bit) {
 		unsigned char* temp = (unsigned char*)data;
+		bool bits = _dType == DataType::Bit;
 		for (unsigned int i = 0; i < _tileSize * _tileSize * cDepth; i += cDepth) {
 			for (unsigned int j = 0; j < cDepth; ++j) {
-				double val = temp[i + j];
+				double val = bits ? (temp[i + j] != 0) : temp[i + j];
 				if (val > _max_vals[j]) {
 					_max_vals[j] = val;
 				}
@@ -295,18 +486,7 @@ void MultiResolutionImageWriter::writeBaseImagePartToTIFFTile(void* data, unsign
 	}
 	else {
 		auto startTileWrite = std::chrono::steady_clock::now();
-		if (_dType == DataType::Float) {
-			TIFFWriteEncodedTile(_tiff, pos, data, npixels * sizeof(float));
-		}
-		else if (_dType == DataType::UInt16) {
-			TIFFWriteEncodedTile(_tiff, pos, data, npixels * sizeof(unsigned short));
-		}
-		else if (_dType == DataType::UInt32) {
-			TIFFWriteEncodedTile(_tiff, pos, data, npixels * sizeof(unsigned int));
-		}
-		else {
-			TIFFWriteEncodedTile(_tiff, pos, data, npixels * sizeof(unsigned char));
-		}
+		writeTile(_tiff, pos, data, cDepth);
 		auto endTileWrite = std::chrono::steady_clock::now();
 		_totalBaseWritingTime += std::chrono::duration<double, milli>(endTileWrite - startTileWrite).count();
 	}
@@ -315,6 +495,58 @@ void MultiResolutionImageWriter::writeBaseImagePartToTIFFTile(void* data, unsign
 	}
 }
 
+int MultiResolutionImageWriter::writeTile(TIFF* levelTiff, unsigned int tileNr, void* tile, unsigned int nrSamples) {
+	unsigned int nrValues = _tileSize * _tileSize * nrSamples;
+	if (_dType == DataType::Float16) {
+		std::vector<unsigned short> halves(nrValues);
+		convertFloatToHalf((float*)tile, nrValues, halves.data());
+		return TIFFWriteEncodedTile(levelTiff, tileNr, halves.data(), nrValues * sizeof(unsigned short));
+	}
+	else if (_dType == DataType::Bit) {
+		// Every row of the tile starts at a new byte
+		unsigned int rowSize = (_tileSize * nrSamples + 7) / 8;
+		std::vector<unsigned char> bits(rowSize * _tileSize);
+		for (unsigned int y = 0; y < _tileSize; ++y) {
+			packBits((unsigned char*)tile + y * _tileSize * nrSamples, _tileSize * nrSamples, bits.data() + y * rowSize);
+		}
+		return TIFFWriteEncodedTile(levelTiff, tileNr, bits.data(), bits.size());
+	}
+	else if (_dType == DataType::Float) {
+		return TIFFWriteEncodedTile(levelTiff, tileNr, tile, nrValues * sizeof(float));
+	}
+	else if (_dType == DataType::UInt16) {
+		return TIFFWriteEncodedTile(levelTiff, tileNr, tile, nrValues * sizeof(unsigned short));
+	}
+	else if (_dType == DataType::UInt32) {
+		return TIFFWriteEncodedTile(levelTiff, tileNr, tile, nrValues * sizeof(unsigned int));
+	}
+	return TIFFWriteEncodedTile(levelTiff, tileNr, tile, nrValues * sizeof(unsigned char));
+}
+
+int MultiResolutionImageWriter::readTile(TIFF* levelTiff, void* tile, unsigned int x, unsigned int y, unsigned int nrSamples) {
+	unsigned int nrValues = _tileSize * _tileSize * nrSamples;
+	if (_dType == DataType::Float16) {
+		std::vector<unsigned short> halves(nrValues);
+		int result = TIFFReadTile(levelTiff, halves.data(), x, y, 0, 0);
+		if (result >= 0) {
+			convertHalfToFloat(halves.data(), nrValues, (float*)tile);
+		}
+		return result;
+	}
+	else if (_dType == DataType::Bit) {
+		unsigned int rowSize = (_tileSize * nrSamples + 7) / 8;
+		std::vector<unsigned char> bits(rowSize * _tileSize);
+		int result = TIFFReadTile(levelTiff, bits.data(), x, y, 0, 0);
+		if (result >= 0) {
+			for (unsigned int row = 0; row < _tileSize; ++row) {
+				unpackBits(bits.data() + row * rowSize, 0, _tileSize * nrSamples, (unsigned char*)tile + row * _tileSize * nrSamples);
+			}
+		}
+		return result;
+	}
+	return TIFFReadTile(levelTiff, tile, x, y, 0, 0);
+}
+
 int MultiResolutionImageWriter::finishImage() {	
 	if (TIFFIsTiled(_tiff) == 0) {
 		std::cout << "No valid tiles have been written to the base image, cannot finish image." << std::endl;
@@ -345,7 +577,7 @@ int MultiResolutionImageWriter::finishImage() {
 		return -1;
 	}		incorporatePyramid<unsigned short>();
 	}
-	else if (getDataType() == DataType::UChar) {
+	else if (getDataType() == DataType::UChar || getDataType() == DataType::Bit) {
 		if (writePyramidToDisk<unsigned char>() < 0) {
 			std::cout << "Writing pyramid to disk failed, TIFF file is still valid for further analysis." << std::endl;
 			return -1;
@@ -362,7 +594,7 @@ int MultiResolutionImageWriter::finishImage() {
 	auto endPyramidTime = std::chrono::steady_clock::now();
 	_totalPyramidTime += std::chrono::duration<double, milli>(endPyramidTime - startPyramidTime).count();
 	for (std::vector<std::string>::const_iterator it = _levelFiles.begin(); it != _levelFiles.end(); ++it) {
-		for (int i = 0; i < 5; ++i) {
+		for (int i = 0; i < 5 && !it->empty(); ++i) {
 			if (remove(it->c_str()) == 0) {
 				break;
 			}
@@ -371,6 +603,7 @@ int MultiResolutionImageWriter::finishImage() {
 	TIFFClose(_tiff);
 	_tiff = NULL;
 	_levelFiles.clear();
+	_nonEmptyTiles.clear();
 	_fileName = "";
 	_pos = 0;
 	std::cout << "Total time was " << _totalReadingTime + _totalBaseWritingTime + _totalPyramidTime + _jpeg2kCompressionTime << std::endl;
@@ -434,12 +667,32 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 	string fileName = _fileName.substr(found + 1);
 	size_t dotLoc = fileName.find_last_of(".");
 	string baseName = fileName.substr(0, dotLoc);
+	_pyramidSourceLevels.assign(pyramidlevels + 1, -1);
+	if (_passthroughSource) {
+		_pyramidSourceLevels[0] = 0;
+	}
+	_nonEmptyTiles.resize(pyramidlevels + 1);
 	for (unsigned int level = 1; level <= pyramidlevels; ++level) {
 		if (_monitor) {
 			_monitor->setProgress((_monitor->maximumProgress() / 2.) + (static_cast<float>(level) / static_cast<float>(pyramidlevels))* (_monitor->maximumProgress() / 4.));
 		}
+		unsigned int levelw = (unsigned int)(w / pow(_downsamplePerLevel, (double)level));
+		unsigned int levelh = (unsigned int)(h / pow(_downsamplePerLevel, (double)level));
+		// Levels present in the source are copied in incorporatePyramid; the lowest level is always
+		// generated, as the SVS thumbnail is created from its temporary file
+		int sourceLevel = level < pyramidlevels ? findPassthroughSourceLevel(levelw, levelh) : -1;
+		if (sourceLevel >= 0) {
+			_pyramidSourceLevels[level] = sourceLevel;
+			_levelFiles.push_back("");
+			if (!spacing.empty()) {
+				spacing[0] *= _downsamplePerLevel;
+				spacing[1] *= _downsamplePerLevel;
+			}
+			continue;
+		}
 		TIFF* prevLevelTiff = _tiff;
-		if (level != 1) {
+		int prevSourceLevel = _pyramidSourceLevels[level - 1];
+		if (level != 1 && prevSourceLevel < 0) {
 			std::stringstream ssm;
 			ssm << tmpPth << "temp" << baseName << "Level" << level - 1 << ".tif";
 			prevLevelTiff = TIFFOpen(ssm.str().c_str(), "r");
@@ -448,8 +701,6 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 		ssm << tmpPth << "temp" << baseName << "Level" << level << ".tif";
 		TIFF* levelTiff = TIFFOpen(ssm.str().c_str(), "w8");
 		_levelFiles.push_back(ssm.str());
-		unsigned int levelw = (unsigned int)(w / pow(_downsamplePerLevel, (double)level));
-		unsigned int levelh = (unsigned int)(h / pow(_downsamplePerLevel, (double)level));
 		unsigned int prevLevelw = (unsigned int)(w / pow(_downsamplePerLevel, (double)level - 1));
 		unsigned int prevLevelh = (unsigned int)(h / pow(_downsamplePerLevel, (double)level - 1));
 		setTempPyramidTags(levelTiff, levelw, levelh);
@@ -457,6 +708,18 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 		unsigned int nrTilesY = (unsigned int)ceil(float(levelh) / _tileSize);
 		unsigned int levelTiles = nrTilesX * nrTilesY;
 		unsigned int npixels = _tileSize * _tileSize * nrsamples;
+		// Tiles of the previous level which were not written are empty, they are neither read nor
+		// downscaled, and output tiles which only cover empty tiles are not computed
+		const std::vector<bool>& prevNonEmpty = _nonEmptyTiles[level - 1];
+		auto isPrevTileEmpty = [&](unsigned int x, unsigned int y) {
+			if (prevSourceLevel >= 0 || prevNonEmpty.empty()) {
+				return false;
+			}
+			unsigned int tileNr = TIFFComputeTile(prevLevelTiff, x, y, 0, 0);
+			return tileNr >= prevNonEmpty.size() || !prevNonEmpty[tileNr];
+		};
+		std::vector<bool>& levelNonEmpty = _nonEmptyTiles[level];
+		levelNonEmpty.assign(levelTiles, false);
 		int rowOrg = -_downsamplePerLevel, colOrg = 0;
 		for (unsigned int i = 0; i < levelTiles; ++i) {
 			if (i % nrTilesX == 0) {
@@ -466,6 +729,17 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 			unsigned int xpos = _tileSize * colOrg;
 			unsigned int ypos = _tileSize * rowOrg;
 			int inpTilesForOutpTile = _downsamplePerLevel * _downsamplePerLevel;
+			bool allEmpty = true;
+			for (int inRow = 0; inRow < _downsamplePerLevel && allEmpty; inRow++) {
+				for (int inCol = 0; inCol < _downsamplePerLevel && allEmpty; inCol++) {
+					unsigned int inX = xpos + inCol * _tileSize, inY = ypos + inRow * _tileSize;
+					allEmpty = inX >= prevLevelw || inY >= prevLevelh || isPrevTileEmpty(inX, inY);
+				}
+			}
+			if (allEmpty) {
+				colOrg += _downsamplePerLevel;
+				continue;
+			}
 			std::vector<T*> tiles;
 			std::vector<bool> tiles_valid;
 			for (int inTileNr = 0; inTileNr < inpTilesForOutpTile; ++inTileNr) {
@@ -474,10 +748,29 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 			}
 			T* outTile = (T*)_TIFFmalloc(npixels * sizeof(T));
 			unsigned int size = npixels * sizeof(T);
-			if (level == 1 && (getCompression() == Compression::JPEG2000)) {
+			if (prevSourceLevel >= 0) {
+				// The previous level was copied from the source, decode its tiles from there
+				double sourceDownsample = _passthroughSource->getLevelDownsample(prevSourceLevel);
 				for (int inRow = 0; inRow < _downsamplePerLevel; inRow++) {
 					for (int inCol = 0; inCol < _downsamplePerLevel; inCol++) {
+						T* inTile = tiles[inRow * _downsamplePerLevel + inCol];
 						if (xpos + inCol * _tileSize >= prevLevelw || ypos + inRow * _tileSize >= prevLevelh) {
+							std::fill_n(inTile, npixels, static_cast<T>(0));
+						}
+						else {
+							T* region = new T[npixels];
+							_passthroughSource->getRawRegion<T>((xpos + inCol * _tileSize) * sourceDownsample, (ypos + inRow * _tileSize) * sourceDownsample, _tileSize, _tileSize, prevSourceLevel, region);
+							std::copy(region, region + npixels, inTile);
+							delete[] region;
+							tiles_valid[inRow * _downsamplePerLevel + inCol] = true;
+						}
+					}
+				}
+			}
+			else if (level == 1 && (getCompression() == Compression::JPEG2000)) {
+				for (int inRow = 0; inRow < _downsamplePerLevel; inRow++) {
+					for (int inCol = 0; inCol < _downsamplePerLevel; inCol++) {
+						if (xpos + inCol * _tileSize >= prevLevelw || ypos + inRow * _tileSize >= prevLevelh || isPrevTileEmpty(xpos + inCol * _tileSize, ypos + inRow * _tileSize)) {
 							std::fill_n(tiles[inRow * _downsamplePerLevel + inCol], npixels, static_cast<T>(0));
 						}
 						else {
@@ -497,10 +790,10 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 			else {
 				for (int inRow = 0; inRow < _downsamplePerLevel; inRow++) {
 					for (int inCol = 0; inCol < _downsamplePerLevel; inCol++) {
-						if (xpos + inCol * _tileSize >= prevLevelw || ypos + inRow * _tileSize >= prevLevelh) {
+						if (xpos + inCol * _tileSize >= prevLevelw || ypos + inRow * _tileSize >= prevLevelh || isPrevTileEmpty(xpos + inCol * _tileSize, ypos + inRow * _tileSize)) {
 							std::fill_n(tiles[inRow * _downsamplePerLevel + inCol], npixels, static_cast<T>(0));
 						} else {
-							if (TIFFReadTile(prevLevelTiff, tiles[inRow * _downsamplePerLevel + inCol], xpos + inCol * _tileSize, ypos + inRow * _tileSize, 0, 0) < 0) {
+							if (readTile(prevLevelTiff, tiles[inRow * _downsamplePerLevel + inCol], xpos + inCol * _tileSize, ypos + inRow * _tileSize, nrsamples) < 0) {
 								std::fill_n(tiles[inRow * _downsamplePerLevel + inCol], npixels, static_cast<T>(0));
 							}
 							else {
@@ -512,10 +805,17 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 			}
 			if (std::any_of(tiles_valid.begin(), tiles_valid.end(), [](bool v) { return v; })) {
 				std::vector<T*> dsTiles;
-				for (auto tile : tiles) {
-					dsTiles.push_back(downscaleTile(tile, _tileSize, nrsamples));
-				}
 				unsigned int dsSize = _tileSize / _downsamplePerLevel;
+				for (unsigned int k = 0; k < tiles.size(); ++k) {
+					if (tiles_valid[k]) {
+						dsTiles.push_back(downscaleTile(tiles[k], _tileSize, nrsamples));
+					}
+					else {
+						T* dsTile = (T*)_TIFFmalloc(dsSize * dsSize * nrsamples * sizeof(T));
+						std::fill_n(dsTile, dsSize * dsSize * nrsamples, static_cast<T>(0));
+						dsTiles.push_back(dsTile);
+					}
+				}
 				for (unsigned int y = 0; y < _tileSize; ++y) {
 					for (unsigned int x = 0; x < _tileSize; ++x) {
 						for (unsigned int s = 0; s < nrsamples; ++s) {
@@ -530,7 +830,10 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 						}
 					}
 				}
-				TIFFWriteEncodedTile(levelTiff, i, outTile, npixels * sizeof(T));
+				if (!_skipEmptyTiles || !isAllZero(outTile, npixels * sizeof(T))) {
+					writeTile(levelTiff, i, outTile, nrsamples);
+					levelNonEmpty[i] = true;
+				}
 				for (auto tile : dsTiles) {
 					_TIFFfree(tile);
 				}
@@ -541,7 +844,7 @@ template <typename T> int MultiResolutionImageWriter::writePyramidToDisk() {
 			_TIFFfree(outTile);
 			colOrg += _downsamplePerLevel;
 		}
-		if (level != 1) {
+		if (prevLevelTiff != _tiff) {
 			TIFFClose(prevLevelTiff);
 		}
 		TIFFSetField(_tiff, TIFFTAG_RESOLUTIONUNIT, RESUNIT_CENTIMETER);
@@ -568,6 +871,24 @@ template <typename T> int MultiResolutionImageWriter::incorporatePyramid() {
 		if (_monitor) {
 			_monitor->setProgress(3 * (_monitor->maximumProgress() / 4.) + ((static_cast<float>(it - _levelFiles.begin()) + 1.0) / static_cast<float>(_levelFiles.size()))* (_monitor->maximumProgress() / 4.));
 		}
+		int sourceLevel = _pyramidSourceLevels.size() > (it - _levelFiles.begin()) + 1 ? _pyramidSourceLevels[(it - _levelFiles.begin()) + 1] : -1;
+		if (sourceLevel >= 0) {
+			EncodedTileInfo info;
+			_passthroughSource->getEncodedTileInfo(sourceLevel, info);
+			std::vector<unsigned long long> dims = _passthroughSource->getLevelDimensions(sourceLevel);
+			std::vector<double> spacing = _overrideSpacing.empty() ? _passthroughSource->getSpacing() : _overrideSpacing;
+			if (spacing.size() >= 2) {
+				spacing[0] *= _passthroughSource->getLevelDownsample(sourceLevel);
+				spacing[1] *= _passthroughSource->getLevelDownsample(sourceLevel);
+			}
+			setPyramidTags(_tiff, dims[0], dims[1]);
+			TIFFSetField(_tiff, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+			setEncodedTileTags(_tiff, info);
+			copyEncodedTiles(_passthroughSource, sourceLevel, dims[0], dims[1]);
+			setSpacing(spacing);
+			TIFFWriteDirectory(_tiff);
+			continue;
+		}
 		TIFF* level = TIFFOpen(it->c_str(), "rm");
 
 		float spacingX = 0, spacingY = 0;
@@ -585,7 +906,7 @@ template <typename T> int MultiResolutionImageWriter::incorporatePyramid() {
 		setPyramidTags(_tiff, levelw, levelh);
 		TIFFSetField(_tiff, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
 		TIFFGetField(level, TIFFTAG_SAMPLESPERPIXEL, &nrsamples);
-		writePyramidLevel<T>(level, levelw, levelh, nrsamples);
+		writePyramidLevel<T>(level, levelw, levelh, nrsamples, _nonEmptyTiles[(it - _levelFiles.begin()) + 1]);
 
 		setSpacing(spacing);
 		TIFFWriteDirectory(_tiff);
@@ -620,6 +941,14 @@ void MultiResolutionImageWriter::setBaseTags(TIFF* levelTiff) {
 		TIFFSetField(levelTiff, TIFFTAG_BITSPERSAMPLE, sizeof(float) * 8);
 		TIFFSetField(levelTiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
 	}
+	else if (_dType == DataType::Float16) {
+		TIFFSetField(levelTiff, TIFFTAG_BITSPERSAMPLE, 16);
+		TIFFSetField(levelTiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+	}
+	else if (_dType == DataType::Bit) {
+		TIFFSetField(levelTiff, TIFFTAG_BITSPERSAMPLE, 1);
+		TIFFSetField(levelTiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+	}
 	if (_cType == ColorType::Monochrome) {
 		TIFFSetField(levelTiff, TIFFTAG_SAMPLESPERPIXEL, 1);
 	}
@@ -655,6 +984,27 @@ void MultiResolutionImageWriter::setPyramidTags(TIFF* levelTiff, const unsigned
 	else if (_codec == Compression::JPEG2000) {
 		TIFFSetField(levelTiff, TIFFTAG_COMPRESSION, 33005);
 	}
+	else if (_codec == Compression::ZSTD) {
+		TIFFSetField(levelTiff, TIFFTAG_COMPRESSION, COMPRESSION_ZSTD);
+		TIFFSetField(levelTiff, TIFFTAG_ZSTD_LEVEL, _compressionLevel);
+	}
+	else if (_codec == Compression::WEBP) {
+		TIFFSetField(levelTiff, TIFFTAG_COMPRESSION, COMPRESSION_WEBP);
+		if (_quality >= 100) {
+			TIFFSetField(levelTiff, TIFFTAG_WEBP_LOSSLESS, 1);
+		}
+		else {
+			TIFFSetField(levelTiff, TIFFTAG_WEBP_LEVEL, (int)_quality);
+		}
+	}
+	if (_usePredictor && (_codec == Compression::LZW || _codec == Compression::ZSTD) && _dType != DataType::Bit) {
+		if (_dType == DataType::Float || _dType == DataType::Float16) {
+			TIFFSetField(levelTiff, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+		}
+		else {
+			TIFFSetField(levelTiff, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+		}
+	}
 
 	TIFFSetField(levelTiff, TIFFTAG_TILEWIDTH, _tileSize);
 	TIFFSetField(levelTiff, TIFFTAG_TILELENGTH, _tileSize);
@@ -689,7 +1039,8 @@ template <typename T> T* MultiResolutionImageWriter::downscaleTile(T* inTile, un
 							interVal += (*(inTile + index + j * (tileSize * nrSamples) + i * nrSamples) / ((float)_downsamplePerLevel * _downsamplePerLevel));
 						}
 					}
-					*(dsTile + dsIndex) = (T)interVal;
+					// Masks keep the value which covers at least half of the pixels
+					*(dsTile + dsIndex) = _dType == DataType::Bit ? (T)(interVal + 0.5f) : (T)interVal;
 				}
 				else {
 					*(dsTile + dsIndex) = (T)(*(inTile + index));
@@ -702,9 +1053,10 @@ template <typename T> T* MultiResolutionImageWriter::downscaleTile(T* inTile, un
 	return dsTile;
 }
 
-template <typename T> void MultiResolutionImageWriter::writePyramidLevel(TIFF* levelTiff, unsigned int levelwidth, unsigned int levelheight, unsigned int nrsamples) {
+template <typename T> void MultiResolutionImageWriter::writePyramidLevel(TIFF* levelTiff, unsigned int levelwidth, unsigned int levelheight, unsigned int nrsamples, const std::vector<bool>& nonEmptyTiles) {
 	unsigned int npixels = _tileSize * _tileSize * nrsamples;
 	T* raster = (T*)_TIFFmalloc(npixels * sizeof(T));
+	std::vector<unsigned int> tileNumbers = getOrderedTileNumbers((levelwidth + _tileSize - 1) / _tileSize, (levelheight + _tileSize - 1) / _tileSize);
 	if (getCompression() == Compression::JPEG2000) {
 		int depth = 8;
 		unsigned int size = npixels * sizeof(unsigned char);
@@ -725,7 +1077,10 @@ template <typename T> void MultiResolutionImageWriter::writePyramidLevel(TIFF* l
 		}
 
 		float rate = getJPEGQuality();
-		for (unsigned int i = 0; i < TIFFNumberOfTiles(levelTiff); ++i) {
+		for (unsigned int i : tileNumbers) {
+			if (i < nonEmptyTiles.size() && !nonEmptyTiles[i]) {
+				continue;
+			}
 			if (TIFFReadEncodedTile(levelTiff, i, raster, npixels * sizeof(T)) > 0) {
 				unsigned int size = npixels * sizeof(T);
 				TIFFWriteRawTile(_tiff, i, raster, size);
@@ -733,9 +1088,14 @@ template <typename T> void MultiResolutionImageWriter::writePyramidLevel(TIFF* l
 		}
 	}
 	else {
-		for (unsigned int i = 0; i < TIFFNumberOfTiles(levelTiff); ++i) {
-			if (TIFFReadEncodedTile(levelTiff, i, raster, npixels * sizeof(T)) > 0) {
-				TIFFWriteEncodedTile(_tiff, i, raster, npixels * sizeof(T));
+		// The tiles are copied as stored, which for Float16 and Bit is less than npixels values of T
+		for (unsigned int i : tileNumbers) {
+			if (i < nonEmptyTiles.size() && !nonEmptyTiles[i]) {
+				continue;
+			}
+			tmsize_t size = TIFFReadEncodedTile(levelTiff, i, raster, npixels * sizeof(T));
+			if (size > 0) {
+				TIFFWriteEncodedTile(_tiff, i, raster, size);
 			}
 		}
 	}
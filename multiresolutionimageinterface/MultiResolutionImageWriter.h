@@ -9,6 +9,7 @@ struct tiff;
 typedef struct tiff TIFF;
 
 class MultiResolutionImage;
+struct EncodedTileInfo;
 class ProgressMonitor;
 class JPEG2000Codec;
 
@@ -17,6 +18,7 @@ namespace pathology {
   enum class Interpolation: int;
   enum class ColorType : int;
   enum class DataType : int;
+  enum class TileOrder : int;
 }
 
 //! This class can be used to write images to disk in a multi-resolution pyramid fashion.
@@ -25,7 +27,10 @@ namespace pathology {
 //! information (writeImageInformation), write the base parts (writeBaseParts) and then finish
 //! the pyramid (finishImage). The class also contains a convenience function (writeImage), 
 //! which writes an entire MultiResolutionImage to disk using the image properties (color, data)
-//! and the specified codec.
+//! and the specified codec. When the source image stores its tiles with the same codec and tile
+//! size (e.g. JPEG tiles in SVS, TIFF or DICOM files), writeImage copies the compressed tiles
+//! as-is instead of decoding and re-encoding them. Pyramid levels which the source already
+//! contains are copied as well, only the missing levels are generated.
 
 class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT MultiResolutionImageWriter {
 protected:
@@ -57,9 +62,18 @@ protected:
   //! Compression
   pathology::Compression _codec;
 
+  //! ZSTD compression level
+  int _compressionLevel;
+
+  //! Whether LZW and ZSTD tiles are written with a predictor
+  bool _usePredictor;
+
   //! Pyramid interpolation type
   pathology::Interpolation _interpolation;
 
+  //! Order in which the tiles of a level are stored in the file
+  pathology::TileOrder _tileOrder;
+
   //! Data type
   pathology::DataType _dType;
 
@@ -88,16 +102,44 @@ protected:
   void setBaseTags(TIFF* levelTiff);
   void setPyramidTags(TIFF* levelTiff, const unsigned long long& width, const unsigned long long& hight);
   void setTempPyramidTags(TIFF* levelTiff, const unsigned long long& width, const unsigned long long& hight);
-  template <typename T> void writePyramidLevel(TIFF* levelTiff, unsigned int levelwidth, unsigned int levelheight, unsigned int nrsamples);
+  template <typename T> void writePyramidLevel(TIFF* levelTiff, unsigned int levelwidth, unsigned int levelheight, unsigned int nrsamples, const std::vector<bool>& nonEmptyTiles);
   template <typename T> T* downscaleTile(T* inTile, unsigned int tileSize, unsigned int nrSamples);
   template <typename T> int writePyramidToDisk();
   template <typename T> int incorporatePyramid();
   void writeBaseImagePartToTIFFTile(void* data, unsigned int pos);
 
-  //! Temporary storage for the levelFiles
+  //! Write and read a tile of the current data type, Float16 and Bit tiles are passed as float
+  //! and unsigned char 0/1 and converted to and from halves and packed bits around libtiff
+  int writeTile(TIFF* levelTiff, unsigned int tileNr, void* tile, unsigned int nrSamples);
+  int readTile(TIFF* levelTiff, void* tile, unsigned int x, unsigned int y, unsigned int nrSamples);
+
+  //! Copies the compressed tiles of a level of the source image to the current directory
+  void copyEncodedTiles(MultiResolutionImage* source, const unsigned int& level, const unsigned long long& width, const unsigned long long& height);
+  void setEncodedTileTags(TIFF* levelTiff, const EncodedTileInfo& info);
+  //! Whether the codec and tile size of a source level match the writer settings
+  bool isPassthroughCompatible(const EncodedTileInfo& info) const;
+  int findPassthroughSourceLevel(const unsigned long long& width, const unsigned long long& height) const;
+
+  //! Temporary storage for the levelFiles, empty for levels which are copied from the source
   std::vector<std::string> _levelFiles;
   JPEG2000Codec* _jpeg2000Codec;
 
+  //! Whether compressed tiles may be copied from the source image
+  bool _tilePassthrough;
+
+  //! Image whose compressed tiles are copied while writing, this object is not the owner!
+  MultiResolutionImage* _passthroughSource;
+
+  //! For each level of the output the level of _passthroughSource it is copied from, or -1
+  std::vector<int> _pyramidSourceLevels;
+
+  //! Whether tiles of which all samples are 0 are left out of the file
+  bool _skipEmptyTiles;
+
+  //! For each level of the output which tiles have been written, tiles which are not written are
+  //! empty and are not read again when building the pyramid. Empty for levels copied from the source.
+  std::vector<std::vector<bool> > _nonEmptyTiles;
+
 public:
   MultiResolutionImageWriter();
   virtual ~MultiResolutionImageWriter();
@@ -123,10 +165,27 @@ public:
   //! Subsequently the image will be closed.
   virtual int finishImage();
 
-  //! Sets the compression
+  //! Sets the compression. WebP only supports 8-bit RGB and RGBA images, others are written with
+  //! LZW; ZSTD and WebP also fall back to LZW when libtiff was built without them.
   void setCompression(const pathology::Compression& codec) 
   {_codec = codec;}
 
+  //! Sets the ZSTD compression level, from 1 (fastest) to 22 (smallest), default 9
+  void setCompressionLevel(const int& level)
+  {_compressionLevel = level;}
+
+  const int getCompressionLevel() const
+  {return _compressionLevel;}
+
+  //! Enables or disables the predictor for LZW and ZSTD (default disabled): the horizontal
+  //! differencing predictor for integer data and the floating point predictor for Float and
+  //! Float16 data, which make smooth images compress much better
+  void setUsePredictor(const bool& usePredictor)
+  {_usePredictor = usePredictor;}
+
+  const bool getUsePredictor() const
+  {return _usePredictor;}
+
   //! Gets the compression
   const pathology::Compression getCompression() const 
   {return _codec;}
@@ -139,6 +198,22 @@ public:
   const pathology::Interpolation getInterpolation() const 
   {return _interpolation;}
 
+  //! Sets the order in which the tiles of each level are stored in the file (default raster).
+  //! With Z-order or Hilbert order tiles which are close in the image are close in the file, so
+  //! reading a region needs fewer seeks and TIFFImage reads neighbouring tiles with a single I/O.
+  //! The tile offsets stay standard TIFF, so other readers are not affected. Pyramid levels and
+  //! images written with writeImageToFile follow the order; base parts written with
+  //! writeBaseImagePart are stored in the order they are written, use getOrderedTileNumbers and
+  //! writeBaseImagePartToLocation to write them in locality order.
+  void setTileOrder(const pathology::TileOrder& tileOrder)
+  {_tileOrder = tileOrder;}
+
+  const pathology::TileOrder getTileOrder() const
+  {return _tileOrder;}
+
+  //! Returns the numbers (y * nrTilesX + x) of the tiles of a level in the tile order
+  std::vector<unsigned int> getOrderedTileNumbers(const unsigned long long& nrTilesX, const unsigned long long& nrTilesY) const;
+
   //! Get the maximum number of pyramid levels (-1 means determine automatically)
   const int getMaxNumberOfPyramidLevels() const {
       return _maxPyramidLevels;
@@ -159,7 +234,9 @@ public:
       _downsamplePerLevel = downsamplePerLevel;
   }
 
-  //! Sets the datatype
+  //! Sets the datatype. The parts of Float16 images are written as float and those of Bit images
+  //! as unsigned char, in which every non-zero value is 1. These types cannot be compressed with
+  //! JPEG or JPEG2000, LZW is used instead.
   void setDataType(const pathology::DataType& dType) 
   {
     _dType = dType;
@@ -210,7 +287,8 @@ public:
     _overrideSpacing = spacing;
   }
 
-  //! Set JPEG quality (default value = 30)
+  //! Set JPEG quality (default value = 30), also the rate of JPEG2000 and the quality of WebP, for
+  //! both of which 100 is lossless
   const int setJPEGQuality(const float& quality) 
   {if (quality > 0 && quality <= 100) {_quality = quality; return 0;} else {return -1;} }
 
@@ -219,6 +297,32 @@ public:
 
   void setProgressMonitor(ProgressMonitor* monitor);
 
+  //! Enables or disables leaving tiles of which all samples are 0 out of the file (default
+  //! disabled, so files stay readable by readers which do not support sparse files). They get a
+  //! byte count of 0, as in sparse GDAL and OpenSlide files, and read back as 0 in TIFFImage.
+  //! Pyramid tiles of which all tiles below are empty are not computed at all.
+  void setSkipEmptyTiles(const bool& skipEmptyTiles) {
+    _skipEmptyTiles = skipEmptyTiles;
+  }
+
+  const bool getSkipEmptyTiles() const {
+    return _skipEmptyTiles;
+  }
+
+  //! Enables or disables copying compressed tiles from the source in writeImageToFile (default enabled)
+  void setTilePassthrough(const bool& tilePassthrough) {
+    _tilePassthrough = tilePassthrough;
+  }
+
+  const bool getTilePassthrough() const {
+    return _tilePassthrough;
+  }
+
+  //! Whether writeImageToFile would copy the compressed base tiles of img with the current
+  //! settings: passthrough is enabled, img is RGB UChar and its codec and tile size are the ones
+  //! set on the writer
+  bool canCopyEncodedTiles(MultiResolutionImage* img) const;
+
 };
 
 #endif
@@ -1,7 +1,9 @@
 #include "OpenSlideImage.h"
 #include <shared_mutex>
 #include "openslide.h" 
+#include "PixelConversion.h"
 #include <sstream>
+#include <vector>
 
 using namespace pathology;
 
@@ -101,6 +103,16 @@ std::string OpenSlideImage::getProperty(const std::string& propertyName) {
   return propertyValue;
 }
 
+bool OpenSlideImage::readRegionBGRA(const long long& startX, const long long& startY, const unsigned long long& width,
+  const unsigned long long& height, const unsigned int& level, unsigned int* data) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_isValid || level >= _numberOfLevels) {
+    return false;
+  }
+  openslide_read_region(_slide, data, startX, startY, level, width, height);
+  return openslide_get_error(_slide) == NULL;
+}
+
 void* OpenSlideImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level) {
   
@@ -108,31 +120,25 @@ void* OpenSlideImage::readDataFromImage(const long long& startX, const long long
     return NULL;
   }
 
+  // OpenSlide writes 4 bytes per pixel, convert to RGB in place so the buffer can be handed to
+  // the caller without a second allocation
   std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
-  unsigned int* temp = new unsigned int[width*height];
-  openslide_read_region(_slide, temp, startX, startY, level, width, height);
+  unsigned char* rgb = new unsigned char[width * height * 4];
+  openslide_read_region(_slide, reinterpret_cast<uint32_t*>(rgb), startX, startY, level, width, height);
+  convertPremultipliedBGRAToRGB(rgb, width * height, rgb, _bg_r, _bg_g, _bg_b);
+  return rgb;
+}
 
-  unsigned char* rgb = new unsigned char[width*height*3];
-  unsigned char* bgra = (unsigned char*)temp;
-  for (unsigned long long i = 0, j = 0; i < width*height*4; i+=4, j+=3) {
-    if (bgra[i + 3] == 255) {
-      rgb[j] = bgra[i + 2];
-      rgb[j + 1] = bgra[i + 1];
-      rgb[j + 2] = bgra[i];
-    }
-    else if (bgra[i + 3] == 0) {
-      rgb[j] = _bg_r;
-      rgb[j + 1] = _bg_g;
-      rgb[j + 2] = _bg_b;
-    }
-    else {
-      rgb[j] = (255. * bgra[i + 2]) / bgra[i + 3];
-      rgb[j + 1] = (255. * bgra[i + 1]) / bgra[i + 3];
-      rgb[j + 2] = (255. * bgra[i]) / bgra[i + 3];
-    }
+bool OpenSlideImage::readDataFromImageInto(const long long& startX, const long long& startY, const unsigned long long& width,
+  const unsigned long long& height, const unsigned int& level, void* data) {
+  // The caller's buffer only holds RGB, so OpenSlide's output is converted into it from a
+  // temporary buffer; this saves the copy getRawRegionInto would make otherwise
+  std::vector<unsigned int> bgra(width * height);
+  if (!readRegionBGRA(startX, startY, width, height, level, bgra.data())) {
+    return false;
   }
-  delete[] temp;
-  return rgb;
+  convertPremultipliedBGRAToRGB(reinterpret_cast<const unsigned char*>(bgra.data()), width * height, static_cast<unsigned char*>(data), _bg_r, _bg_g, _bg_b);
+  return true;
 }
 
 void OpenSlideImage::cleanup() {
@@ -22,11 +22,19 @@ public:
 
   void setCacheSize(const unsigned long long cacheSize);
 
+  //! Reads a region in OpenSlide's native format (premultiplied ARGB, native-endian 32-bit, e.g.
+  //! QImage::Format_ARGB32_Premultiplied) directly into data, which has to hold width * height
+  //! values. Skips the RGB conversion for consumers which can render this format as is.
+  bool readRegionBGRA(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level, unsigned int* data);
+
 protected :
   void cleanup();
   
   void* readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level);
+  bool readDataFromImageInto(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level, void* data);
 
   openslide_t* _slide;
 
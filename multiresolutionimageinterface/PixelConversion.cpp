@@ -0,0 +1,424 @@
+#include "PixelConversion.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define PIXELCONVERSION_SSSE3 1
+#define PIXELCONVERSION_TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <tmmintrin.h>
+#define PIXELCONVERSION_SSSE3 1
+#define PIXELCONVERSION_TARGET_SSSE3
+#endif
+
+namespace {
+
+  inline float halfToFloat(const unsigned short& half) {
+    unsigned int sign = static_cast<unsigned int>(half & 0x8000) << 16;
+    unsigned int exponent = (half >> 10) & 0x1f;
+    unsigned int mantissa = half & 0x3ff;
+    unsigned int bits;
+    if (exponent == 0) {
+      // Zero or subnormal, of which the value is mantissa * 2^-24
+      float value = mantissa * 5.9604644775390625e-8f;
+      std::memcpy(&bits, &value, sizeof(bits));
+      bits |= sign;
+    }
+    else if (exponent == 31) {
+      bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+
+  inline unsigned short floatToHalf(const float& value) {
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    unsigned short sign = static_cast<unsigned short>((bits >> 16) & 0x8000);
+    unsigned int magnitude = bits & 0x7fffffff;
+    if (magnitude >= 0x7f800000) {
+      return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    // 65520 and up round to infinity
+    if (magnitude >= 0x477ff000) {
+      return sign | 0x7c00;
+    }
+    unsigned int half;
+    unsigned int remainder;
+    unsigned int tie;
+    if (magnitude < 0x38800000) {
+      // Below the smallest normal half, 2^-14
+      if (magnitude < 0x33000000) {
+        return sign;
+      }
+      unsigned int mantissa = (magnitude & 0x7fffff) | 0x800000;
+      unsigned int shift = 126 - (magnitude >> 23);
+      half = mantissa >> shift;
+      remainder = mantissa & ((1u << shift) - 1);
+      tie = 1u << (shift - 1);
+    }
+    else {
+      half = (magnitude - 0x38000000) >> 13;
+      remainder = magnitude & 0x1fff;
+      tie = 0x1000;
+    }
+    if (remainder > tie || (remainder == tie && (half & 1))) {
+      ++half;
+    }
+    return sign | static_cast<unsigned short>(half);
+  }
+
+  // 16.16 fixed point reciprocals of the alpha values, (c * reciprocal[a]) >> 16 equals
+  // floor(255 * c / a) for all c, a in [0, 255]
+  struct AlphaReciprocals {
+    unsigned int values[256];
+    AlphaReciprocals() {
+      values[0] = 0;
+      for (unsigned int a = 1; a < 256; ++a) {
+        values[a] = ((255u << 16) + a - 1) / a;
+      }
+    }
+  };
+
+  const AlphaReciprocals alphaReciprocals;
+
+  inline unsigned char unpremultiply(unsigned int value, unsigned int reciprocal) {
+    unsigned int result = (value * reciprocal) >> 16;
+    return result > 255 ? 255 : static_cast<unsigned char>(result);
+  }
+
+  inline void convertPixel(const unsigned char* bgra, unsigned char* rgb, const unsigned char* background) {
+    unsigned char alpha = bgra[3];
+    unsigned char b = bgra[0], g = bgra[1], r = bgra[2];
+    if (alpha == 255) {
+      rgb[0] = r;
+      rgb[1] = g;
+      rgb[2] = b;
+    }
+    else if (alpha == 0) {
+      rgb[0] = background[0];
+      rgb[1] = background[1];
+      rgb[2] = background[2];
+    }
+    else {
+      unsigned int reciprocal = alphaReciprocals.values[alpha];
+      rgb[0] = unpremultiply(r, reciprocal);
+      rgb[1] = unpremultiply(g, reciprocal);
+      rgb[2] = unpremultiply(b, reciprocal);
+    }
+  }
+
+  unsigned long long convertScalar(const unsigned char* bgra, unsigned long long first, const unsigned long long& nrPixels, unsigned char* rgb, const unsigned char* background) {
+    for (; first < nrPixels; ++first) {
+      convertPixel(bgra + 4 * first, rgb + 3 * first, background);
+    }
+    return first;
+  }
+
+#ifdef PIXELCONVERSION_SSSE3
+  bool cpuSupportsSSSE3() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+  }
+
+  const bool hasSSSE3 = cpuSupportsSSSE3();
+
+  // Converts four pixels per iteration, blocks which are not fully opaque fall back to the scalar
+  // path. Every store writes 16 bytes of which the last 4 are overwritten by the next block, so
+  // stop 6 pixels before the end to stay inside the output.
+  PIXELCONVERSION_TARGET_SSSE3 unsigned long long convertSSSE3(const unsigned char* bgra, const unsigned long long& nrPixels, unsigned char* rgb, const unsigned char* background) {
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const __m128i toRGB = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    unsigned long long i = 0;
+    for (; i + 6 <= nrPixels; i += 4) {
+      __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgra + 4 * i));
+      __m128i opaque = _mm_cmpeq_epi8(_mm_and_si128(pixels, alphaMask), alphaMask);
+      if (_mm_movemask_epi8(opaque) == 0xFFFF) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + 3 * i), _mm_shuffle_epi8(pixels, toRGB));
+      }
+      else {
+        for (unsigned int p = 0; p < 4; ++p) {
+          convertPixel(bgra + 4 * (i + p), rgb + 3 * (i + p), background);
+        }
+      }
+    }
+    return i;
+  }
+#endif
+
+  // Sums two rows of 8-bit samples into 16-bit sums
+  unsigned long long sumRowsScalar(const unsigned char* row0, const unsigned char* row1, unsigned long long first, const unsigned long long& size, unsigned short* sums) {
+    for (; first < size; ++first) {
+      sums[first] = static_cast<unsigned short>(row0[first] + row1[first]);
+    }
+    return first;
+  }
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  // SSE2 is part of x86-64, so this needs no check of the CPU
+  unsigned long long sumRowsSSE2(const unsigned char* row0, const unsigned char* row1, const unsigned long long& size, unsigned short* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    unsigned long long i = 0;
+    for (; i + 16 <= size; i += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i + 8), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+    return i;
+  }
+  // Whether all bytes from 0 up to the returned multiple of 64 are zero, stops at the first
+  // block which is not
+  unsigned long long zeroPrefixSSE2(const unsigned char* data, const unsigned long long& size) {
+    unsigned long long i = 0;
+    for (; i + 64 <= size; i += 64) {
+      __m128i block = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16))),
+        _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48))));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128())) != 0xffff) {
+        break;
+      }
+    }
+    return i;
+  }
+
+  // Adds weight times 8-bit samples to float sums, 16 samples at a time
+  unsigned long long accumulateWeightedRowSSE2(const unsigned char* row, const unsigned long long& size, const float& weight, float* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 factor = _mm_set1_ps(weight);
+    unsigned long long i = 0;
+    for (; i + 16 <= size; i += 16) {
+      __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      __m128i low = _mm_unpacklo_epi8(bytes, zero);
+      __m128i high = _mm_unpackhi_epi8(bytes, zero);
+      __m128i words[4] = { _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero), _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero) };
+      for (unsigned int j = 0; j < 4; ++j) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(sums + i + 4 * j), _mm_mul_ps(factor, _mm_cvtepi32_ps(words[j])));
+        _mm_storeu_ps(sums + i + 4 * j, sum);
+      }
+    }
+    return i;
+  }
+
+  unsigned long long accumulateWeightedRowSSE2(const float* row, const unsigned long long& size, const float& weight, float* sums) {
+    const __m128 factor = _mm_set1_ps(weight);
+    unsigned long long i = 0;
+    for (; i + 4 <= size; i += 4) {
+      _mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), _mm_mul_ps(factor, _mm_loadu_ps(row + i))));
+    }
+    return i;
+  }
+#define PIXELCONVERSION_SSE2 1
+#endif
+
+  // Averages the column sums of pairs of pixels; a constant number of samples (N > 0) lets the
+  // compiler unroll and vectorize the loop
+  template <unsigned int N>
+  void averagePixelPairs(const unsigned short* sums, const unsigned long long& nrPairs, const unsigned int& nrSamples, unsigned char* out) {
+    const unsigned int samples = N > 0 ? N : nrSamples;
+    for (unsigned long long x = 0; x < nrPairs; ++x) {
+      const unsigned short* pair = sums + 2 * x * samples;
+      for (unsigned int s = 0; s < samples; ++s) {
+        out[x * samples + s] = static_cast<unsigned char>((pair[s] + pair[samples + s] + 2) >> 2);
+      }
+    }
+  }
+
+}
+
+namespace pathology {
+
+  void downsampleByTwo(const unsigned char* source, const unsigned long long& width, const unsigned long long& height,
+    const unsigned int& nrSamples, unsigned char* destination) {
+    unsigned long long outWidth = (width + 1) / 2;
+    unsigned long long outHeight = (height + 1) / 2;
+    unsigned long long rowSize = width * nrSamples;
+    std::vector<unsigned short> sums(rowSize);
+    for (unsigned long long y = 0; y < outHeight; ++y) {
+      const unsigned char* row0 = source + 2 * y * rowSize;
+      const unsigned char* row1 = 2 * y + 1 < height ? row0 + rowSize : row0;
+      unsigned long long summed = 0;
+#ifdef PIXELCONVERSION_SSE2
+      summed = sumRowsSSE2(row0, row1, rowSize, sums.data());
+#endif
+      sumRowsScalar(row0, row1, summed, rowSize, sums.data());
+      unsigned char* out = destination + y * outWidth * nrSamples;
+      unsigned long long nrPairs = width / 2;
+      if (nrSamples == 3) {
+        averagePixelPairs<3>(sums.data(), nrPairs, nrSamples, out);
+      }
+      else if (nrSamples == 4) {
+        averagePixelPairs<4>(sums.data(), nrPairs, nrSamples, out);
+      }
+      else if (nrSamples == 1) {
+        averagePixelPairs<1>(sums.data(), nrPairs, nrSamples, out);
+      }
+      else {
+        averagePixelPairs<0>(sums.data(), nrPairs, nrSamples, out);
+      }
+      if (width % 2) {
+        const unsigned short* last = sums.data() + (width - 1) * nrSamples;
+        for (unsigned int s = 0; s < nrSamples; ++s) {
+          out[nrPairs * nrSamples + s] = static_cast<unsigned char>((2 * last[s] + 2) >> 2);
+        }
+      }
+    }
+  }
+
+  void accumulateWeightedRow(const unsigned char* row, const unsigned long long& size, const float& weight, float* sums) {
+    unsigned long long i = 0;
+#ifdef PIXELCONVERSION_SSE2
+    i = accumulateWeightedRowSSE2(row, size, weight, sums);
+#endif
+    for (; i < size; ++i) {
+      sums[i] += weight * row[i];
+    }
+  }
+
+  void accumulateWeightedRow(const float* row, const unsigned long long& size, const float& weight, float* sums) {
+    unsigned long long i = 0;
+#ifdef PIXELCONVERSION_SSE2
+    i = accumulateWeightedRowSSE2(row, size, weight, sums);
+#endif
+    for (; i < size; ++i) {
+      sums[i] += weight * row[i];
+    }
+  }
+
+  ResamplingAxis createResamplingAxis(const double& start, const double& scale, const unsigned long long& size,
+    const unsigned long long& sourceSize, const Interpolation& interpolation) {
+    ResamplingAxis axis;
+    bool area = interpolation == Interpolation::Linear && scale > 1.;
+    axis.maxTaps = interpolation == Interpolation::NearestNeighbor ? 1 : (area ? static_cast<unsigned int>(std::ceil(scale)) + 1 : 2);
+    axis.first.resize(size);
+    axis.nrTaps.resize(size);
+    axis.weights.assign(size * axis.maxTaps, 0.f);
+    std::vector<float> clamped(axis.maxTaps);
+    long long lastSourcePixel = static_cast<long long>(sourceSize) - 1;
+    for (unsigned long long i = 0; i < size; ++i) {
+      float* weights = axis.weights.data() + i * axis.maxTaps;
+      if (interpolation == Interpolation::NearestNeighbor) {
+        axis.first[i] = static_cast<long long>(std::floor(start + (i + 0.5) * scale));
+        axis.nrTaps[i] = 1;
+        weights[0] = 1.f;
+      }
+      else if (!area) {
+        double center = start + (i + 0.5) * scale - 0.5;
+        double first = std::floor(center);
+        axis.first[i] = static_cast<long long>(first);
+        axis.nrTaps[i] = 2;
+        weights[0] = static_cast<float>(1. - (center - first));
+        weights[1] = static_cast<float>(center - first);
+      }
+      else {
+        double from = start + i * scale;
+        double to = from + scale;
+        long long first = static_cast<long long>(std::floor(from));
+        long long last = std::max(first, static_cast<long long>(std::ceil(to)) - 1);
+        axis.first[i] = first;
+        axis.nrTaps[i] = static_cast<unsigned int>(last - first + 1);
+        for (long long j = first; j <= last; ++j) {
+          weights[j - first] = static_cast<float>((std::min<double>(to, j + 1) - std::max<double>(from, j)) / scale);
+        }
+      }
+      double center = start + (i + 0.5) * scale;
+      long long first = axis.first[i];
+      long long last = first + axis.nrTaps[i] - 1;
+      if (center >= 0 && center < sourceSize && (first < 0 || last > lastSourcePixel)) {
+        long long clampedFirst = std::min(std::max(first, 0LL), lastSourcePixel);
+        long long clampedLast = std::min(std::max(last, 0LL), lastSourcePixel);
+        std::fill(clamped.begin(), clamped.end(), 0.f);
+        for (long long j = first; j <= last; ++j) {
+          clamped[std::min(std::max(j, 0LL), lastSourcePixel) - clampedFirst] += weights[j - first];
+        }
+        std::copy(clamped.begin(), clamped.end(), weights);
+        axis.first[i] = clampedFirst;
+        axis.nrTaps[i] = static_cast<unsigned int>(clampedLast - clampedFirst + 1);
+      }
+    }
+    return axis;
+  }
+
+  void convertPremultipliedBGRAToRGB(const unsigned char* bgra, const unsigned long long& nrPixels, unsigned char* rgb,
+    const unsigned char& backgroundR, const unsigned char& backgroundG, const unsigned char& backgroundB) {
+    const unsigned char background[3] = { backgroundR, backgroundG, backgroundB };
+    unsigned long long converted = 0;
+#ifdef PIXELCONVERSION_SSSE3
+    if (hasSSSE3) {
+      converted = convertSSSE3(bgra, nrPixels, rgb, background);
+    }
+#endif
+    convertScalar(bgra, converted, nrPixels, rgb, background);
+  }
+
+  void convertHalfToFloat(const unsigned short* source, const unsigned long long& size, float* destination) {
+    for (unsigned long long i = 0; i < size; ++i) {
+      destination[i] = halfToFloat(source[i]);
+    }
+  }
+
+  void convertFloatToHalf(const float* source, const unsigned long long& size, unsigned short* destination) {
+    for (unsigned long long i = 0; i < size; ++i) {
+      destination[i] = floatToHalf(source[i]);
+    }
+  }
+
+  void unpackBits(const unsigned char* source, const unsigned long long& firstBit, const unsigned long long& size, unsigned char* destination) {
+    unsigned long long i = 0;
+    for (; i < size && (firstBit + i) % 8 != 0; ++i) {
+      destination[i] = (source[(firstBit + i) / 8] >> (7 - (firstBit + i) % 8)) & 1;
+    }
+    for (; i + 8 <= size; i += 8) {
+      unsigned char byte = source[(firstBit + i) / 8];
+      for (unsigned int bit = 0; bit < 8; ++bit) {
+        destination[i + bit] = (byte >> (7 - bit)) & 1;
+      }
+    }
+    for (; i < size; ++i) {
+      destination[i] = (source[(firstBit + i) / 8] >> (7 - (firstBit + i) % 8)) & 1;
+    }
+  }
+
+  void packBits(const unsigned char* source, const unsigned long long& size, unsigned char* destination) {
+    for (unsigned long long i = 0; i < (size + 7) / 8; ++i) {
+      const unsigned char* in = source + 8 * i;
+      unsigned int nrBits = size - 8 * i < 8 ? static_cast<unsigned int>(size - 8 * i) : 8;
+      unsigned char byte = 0;
+      for (unsigned int bit = 0; bit < nrBits; ++bit) {
+        byte |= (in[bit] != 0) << (7 - bit);
+      }
+      destination[i] = byte;
+    }
+  }
+
+  bool isAllZero(const void* data, const unsigned long long& byteSize) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    unsigned long long i = 0;
+#ifdef PIXELCONVERSION_SSE2
+    i = zeroPrefixSSE2(bytes, byteSize);
+    if (i + 64 <= byteSize) {
+      return false;
+    }
+#endif
+    for (; i < byteSize; ++i) {
+      if (bytes[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+}
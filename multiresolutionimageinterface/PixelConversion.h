@@ -0,0 +1,186 @@
+#ifndef _PixelConversion
+#define _PixelConversion
+
+#include <vector>
+#include <limits>
+#include "multiresolutionimageinterface_export.h"
+#include "core/PathologyEnums.h"
+
+namespace pathology {
+
+  //! The type in which the samples of an image of the given type are presented in memory: Float16
+  //! images are read as and written from float, Bit images as unsigned char 0/1
+  inline DataType decodedDataType(const DataType& type) {
+    if (type == DataType::Float16) {
+      return DataType::Float;
+    }
+    if (type == DataType::Bit) {
+      return DataType::UChar;
+    }
+    return type;
+  }
+
+  //! The decoded data type of which T is the sample type, InvalidDataType for other types
+  template <typename T> inline DataType dataTypeOf() { return DataType::InvalidDataType; }
+  template <> inline DataType dataTypeOf<unsigned char>() { return DataType::UChar; }
+  template <> inline DataType dataTypeOf<unsigned short>() { return DataType::UInt16; }
+  template <> inline DataType dataTypeOf<unsigned int>() { return DataType::UInt32; }
+  template <> inline DataType dataTypeOf<float>() { return DataType::Float; }
+
+  //! Converts IEEE 754 half-precision values to float
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void convertHalfToFloat(const unsigned short* source, const unsigned long long& size, float* destination);
+
+  //! Converts floats to IEEE 754 half precision, rounding to nearest even. Values beyond the half
+  //! range become infinity, NaN stays NaN.
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void convertFloatToHalf(const float* source, const unsigned long long& size, unsigned short* destination);
+
+  //! Unpacks size 1-bit samples, most significant bit first, from bit firstBit of source on to
+  //! unsigned char 0/1
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void unpackBits(const unsigned char* source, const unsigned long long& firstBit, const unsigned long long& size,
+    unsigned char* destination);
+
+  //! Packs size samples into bits, most significant bit first; non-zero samples become 1 and the
+  //! unused bits of the last byte 0
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void packBits(const unsigned char* source, const unsigned long long& size, unsigned char* destination);
+
+  //! Whether all bytes of data are zero, which for every data type means all samples are 0. Uses
+  //! SSE2 where available.
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT bool isAllZero(const void* data, const unsigned long long& byteSize);
+
+  template <typename T>
+  inline T averageOfFour(const T& a, const T& b, const T& c, const T& d) {
+    return static_cast<T>((static_cast<unsigned long long>(a) + b + c + d + 2) / 4);
+  }
+
+  template <>
+  inline float averageOfFour(const float& a, const float& b, const float& c, const float& d) {
+    return (a + b + c + d) * 0.25f;
+  }
+
+  template <>
+  inline double averageOfFour(const double& a, const double& b, const double& c, const double& d) {
+    return (a + b + c + d) * 0.25;
+  }
+
+  //! Halves an image of width x height pixels with nrSamples interleaved samples by averaging
+  //! blocks of 2x2 pixels into an image of ceil(width / 2) x ceil(height / 2) pixels. A last odd
+  //! row or column is averaged with itself.
+  template <typename T>
+  void downsampleByTwo(const T* source, const unsigned long long& width, const unsigned long long& height, const unsigned int& nrSamples, T* destination) {
+    unsigned long long outWidth = (width + 1) / 2;
+    unsigned long long outHeight = (height + 1) / 2;
+    for (unsigned long long y = 0; y < outHeight; ++y) {
+      const T* row0 = source + 2 * y * width * nrSamples;
+      const T* row1 = 2 * y + 1 < height ? row0 + width * nrSamples : row0;
+      T* out = destination + y * outWidth * nrSamples;
+      for (unsigned long long x = 0; x < outWidth; ++x) {
+        unsigned long long x0 = 2 * x * nrSamples;
+        unsigned long long x1 = 2 * x + 1 < width ? x0 + nrSamples : x0;
+        for (unsigned int s = 0; s < nrSamples; ++s) {
+          out[x * nrSamples + s] = averageOfFour(row0[x0 + s], row0[x1 + s], row1[x0 + s], row1[x1 + s]);
+        }
+      }
+    }
+  }
+
+  //! 8-bit version of downsampleByTwo, which sums the row pairs with SSE2 where available
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void downsampleByTwo(const unsigned char* source, const unsigned long long& width, const unsigned long long& height,
+    const unsigned int& nrSamples, unsigned char* destination);
+
+  //! Taps of a separable resampling kernel along one axis: output pixel i is the weighted sum of
+  //! the nrTaps[i] source pixels from first[i] on, with the weights from weights[i * maxTaps]
+  struct ResamplingAxis {
+    std::vector<long long> first;
+    std::vector<unsigned int> nrTaps;
+    std::vector<float> weights;
+    unsigned int maxTaps;
+  };
+
+  //! Creates the taps of size output pixels, of which pixel i covers the source pixels from
+  //! start + i * scale to start + (i + 1) * scale. Nearest neighbor takes the source pixel at the
+  //! center. Linear interpolates bilinearly when magnifying (scale <= 1) and averages the covered
+  //! source pixels weighted by their overlap when minifying, as the writer does for its pyramid.
+  //! Taps beyond the edges of the sourceSize source pixels are moved to the edge pixel, so pixels
+  //! at the edge are not blended with the zeros read outside the image. Pixels centered outside
+  //! the source keep their taps and fade to the zeros getRawRegion returns there.
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT ResamplingAxis createResamplingAxis(const double& start, const double& scale, const unsigned long long& size,
+    const unsigned long long& sourceSize, const Interpolation& interpolation);
+
+  template <typename T> struct ResamplingAccumulator { typedef float type; };
+  template <> struct ResamplingAccumulator<unsigned int> { typedef double type; };
+
+  template <typename T>
+  inline T roundSample(const typename ResamplingAccumulator<T>::type& value) {
+    if (value <= 0) {
+      return 0;
+    }
+    if (value >= std::numeric_limits<T>::max()) {
+      return std::numeric_limits<T>::max();
+    }
+    return static_cast<T>(value + 0.5);
+  }
+
+  template <>
+  inline float roundSample<float>(const float& value) {
+    return value;
+  }
+
+  //! Adds weight times the size samples of row to sums
+  template <typename T>
+  void accumulateWeightedRow(const T* row, const unsigned long long& size, const float& weight, typename ResamplingAccumulator<T>::type* sums) {
+    typedef typename ResamplingAccumulator<T>::type Accumulator;
+    for (unsigned long long i = 0; i < size; ++i) {
+      sums[i] += static_cast<Accumulator>(weight) * row[i];
+    }
+  }
+
+  //! 8-bit and float versions of accumulateWeightedRow, which use SSE2 where available
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void accumulateWeightedRow(const unsigned char* row, const unsigned long long& size, const float& weight, float* sums);
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void accumulateWeightedRow(const float* row, const unsigned long long& size, const float& weight, float* sums);
+
+  //! Resamples the output pixels [outX0, outX1) x [outY0, outY1) into destination, which is
+  //! destinationWidth pixels wide, from a region of sourceWidth x sourceHeight source pixels at
+  //! (sourceX, sourceY) which holds all of their taps. Each output row first filters the source
+  //! rows vertically, a weighted sum of contiguous rows of samples which accumulateWeightedRow
+  //! vectorizes; the horizontal pass then only runs over the output pixels.
+  template <typename T>
+  void resample(const T* source, const long long& sourceX, const long long& sourceY, const unsigned long long& sourceWidth, const unsigned long long& sourceHeight,
+    const unsigned int& nrSamples, const ResamplingAxis& axisX, const ResamplingAxis& axisY, const unsigned long long& outX0, const unsigned long long& outX1,
+    const unsigned long long& outY0, const unsigned long long& outY1, T* destination, const unsigned long long& destinationWidth) {
+    typedef typename ResamplingAccumulator<T>::type Accumulator;
+    // Only the source columns of the taps of [outX0, outX1) are filtered
+    long long firstColumn = axisX.first[outX0] - sourceX;
+    unsigned long long columnsSize = (axisX.first[outX1 - 1] + axisX.nrTaps[outX1 - 1] - sourceX - firstColumn) * nrSamples;
+    std::vector<Accumulator> columns(columnsSize);
+    for (unsigned long long y = outY0; y < outY1; ++y) {
+      std::fill(columns.begin(), columns.end(), static_cast<Accumulator>(0));
+      const float* weights = axisY.weights.data() + y * axisY.maxTaps;
+      const T* rows = source + ((axisY.first[y] - sourceY) * sourceWidth + firstColumn) * nrSamples;
+      for (unsigned int tap = 0; tap < axisY.nrTaps[y]; ++tap) {
+        accumulateWeightedRow(rows + tap * sourceWidth * nrSamples, columnsSize, weights[tap], columns.data());
+      }
+      T* out = destination + (y * destinationWidth + outX0) * nrSamples;
+      for (unsigned long long x = outX0; x < outX1; ++x) {
+        const Accumulator* pixel = columns.data() + (axisX.first[x] - sourceX - firstColumn) * nrSamples;
+        const float* weightsX = axisX.weights.data() + x * axisX.maxTaps;
+        for (unsigned int s = 0; s < nrSamples; ++s) {
+          Accumulator sum = 0;
+          for (unsigned int tap = 0; tap < axisX.nrTaps[x]; ++tap) {
+            sum += static_cast<Accumulator>(weightsX[tap]) * pixel[tap * nrSamples + s];
+          }
+          out[(x - outX0) * nrSamples + s] = roundSample<T>(sum);
+        }
+      }
+    }
+  }
+
+  //! Converts premultiplied BGRA pixels (OpenSlide's native-endian ARGB on little-endian
+  //! machines) to RGB. Fully transparent pixels get the background color, partially transparent
+  //! pixels are unpremultiplied. Uses SSSE3 when the CPU supports it. The conversion may be done
+  //! in place (rgb == bgra), as the output is never ahead of the input.
+  MULTIRESOLUTIONIMAGEINTERFACE_EXPORT void convertPremultipliedBGRAToRGB(const unsigned char* bgra, const unsigned long long& nrPixels,
+    unsigned char* rgb, const unsigned char& backgroundR, const unsigned char& backgroundG, const unsigned char& backgroundB);
+
+}
+
+#endif
@@ -5,13 +5,52 @@
 #endif
 #include "tiffio.h"
 #include "JPEG2000Codec.h"
+#include "PixelConversion.h"
 #include "core/PathologyEnums.h"
+#include <algorithm>
+#include <cstdio>
 #include <shared_mutex>
 #include <cmath>
 #include <sstream>
 
 using namespace pathology;
 
+namespace {
+
+  // Copies size samples from sample first on of a row of a tile as it is stored in the cache
+  template <typename T>
+  inline void copyTileRow(const T* row, const unsigned long long& first, const unsigned long long& size, const bool& packed, T* destination) {
+    std::copy(row + first, row + first + size, destination);
+  }
+
+  inline void copyTileRow(const unsigned char* row, const unsigned long long& first, const unsigned long long& size, const bool& packed, unsigned char* destination) {
+    if (packed) {
+      unpackBits(row, first, size, destination);
+    }
+    else {
+      std::copy(row + first, row + first + size, destination);
+    }
+  }
+
+  inline void copyTileRow(const unsigned short* row, const unsigned long long& first, const unsigned long long& size, const bool& packed, float* destination) {
+    convertHalfToFloat(row + first, size, destination);
+  }
+
+  TIFF* openTIFF(const std::string& imagePath) {
+#ifdef _WIN32
+    int wchars_num = MultiByteToWideChar(CP_UTF8, 0, imagePath.c_str(), -1, NULL, 0);
+    wchar_t* w_imagePath = new wchar_t[wchars_num];
+    MultiByteToWideChar(CP_UTF8, 0, imagePath.c_str(), -1, w_imagePath, wchars_num);
+    TIFF* tiff = TIFFOpenW(w_imagePath, "rm");
+    delete[] w_imagePath;
+    return tiff;
+#else
+    return TIFFOpen(imagePath.c_str(), "rm");
+#endif
+  }
+
+}
+
 TIFFImage::TIFFImage() : MultiResolutionImage(), _tiff(NULL), _jp2000(NULL) {
 }
 
@@ -25,15 +64,7 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
   std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
   cleanup();
 
-#ifdef _WIN32
-  int wchars_num = MultiByteToWideChar(CP_UTF8, 0, imagePath.c_str(), -1, NULL, 0);
-  wchar_t* w_imagePath = new wchar_t[wchars_num];
-  MultiByteToWideChar(CP_UTF8, 0, imagePath.c_str(), -1, w_imagePath, wchars_num);
-  _tiff = TIFFOpenW(w_imagePath, "rm");
-  delete[] w_imagePath;
-#else
-  _tiff = TIFFOpen(imagePath.c_str(), "rm");
-#endif
+  _tiff = openTIFF(imagePath);
 
   if (_tiff) {
     const char* img_desc = NULL;
@@ -53,7 +84,13 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
     }
     unsigned int codec = 0;
     TIFFGetField(_tiff, TIFFTAG_COMPRESSION, &codec);
-    if (codec != 33005 && codec != COMPRESSION_DEFLATE && codec != COMPRESSION_JPEG && codec != COMPRESSION_LZW && codec != COMPRESSION_NONE) {
+    if (codec != 33005 && codec != COMPRESSION_DEFLATE && codec != COMPRESSION_ADOBE_DEFLATE && codec != COMPRESSION_JPEG && codec != COMPRESSION_LZW &&
+      codec != COMPRESSION_NONE && codec != COMPRESSION_ZSTD && codec != COMPRESSION_WEBP) {
+      cleanup();
+      return false;
+    }
+    // ZSTD and WebP are optional in libtiff
+    if ((codec == COMPRESSION_ZSTD || codec == COMPRESSION_WEBP) && !TIFFIsCODECConfigured(codec)) {
       cleanup();
       return false;
     }
@@ -83,10 +120,13 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
     if (cType == PHOTOMETRIC_RGB && _samplesPerPixel != 3 && _samplesPerPixel != 4) {
       cleanup();
     }
-    if (dType == SAMPLEFORMAT_IEEEFP && bitsPerSample != 32) {
+    if (dType == SAMPLEFORMAT_IEEEFP && bitsPerSample != 32 && bitsPerSample != 16) {
+      cleanup();
+    }
+    if (dType == SAMPLEFORMAT_UINT && bitsPerSample != 32 && bitsPerSample != 16 && bitsPerSample != 8 && bitsPerSample != 1) {
       cleanup();
     }
-    if (dType == SAMPLEFORMAT_UINT && bitsPerSample != 32 && bitsPerSample != 16 && bitsPerSample != 8) {
+    if (bitsPerSample == 1 && (cType != PHOTOMETRIC_MINISBLACK || codec == COMPRESSION_JPEG || codec == 33005)) {
       cleanup();
     }
     if (!_tiff) {
@@ -122,6 +162,7 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
         levelTileSize.push_back(tileH);
         _levelDimensions.push_back(tmp);
         _tileSizesPerLevel.push_back(levelTileSize);
+        _levelDirectories.push_back(level);
         if (level > 0) {
           if (width > x) {
             width = x;
@@ -139,10 +180,13 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
 
     TIFFSetDirectory(_tiff, 0);
     if (dType == SAMPLEFORMAT_IEEEFP) {
-      _dataType = DataType::Float;
+      _dataType = bitsPerSample == 16 ? DataType::Float16 : DataType::Float;
     }
     else if (dType == SAMPLEFORMAT_UINT) {
-      if (bitsPerSample == 8) {
+      if (bitsPerSample == 1) {
+        _dataType = DataType::Bit;
+      }
+      else if (bitsPerSample == 8) {
         _dataType = DataType::UChar;
       }
       else if (bitsPerSample == 16) {
@@ -221,6 +265,11 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
     }
     TIFFSetField(_tiff, TIFFTAG_PERSAMPLE, PERSAMPLE_MERGED);
 
+    if (!initializeLevels(imagePath)) {
+      cleanup();
+      return false;
+    }
+
     _fileType = "tif";
     _isValid = true;
   }
@@ -241,9 +290,52 @@ bool TIFFImage::initializeType(const std::string& imagePath) {
   else if (_dataType == DataType::UChar) {
     createCache<unsigned char>();
   }
+  // Float16 and Bit tiles are cached as stored, at 2 bytes and 1 bit per sample
+  else if (_dataType == DataType::Float16) {
+    createCache<unsigned short>();
+  }
+  else if (_dataType == DataType::Bit) {
+    createCache<unsigned char>();
+  }
   return _isValid;
 }
 
+bool TIFFImage::initializeLevels(const std::string& imagePath) {
+  _levels.resize(_levelDirectories.size());
+  for (unsigned int level = 0; level < _levelDirectories.size(); ++level) {
+    TIFFLevel& tiffLevel = _levels[level];
+    tiffLevel.handle = openTIFF(imagePath);
+    if (!tiffLevel.handle || !TIFFSetDirectory(tiffLevel.handle, _levelDirectories[level])) {
+      return false;
+    }
+    tiffLevel.mutex.reset(new std::mutex());
+    tiffLevel.directory = _levelDirectories[level];
+    tiffLevel.codec = 0;
+    tiffLevel.photometric = 0;
+    TIFFGetField(tiffLevel.handle, TIFFTAG_COMPRESSION, &tiffLevel.codec);
+    TIFFGetField(tiffLevel.handle, TIFFTAG_PHOTOMETRIC, &tiffLevel.photometric);
+    tiffLevel.ycbcrSubsamplingX = 1;
+    tiffLevel.ycbcrSubsamplingY = 1;
+    if (tiffLevel.photometric == PHOTOMETRIC_YCBCR) {
+      TIFFGetFieldDefaulted(tiffLevel.handle, TIFFTAG_YCBCRSUBSAMPLING, &tiffLevel.ycbcrSubsamplingX, &tiffLevel.ycbcrSubsamplingY);
+      if (tiffLevel.codec == COMPRESSION_JPEG) {
+        TIFFSetField(tiffLevel.handle, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+      }
+    }
+    tiffLevel.numberOfTiles = TIFFNumberOfTiles(tiffLevel.handle);
+    tiffLevel.tileByteCounts = NULL;
+    TIFFGetField(tiffLevel.handle, TIFFTAG_TILEBYTECOUNTS, &tiffLevel.tileByteCounts);
+    tiffLevel.tileOffsets = NULL;
+    TIFFGetField(tiffLevel.handle, TIFFTAG_TILEOFFSETS, &tiffLevel.tileOffsets);
+    unsigned int count = 0;
+    unsigned char* tables = NULL;
+    if (tiffLevel.codec == COMPRESSION_JPEG && TIFFGetField(tiffLevel.handle, TIFFTAG_JPEGTABLES, &count, &tables) != 0 && count > 4) {
+      tiffLevel.jpegTables.assign(tables, tables + count);
+    }
+  }
+  return true;
+}
+
 double TIFFImage::getMinValue(int channel) {
   if (!_minValues.empty() && channel > 0 && channel < _minValues.size()) {
     return _minValues[channel];
@@ -270,6 +362,13 @@ double TIFFImage::getMaxValue(int channel) {
 
 void TIFFImage::cleanup() {
   _tileSizesPerLevel.clear();
+  _levelDirectories.clear();
+  for (TIFFLevel& tiffLevel : _levels) {
+    if (tiffLevel.handle) {
+      TIFFClose(tiffLevel.handle);
+    }
+  }
+  _levels.clear();
   if (_tiff) {
     TIFFClose(_tiff);
     _tiff = NULL;
@@ -294,122 +393,165 @@ void* TIFFImage::readDataFromImage(const long long& startX, const long long& sta
     float* temp = FillRequestedRegionFromTIFF<float>(startX, startY, width, height, level, _samplesPerPixel);
     return (void*)temp;
   }
-  else if (getDataType() == DataType::UChar) {
+  else if (getDataType() == DataType::UChar || getDataType() == DataType::Bit) {
     unsigned char* temp = FillRequestedRegionFromTIFF<unsigned char>(startX, startY, width, height, level, _samplesPerPixel);
     return (void*)temp;
   }
+  else if (getDataType() == DataType::Float16) {
+    float* temp = FillRequestedRegionFromTIFF<float, unsigned short>(startX, startY, width, height, level, _samplesPerPixel);
+    return (void*)temp;
+  }
   else {
     return NULL;
   }
 }
 
-long long TIFFImage::getEncodedTileSize(const long long& startX, const long long& startY, const unsigned int& level) {
-  if (_tiff && level < this->_numberOfLevels) {
-    long long levelStartX = std::floor(startX / getLevelDownsample(level) + 0.5);
-    long long levelStartY = std::floor(startY / getLevelDownsample(level) + 0.5);
-    TIFFSetDirectory(_tiff, level);
-    unsigned int tileNr = TIFFComputeTile(_tiff, levelStartX, levelStartY, 0, 0);
-    unsigned int total_tiles = TIFFNumberOfTiles(_tiff);
-    if (tileNr < total_tiles) {
-      unsigned long long* tbc = NULL;
-      TIFFGetField(_tiff, TIFFTAG_TILEBYTECOUNTS, &tbc);
-      unsigned long long k = tbc[tileNr];
-      if (k == 0) {
-        return -1;
-      }
-      unsigned int count = 0;
-      unsigned char* jpt;
-      if (TIFFGetField(_tiff, TIFFTAG_JPEGTABLES, &count, &jpt) != 0) {
-        if (count > 4) {
-          k = k + count;
-          k -= 2; /* don't use EOI of header or SOI of tile */
-        }
-      }
-      return k;
-    }
-    else {
-      return -1;
-    }
+bool TIFFImage::readDataFromImageInto(const long long& startX, const long long& startY, const unsigned long long& width,
+  const unsigned long long& height, const unsigned int& level, void* data) {
+  if (getDataType() == DataType::UInt32) {
+    FillRequestedRegionFromTIFF<unsigned int>(startX, startY, width, height, level, _samplesPerPixel, (unsigned int*)data);
+  }
+  else if (getDataType() == DataType::UInt16) {
+    FillRequestedRegionFromTIFF<unsigned short>(startX, startY, width, height, level, _samplesPerPixel, (unsigned short*)data);
+  }
+  else if (getDataType() == DataType::Float) {
+    FillRequestedRegionFromTIFF<float>(startX, startY, width, height, level, _samplesPerPixel, (float*)data);
+  }
+  else if (getDataType() == DataType::UChar || getDataType() == DataType::Bit) {
+    FillRequestedRegionFromTIFF<unsigned char>(startX, startY, width, height, level, _samplesPerPixel, (unsigned char*)data);
+  }
+  else if (getDataType() == DataType::Float16) {
+    FillRequestedRegionFromTIFF<float, unsigned short>(startX, startY, width, height, level, _samplesPerPixel, (float*)data);
   }
   else {
+    return false;
+  }
+  return true;
+}
+
+bool TIFFImage::getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_tiff || level >= _levels.size()) {
+    return false;
+  }
+  const TIFFLevel& tiffLevel = _levels[level];
+  if (tiffLevel.codec == COMPRESSION_JPEG) {
+    info.compression = Compression::JPEG;
+  }
+  else if (tiffLevel.codec == 33005) {
+    info.compression = Compression::JPEG2000;
+  }
+  else {
+    return false;
+  }
+  info.tileWidth = _tileSizesPerLevel[level][0];
+  info.tileHeight = _tileSizesPerLevel[level][1];
+  info.ycbcr = tiffLevel.photometric == PHOTOMETRIC_YCBCR;
+  info.ycbcrSubsamplingX = tiffLevel.ycbcrSubsamplingX;
+  info.ycbcrSubsamplingY = tiffLevel.ycbcrSubsamplingY;
+  info.jpegTables = tiffLevel.jpegTables;
+  return true;
+}
+
+bool TIFFImage::readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  data.clear();
+  if (!_tiff || level >= _levels.size()) {
+    return false;
+  }
+  // libtiff handles are not thread-safe, each level has a lock guarding its handle
+  TIFFLevel& tiffLevel = _levels[level];
+  std::unique_lock<std::mutex> levelLock(*tiffLevel.mutex);
+  unsigned int tileNr = TIFFComputeTile(tiffLevel.handle, tileX * _tileSizesPerLevel[level][0], tileY * _tileSizesPerLevel[level][1], 0, 0);
+  if (tileNr >= tiffLevel.numberOfTiles || !tiffLevel.tileByteCounts || tiffLevel.tileByteCounts[tileNr] == 0) {
+    return false;
+  }
+  data.resize(tiffLevel.tileByteCounts[tileNr]);
+  tmsize_t rawSize = TIFFReadRawTile(tiffLevel.handle, tileNr, data.data(), data.size());
+  if (rawSize <= 0) {
+    data.clear();
+    return false;
+  }
+  data.resize(rawSize);
+  return true;
+}
+
+long long TIFFImage::getEncodedTileSize(const long long& startX, const long long& startY, const unsigned int& level) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_tiff || level >= _levels.size()) {
+    return -1;
+  }
+  long long levelStartX = std::floor(startX / getLevelDownsample(level) + 0.5);
+  long long levelStartY = std::floor(startY / getLevelDownsample(level) + 0.5);
+  TIFFLevel& tiffLevel = _levels[level];
+  std::unique_lock<std::mutex> levelLock(*tiffLevel.mutex);
+  unsigned int tileNr = TIFFComputeTile(tiffLevel.handle, levelStartX, levelStartY, 0, 0);
+  if (tileNr >= tiffLevel.numberOfTiles || !tiffLevel.tileByteCounts) {
     return -1;
   }
+  long long k = tiffLevel.tileByteCounts[tileNr];
+  if (k == 0) {
+    return -1;
+  }
+  if (tiffLevel.jpegTables.size() > 4) {
+    k = k + tiffLevel.jpegTables.size();
+    k -= 2; /* don't use EOI of header or SOI of tile */
+  }
+  return k;
 }
 
 unsigned char* TIFFImage::readEncodedDataFromImage(const long long& startX, const long long& startY, const unsigned int& level) {
-  if (_tiff) {
-    unsigned int codec = 0;
-    TIFFGetField(_tiff, TIFFTAG_COMPRESSION, &codec);
-    if (codec == 7) { // New style JPEG
-      long long levelStartX = std::floor(startX / getLevelDownsample(level) + 0.5);
-      long long levelStartY = std::floor(startY / getLevelDownsample(level) + 0.5);
-      TIFFSetDirectory(_tiff, level);
-      unsigned int tileNr = TIFFComputeTile(_tiff, levelStartX, levelStartY, 0, 0);
-      if (tileNr < TIFFNumberOfTiles(_tiff)) {
-        unsigned char table_end[2];
-        unsigned int count = 0;
-        unsigned char* jpt;
-        float* xfloatp;
-        unsigned int endOfBuffer = 0;
-        unsigned long long datasize = this->getEncodedTileSize(startX, startY, level);
-        if (datasize < 0) {
-          return NULL;
-        }
-        unsigned long long bufferoffset = 0;
-        unsigned char* buffer = new unsigned char[datasize];
-
-        if (TIFFGetField(_tiff, TIFFTAG_JPEGTABLES, &count, &jpt) != 0) {
-          if (count > 4) {
-            int retTIFFReadRawTile;
-            /* Ignore EOI marker of JpegTables */
-            _TIFFmemcpy(buffer, jpt, count - 2);
-            bufferoffset += count - 2;
-            /* Store last 2 bytes of the JpegTables */
-            table_end[0] = buffer[bufferoffset - 2];
-            table_end[1] = buffer[bufferoffset - 1];
-            endOfBuffer = bufferoffset;
-            bufferoffset -= 2;
-            retTIFFReadRawTile = TIFFReadRawTile(
-              _tiff,
-              tileNr,
-              (void*)&(((unsigned char*)buffer)[bufferoffset]),
-              -1);
-            bufferoffset += retTIFFReadRawTile;
-            /* Overwrite SOI marker of image scan with previously */
-            /* saved end of JpegTables */
-            buffer[endOfBuffer - 2] = table_end[0];
-            buffer[endOfBuffer - 1] = table_end[1];
-          }
-        }
-        else {
-          TIFFReadRawTile(
-            _tiff,
-            tileNr,
-            (void*)&(((unsigned char*)buffer)[bufferoffset]),
-            -1);
-        }
-        return buffer;
-      }
-      else {
-        return NULL;
-      }
-    }
-    else {
-      return NULL;
-    }
+  long long datasize = this->getEncodedTileSize(startX, startY, level);
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_tiff || level >= _levels.size() || datasize < 0) {
+    return NULL;
   }
-  else {
+  TIFFLevel& tiffLevel = _levels[level];
+  if (tiffLevel.codec != COMPRESSION_JPEG) { // New style JPEG
+    return NULL;
+  }
+  long long levelStartX = std::floor(startX / getLevelDownsample(level) + 0.5);
+  long long levelStartY = std::floor(startY / getLevelDownsample(level) + 0.5);
+  std::unique_lock<std::mutex> levelLock(*tiffLevel.mutex);
+  unsigned int tileNr = TIFFComputeTile(tiffLevel.handle, levelStartX, levelStartY, 0, 0);
+  if (tileNr >= tiffLevel.numberOfTiles) {
     return NULL;
   }
+  unsigned char* buffer = new unsigned char[datasize];
+  const std::vector<unsigned char>& jpt = tiffLevel.jpegTables;
+  if (jpt.size() > 4) {
+    /* Ignore EOI marker of JpegTables */
+    std::copy(jpt.begin(), jpt.end() - 2, buffer);
+    unsigned long long bufferoffset = jpt.size() - 2;
+    /* Store last 2 bytes of the JpegTables */
+    unsigned char table_end[2] = { buffer[bufferoffset - 2], buffer[bufferoffset - 1] };
+    unsigned long long endOfBuffer = bufferoffset;
+    bufferoffset -= 2;
+    TIFFReadRawTile(tiffLevel.handle, tileNr, buffer + bufferoffset, datasize - bufferoffset);
+    /* Overwrite SOI marker of image scan with previously */
+    /* saved end of JpegTables */
+    buffer[endOfBuffer - 2] = table_end[0];
+    buffer[endOfBuffer - 1] = table_end[1];
+  }
+  else {
+    TIFFReadRawTile(tiffLevel.handle, tileNr, buffer, datasize);
+  }
+  return buffer;
 }
 
-template <typename T> T* TIFFImage::FillRequestedRegionFromTIFF(const long long& startX, const long long& startY, const unsigned long long& width,
-  const unsigned long long& height, const unsigned int& level, unsigned int nrSamples)
+template <typename T, typename Stored> T* TIFFImage::FillRequestedRegionFromTIFF(const long long& startX, const long long& startY, const unsigned long long& width,
+  const unsigned long long& height, const unsigned int& level, unsigned int nrSamples, T* destination)
 {
   std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
-  T* temp = new T[width * height * nrSamples];
+  T* temp = destination ? destination : new T[width * height * nrSamples];
   std::fill(temp, temp + width * height * nrSamples, static_cast<T>(0));
   unsigned int tileW = _tileSizesPerLevel[level][0], tileH = _tileSizesPerLevel[level][1], levelH = _levelDimensions[level][1], levelW = _levelDimensions[level][0];
+  // Size of a row of a tile in stored samples, the rows of 1-bit tiles are padded to whole bytes
+  bool packed = getDataType() == DataType::Bit;
+  unsigned long long tileRowSize = packed ? (tileW * nrSamples + 7) / 8 : tileW * nrSamples;
+  unsigned long long tileSize = tileRowSize * tileH;
+  unsigned long long tilesAcross = (levelW + tileW - 1) / tileW;
+  const TIFFLevel& levelInfo = _levels[level];
 
   long long levelStartX = std::floor(startX / getLevelDownsample(level) + 0.5);
   long long levelStartY = std::floor(startY / getLevelDownsample(level) + 0.5);
@@ -418,6 +560,31 @@ template <typename T> T* TIFFImage::FillRequestedRegionFromTIFF(const long long&
   long long finalX = levelStartX + width >= levelW ? levelW : levelStartX + width;
   long long finalY = levelStartY + height >= levelH ? levelH : levelStartY + height;
 
+  auto copyTile = [&](long long ix, long long iy, const Stored* tile) {
+    long long ixx = (ix - levelStartX);
+    long long iyy = (iy - levelStartY);
+    long long lxw = levelStartX + width;
+    long long ixw = ixx + tileW;
+    long long rowLength = ixw > static_cast<long long>(width) ? (tileW - (ixw - width)) * nrSamples : tileW * nrSamples;
+    long long tileDeltaX = 0;
+    if (ixx < 0) {
+      rowLength += ixx * nrSamples;
+      tileDeltaX -= ixx * nrSamples;
+      ixx = 0;
+    }
+    for (unsigned int ty = 0; ty < tileH; ++ty) {
+      if ((iyy + ty >= 0) && (ixx >= 0) && (iyy + ty < static_cast<long long>(height)) && lxw > 0) {
+        long long idx = (ty + iyy) * width * nrSamples + ixx * nrSamples;
+        copyTileRow(tile + ty * tileRowSize, tileDeltaX, rowLength, packed, temp + idx);
+      }
+    }
+  };
+
+  // Tiles which are not cached are read after all cached tiles have been copied, so tiles
+  // which are stored next to each other are read together
+  std::vector<unsigned int> missingTileNumbers;
+  std::vector<std::pair<long long, long long> > missingPositions;
+  std::vector<std::string> missingKeys;
   for (long long iy = startTileY; iy < finalY; iy += tileH) {
     if (iy < 0) {
       continue;
@@ -426,67 +593,134 @@ template <typename T> T* TIFFImage::FillRequestedRegionFromTIFF(const long long&
       if (ix < 0) {
         continue;
       }
+      // Tiles without data (sparse files) keep the fill value 0 of the region
+      unsigned long long tileNr = (iy / tileH) * tilesAcross + ix / tileW;
+      if (levelInfo.tileByteCounts && tileNr < levelInfo.numberOfTiles && levelInfo.tileByteCounts[tileNr] == 0) {
+        continue;
+      }
 
       std::stringstream k;
       k << ix * getLevelDownsample(level) << "-" << iy * getLevelDownsample(level) << "-" << level;
-      bool deleteTile = false;
       unsigned int cachedTileSize = 0;
-      T* tile = NULL;
+      Stored* tile = NULL;
+      _cacheMutex->lock();
+      std::static_pointer_cast<TileCache<Stored>>(_cache)->get(k.str(), tile, cachedTileSize);
+      _cacheMutex->unlock();
+      if (tile) {
+        copyTile(ix, iy, tile);
+      }
+      else {
+        missingTileNumbers.push_back(tileNr);
+        missingPositions.push_back(std::make_pair(ix, iy));
+        missingKeys.push_back(k.str());
+      }
+    }
+  }
+
+  if (!missingTileNumbers.empty()) {
+    std::vector<Stored*> tiles(missingTileNumbers.size());
+    for (unsigned int i = 0; i < tiles.size(); ++i) {
+      tiles[i] = new Stored[tileSize];
+      std::fill(tiles[i], tiles[i] + tileSize, static_cast<Stored>(0));
+    }
+    std::vector<bool> decoded = readTiles<Stored>(_levels[level], missingTileNumbers, tiles, tileSize);
+    for (unsigned int i = 0; i < tiles.size(); ++i) {
+      copyTile(missingPositions[i].first, missingPositions[i].second, tiles[i]);
+      // Tiles which failed to decode are not cached, so they are read again next time
+      if (!decoded[i]) {
+        delete[] tiles[i];
+        continue;
+      }
       _cacheMutex->lock();
-      std::static_pointer_cast<TileCache<T>>(_cache)->get(k.str(), tile, cachedTileSize);
+      if (std::static_pointer_cast<TileCache<Stored>>(_cache)->set(missingKeys[i], tiles[i], tileSize * sizeof(Stored))) {
+        delete[] tiles[i];
+      }
       _cacheMutex->unlock();
-      if (!tile) {
-        tile = new T[tileW * tileH * getSamplesPerPixel()];
-        std::fill(tile, tile + tileW * tileH * getSamplesPerPixel(), static_cast<T>(0.0));
-        _cacheMutex->lock();
-        TIFFSetDirectory(_tiff, level);
-        unsigned int codec = 0;
-        TIFFGetField(_tiff, TIFFTAG_COMPRESSION, &codec);
-        unsigned int ycbcr = 0;
-        TIFFGetField(_tiff, TIFFTAG_PHOTOMETRIC, &ycbcr);
-        if (codec == 33005) {
-          if (!_jp2000) {
-            _jp2000 = new JPEG2000Codec();
+    }
+  }
+  return temp;
+}
+
+template <typename Stored> std::vector<bool> TIFFImage::readTiles(TIFFLevel& tiffLevel, const std::vector<unsigned int>& tileNumbers, std::vector<Stored*>& tiles, const unsigned long long& tileSize) {
+  // Runs of tiles stored back to back are read at once up to this size
+  const unsigned long long maxRunSize = 16 * 1024 * 1024;
+  tmsize_t byteSize = tileSize * sizeof(Stored);
+  bool jpeg2000 = tiffLevel.codec == 33005;
+  bool coalesce = tiffLevel.tileOffsets && tiffLevel.tileByteCounts;
+  std::vector<tmsize_t> rawSizes(tiles.size(), 0);
+  std::vector<bool> decoded(tiles.size(), true);
+  std::vector<unsigned int> order(tileNumbers.size());
+  for (unsigned int i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  if (coalesce) {
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+      return tiffLevel.tileOffsets[tileNumbers[a]] < tiffLevel.tileOffsets[tileNumbers[b]];
+    });
+  }
+  std::vector<unsigned char> run;
+  std::unique_lock<std::mutex> levelLock(*tiffLevel.mutex);
+  for (unsigned int first = 0; first < order.size();) {
+    unsigned int last = first + 1;
+    bool runRead = false;
+    if (coalesce) {
+      unsigned long long runStart = tiffLevel.tileOffsets[tileNumbers[order[first]]];
+      unsigned long long runEnd = runStart + tiffLevel.tileByteCounts[tileNumbers[order[first]]];
+      while (last < order.size() && tiffLevel.tileOffsets[tileNumbers[order[last]]] == runEnd && runEnd - runStart < maxRunSize) {
+        runEnd += tiffLevel.tileByteCounts[tileNumbers[order[last]]];
+        ++last;
+      }
+      if (last - first > 1) {
+        run.resize(runEnd - runStart);
+        thandle_t client = TIFFClientdata(tiffLevel.handle);
+        runRead = TIFFGetSeekProc(tiffLevel.handle)(client, runStart, SEEK_SET) == runStart &&
+          TIFFGetReadProc(tiffLevel.handle)(client, run.data(), run.size()) == static_cast<tmsize_t>(run.size());
+      }
+      if (runRead) {
+        for (unsigned int i = first; i < last; ++i) {
+          unsigned int tileNr = tileNumbers[order[i]];
+          unsigned char* data = run.data() + (tiffLevel.tileOffsets[tileNr] - runStart);
+          tmsize_t size = tiffLevel.tileByteCounts[tileNr];
+          if (jpeg2000) {
+            rawSizes[order[i]] = std::min(size, byteSize);
+            std::copy(data, data + rawSizes[order[i]], reinterpret_cast<unsigned char*>(tiles[order[i]]));
           }
-          unsigned int byteSize = tileW * tileH * getSamplesPerPixel() * sizeof(T);
-          unsigned int rawSize = TIFFReadRawTile(_tiff, TIFFComputeTile(_tiff, ix, iy, 0, 0), tile, byteSize);
-          _jp2000->decode((unsigned char*)tile, rawSize, byteSize);
-        }
-        else {
-          if (codec == COMPRESSION_JPEG && ycbcr == PHOTOMETRIC_YCBCR) {
-            TIFFSetField(_tiff, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+          else {
+            decoded[order[i]] = TIFFReadFromUserBuffer(tiffLevel.handle, tileNr, data, size, tiles[order[i]], byteSize) != 0;
           }
-          TIFFReadTile(_tiff, tile, ix, iy, 0, 0);
         }
-        if (std::static_pointer_cast<TileCache<T>>(_cache)->set(k.str(), tile, tileW * tileH * getSamplesPerPixel() * sizeof(T))) {
-          deleteTile = true;
+      }
+    }
+    if (!runRead) {
+      for (unsigned int i = first; i < last; ++i) {
+        if (jpeg2000) {
+          rawSizes[order[i]] = TIFFReadRawTile(tiffLevel.handle, tileNumbers[order[i]], tiles[order[i]], byteSize);
         }
-        _cacheMutex->unlock();
-      }
-
-      long long ixx = (ix - levelStartX);
-      long long iyy = (iy - levelStartY);
-      long long lyh = levelStartY + height;
-      long long lxw = levelStartX + width;
-      long long ixw = ixx + tileW;
-      long long rowLength = ixw > static_cast<long long>(width) ? (tileW - (ixw - width)) * nrSamples : tileW * nrSamples;
-      long long tileDeltaX = 0;
-      if (ixx < 0) {
-        rowLength += ixx * nrSamples;
-        tileDeltaX -= ixx * nrSamples;
-        ixx = 0;
-      }
-      for (unsigned int ty = 0; ty < tileH; ++ty) {
-        if ((iyy + ty >= 0) && (ixx >= 0) && (iyy + ty < static_cast<long long>(height)) && lxw > 0) {
-          long long idx = (ty + iyy) * width * nrSamples + ixx * nrSamples;
-          long long tids = (ty * tileW) * nrSamples;
-          std::copy(tile + tids + tileDeltaX, tile + tids + rowLength + tileDeltaX, temp + idx);
+        else {
+          decoded[order[i]] = TIFFReadEncodedTile(tiffLevel.handle, tileNumbers[order[i]], tiles[order[i]], byteSize) >= 0;
         }
       }
-      if (deleteTile) {
-        delete[] tile;
-      }
     }
+    first = last;
   }
-  return temp;
+  // Only reading from libtiff needs the lock, decode outside it so tiles requested by
+  // different threads are decoded in parallel
+  levelLock.unlock();
+  if (jpeg2000) {
+    _cacheMutex->lock();
+    if (!_jp2000) {
+      _jp2000 = new JPEG2000Codec();
+    }
+    _cacheMutex->unlock();
+    for (unsigned int i = 0; i < tiles.size(); ++i) {
+      // On failure the buffer still holds (part of) the codestream
+      decoded[i] = rawSizes[i] > 0 && _jp2000->decode(reinterpret_cast<unsigned char*>(tiles[i]), static_cast<unsigned int>(rawSizes[i]), static_cast<unsigned int>(byteSize));
+    }
+  }
+  for (unsigned int i = 0; i < tiles.size(); ++i) {
+    if (!decoded[i]) {
+      std::fill(tiles[i], tiles[i] + tileSize, static_cast<Stored>(0));
+    }
+  }
+  return decoded;
 }
\ No newline at end of file
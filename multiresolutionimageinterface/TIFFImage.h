@@ -22,17 +22,55 @@ public:
   long long getEncodedTileSize(const long long& startX, const long long& startY, const unsigned int& level);
   unsigned char* readEncodedDataFromImage(const long long& startX, const long long& startY, const unsigned int& level);
 
+  bool getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info);
+  bool readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data);
+
 protected :
   void cleanup();
   
   void* readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level);
+  bool readDataFromImageInto(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level, void* data);
+
+  //! Stored is the type of the samples in the file and in the cache, which differs from T for
+  //! Float16 images (unsigned short halves read as float); Bit images keep packed rows of bits.
+  //! The region is written to destination, or to a new array when it is NULL.
+  template <typename T, typename Stored = T> T* FillRequestedRegionFromTIFF(const  long long& startX, const long long& startY, const unsigned long long& width, 
+    const unsigned long long& height, const unsigned int& level, unsigned int nrSamples, T* destination = NULL);
+
+  //! State of a level which is read once when the image is opened. Every level has a TIFF
+  //! handle of its own which stays on the directory of the level, so reading tiles never
+  //! switches directories (libtiff re-reads the directory and its tile offsets and byte counts
+  //! on every switch). Reads from different levels only contend for the file, not for a lock.
+  struct TIFFLevel {
+    TIFF* handle;
+    std::unique_ptr<std::mutex> mutex;
+    unsigned int directory;
+    unsigned int codec;
+    unsigned int photometric;
+    unsigned short ycbcrSubsamplingX;
+    unsigned short ycbcrSubsamplingY;
+    unsigned int numberOfTiles;
+    //! Owned by the handle, valid as long as it stays on the directory of the level
+    unsigned long long* tileByteCounts;
+    unsigned long long* tileOffsets;
+    std::vector<unsigned char> jpegTables;
+  };
+
+  //! Reads and decodes tiles of a level into buffers of tileSize stored samples. The tiles are
+  //! read in the order in which they are stored and tiles stored back to back (e.g. neighbouring
+  //! tiles of images written in Z-order or Hilbert order) are read with a single I/O. Returns for
+  //! every tile whether it was decoded, tiles which could not be read or decoded are filled with 0.
+  template <typename Stored> std::vector<bool> readTiles(TIFFLevel& tiffLevel, const std::vector<unsigned int>& tileNumbers, std::vector<Stored*>& tiles, const unsigned long long& tileSize);
 
-  template <typename T> T* FillRequestedRegionFromTIFF(const  long long& startX, const long long& startY, const unsigned long long& width, 
-    const unsigned long long& height, const unsigned int& level, unsigned int nrSamples);
+  bool initializeLevels(const std::string& imagePath);
 
   TIFF* _tiff;
   std::vector<std::vector<unsigned int> > _tileSizesPerLevel;
+  // TIFF directory of each level, non-tiled directories (e.g. thumbnails or labels) are skipped
+  std::vector<unsigned int> _levelDirectories;
+  std::vector<TIFFLevel> _levels;
 
   std::vector<double> _minValues;
   std::vector<double> _maxValues;
@@ -5,7 +5,9 @@
 #include <string>
 #include <vector>
 
-template <typename T>
+//! LRU cache for decoded tiles. By default tiles are identified by a position string
+//! (x-y-level); callers with cheaper identifiers can provide their own (ordered) key type.
+template <typename T, typename KeyType = std::string>
 class TileCache {
 public :
 
@@ -32,9 +34,9 @@ public :
     }
   }
 
-  typedef std::string keyType;
+  typedef KeyType keyType;
   typedef std::list<keyType> keyTypeList;
-  typedef typename std::map<keyType,std::pair<std::pair<T*, unsigned int>,std::list<keyType>::iterator> >::iterator key_iterator;  
+  typedef typename std::map<keyType,std::pair<std::pair<T*, unsigned int>,typename keyTypeList::iterator> >::iterator key_iterator;  
 
   virtual void get(const keyType& k, T*& tile, unsigned int& size) {
     key_iterator it  = _cache.find(k);
@@ -65,7 +67,7 @@ public :
       evict();
     }
 
-    keyTypeList::iterator it =_LRU.insert(_LRU.end(),k); 
+    typename keyTypeList::iterator it =_LRU.insert(_LRU.end(),k); 
     _cache[k] = std::make_pair(std::make_pair(v,size),it);
     _cacheCurrentByteSize += size;
     return 0;
@@ -100,7 +102,7 @@ protected :
 
   // Structure of the cache is as follow: each entry has a position string as the key (x-y-level)
   // Each value contains ((tile, size), iterator to position in _LRU)
-  std::map<keyType,std::pair<std::pair<T*, unsigned int>,keyTypeList::iterator> > _cache;
+  std::map<keyType,std::pair<std::pair<T*, unsigned int>,typename keyTypeList::iterator> > _cache;
 
 
   // Removes the least recently used (LRU) tile from the cache
@@ -4,9 +4,10 @@
 #include <string>
 #include <cstring>
 #include <math.h>
+#include <algorithm>
 #include "core/filetools.h"
-#include "core/Box.h"
 #include "core/PathologyEnums.h"
+#include "core/PositionalFileReader.h"
 
 // Include DCMTK LIBJPEG for lossy and lossless JPEG compression
 extern "C" {
@@ -18,40 +19,49 @@ extern "C" {
 }
 
 #include "JPEG2000Codec.h"
+#include "JPEGCodec.h"
+#include "DecodePool.h"
 
 using namespace pathology;
 using namespace std;
 
+namespace {
+  // Rounds towards minus infinity, so regions left of or above the image get no tiles
+  long long floorDivide(const long long& value, const long long& divisor) {
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+  }
+}
+
 VSIImage::VSIImage() : MultiResolutionImage(),
-	_vsiFileName(""), _etsFile(""), _tileOffsets(), _tileCoords(),
-	_tileSizeX(0), _tileSizeY(0), _nrTilesX(0),
-	_nrTilesY(0), _compressionType(0) 
+	_vsiFileName(""), _etsFile(""), _ets(), _tiles(), _tileIndex(),
+	_nrTilesPerLevel(), _tileSizeX(0), _tileSizeY(0), _compressionType(0)
 {
 }
 
 VSIImage::~VSIImage() {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
   cleanup();
 }
 
 void VSIImage::cleanup() {
 	_vsiFileName = "";
 	_etsFile = "";
-	_tileCoords.clear();
-	_tileOffsets.clear();
+  _ets.reset();
+	_tiles.clear();
+	_tileIndex.clear();
+	_nrTilesPerLevel.clear();
 	_tileSizeX = 0;
 	_tileSizeY = 0;
-	_nrTilesX = 0;
-	_nrTilesY = 0;
   _compressionType = 0;
   MultiResolutionImage::cleanup();
 }
 
 bool VSIImage::initializeType(const std::string& imagePath) {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
 	cleanup();
 	if (!core::fileExists(imagePath)) {
 		return false;
 	}
-	_vsiFileName = imagePath;
   string pth = core::extractFilePath(imagePath);
 	string fileName = core::extractFileName(imagePath);	
   string baseName = core::extractBaseName(imagePath);    
@@ -70,250 +80,308 @@ bool VSIImage::initializeType(const std::string& imagePath) {
       }
     }
   }
-  unsigned long long _mostNrPixels = 0;
+
+  // The ETS file with the largest base level contains the slide, the others hold overviews and labels
+  unsigned long long mostNrPixels = 0;
+  string etsFile;
 	for (unsigned int i = 0; i < etsFiles.size(); ++i) {
-		ifstream ets;
-		ets.open(etsFiles[i].c_str(), ios::in | ios::binary);
-		if (ets.good()) {
+    PositionalFileReader ets(etsFiles[i]);
+		if (ets.valid()) {
       unsigned long long nrPixels = parseETSFile(ets);
-      if (nrPixels > _mostNrPixels) {
-        _mostNrPixels = nrPixels;
-        _etsFile = etsFiles[i];
+      if (nrPixels > mostNrPixels) {
+        mostNrPixels = nrPixels;
+        etsFile = etsFiles[i];
       }
 		}
-		ets.close();	
-	  _tileCoords.clear();
-	  _tileOffsets.clear();
-	  _tileSizeX = 0;
-	  _tileSizeY = 0;
-	  _nrTilesX = 0;
-	  _nrTilesY = 0;
-    _compressionType = 0;
-    _levelDimensions.clear();
+    cleanup();
 	}
-	ifstream ets;
-	ets.open(_etsFile.c_str(), ios::in | ios::binary);
-  parseETSFile(ets);
-  ets.close();	
+  if (etsFile.empty()) {
+    return false;
+  }
+  _vsiFileName = imagePath;
+  _etsFile = etsFile;
+  _ets.reset(new PositionalFileReader(_etsFile));
+  parseETSFile(*_ets);
   _fileType = "vsi";
+  _filePath = imagePath;
+  if (_isValid) {
+    createCache<unsigned char>();
+  }
   return _isValid;
 }
 
-unsigned long long VSIImage::parseETSFile(std::ifstream& ets) {
-  // Read general file info
-  char* memblock = new char[4];
-  char* memblockLong = new char[8];
-  ets.read(memblock,4);
-  ets.read(memblock,4);
-  int headerSize = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int version = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int nDims = *reinterpret_cast<int*>(memblock);
-  ets.read(memblockLong,8);
-  long additionalHeaderOffset = *reinterpret_cast<long*>(memblockLong);
-  ets.read(memblock,4);
-  int additionalHeaderSize =  *reinterpret_cast<int*>(memblock);
-  ets.seekg(4, ios::cur);
-  ets.read(memblockLong, 8);
-  unsigned long long usedChunkOffset = *reinterpret_cast<unsigned long long *>(memblockLong);
-  ets.read(memblock,4);
-  int nUsedChunks =  *reinterpret_cast<int*>(memblock);
-  ets.seekg(additionalHeaderOffset);
-  ets.read(memblock,4);
-  ets.seekg(4, ios::cur);
-  ets.read(memblock,4);
-  int pixelType = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int nrColors = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int colorSpace = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  _compressionType = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int compressionQuality = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  _tileSizeX = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  _tileSizeY = *reinterpret_cast<int*>(memblock);
-  ets.read(memblock,4);
-  int tileDepth = *reinterpret_cast<int*>(memblock);
-  bool isRGB = nrColors > 1;
+unsigned long long VSIImage::parseETSFile(const PositionalFileReader& ets) {
+  _isValid = false;
 
-  // Read locations of tiles and file offsets
-  ets.seekg(usedChunkOffset);
-  for (int tile = 0; tile < nUsedChunks; ++tile) {
-	  ets.seekg(4,ios::cur);
-	  vector<int> curTileCoords;
-   	  for (int i=0; i<nDims; i++) {
-		  ets.read(memblock,4);
-		  curTileCoords.push_back(*reinterpret_cast<int*>(memblock));
-	  }
-	  ets.read(memblockLong,8);
-	  _tileOffsets.push_back(*reinterpret_cast<unsigned long long*>(memblockLong));
-        ets.read(memblock,4);
-	  int nrBytes = *reinterpret_cast<int*>(memblock);
-	  ets.seekg(4, ios::cur);
-	  _tileCoords.push_back(curTileCoords);
-  }
-  int maxX = 0;
-  int maxY = 0;
-
-  for (vector<vector<int> >::iterator t = _tileCoords.begin(); t != _tileCoords.end(); ++t) {
-	  if ((*t)[0] > maxX) {
-	  maxX = (*t)[0];
-	  }
-	  if ((*t)[1] > maxY) {
-	  maxY = (*t)[1];
-	  }
+  // Read general file info
+  unsigned char header[44];
+  if (!ets.read(0, sizeof(header), header)) {
+    return 0;
   }
-  std::vector<unsigned long long> L0Dims(2,0);
-  if (maxX > 1) {
-	  L0Dims[0] = _tileSizeX * (maxX + 1);
+  int nDims = 0;
+  long long additionalHeaderOffset = 0;
+  unsigned long long usedChunkOffset = 0;
+  int nUsedChunks = 0;
+  std::memcpy(&nDims, header + 12, 4);
+  std::memcpy(&additionalHeaderOffset, header + 16, 8);
+  std::memcpy(&usedChunkOffset, header + 32, 8);
+  std::memcpy(&nUsedChunks, header + 40, 4);
+  if (nDims < 2 || nUsedChunks <= 0) {
+    return 0;
   }
-  else {
-	  L0Dims[0] = _tileSizeX;
-  }
-  if (maxY > 1) {
-	  L0Dims[1] = _tileSizeY * (maxY + 1);
+
+  // Additional header: magic, version, pixel type, nr colors, color space, compression, quality, tile size
+  int additionalHeader[10];
+  if (!ets.read(additionalHeaderOffset, sizeof(additionalHeader), additionalHeader)) {
+    return 0;
   }
-  else {
-	  L0Dims[1] = _tileSizeY;
+  _compressionType = additionalHeader[5];
+  _tileSizeX = additionalHeader[7];
+  _tileSizeY = additionalHeader[8];
+  if (_tileSizeX == 0 || _tileSizeY == 0) {
+    return 0;
   }
-  _levelDimensions.push_back(L0Dims);
 
-  if (maxY > 1) {
-	  _nrTilesY = maxY + 1;
+  // Read locations of tiles and file offsets in one go, each entry consists of 4 reserved bytes,
+  // the coordinates, the offset, the number of bytes and another 4 reserved bytes. The last
+  // coordinate is the pyramid level when there are more than three dimensions.
+  unsigned int entrySize = 4 + 4 * nDims + 8 + 4 + 4;
+  vector<unsigned char> chunks(static_cast<size_t>(entrySize) * nUsedChunks);
+  if (!ets.read(usedChunkOffset, chunks.size(), chunks.data())) {
+    return 0;
   }
-  else {
-	  _nrTilesY = 1;
+  vector<vector<int> > tileCoords(nUsedChunks, vector<int>(nDims, 0));
+  _tiles.resize(nUsedChunks);
+  vector<vector<unsigned int> > maxTile;
+  for (int tile = 0; tile < nUsedChunks; ++tile) {
+    const unsigned char* entry = chunks.data() + static_cast<size_t>(tile) * entrySize;
+    std::memcpy(tileCoords[tile].data(), entry + 4, 4 * nDims);
+    std::memcpy(&_tiles[tile].offset, entry + 4 + 4 * nDims, 8);
+    std::memcpy(&_tiles[tile].size, entry + 4 + 4 * nDims + 8, 4);
+    int level = nDims > 3 ? tileCoords[tile][nDims - 1] : 0;
+    if (level < 0 || tileCoords[tile][0] < 0 || tileCoords[tile][1] < 0) {
+      continue;
+    }
+    if (level >= static_cast<int>(maxTile.size())) {
+      maxTile.resize(level + 1);
+    }
+    if (maxTile[level].empty()) {
+      maxTile[level] = { 0, 0 };
+    }
+    maxTile[level][0] = std::max(maxTile[level][0], static_cast<unsigned int>(tileCoords[tile][0]));
+    maxTile[level][1] = std::max(maxTile[level][1], static_cast<unsigned int>(tileCoords[tile][1]));
   }
-  if (maxX > 1) {
-	  _nrTilesX = maxX + 1;
+
+  // Only expose the consecutive levels starting at the base level
+  for (unsigned int level = 0; level < maxTile.size() && !maxTile[level].empty(); ++level) {
+    unsigned int nrTilesX = maxTile[level][0] + 1;
+    unsigned int nrTilesY = maxTile[level][1] + 1;
+    _nrTilesPerLevel.push_back({ nrTilesX, nrTilesY });
+    _levelDimensions.push_back({ static_cast<unsigned long long>(_tileSizeX) * nrTilesX, static_cast<unsigned long long>(_tileSizeY) * nrTilesY });
+    _tileIndex.push_back(vector<long long>(static_cast<size_t>(nrTilesX) * nrTilesY, -1));
   }
-  else {
-	  _nrTilesX = 1;
+  for (int tile = 0; tile < nUsedChunks; ++tile) {
+    const vector<int>& coords = tileCoords[tile];
+    int level = nDims > 3 ? coords[nDims - 1] : 0;
+    if (level < 0 || level >= static_cast<int>(_tileIndex.size()) || coords[0] < 0 || coords[1] < 0) {
+      continue;
+    }
+    // Prefer the tile of the first plane/channel when there are multiple for the same position
+    long long& index = _tileIndex[level][static_cast<size_t>(coords[1]) * _nrTilesPerLevel[level][0] + coords[0]];
+    bool firstPlane = nDims < 3 || coords[2] == 0;
+    if (index < 0 || (firstPlane && nDims > 2 && tileCoords[index][2] != 0)) {
+      index = tile;
+    }
   }
 
-  delete[] memblock;
-  delete[] memblockLong;
-
   // Set some defaults for VSI
-  _numberOfLevels = 1;
+  _numberOfLevels = _levelDimensions.size();
   _samplesPerPixel = 3;
   _colorType = ColorType::RGB;
   _dataType = DataType::UChar;
-  if (L0Dims[0]*L0Dims[1] > 0) {
-    _isValid = true;
-  } else {
-    _isValid = false;
+  if (_numberOfLevels == 0) {
+    return 0;
   }
-
-  return L0Dims[0]*L0Dims[1];
+  unsigned long long nrPixels = _levelDimensions[0][0] * _levelDimensions[0][1];
+  _isValid = nrPixels > 0;
+  return nrPixels;
 }
 
-char* VSIImage::decodeTile(int no, int row, int col) const {	
-  int size = _tileSizeX*_tileSizeY*3;
-  char* buf = new char[size];
-  std::fill(buf, buf + size, 255);
-	if (no!=_tileCoords.size()) {
-		ifstream ets;
-		ets.open(_etsFile.c_str(), ios::in | ios::binary);
-		ets.seekg(_tileOffsets[no]);
-    ets.read(buf, size);
-    if (_compressionType == 0) {
-      return buf;
+bool VSIImage::decodeTile(const ETSTile& tile, unsigned char* buffer) const {
+  unsigned int size = _tileSizeX * _tileSizeY * 3;
+  vector<unsigned char> compressed(tile.size);
+  if (tile.size == 0 || !_ets->read(tile.offset, tile.size, compressed.data())) {
+    return false;
+  }
+  if (_compressionType == 0) {
+    std::copy(compressed.begin(), compressed.begin() + std::min(size, tile.size), buffer);
+  }
+  else if (_compressionType == 3) {
+    JPEG2000Codec cod;
+    std::fill(buffer, buffer + size, 0);
+    if (!cod.decode(compressed.data(), tile.size, buffer, size)) {
+      std::fill(buffer, buffer + size, 0);
+      return false;
     }
-    else if (_compressionType == 3) {
-      JPEG2000Codec cod;
-      cod.decode((unsigned char*)buf, size, size);
+  }
+  else if (_compressionType == 2 || _compressionType == 5) {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr; //error handling
+    jpeg_source_mgr src_mem;
+    jpeg_create_decompress(&cinfo);
+    cinfo.err = jpeg_std_error(&jerr);      
+    jpeg_mem_src(&cinfo, &src_mem, (void*)compressed.data(), tile.size);
+    jpeg_read_header(&cinfo, true);
+    if (_compressionType == 2) {
+      cinfo.jpeg_color_space = JCS_YCbCr;
+    } else {
+      cinfo.jpeg_color_space = JCS_RGB;
     }
-    else if (_compressionType == 2 || _compressionType == 5) {
-      jpeg_decompress_struct cinfo;
-      jpeg_error_mgr jerr; //error handling
-      jpeg_source_mgr src_mem;
-      jpeg_create_decompress(&cinfo);
-      cinfo.err = jpeg_std_error(&jerr);      
-      jpeg_mem_src(&cinfo, &src_mem, (void*)buf, size);
-      jpeg_read_header(&cinfo, true);
-      if (_compressionType == 2) {
-        cinfo.jpeg_color_space = JCS_YCbCr;
-      } else {
-        cinfo.jpeg_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    unsigned char* line = buffer;
+    unsigned int rowSize = 3 * std::min(cinfo.output_width, _tileSizeX);
+    vector<unsigned char> scanline(3 * cinfo.output_width);
+    unsigned char* scanlinePtr = scanline.data();
+    while (cinfo.output_scanline < cinfo.output_height) {
+      jpeg_read_scanlines(&cinfo, &scanlinePtr, 1);
+      if (cinfo.output_scanline <= _tileSizeY) {
+        std::copy(scanline.begin(), scanline.begin() + rowSize, line);
+        line += 3 * _tileSizeX;
       }
-      jpeg_start_decompress(&cinfo);
-      unsigned char* outBuf = new unsigned char[size];
-      unsigned char* line = outBuf;
-      while (cinfo.output_scanline < cinfo.output_height) {
-        jpeg_read_scanlines (&cinfo, &line, 1);
-        line += 3*cinfo.output_width;
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+  }
+  else {
+    return false;
+  }
+	return true;
+}
+
+bool VSIImage::getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info) {
+  // Compression type 5 is lossless JPEG, which is only supported by the DCMTK decoder
+  if (level >= _numberOfLevels || (_compressionType != 2 && _compressionType != 3)) {
+    return false;
+  }
+  info.tileWidth = _tileSizeX;
+  info.tileHeight = _tileSizeY;
+  info.compression = _compressionType == 2 ? Compression::JPEG : Compression::JPEG2000;
+  info.ycbcr = _compressionType == 2;
+  info.ycbcrSubsamplingX = 1;
+  info.ycbcrSubsamplingY = 1;
+  info.jpegTables.clear();
+  if (_compressionType == 2) {
+    // Tiles are complete JPEG streams which are all written with the same subsampling
+    std::vector<unsigned char> tile;
+    unsigned int width = 0, height = 0, nrComponents = 0;
+    for (unsigned long long i = 0; i < _tileIndex[level].size() && tile.empty(); ++i) {
+      if (_tileIndex[level][i] >= 0) {
+        readEncodedTile(level, i % _nrTilesPerLevel[level][0], i / _nrTilesPerLevel[level][0], tile);
       }
-      jpeg_finish_decompress(&cinfo);
-      jpeg_destroy_decompress(&cinfo);
-      delete[] buf;
-      buf = (char*)outBuf;
     }
-	}
-	return buf;
+    if (tile.empty() || !JPEGCodec().readHeader(tile.data(), tile.size(), width, height, nrComponents, info.ycbcrSubsamplingX, info.ycbcrSubsamplingY)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool VSIImage::readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  data.clear();
+  if (level >= _numberOfLevels || tileX >= _nrTilesPerLevel[level][0] || tileY >= _nrTilesPerLevel[level][1]) {
+    return false;
+  }
+  long long index = _tileIndex[level][tileY * _nrTilesPerLevel[level][0] + tileX];
+  if (index < 0 || _tiles[index].size == 0) {
+    return false;
+  }
+  data.resize(_tiles[index].size);
+  if (!_ets->read(_tiles[index].offset, _tiles[index].size, data.data())) {
+    data.clear();
+    return false;
+  }
+  return true;
 }
 
 void* VSIImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width, 
     const unsigned long long& height, const unsigned int& level) {
-    if (level!=0) {
-      return NULL;
-    }
-    int dataSize = width*height*_samplesPerPixel;
-    unsigned char* data = new unsigned char[dataSize];
-    std::fill(data, data + dataSize, 255);
-    int tileRows = _nrTilesY;
-    int tileCols = _nrTilesX;
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (level >= _numberOfLevels) {
+    return NULL;
+  }
+  unsigned long long dataSize = width * height * _samplesPerPixel;
+  unsigned char* data = new unsigned char[dataSize];
+  std::fill(data, data + dataSize, 255);
 
-    Box image = Box(startX, startY, width, height);
-    int outputRow = 0, outputCol = 0;
-    int outputRowLen = width * 3;
+  double downsample = getLevelDownsample(level);
+  long long levelStartX = std::floor(startX / downsample + 0.5);
+  long long levelStartY = std::floor(startY / downsample + 0.5);
+  long long levelEndX = levelStartX + static_cast<long long>(width);
+  long long levelEndY = levelStartY + static_cast<long long>(height);
+  long long nrTilesX = _nrTilesPerLevel[level][0];
+  long long nrTilesY = _nrTilesPerLevel[level][1];
+  long long firstCol = std::max(0LL, floorDivide(levelStartX, _tileSizeX));
+  long long firstRow = std::max(0LL, floorDivide(levelStartY, _tileSizeY));
+  long long lastCol = std::min(nrTilesX - 1, floorDivide(levelEndX - 1, _tileSizeX));
+  long long lastRow = std::min(nrTilesY - 1, floorDivide(levelEndY - 1, _tileSizeY));
+  unsigned int tileByteSize = _tileSizeX * _tileSizeY * 3;
 
-	  Box intersection(0,0,0,0);
-    for (int row=0; row<tileRows; row++) {
-      for (int col=0; col<tileCols; col++) {
-        int width = _tileSizeX;
-        int height = _tileSizeY;
-        Box tile = Box(col * width, row * height, width, height);
-        if (!tile.intersects(image)) {
+  auto copyTile = [&](const unsigned char* tile, long long col, long long row) {
+    long long tileX = col * _tileSizeX;
+    long long tileY = row * _tileSizeY;
+    long long x0 = std::max(tileX, levelStartX);
+    long long x1 = std::min(tileX + static_cast<long long>(_tileSizeX), levelEndX);
+    long long y0 = std::max(tileY, levelStartY);
+    long long y1 = std::min(tileY + static_cast<long long>(_tileSizeY), levelEndY);
+    for (long long y = y0; y < y1 && x0 < x1; ++y) {
+      const unsigned char* source = tile + 3 * ((y - tileY) * _tileSizeX + (x0 - tileX));
+      std::memcpy(data + 3 * ((y - levelStartY) * width + (x0 - levelStartX)), source, 3 * (x1 - x0));
+    }
+  };
+  auto tileKey = [&](long long col, long long row) {
+    return std::to_string(col) + "-" + std::to_string(row) + "-" + std::to_string(level);
+  };
+
+  // Copy cached tiles (under the lock, so they cannot be evicted meanwhile) and collect the rest
+  vector<std::pair<long long, long long> > tilesToDecode;
+  {
+    std::unique_lock<std::mutex> cl(*_cacheMutex);
+    std::shared_ptr<TileCache<unsigned char> > cache = std::static_pointer_cast<TileCache<unsigned char> >(_cache);
+    for (long long row = firstRow; row <= lastRow; ++row) {
+      for (long long col = firstCol; col <= lastCol; ++col) {
+        if (_tileIndex[level][row * nrTilesX + col] < 0) {
           continue;
         }
-
-        intersection = tile.intersection(image);
-        int intersectionX = 0;
-
-        if (tile.getStart()[0] < image.getStart()[0]) {
-          intersectionX = image.getStart()[0] - tile.getStart()[0];
+        unsigned char* tile = NULL;
+        unsigned int cachedSize = 0;
+        cache->get(tileKey(col, row), tile, cachedSize);
+        if (tile) {
+          copyTile(tile, col, row);
         }
-
-		    int no=0;
-		    for (vector<vector<int> >::const_iterator it = _tileCoords.begin(); it != _tileCoords.end(); ++it) {
-			    if (((*it)[0] == col) && ((*it)[1] == row && ((*it)[3] == 0))) {
-				    break;
-			    }
-			    no++;
-		    }
-        char* tileBuf =  decodeTile(no, row, col);
-        int rowLen = 3 * (intersection.getSize()[0] < width ? intersection.getSize()[0] : width);
-        int outputOffset = outputRow * outputRowLen + outputCol;
-        for (int trow=0; trow<intersection.getSize()[1]; trow++) {
-          int realRow = trow + intersection.getStart()[1] - tile.getStart()[1];
-          int inputOffset = 3 * (realRow * width + intersectionX);
-          std::memcpy(data+outputOffset, tileBuf+inputOffset, rowLen);
-          outputOffset += outputRowLen;
+        else {
+          tilesToDecode.push_back(std::make_pair(col, row));
         }
-
-        outputCol += rowLen;
-		    delete[] tileBuf;
       }
+    }
+  }
 
-      if (intersection.getSize()[0] > 0 && intersection.getSize()[1] > 0) {
-        outputRow += intersection.getSize()[1];
-        outputCol = 0;
-      }
+  // Decode the remaining tiles outside the lock on the shared decode pool. Tiles cover disjoint
+  // parts of the region, so they can be copied without synchronization.
+  DecodePool::instance().run(tilesToDecode.size(), [&](size_t i) {
+    long long col = tilesToDecode[i].first;
+    long long row = tilesToDecode[i].second;
+    unsigned char* tile = new unsigned char[tileByteSize];
+    std::fill(tile, tile + tileByteSize, 255);
+    if (!decodeTile(_tiles[_tileIndex[level][row * nrTilesX + col]], tile)) {
+      delete[] tile;
+      return;
+    }
+    copyTile(tile, col, row);
+    std::unique_lock<std::mutex> cl(*_cacheMutex);
+    if (std::static_pointer_cast<TileCache<unsigned char> >(_cache)->set(tileKey(col, row), tile, tileByteSize)) {
+      delete[] tile;
     }
+  });
   return data;
 }
@@ -2,9 +2,12 @@
 #define _VSIImage
 
 #include <vector>
+#include <memory>
 #include "MultiResolutionImage.h"
 #include "multiresolutionimageinterface_export.h"
 
+class PositionalFileReader;
+
 class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT VSIImage : public MultiResolutionImage {
 
 public:
@@ -13,6 +16,10 @@ public:
 
   bool initializeType(const std::string& imagePath);
 
+  //! Tiles compressed as (lossy) JPEG or JPEG2000 can be read as stored in the ETS file
+  bool getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info);
+  bool readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data);
+
 protected :
 
   void cleanup();
@@ -24,18 +31,28 @@ protected :
   double getMaxValue(int channel = -1) { return 255.; }
 
 private :
+  struct ETSTile {
+    unsigned long long offset;
+    unsigned int size;
+  };
+
 	std::string _vsiFileName;
 	std::string _etsFile;
-	std::vector<unsigned long long> _tileOffsets;
-	std::vector<std::vector<int> > _tileCoords;
+
+  // Kept open for the lifetime of the image, tiles are read with positional reads
+  std::unique_ptr<PositionalFileReader> _ets;
+
+  // All tiles in the ETS file, and per level a (row-major) lookup from tile position to
+  // the index in _tiles, -1 for positions without a tile
+  std::vector<ETSTile> _tiles;
+  std::vector<std::vector<long long> > _tileIndex;
+  std::vector<std::vector<unsigned int> > _nrTilesPerLevel;
 	unsigned int _tileSizeX;
 	unsigned int _tileSizeY;
-	unsigned int _nrTilesX;
-	unsigned int _nrTilesY;
   unsigned int _compressionType;
 
-  char* decodeTile(int no, int row, int col) const;
-  unsigned long long parseETSFile(std::ifstream& ets);
+  bool decodeTile(const ETSTile& tile, unsigned char* buffer) const;
+  unsigned long long parseETSFile(const PositionalFileReader& ets);
 };
 
-#endif
\ No newline at end of file
+#endif
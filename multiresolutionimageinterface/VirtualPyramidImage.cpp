@@ -0,0 +1,496 @@
+#include "VirtualPyramidImage.h"
+#include "PixelConversion.h"
+#include "JPEGCodec.h"
+#include "JPEG2000Codec.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+using namespace pathology;
+
+namespace {
+
+  // Consecutive levels further apart than this get levels in between; pyramids are usually
+  // made with factors of 2 or 4
+  const double MAX_LEVEL_STEP = 4.5;
+
+  // Images of which the coarsest level is this large are too slow to show as a whole
+  const unsigned long long MAX_COARSEST_LEVEL_SIZE = 4096;
+
+  // Virtual levels are added below the coarsest level until it is this small
+  const unsigned long long MIN_COARSEST_LEVEL_SIZE = 1024;
+
+  // Synthesized tiles are cached as they are expensive to recompute
+  const unsigned long long DEFAULT_CACHE_SIZE = 256 * 1024 * 1024;
+
+  const char SIDECAR_MAGIC[8] = { 'A', 'S', 'A', 'P', 'V', 'P', 'Y', '1' };
+
+  // A sidecar record is the level, column and row of a tile and the size of its data
+  const unsigned long long SIDECAR_RECORD_HEADER_SIZE = sizeof(unsigned int) + 3 * sizeof(unsigned long long);
+
+  std::string tileKey(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY) {
+    return std::to_string(tileX) + "-" + std::to_string(tileY) + "-" + std::to_string(level);
+  }
+
+  template <typename T> void appendValue(std::vector<char>& buffer, const T& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+  }
+
+  template <typename T> T readValue(const char*& buffer) {
+    T value;
+    std::memcpy(&value, buffer, sizeof(T));
+    buffer += sizeof(T);
+    return value;
+  }
+
+}
+
+VirtualPyramidImage::VirtualPyramidImage(MultiResolutionImage* source) : MultiResolutionImage(),
+  _source(source), _virtualLevels(), _sidecar(), _sidecarIndex(), _sidecarEnd(0)
+{
+}
+
+VirtualPyramidImage::~VirtualPyramidImage() {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
+  cleanup();
+}
+
+void VirtualPyramidImage::cleanup() {
+  _virtualLevels.clear();
+  {
+    std::unique_lock<std::mutex> sl(_sidecarMutex);
+    _sidecar.reset();
+    _sidecarIndex.clear();
+    _sidecarEnd = 0;
+  }
+  MultiResolutionImage::cleanup();
+}
+
+bool VirtualPyramidImage::needsVirtualLevels(MultiResolutionImage* image) {
+  if (!image || !image->valid()) {
+    return false;
+  }
+  int nrLevels = image->getNumberOfLevels();
+  std::vector<unsigned long long> coarsest = image->getLevelDimensions(nrLevels - 1);
+  if (std::max(coarsest[0], coarsest[1]) >= MAX_COARSEST_LEVEL_SIZE) {
+    return true;
+  }
+  for (int level = 1; level < nrLevels; ++level) {
+    if (image->getLevelDownsample(level) / image->getLevelDownsample(level - 1) > MAX_LEVEL_STEP) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool VirtualPyramidImage::initializeType(const std::string& imagePath) {
+  std::unique_lock<std::shared_mutex> l(*_openCloseMutex);
+  cleanup();
+  if (!_source || (!_source->valid() && !_source->initialize(imagePath))) {
+    return false;
+  }
+  _filePath = imagePath;
+  return initializeLevels();
+}
+
+bool VirtualPyramidImage::initializeLevels() {
+  // Each synthesized level halves the level before it, up to the next level of the source
+  auto addVirtualLevel = [this]() {
+    const std::vector<unsigned long long>& previous = _levelDimensions.back();
+    std::vector<unsigned long long> dims(2);
+    dims[0] = (previous[0] + 1) / 2;
+    dims[1] = (previous[1] + 1) / 2;
+    VirtualLevel virtualLevel = { _virtualLevels.back().sourceLevel, _virtualLevels.back().reduction + 1 };
+    _levelDimensions.push_back(dims);
+    _virtualLevels.push_back(virtualLevel);
+  };
+
+  for (int sourceLevel = 0; sourceLevel < _source->getNumberOfLevels(); ++sourceLevel) {
+    std::vector<unsigned long long> dims = _source->getLevelDimensions(sourceLevel);
+    if (dims.size() < 2 || dims[0] == 0 || dims[1] == 0) {
+      return false;
+    }
+    while (!_levelDimensions.empty() && static_cast<double>(_levelDimensions.back()[0]) / dims[0] > MAX_LEVEL_STEP) {
+      addVirtualLevel();
+    }
+    VirtualLevel virtualLevel = { static_cast<unsigned int>(sourceLevel), 0 };
+    _levelDimensions.push_back(dims);
+    _virtualLevels.push_back(virtualLevel);
+  }
+  if (_levelDimensions.empty()) {
+    return false;
+  }
+  while (std::max(_levelDimensions.back()[0], _levelDimensions.back()[1]) > MIN_COARSEST_LEVEL_SIZE) {
+    addVirtualLevel();
+  }
+
+  _numberOfLevels = static_cast<unsigned int>(_levelDimensions.size());
+  _samplesPerPixel = _source->getSamplesPerPixel();
+  _colorType = _source->getColorType();
+  // Synthesized tiles are kept as the source reads them, so Float16 and Bit images are
+  // presented as Float and UChar
+  _dataType = decodedDataType(_source->getDataType());
+  _spacing = _source->getSpacing();
+  _fileType = _source->getFileType();
+  _cacheSize = DEFAULT_CACHE_SIZE;
+  _isValid = true;
+  if (_dataType == DataType::UInt32) {
+    createCache<unsigned int>();
+  }
+  else if (_dataType == DataType::UInt16) {
+    createCache<unsigned short>();
+  }
+  else if (_dataType == DataType::UChar) {
+    createCache<unsigned char>();
+  }
+  else if (_dataType == DataType::Float) {
+    createCache<float>();
+  }
+  else {
+    _isValid = false;
+  }
+  return _isValid;
+}
+
+std::string VirtualPyramidImage::getProperty(const std::string& propertyName) {
+  return _source ? _source->getProperty(propertyName) : std::string();
+}
+
+double VirtualPyramidImage::getMinValue(int channel) {
+  return _source ? _source->getMinValue(channel) : 0.;
+}
+
+double VirtualPyramidImage::getMaxValue(int channel) {
+  return _source ? _source->getMaxValue(channel) : 0.;
+}
+
+void VirtualPyramidImage::setCacheSize(const unsigned long long cacheSize) {
+  if (_isValid) {
+    MultiResolutionImage::setCacheSize(cacheSize);
+  }
+  if (_source) {
+    _source->setCacheSize(cacheSize);
+  }
+}
+
+bool VirtualPyramidImage::isVirtualLevel(const unsigned int& level) const {
+  return level < _virtualLevels.size() && _virtualLevels[level].reduction > 0;
+}
+
+MultiResolutionImage* VirtualPyramidImage::getSource() const {
+  return _source.get();
+}
+
+bool VirtualPyramidImage::getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (level >= _virtualLevels.size() || _virtualLevels[level].reduction > 0) {
+    return false;
+  }
+  return _source->getEncodedTileInfo(_virtualLevels[level].sourceLevel, info);
+}
+
+bool VirtualPyramidImage::readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (level >= _virtualLevels.size() || _virtualLevels[level].reduction > 0) {
+    return false;
+  }
+  return _source->readEncodedTile(_virtualLevels[level].sourceLevel, tileX, tileY, data);
+}
+
+void* VirtualPyramidImage::readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width,
+  const unsigned long long& height, const unsigned int& level) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (level >= _virtualLevels.size()) {
+    return NULL;
+  }
+  double downsample = getLevelDownsample(level);
+  long long levelStartX = std::floor(startX / downsample + 0.5);
+  long long levelStartY = std::floor(startY / downsample + 0.5);
+  if (_dataType == DataType::UInt32) {
+    return readRegion<unsigned int>(level, levelStartX, levelStartY, width, height);
+  }
+  else if (_dataType == DataType::UInt16) {
+    return readRegion<unsigned short>(level, levelStartX, levelStartY, width, height);
+  }
+  else if (_dataType == DataType::Float) {
+    return readRegion<float>(level, levelStartX, levelStartY, width, height);
+  }
+  else if (_dataType == DataType::UChar) {
+    return readRegion<unsigned char>(level, levelStartX, levelStartY, width, height);
+  }
+  return NULL;
+}
+
+template <typename T> T* VirtualPyramidImage::readRegion(const unsigned int& level, const long long& levelX, const long long& levelY,
+  const unsigned long long& width, const unsigned long long& height) {
+  unsigned long long dataSize = width * height * _samplesPerPixel;
+  T* data = new T[dataSize];
+  const VirtualLevel& virtualLevel = _virtualLevels[level];
+  if (virtualLevel.reduction == 0) {
+    double downsample = getLevelDownsample(level);
+    _source->getRawRegion<T>(std::floor(levelX * downsample + 0.5), std::floor(levelY * downsample + 0.5), width, height, virtualLevel.sourceLevel, data);
+    return data;
+  }
+  std::fill(data, data + dataSize, static_cast<T>(0));
+
+  const std::vector<unsigned long long>& dims = _levelDimensions[level];
+  long long tileSize = TILE_SIZE;
+  long long levelEndX = levelX + static_cast<long long>(width);
+  long long levelEndY = levelY + static_cast<long long>(height);
+  long long nrTilesX = (dims[0] + TILE_SIZE - 1) / TILE_SIZE;
+  long long nrTilesY = (dims[1] + TILE_SIZE - 1) / TILE_SIZE;
+  long long firstCol = std::max(0LL, levelX / tileSize);
+  long long firstRow = std::max(0LL, levelY / tileSize);
+  long long lastCol = std::min(nrTilesX - 1, (levelEndX - 1) / tileSize);
+  long long lastRow = std::min(nrTilesY - 1, (levelEndY - 1) / tileSize);
+
+  // Tiles are stored without padding, edge tiles are smaller
+  auto copyTile = [&](const T* tile, long long col, long long row) {
+    long long tileX = col * tileSize;
+    long long tileY = row * tileSize;
+    long long tileWidth = std::min(tileSize, static_cast<long long>(dims[0]) - tileX);
+    long long tileHeight = std::min(tileSize, static_cast<long long>(dims[1]) - tileY);
+    long long x0 = std::max(tileX, levelX);
+    long long x1 = std::min(tileX + tileWidth, levelEndX);
+    long long y0 = std::max(tileY, levelY);
+    long long y1 = std::min(tileY + tileHeight, levelEndY);
+    for (long long y = y0; y < y1 && x0 < x1; ++y) {
+      const T* source = tile + _samplesPerPixel * ((y - tileY) * tileWidth + (x0 - tileX));
+      std::copy(source, source + _samplesPerPixel * (x1 - x0), data + _samplesPerPixel * ((y - levelY) * width + (x0 - levelX)));
+    }
+  };
+
+  for (long long row = firstRow; row <= lastRow; ++row) {
+    for (long long col = firstCol; col <= lastCol; ++col) {
+      std::string key = tileKey(level, col, row);
+      {
+        // Copy under the lock, so the tile cannot be evicted meanwhile
+        std::unique_lock<std::mutex> cl(*_cacheMutex);
+        T* tile = NULL;
+        unsigned int cachedSize = 0;
+        std::static_pointer_cast<TileCache<T> >(_cache)->get(key, tile, cachedSize);
+        if (tile) {
+          copyTile(tile, col, row);
+          continue;
+        }
+      }
+      T* tile = synthesizeTile<T>(level, col, row);
+      copyTile(tile, col, row);
+      unsigned long long tileWidth = std::min<unsigned long long>(TILE_SIZE, dims[0] - col * TILE_SIZE);
+      unsigned long long tileHeight = std::min<unsigned long long>(TILE_SIZE, dims[1] - row * TILE_SIZE);
+      std::unique_lock<std::mutex> cl(*_cacheMutex);
+      if (std::static_pointer_cast<TileCache<T> >(_cache)->set(key, tile, tileWidth * tileHeight * _samplesPerPixel * sizeof(T))) {
+        delete[] tile;
+      }
+    }
+  }
+  return data;
+}
+
+template <typename T> T* VirtualPyramidImage::synthesizeTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY) {
+  const std::vector<unsigned long long>& dims = _levelDimensions[level];
+  unsigned long long tileWidth = std::min<unsigned long long>(TILE_SIZE, dims[0] - tileX * TILE_SIZE);
+  unsigned long long tileHeight = std::min<unsigned long long>(TILE_SIZE, dims[1] - tileY * TILE_SIZE);
+  unsigned long long tileSize = tileWidth * tileHeight * _samplesPerPixel;
+  T* tile = new T[tileSize];
+  if (readSidecarTile(level, tileX, tileY, tile, tileSize * sizeof(T))) {
+    return tile;
+  }
+
+  std::fill(tile, tile + tileSize, static_cast<T>(0));
+  if (!decodeReducedTile(level, tileX, tileY, tile)) {
+    // The tile halves (at most) 2x2 tiles of the next finer level, which are read from the
+    // source or synthesized themselves
+    std::fill(tile, tile + tileSize, static_cast<T>(0));
+    const std::vector<unsigned long long>& finerDims = _levelDimensions[level - 1];
+    unsigned long long finerX = 2 * tileX * TILE_SIZE;
+    unsigned long long finerY = 2 * tileY * TILE_SIZE;
+    unsigned long long finerWidth = std::min<unsigned long long>(2 * TILE_SIZE, finerDims[0] - finerX);
+    unsigned long long finerHeight = std::min<unsigned long long>(2 * TILE_SIZE, finerDims[1] - finerY);
+    T* finer = readRegion<T>(level - 1, finerX, finerY, finerWidth, finerHeight);
+    downsampleByTwo(finer, finerWidth, finerHeight, _samplesPerPixel, tile);
+    delete[] finer;
+  }
+
+  // Tiles of levels close to the source are cheap to recompute from it
+  if (_virtualLevels[level].reduction >= 2) {
+    writeSidecarTile(level, tileX, tileY, tile, tileSize * sizeof(T));
+  }
+  return tile;
+}
+
+bool VirtualPyramidImage::decodeReducedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, unsigned char* tile) {
+  const VirtualLevel& virtualLevel = _virtualLevels[level];
+  EncodedTileInfo info;
+  if (virtualLevel.reduction > JPEGCodec::MAX_REDUCTION || !_source->getEncodedTileInfo(virtualLevel.sourceLevel, info)) {
+    return false;
+  }
+  // Decoded tiles have to line up with the pixels of the level
+  unsigned int factor = 1 << virtualLevel.reduction;
+  if (info.tileWidth % factor != 0 || info.tileHeight % factor != 0) {
+    return false;
+  }
+  unsigned long long reducedTileWidth = info.tileWidth / factor;
+  unsigned long long reducedTileHeight = info.tileHeight / factor;
+  const std::vector<unsigned long long>& dims = _levelDimensions[level];
+  std::vector<unsigned long long> sourceDims = _source->getLevelDimensions(virtualLevel.sourceLevel);
+  unsigned long long nrSourceTilesX = (sourceDims[0] + info.tileWidth - 1) / info.tileWidth;
+  unsigned long long nrSourceTilesY = (sourceDims[1] + info.tileHeight - 1) / info.tileHeight;
+  unsigned long long x0 = tileX * TILE_SIZE;
+  unsigned long long y0 = tileY * TILE_SIZE;
+  unsigned long long tileWidth = std::min<unsigned long long>(TILE_SIZE, dims[0] - x0);
+  unsigned long long tileHeight = std::min<unsigned long long>(TILE_SIZE, dims[1] - y0);
+  unsigned long long lastCol = std::min(nrSourceTilesX - 1, (x0 + tileWidth - 1) / reducedTileWidth);
+  unsigned long long lastRow = std::min(nrSourceTilesY - 1, (y0 + tileHeight - 1) / reducedTileHeight);
+
+  JPEGCodec jpegCodec;
+  JPEG2000Codec jpeg2000Codec;
+  std::vector<unsigned char> encoded;
+  std::vector<unsigned char> decoded;
+  for (unsigned long long row = y0 / reducedTileHeight; row <= lastRow; ++row) {
+    for (unsigned long long col = x0 / reducedTileWidth; col <= lastCol; ++col) {
+      // Missing tiles are left to the regular path, which fills them like the source does
+      if (!_source->readEncodedTile(virtualLevel.sourceLevel, col, row, encoded)) {
+        return false;
+      }
+      unsigned int width = reducedTileWidth;
+      unsigned int height = reducedTileHeight;
+      if (info.compression == Compression::JPEG) {
+        unsigned int nrComponents = 0;
+        if (!jpegCodec.decode(encoded.data(), encoded.size(), decoded, width, height, nrComponents, virtualLevel.reduction, info.ycbcr, info.jpegTables) ||
+            nrComponents != _samplesPerPixel) {
+          return false;
+        }
+      }
+      else if (info.compression == Compression::JPEG2000) {
+        unsigned int outSize = width * height * _samplesPerPixel;
+        decoded.resize(outSize);
+        if (!jpeg2000Codec.decode(encoded.data(), encoded.size(), decoded.data(), outSize, virtualLevel.reduction)) {
+          return false;
+        }
+      }
+      else {
+        return false;
+      }
+      unsigned long long decodedX = col * reducedTileWidth;
+      unsigned long long decodedY = row * reducedTileHeight;
+      unsigned long long startX = std::max(decodedX, x0);
+      unsigned long long endX = std::min(decodedX + width, x0 + tileWidth);
+      unsigned long long startY = std::max(decodedY, y0);
+      unsigned long long endY = std::min(decodedY + height, y0 + tileHeight);
+      for (unsigned long long y = startY; y < endY && startX < endX; ++y) {
+        const unsigned char* source = decoded.data() + _samplesPerPixel * ((y - decodedY) * width + (startX - decodedX));
+        std::memcpy(tile + _samplesPerPixel * ((y - y0) * tileWidth + (startX - x0)), source, _samplesPerPixel * (endX - startX));
+      }
+    }
+  }
+  return true;
+}
+
+std::vector<char> VirtualPyramidImage::getSidecarHeader() const {
+  // The size of the image file tells apart a replaced file with the same name
+  std::error_code error;
+  unsigned long long sourceFileSize = std::filesystem::file_size(_filePath, error);
+  if (error) {
+    sourceFileSize = 0;
+  }
+  std::vector<char> header(SIDECAR_MAGIC, SIDECAR_MAGIC + sizeof(SIDECAR_MAGIC));
+  appendValue(header, static_cast<unsigned int>(_dataType));
+  appendValue(header, static_cast<unsigned int>(_samplesPerPixel));
+  appendValue(header, static_cast<unsigned int>(TILE_SIZE));
+  appendValue(header, static_cast<unsigned int>(_numberOfLevels));
+  appendValue(header, _levelDimensions[0][0]);
+  appendValue(header, _levelDimensions[0][1]);
+  appendValue(header, sourceFileSize);
+  return header;
+}
+
+bool VirtualPyramidImage::setSidecarFile(const std::string& sidecarPath) {
+  std::shared_lock<std::shared_mutex> l(*_openCloseMutex);
+  if (!_isValid) {
+    return false;
+  }
+  std::unique_lock<std::mutex> sl(_sidecarMutex);
+  _sidecar.reset();
+  _sidecarIndex.clear();
+  _sidecarEnd = 0;
+  std::vector<char> header = getSidecarHeader();
+
+  // Index the complete records of an existing file, a record cut off by a crash is dropped
+  std::error_code error;
+  unsigned long long fileSize = std::filesystem::file_size(sidecarPath, error);
+  if (!error && fileSize >= header.size()) {
+    std::unique_ptr<std::fstream> file(new std::fstream(sidecarPath, std::ios::in | std::ios::out | std::ios::binary));
+    std::vector<char> existingHeader(header.size());
+    if (file->read(existingHeader.data(), existingHeader.size()) && existingHeader == header) {
+      unsigned long long offset = header.size();
+      std::vector<char> recordHeader(SIDECAR_RECORD_HEADER_SIZE);
+      while (offset + SIDECAR_RECORD_HEADER_SIZE <= fileSize && file->read(recordHeader.data(), recordHeader.size())) {
+        const char* field = recordHeader.data();
+        unsigned int level = readValue<unsigned int>(field);
+        unsigned long long tileX = readValue<unsigned long long>(field);
+        unsigned long long tileY = readValue<unsigned long long>(field);
+        unsigned long long byteSize = readValue<unsigned long long>(field);
+        if (offset + SIDECAR_RECORD_HEADER_SIZE + byteSize > fileSize) {
+          break;
+        }
+        _sidecarIndex[tileKey(level, tileX, tileY)] = std::make_pair(offset + SIDECAR_RECORD_HEADER_SIZE, byteSize);
+        offset += SIDECAR_RECORD_HEADER_SIZE + byteSize;
+        file->seekg(offset);
+      }
+      file.reset();
+      if (offset < fileSize) {
+        std::filesystem::resize_file(sidecarPath, offset, error);
+      }
+      _sidecar.reset(new std::fstream(sidecarPath, std::ios::in | std::ios::out | std::ios::binary));
+      if (_sidecar->good()) {
+        _sidecarEnd = offset;
+        return true;
+      }
+      _sidecarIndex.clear();
+    }
+  }
+
+  _sidecar.reset(new std::fstream(sidecarPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc));
+  if (!_sidecar->write(header.data(), header.size())) {
+    _sidecar.reset();
+    return false;
+  }
+  _sidecarEnd = header.size();
+  return true;
+}
+
+bool VirtualPyramidImage::readSidecarTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, void* tile, const unsigned long long& byteSize) {
+  std::unique_lock<std::mutex> sl(_sidecarMutex);
+  if (!_sidecar) {
+    return false;
+  }
+  std::map<std::string, std::pair<unsigned long long, unsigned long long> >::const_iterator record = _sidecarIndex.find(tileKey(level, tileX, tileY));
+  if (record == _sidecarIndex.end() || record->second.second != byteSize) {
+    return false;
+  }
+  _sidecar->clear();
+  _sidecar->seekg(record->second.first);
+  return static_cast<bool>(_sidecar->read(static_cast<char*>(tile), byteSize));
+}
+
+void VirtualPyramidImage::writeSidecarTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, const void* tile, const unsigned long long& byteSize) {
+  std::unique_lock<std::mutex> sl(_sidecarMutex);
+  std::string key = tileKey(level, tileX, tileY);
+  if (!_sidecar || _sidecarIndex.find(key) != _sidecarIndex.end()) {
+    return;
+  }
+  std::vector<char> record;
+  appendValue(record, level);
+  appendValue(record, tileX);
+  appendValue(record, tileY);
+  appendValue(record, byteSize);
+  _sidecar->clear();
+  _sidecar->seekp(_sidecarEnd);
+  if (_sidecar->write(record.data(), record.size()) && _sidecar->write(static_cast<const char*>(tile), byteSize) && _sidecar->flush()) {
+    _sidecarIndex[key] = std::make_pair(_sidecarEnd + record.size(), byteSize);
+    _sidecarEnd += record.size() + byteSize;
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef _VirtualPyramidImage
+#define _VirtualPyramidImage
+
+#include <map>
+#include <fstream>
+#include "MultiResolutionImage.h"
+#include "multiresolutionimageinterface_export.h"
+
+//! Presents an image with a single large level, or with levels which are far apart, as a full
+//! pyramid. The missing levels are synthesized on demand in tiles of TILE_SIZE pixels, which are
+//! kept in the tile cache: a tile halves the 2x2 tiles below it in the next finer level by area
+//! averaging, or, for the first three levels below a level stored as JPEG or JPEG2000, is decoded
+//! directly from that level at reduced resolution. The levels of the source image are read from
+//! the source as they are.
+class MULTIRESOLUTIONIMAGEINTERFACE_EXPORT VirtualPyramidImage : public MultiResolutionImage {
+
+public:
+  static const unsigned int TILE_SIZE = 512;
+
+  //! Takes ownership of the source image
+  VirtualPyramidImage(MultiResolutionImage* source);
+  ~VirtualPyramidImage();
+
+  //! Whether the coarsest level of an image is 4096 pixels or larger, or two consecutive levels
+  //! are more than a factor 4 apart
+  static bool needsVirtualLevels(MultiResolutionImage* image);
+
+  //! Initializes the source image from imagePath, unless it already is, and adds the virtual levels
+  bool initializeType(const std::string& imagePath);
+
+  std::string getProperty(const std::string& propertyName);
+  double getMinValue(int channel = -1);
+  double getMaxValue(int channel = -1);
+
+  //! Sets the size of the cache of synthesized tiles and of the cache of the source image
+  void setCacheSize(const unsigned long long cacheSize);
+
+  //! Whether a level is synthesized rather than a level of the source image
+  bool isVirtualLevel(const unsigned int& level) const;
+  MultiResolutionImage* getSource() const;
+
+  //! Encoded tiles are only available for the levels of the source image
+  bool getEncodedTileInfo(const unsigned int& level, EncodedTileInfo& info);
+  bool readEncodedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, std::vector<unsigned char>& data);
+
+  //! Also keeps the synthesized tiles of levels at least 4 times smaller than the source level
+  //! they derive from in a sidecar file, so coarse levels, for which all of the image has to be
+  //! read, are computed only once. Tiles are stored uncompressed. An existing sidecar file is
+  //! reused when it was written for the same image, otherwise it is replaced. Returns false when
+  //! the file cannot be written.
+  bool setSidecarFile(const std::string& sidecarPath);
+
+protected :
+  void cleanup();
+
+  void* readDataFromImage(const long long& startX, const long long& startY, const unsigned long long& width,
+    const unsigned long long& height, const unsigned int& level);
+
+private :
+  struct VirtualLevel {
+    //! Level of the source image, for synthesized levels the nearest finer one
+    unsigned int sourceLevel;
+    //! The level is 2^reduction times smaller than the source level, 0 for levels of the source
+    unsigned int reduction;
+  };
+
+  bool initializeLevels();
+
+  // Reads a region in the coordinates of the level, the caller holds the open/close lock
+  template <typename T> T* readRegion(const unsigned int& level, const long long& levelX, const long long& levelY,
+    const unsigned long long& width, const unsigned long long& height);
+  template <typename T> T* synthesizeTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY);
+
+  // Fills a tile of a synthesized level by decoding the encoded tiles of its source level at a
+  // reduced resolution, which is only possible for 8-bit images
+  template <typename T> bool decodeReducedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, T* tile) { return false; }
+  bool decodeReducedTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, unsigned char* tile);
+
+  std::vector<char> getSidecarHeader() const;
+  bool readSidecarTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, void* tile, const unsigned long long& byteSize);
+  void writeSidecarTile(const unsigned int& level, const unsigned long long& tileX, const unsigned long long& tileY, const void* tile, const unsigned long long& byteSize);
+
+  std::unique_ptr<MultiResolutionImage> _source;
+  std::vector<VirtualLevel> _virtualLevels;
+
+  // Offset and size of the tiles in the sidecar file
+  std::mutex _sidecarMutex;
+  std::unique_ptr<std::fstream> _sidecar;
+  std::map<std::string, std::pair<unsigned long long, unsigned long long> > _sidecarIndex;
+  unsigned long long _sidecarEnd;
+};
+
+#endif
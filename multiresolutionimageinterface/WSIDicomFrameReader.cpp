@@ -0,0 +1,296 @@
+#include "WSIDicomFrameReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+    const uint32_t UNDEFINED_LENGTH = 0xFFFFFFFF;
+    const uint16_t ITEM_GROUP = 0xFFFE;
+    const uint16_t ITEM = 0xE000;
+    const uint16_t ITEM_DELIMITATION = 0xE00D;
+    const uint16_t SEQUENCE_DELIMITATION = 0xE0DD;
+    const uint16_t PIXEL_DATA_GROUP = 0x7FE0;
+    const uint16_t PIXEL_DATA = 0x0010;
+    const uint16_t EXTENDED_OFFSET_TABLE = 0x0001;
+    const unsigned int MAX_NESTING_DEPTH = 32;
+
+    // Sequential reader on top of the positional reads, buffers a window of the file so walking
+    // many small element headers does not result in a read call per header.
+    class Cursor {
+    public:
+        Cursor(const WSIDicomFrameReader& reader, unsigned long long offset, unsigned int windowSize) :
+            _reader(reader), _offset(offset), _windowStart(0), _windowSize(windowSize) {
+        }
+
+        bool read(void* buffer, unsigned long long size) {
+            if (size > _windowSize) {
+                if (!_reader.read(_offset, size, buffer)) {
+                    return false;
+                }
+                _offset += size;
+                return true;
+            }
+            if (_offset < _windowStart || _offset + size > _windowStart + _window.size()) {
+                unsigned long long fileSize = _reader.getFileSize();
+                if (_offset + size > fileSize) {
+                    return false;
+                }
+                _window.resize(std::min<unsigned long long>(_windowSize, fileSize - _offset));
+                if (!_reader.read(_offset, _window.size(), _window.data())) {
+                    _window.clear();
+                    return false;
+                }
+                _windowStart = _offset;
+            }
+            std::memcpy(buffer, _window.data() + (_offset - _windowStart), size);
+            _offset += size;
+            return true;
+        }
+
+        void skip(unsigned long long size) {
+            _offset += size;
+        }
+
+        unsigned long long offset() const {
+            return _offset;
+        }
+
+    private:
+        const WSIDicomFrameReader& _reader;
+        unsigned long long _offset;
+        unsigned long long _windowStart;
+        unsigned int _windowSize;
+        std::vector<unsigned char> _window;
+    };
+
+    struct ElementHeader {
+        uint16_t group;
+        uint16_t element;
+        char vr[2];
+        uint32_t length;
+    };
+
+    bool hasLongLength(const char vr[2]) {
+        static const char* longVRs[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+        for (const char* longVR : longVRs) {
+            if (vr[0] == longVR[0] && vr[1] == longVR[1]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Reads an explicit VR little endian element header or an item (delimitation) header
+    bool readElementHeader(Cursor& cursor, ElementHeader& header) {
+        unsigned char tag[4];
+        if (!cursor.read(tag, 4)) {
+            return false;
+        }
+        header.group = static_cast<uint16_t>(tag[0] | (tag[1] << 8));
+        header.element = static_cast<uint16_t>(tag[2] | (tag[3] << 8));
+        header.vr[0] = header.vr[1] = 0;
+        if (header.group == ITEM_GROUP) {
+            return cursor.read(&header.length, 4);
+        }
+        if (!cursor.read(header.vr, 2)) {
+            return false;
+        }
+        if (hasLongLength(header.vr)) {
+            cursor.skip(2);
+            return cursor.read(&header.length, 4);
+        }
+        uint16_t shortLength = 0;
+        if (!cursor.read(&shortLength, 2)) {
+            return false;
+        }
+        header.length = shortLength;
+        return true;
+    }
+
+    bool skipSequence(Cursor& cursor, unsigned int depth);
+
+    // Skips the elements of an item with undefined length up to and including its delimiter
+    bool skipItem(Cursor& cursor, unsigned int depth) {
+        ElementHeader header;
+        while (readElementHeader(cursor, header)) {
+            if (header.group == ITEM_GROUP && header.element == ITEM_DELIMITATION) {
+                return true;
+            }
+            if (header.length != UNDEFINED_LENGTH) {
+                cursor.skip(header.length);
+            }
+            else if (header.vr[0] == 'S' && header.vr[1] == 'Q' && depth < MAX_NESTING_DEPTH) {
+                if (!skipSequence(cursor, depth + 1)) {
+                    return false;
+                }
+            }
+            else {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Skips the items of a sequence with undefined length up to and including its delimiter
+    bool skipSequence(Cursor& cursor, unsigned int depth) {
+        ElementHeader header;
+        while (readElementHeader(cursor, header)) {
+            if (header.group != ITEM_GROUP) {
+                return false;
+            }
+            if (header.element == SEQUENCE_DELIMITATION) {
+                return true;
+            }
+            if (header.element != ITEM) {
+                return false;
+            }
+            if (header.length != UNDEFINED_LENGTH) {
+                cursor.skip(header.length);
+            }
+            else if (depth >= MAX_NESTING_DEPTH || !skipItem(cursor, depth + 1)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+}
+
+WSIDicomFrameReader::WSIDicomFrameReader(const std::string& filePath) :
+    _file(filePath), _initialized(false)
+{
+}
+
+WSIDicomFrameReader::~WSIDicomFrameReader()
+{
+}
+
+bool WSIDicomFrameReader::valid() const
+{
+    return _file.valid();
+}
+
+bool WSIDicomFrameReader::initialized() const
+{
+    return _initialized;
+}
+
+unsigned long long WSIDicomFrameReader::getFileSize() const
+{
+    return _file.getFileSize();
+}
+
+bool WSIDicomFrameReader::read(const unsigned long long& offset, const unsigned long long& size, void* buffer) const
+{
+    return _file.read(offset, size, buffer);
+}
+
+bool WSIDicomFrameReader::initialize(const unsigned int& numberOfFrames)
+{
+    _frameOffsets.clear();
+    _initialized = false;
+    char magic[4];
+    if (!read(128, 4, magic) || std::memcmp(magic, "DICM", 4) != 0) {
+        return false;
+    }
+
+    // Walk the top level of the data set until the pixel data, skipping over values and sequences
+    Cursor cursor(*this, 132, 64 * 1024);
+    std::vector<unsigned long long> extendedOffsets;
+    ElementHeader header;
+    bool foundPixelData = false;
+    while (readElementHeader(cursor, header)) {
+        if (header.group == PIXEL_DATA_GROUP && header.element == PIXEL_DATA) {
+            foundPixelData = header.length == UNDEFINED_LENGTH;
+            break;
+        }
+        if (header.group == PIXEL_DATA_GROUP && header.element == EXTENDED_OFFSET_TABLE && header.length != UNDEFINED_LENGTH) {
+            extendedOffsets.resize(header.length / 8);
+            if (!cursor.read(extendedOffsets.data(), extendedOffsets.size() * 8)) {
+                return false;
+            }
+            cursor.skip(header.length - extendedOffsets.size() * 8);
+        }
+        else if (header.length != UNDEFINED_LENGTH) {
+            cursor.skip(header.length);
+        }
+        else if (!skipSequence(cursor, 0)) {
+            return false;
+        }
+    }
+    if (!foundPixelData) {
+        return false;
+    }
+
+    // The first item of encapsulated pixel data is the basic offset table
+    if (!readElementHeader(cursor, header) || header.group != ITEM_GROUP || header.element != ITEM || header.length == UNDEFINED_LENGTH) {
+        return false;
+    }
+    std::vector<uint32_t> basicOffsets(header.length / 4);
+    if (!basicOffsets.empty() && !cursor.read(basicOffsets.data(), basicOffsets.size() * 4)) {
+        return false;
+    }
+    cursor.skip(header.length - basicOffsets.size() * 4);
+    unsigned long long firstFragment = cursor.offset();
+
+    if (extendedOffsets.size() >= numberOfFrames && numberOfFrames > 0) {
+        for (unsigned int i = 0; i < numberOfFrames; ++i) {
+            _frameOffsets.push_back(firstFragment + extendedOffsets[i]);
+        }
+    }
+    else if (basicOffsets.size() >= numberOfFrames && numberOfFrames > 0) {
+        for (unsigned int i = 0; i < numberOfFrames; ++i) {
+            _frameOffsets.push_back(firstFragment + basicOffsets[i]);
+        }
+    }
+    else {
+        // No offset table, walk the fragment headers (assumes one fragment per frame). Values are
+        // skipped, so only read the headers themselves instead of buffering a window of data.
+        Cursor itemCursor(*this, firstFragment, 8);
+        _frameOffsets.reserve(numberOfFrames);
+        while (_frameOffsets.size() < numberOfFrames) {
+            unsigned long long itemOffset = itemCursor.offset();
+            if (!readElementHeader(itemCursor, header) || header.group != ITEM_GROUP || header.element != ITEM || header.length == UNDEFINED_LENGTH) {
+                break;
+            }
+            _frameOffsets.push_back(itemOffset);
+            itemCursor.skip(header.length);
+        }
+    }
+    _initialized = !_frameOffsets.empty();
+    return _initialized;
+}
+
+bool WSIDicomFrameReader::readFrame(const unsigned int& frameIndex, std::vector<unsigned char>& data) const
+{
+    data.clear();
+    if (!_initialized || frameIndex >= _frameOffsets.size()) {
+        return false;
+    }
+    // A frame consists of all fragments up to the start of the next frame
+    unsigned long long offset = _frameOffsets[frameIndex];
+    unsigned long long nextFrame = frameIndex + 1 < _frameOffsets.size() ? _frameOffsets[frameIndex + 1] : getFileSize();
+    while (offset + 8 <= nextFrame) {
+        unsigned char item[8];
+        if (!read(offset, 8, item)) {
+            break;
+        }
+        uint16_t group = static_cast<uint16_t>(item[0] | (item[1] << 8));
+        uint16_t element = static_cast<uint16_t>(item[2] | (item[3] << 8));
+        uint32_t length;
+        std::memcpy(&length, item + 4, 4);
+        if (group != ITEM_GROUP || element != ITEM || length == UNDEFINED_LENGTH) {
+            break;
+        }
+        size_t previousSize = data.size();
+        data.resize(previousSize + length);
+        if (!read(offset + 8, length, data.data() + previousSize)) {
+            data.clear();
+            return false;
+        }
+        offset += 8 + length;
+    }
+    return !data.empty();
+}
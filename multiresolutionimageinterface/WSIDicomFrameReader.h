@@ -0,0 +1,48 @@
+#ifndef _WSIDicomFrameReader
+#define _WSIDicomFrameReader
+
+#include "dicomfileformat_export.h"
+#include <vector>
+#include <string>
+#include "core/PositionalFileReader.h"
+
+//! Reads the encapsulated frames of a DICOM file directly by file offset, so the pixel data
+//! never has to be loaded through DCMTK. On initialization only the element and item headers
+//! are read to locate the pixel data and build the frame offset table (from the extended or
+//! basic offset table when present). Frames are read through a PositionalFileReader, so this
+//! can be done from multiple threads at the same time.
+//! Only explicit VR little endian encoding is supported, which holds for all transfer
+//! syntaxes supported by WSIDicomInstance.
+class DICOMFILEFORMAT_EXPORT WSIDicomFrameReader {
+
+public:
+    WSIDicomFrameReader(const std::string& filePath);
+    ~WSIDicomFrameReader();
+
+    WSIDicomFrameReader(const WSIDicomFrameReader&) = delete;
+    WSIDicomFrameReader& operator=(const WSIDicomFrameReader&) = delete;
+
+    //! Whether the file could be opened
+    bool valid() const;
+
+    //! Locates the pixel data and builds the frame offset table
+    bool initialize(const unsigned int& numberOfFrames);
+    bool initialized() const;
+
+    //! Reads the compressed data of a frame into data (all fragments concatenated)
+    bool readFrame(const unsigned int& frameIndex, std::vector<unsigned char>& data) const;
+
+    //! Reads size bytes starting at offset
+    bool read(const unsigned long long& offset, const unsigned long long& size, void* buffer) const;
+
+    unsigned long long getFileSize() const;
+
+private:
+    PositionalFileReader _file;
+    bool _initialized;
+
+    // Absolute file offsets of the first item of each frame
+    std::vector<unsigned long long> _frameOffsets;
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "dcmtk/config/osconfig.h"
 #include "dcmtk/ofstd/ofcond.h"
@@ -20,22 +21,21 @@
 // JPEG en/decoding
 #include "dcmtk/dcmjpeg/djdecode.h"
 #include "dcmtk/dcmjpeg/djencode.h"
+#include "dcmtk/dcmjpeg/djcparam.h"
+#include "dcmtk/dcmjpeg/djdijg8.h"
 #include "JPEG2000Codec.h"
+#include "WSIDicomFrameReader.h"
 
 const std::vector<std::string> WSIDicomInstance::SUPPORTED_TRANSFER_SYNTAX = { UID_JPEGProcess1TransferSyntax, UID_JPEGProcess2_4TransferSyntax, UID_JPEG2000LosslessOnlyTransferSyntax, UID_JPEG2000TransferSyntax };
 
-WSIDicomInstance::WSIDicomInstance(DcmFileFormat* fileFormat) :
-    _fileFormat(fileFormat), _dataset(fileFormat->getDataset()), _metaInfo(fileFormat->getMetaInfo()), _pixels(nullptr), _isValid(false),
+WSIDicomInstance::WSIDicomInstance(DcmFileFormat* fileFormat, const std::string& filePath) :
+    _fileFormat(fileFormat), _dataset(fileFormat->getDataset()), _metaInfo(fileFormat->getMetaInfo()), _frameReader(new WSIDicomFrameReader(filePath)), _isValid(false),
     _frameOffset(0), _numberOfFrames(0), _imageType(DcmImageType::InvalidImageType), _tiling(TilingType::Sparse),
     _depthInMm(0), _widthInMm(0), _heightInMm(0), _opticalPathSequence(nullptr), _focusMethod(""), _extendedDoF(false),
     _extendedDoFPlaneDistance(0), _extendedDoFPlanes(0), _height(0), _width(0), _tileWidth(0), _tileHeight(0), _samplesPerPixel(0),
-    _instanceNumber(0), _sliceThickness(0), _pixelSpacingX(0), _pixelSpacingY(0), _sliceSpacing(0), _bitsPerSample(0), _jp2Codec(new JPEG2000Codec())
+    _instanceNumber(0), _sliceThickness(0), _pixelSpacingX(0), _pixelSpacingY(0), _sliceSpacing(0), _bitsPerSample(0), _jp2Codec(new JPEG2000Codec()),
+    _tilesPerRow(0), _tilesPerColumn(0), _isJPEG2000(false), _frameTableInitialized(false)
 {
-    DcmElement* element = NULL;
-    if (_dataset->findAndGetElement(DCM_PixelData, element).good()) {
-        _pixels = OFstatic_cast(DcmPixelData*, element);
-    }
-
     OFString msSOPClassUID;
     std::vector<DcmTagKey> requiredTags = { DCM_StudyInstanceUID, DCM_SeriesInstanceUID, DCM_Rows, DCM_Columns,
                                             DCM_SamplesPerPixel, DCM_PhotometricInterpretation, DCM_TotalPixelMatrixColumns,
@@ -47,6 +47,7 @@ WSIDicomInstance::WSIDicomInstance(DcmFileFormat* fileFormat) :
             _isValid = false;
             return;
         }
+        _isJPEG2000 = transferSyntax.getXferID() == std::string(UID_JPEG2000LosslessOnlyTransferSyntax) || transferSyntax.getXferID() == std::string(UID_JPEG2000TransferSyntax);
         DcmElement* tagValue;
         for (auto tag : requiredTags) {
             if (this->_dataset->findAndGetElement(tag, tagValue).bad()) {
@@ -163,6 +164,12 @@ WSIDicomInstance::WSIDicomInstance(DcmFileFormat* fileFormat) :
         this->_dataset->findAndGetUint16(DCM_Rows, _tileHeight);
         this->_dataset->findAndGetUint16(DCM_Columns, _tileWidth);
         this->_dataset->findAndGetUint16(DCM_SamplesPerPixel, _samplesPerPixel);
+        if (_tileHeight == 0 || _tileWidth == 0) {
+            _isValid = false;
+            return;
+        }
+        _tilesPerRow = (_width + _tileWidth - 1) / _tileWidth;
+        _tilesPerColumn = (_height + _tileHeight - 1) / _tileHeight;
         OFString photometricInterpretation = "";
         this->_dataset->findAndGetOFString(DCM_PhotometricInterpretation, photometricInterpretation);
         _photometricInterpretation = std::string(photometricInterpretation.c_str());
@@ -175,17 +182,27 @@ WSIDicomInstance::WSIDicomInstance(DcmFileFormat* fileFormat) :
             _opticalPathSequence = nullptr;
         }
 
-        DcmItem* pfSeq;
+        DcmSequenceOfItems* pfSeqs;
         if (this->_tiling == TilingType::Sparse) {
-            for (long i = 0; i < this->_numberOfFrames; ++i) {
-                if (this->_dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, pfSeq, i).good()) {
+            _tileToFrameIndex.assign(static_cast<size_t>(_tilesPerRow) * _tilesPerColumn, -1);
+            if (this->_dataset->findAndGetSequence(DCM_PerFrameFunctionalGroupsSequence, pfSeqs).good()) {
+                unsigned long nrItems = pfSeqs->card();
+                for (unsigned long i = 0; i < this->_numberOfFrames && i < nrItems; ++i) {
+                    DcmItem* pfSeq = pfSeqs->getItem(i);
                     DcmItem* ppsSeq;
-                    if (pfSeq->findAndGetSequenceItem(DCM_PlanePositionSlideSequence, ppsSeq).good()) {
+                    if (pfSeq && pfSeq->findAndGetSequenceItem(DCM_PlanePositionSlideSequence, ppsSeq).good()) {
                         Sint32 colPos = 0;
                         Sint32 rowPos = 0;
                         ppsSeq->findAndGetSint32(DCM_ColumnPositionInTotalImagePixelMatrix, colPos, 0, true);
                         ppsSeq->findAndGetSint32(DCM_RowPositionInTotalImagePixelMatrix, rowPos, 0, true);
-                        _positionToFrameIndex[(((rowPos - 1) / _tileHeight) * this->getSizeInTiles()[0]) + (((colPos - 1) / _tileWidth))] = i;
+                        if (colPos < 1 || rowPos < 1) {
+                            continue;
+                        }
+                        unsigned int tileRow = (rowPos - 1) / _tileHeight;
+                        unsigned int tileColumn = (colPos - 1) / _tileWidth;
+                        if (tileRow < _tilesPerColumn && tileColumn < _tilesPerRow) {
+                            _tileToFrameIndex[tileRow * _tilesPerRow + tileColumn] = i;
+                        }
                     }
                 }
             }
@@ -200,7 +217,8 @@ WSIDicomInstance::~WSIDicomInstance()
     _isValid = false;
     _dataset = nullptr;
     _metaInfo = nullptr;
-    _pixels = nullptr;
+    delete _frameReader;
+    _frameReader = nullptr;
     delete _fileFormat;
     _fileFormat = nullptr;
     delete _jp2Codec;
@@ -228,9 +246,7 @@ std::vector<unsigned short> WSIDicomInstance::getTileSize() const
 
 std::vector<unsigned short> WSIDicomInstance::getSizeInTiles() const
 {
-    std::vector<unsigned short> sizeInTiles = { static_cast<unsigned short>(std::ceil(static_cast<float>(_width) / _tileWidth)),
-                                                static_cast<unsigned short>(std::ceil(static_cast<float>(_height) / _tileHeight)) };
-    return sizeInTiles;
+    return { static_cast<unsigned short>(_tilesPerRow), static_cast<unsigned short>(_tilesPerColumn) };
 }
 
 WSIDicomInstance::DcmImageType WSIDicomInstance::getImageType() const
@@ -238,62 +254,105 @@ WSIDicomInstance::DcmImageType WSIDicomInstance::getImageType() const
     return _imageType;
 }
 
+unsigned int WSIDicomInstance::getNumberOfFrames() const
+{
+    return _numberOfFrames;
+}
+
+unsigned int WSIDicomInstance::getConcatenationFrameOffset() const
+{
+    return _frameOffset;
+}
+
 bool WSIDicomInstance::valid() const {
     return _isValid;
 }
 
 void* WSIDicomInstance::getFrame(const long long& x, const long long& y, const long long& z, const long long& op)
 {
-    unsigned char* buffer;
-    DcmXfer transferSyntax = _dataset->getOriginalXfer();
-    int frameRow = y / _tileHeight;
-    int frameColumn = x / _tileWidth;
-    std::vector<unsigned short> sizeInTiles = this->getSizeInTiles();
-    int frameOffset = this->_tiling == TilingType::Sparse ? _positionToFrameIndex[frameRow * sizeInTiles[0] + frameColumn] : frameColumn + sizeInTiles[0] * frameRow;
-
-    if (transferSyntax.getXferID() == std::string(UID_JPEG2000LosslessOnlyTransferSyntax) || transferSyntax.getXferID() == std::string(UID_JPEG2000TransferSyntax)) {
-        Uint32 bufferSize = _tileHeight * _tileWidth * _samplesPerPixel;
-        buffer = new unsigned char[bufferSize];
-        std::fill(buffer, buffer + bufferSize, 0);
-
-        DcmPixelSequence* dseq = NULL;
-        E_TransferSyntax xferSyntax = EXS_Unknown;
-        const DcmRepresentationParameter* rep = NULL;
-        // Find the key that is needed to access the right representation of the data within DCMTK
-        _pixels->getOriginalRepresentationKey(xferSyntax, rep);
-        // Access original data representation and get result within pixel sequence
-        OFCondition result = _pixels->getEncapsulatedRepresentation(xferSyntax, rep, dseq);
-        if (result == EC_Normal)
-        {
-            unsigned long numItems = dseq->card();
-            DcmPixelItem* pixitem = NULL;
-            // Access first frame (skipping offset table)
-            dseq->getItem(pixitem, frameOffset + 1);
-            if (pixitem == NULL) {
-                return buffer;
-            }
-            Uint8* pixData = NULL;
-            // Get the length of this pixel item (i.e. fragment, i.e. most of the time, the lenght of the frame)
-            Uint32 length = pixitem->getLength();
-            if (length == 0) {
-                return buffer;
-            }
-            // Finally, get the compressed data for this pixel item
-            result = pixitem->getUint8Array(pixData);
-            // Do something useful with pixData...
-            _jp2Codec->decode(pixData, length, buffer, bufferSize);
+    unsigned int bufferSize = getFrameSize();
+    unsigned char* buffer = new unsigned char[bufferSize];
+    std::fill(buffer, buffer + bufferSize, 0);
+    long long frameIndex = getFrameIndex(x, y);
+    if (frameIndex >= 0) {
+        readFrame(frameIndex, buffer);
+    }
+    return buffer;
+}
+
+long long WSIDicomInstance::getFrameIndex(const long long& x, const long long& y) const
+{
+    if (x < 0 || y < 0 || _tileWidth == 0 || _tileHeight == 0) {
+        return -1;
+    }
+    unsigned long long frameRow = y / _tileHeight;
+    unsigned long long frameColumn = x / _tileWidth;
+    if (frameRow >= _tilesPerColumn || frameColumn >= _tilesPerRow) {
+        return -1;
+    }
+    if (this->_tiling == TilingType::Sparse) {
+        return _tileToFrameIndex[frameRow * _tilesPerRow + frameColumn];
+    }
+    // For concatenations the full tiling spans all instances, starting at the concatenation frame offset
+    long long frameIndex = static_cast<long long>(frameColumn + _tilesPerRow * frameRow) - _frameOffset;
+    if (frameIndex < 0 || frameIndex >= _numberOfFrames) {
+        return -1;
+    }
+    return frameIndex;
+}
+
+unsigned int WSIDicomInstance::getFrameSize() const
+{
+    return static_cast<unsigned int>(_tileWidth) * _tileHeight * _samplesPerPixel;
+}
+
+bool WSIDicomInstance::readCompressedFrame(const long long& frameIndex, std::vector<unsigned char>& data)
+{
+    data.clear();
+    if (frameIndex < 0 || frameIndex >= _numberOfFrames || !_frameReader->valid()) {
+        return false;
+    }
+    {
+        // The frame offset table is only built on the first frame request, so opening stays cheap
+        std::lock_guard<std::mutex> l(_frameTableMutex);
+        if (!_frameTableInitialized) {
+            _frameTableInitialized = true;
+            _frameReader->initialize(_numberOfFrames);
+        }
+    }
+    return _frameReader->readFrame(static_cast<unsigned int>(frameIndex), data);
+}
+
+bool WSIDicomInstance::isJPEG2000() const
+{
+    return _isJPEG2000;
+}
+
+std::string WSIDicomInstance::getPhotometricInterpretation() const
+{
+    return _photometricInterpretation;
+}
+
+bool WSIDicomInstance::readFrame(const long long& frameIndex, unsigned char* buffer)
+{
+    std::vector<unsigned char> compressed;
+    if (!readCompressedFrame(frameIndex, compressed)) {
+        return false;
+    }
+    Uint32 bufferSize = getFrameSize();
+    std::fill(buffer, buffer + bufferSize, 0);
+    if (_isJPEG2000) {
+        if (!_jp2Codec->decode(compressed.data(), compressed.size(), buffer, bufferSize)) {
+            std::fill(buffer, buffer + bufferSize, 0);
+            return false;
         }
     }
     else {
-        Uint32 bufferSize;
-        _pixels->getUncompressedFrameSize(_dataset, bufferSize);
-        buffer = new unsigned char[bufferSize];
-        std::fill(buffer, buffer + bufferSize, 0);
-
-        Uint32 fragmentNo = 0;
-        OFString dcmColorModel = "";
-        _pixels->getUncompressedFrame(_dataset, frameOffset, fragmentNo, buffer, bufferSize, dcmColorModel);
+        DJCodecParameter parameters(ECC_lossyYCbCr, EDC_photometricInterpretation);
+        DJDecompressIJG8Bit decompressor(parameters, _photometricInterpretation.compare(0, 3, "YBR") == 0);
+        if (decompressor.init().bad() || decompressor.decode(compressed.data(), compressed.size(), buffer, bufferSize, OFFalse).bad()) {
+            return false;
+        }
     }
-    return buffer;
+    return true;
 }
-
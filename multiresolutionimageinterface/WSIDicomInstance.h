@@ -5,20 +5,22 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
 
 class DcmFileFormat;
 class DcmMetaInfo;
 class DcmDataset;
-class DcmPixelData;
 class DcmItem;
 class JPEG2000Codec;
+class WSIDicomFrameReader;
 
 class DICOMFILEFORMAT_EXPORT WSIDicomInstance  {
 
 public:
 
     WSIDicomInstance() = delete;
-    WSIDicomInstance(DcmFileFormat* fileformat);
+    //! The file format only needs to contain the header, frames are read from filePath on demand
+    WSIDicomInstance(DcmFileFormat* fileformat, const std::string& filePath);
     ~WSIDicomInstance();
 
     enum class DcmImageType {
@@ -41,10 +43,31 @@ public:
     std::vector<unsigned short> getTileSize() const;
     std::vector<unsigned short> getSizeInTiles() const;
     DcmImageType getImageType() const;
+    unsigned int getNumberOfFrames() const;
+    //! Index of the first frame of this instance within its concatenation
+    unsigned int getConcatenationFrameOffset() const;
     bool valid() const;
 
     void* getFrame(const long long& x, const long long& y, const long long& z = 0, const long long& op = 0);
-    
+
+    //! Returns the index of the frame containing pixel (x, y) within this instance, or -1 if the
+    //! instance has no frame at that position (possible for sparse tiling or concatenations)
+    long long getFrameIndex(const long long& x, const long long& y) const;
+
+    //! Size in bytes of a decoded frame
+    unsigned int getFrameSize() const;
+
+    //! Decodes a frame into buffer, which should be able to hold getFrameSize() bytes. Can be
+    //! called from multiple threads, frames are read with positional reads and decoded without
+    //! holding a lock.
+    bool readFrame(const long long& frameIndex, unsigned char* buffer);
+
+    //! Reads the compressed data of a frame (JPEG or JPEG2000 codestream) without decoding it
+    bool readCompressedFrame(const long long& frameIndex, std::vector<unsigned char>& data);
+
+    bool isJPEG2000() const;
+    std::string getPhotometricInterpretation() const;
+
 
 private:
 
@@ -53,7 +76,7 @@ private:
     DcmFileFormat* _fileFormat;
     DcmMetaInfo* _metaInfo;
     DcmDataset* _dataset;
-    DcmPixelData* _pixels;
+    WSIDicomFrameReader* _frameReader;
 
     DcmItem* _opticalPathSequence;
 
@@ -85,7 +108,16 @@ private:
     std::string _photometricInterpretation;
     unsigned int _instanceNumber;
     float _sliceThickness;
-    std::map<unsigned long, unsigned long> _positionToFrameIndex;
+    unsigned int _tilesPerRow;
+    unsigned int _tilesPerColumn;
+    bool _isJPEG2000;
+
+    // Only filled for sparse tiling, contains the frame index for each tile position or -1
+    std::vector<long long> _tileToFrameIndex;
+
+    // Guards the lazy construction of the frame offset table
+    std::mutex _frameTableMutex;
+    bool _frameTableInitialized;
     
     bool _isValid;
  
@@ -27,6 +27,7 @@
 #include "../annotation/XmlRepository.h"
 #include "../annotation/NDPARepository.h"
 #include "../annotation/ImageScopeRepository.h"
+#include "../annotation/PatchSampler.h"
 %}
 
 %include "std_string.i"
@@ -56,6 +57,8 @@ namespace std {
   %template(vector_point) vector<Point>;
   %template(map_int_string) map<int, string>;
   %template(map_string_int) map<string, int>;
+  %template(map_int_float) map<int, float>;
+  %template(map_int_unsigned_long_long) map<int, unsigned long long>;
 }
 %include "numpy.i"
 
@@ -63,6 +66,105 @@ namespace std {
 import_array();
 %}
 
+%{
+// Copies a patch into a new height x width x samples array, None for an empty patch
+template <typename T>
+PyObject* patchToArray(const Patch<T>& patch, int arrayType) {
+  std::vector<unsigned long long> dims = patch.getDimensions();
+  if (dims.size() < 3 || !patch.getPointer()) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  npy_intp dimsDesc[3];
+  dimsDesc[0] = dims[1];
+  dimsDesc[1] = dims[0];
+  dimsDesc[2] = dims[2];
+  PyObject* array = PyArray_SimpleNew(3, dimsDesc, arrayType);
+  if (!array) {
+    return NULL;
+  }
+  T* array_data = (T*)PyArray_DATA((PyArrayObject*)array);
+  std::copy(patch.getPointer(), patch.getPointer() + dims[0] * dims[1] * dims[2], array_data);
+  return array;
+}
+
+// Returns output when it is a writeable C-contiguous array of the type and shape, a new array
+// when output is None and NULL with a Python exception set otherwise
+PyObject* outputArray(PyObject* output, int nd, npy_intp* dims, int arrayType) {
+  if (!output || output == Py_None) {
+    return PyArray_SimpleNew(nd, dims, arrayType);
+  }
+  if (!PyArray_Check(output)) {
+    PyErr_SetString(PyExc_TypeError, "out must be a numpy array");
+    return NULL;
+  }
+  PyArrayObject* array = (PyArrayObject*)output;
+  if (PyArray_TYPE(array) != arrayType || !PyArray_IS_C_CONTIGUOUS(array) || !PyArray_ISWRITEABLE(array) ||
+      PyArray_NDIM(array) != nd || !PyArray_CompareLists(PyArray_DIMS(array), dims, nd)) {
+    PyErr_SetString(PyExc_ValueError, "out must be a writeable C-contiguous array of the type and shape of the patches");
+    return NULL;
+  }
+  Py_INCREF(output);
+  return output;
+}
+
+// Converts an N x 2 array-like of x, y coordinates to a flat list, false with a Python exception
+// set when it has another shape
+bool patchPositions(PyObject* positions, std::vector<long long>& coordinates) {
+  PyArrayObject* array = (PyArrayObject*)PyArray_FROM_OTF(positions, NPY_LONGLONG, NPY_ARRAY_IN_ARRAY);
+  if (!array) {
+    return false;
+  }
+  if (PyArray_NDIM(array) != 2 || PyArray_DIM(array, 1) != 2) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError, "positions must be an N x 2 array of x, y coordinates");
+    return false;
+  }
+  long long* data = (long long*)PyArray_DATA(array);
+  coordinates.assign(data, data + 2 * PyArray_DIM(array, 0));
+  Py_DECREF(array);
+  return true;
+}
+
+// Reads the patches at the coordinates straight into an array of N x height x width x samples
+// (height x width x samples for a single patch) and releases the GIL while reading, so patches
+// can be read from several Python threads at once. The array is output or a new array.
+template <typename T>
+PyObject* readPatches(MultiResolutionImage* image, const std::vector<long long>& coordinates, bool batched, const unsigned long long& width,
+                      const unsigned long long& height, const unsigned int& level, PyObject* output, int arrayType) {
+  npy_intp dims[4];
+  int nd = 0;
+  if (batched) {
+    dims[nd++] = coordinates.size() / 2;
+  }
+  dims[nd++] = height;
+  dims[nd++] = width;
+  dims[nd++] = image->getSamplesPerPixel();
+  PyObject* array = outputArray(output, nd, dims, arrayType);
+  if (!array) {
+    return NULL;
+  }
+  T* data = (T*)PyArray_DATA((PyArrayObject*)array);
+  unsigned long long patchSize = width * height * image->getSamplesPerPixel();
+  Py_BEGIN_ALLOW_THREADS
+  for (size_t i = 0; i + 1 < coordinates.size(); i += 2) {
+    image->getRawRegionInto<T>(coordinates[i], coordinates[i + 1], width, height, level, data + (i / 2) * patchSize);
+  }
+  Py_END_ALLOW_THREADS
+  return array;
+}
+
+template <typename T>
+PyObject* readBatch(MultiResolutionImage* image, PyObject* positions, const unsigned long long& width, const unsigned long long& height,
+                    const unsigned int& level, PyObject* output, int arrayType) {
+  std::vector<long long> coordinates;
+  if (!patchPositions(positions, coordinates)) {
+    return NULL;
+  }
+  return readPatches<T>(image, coordinates, true, width, height, level, output, arrayType);
+}
+%}
+
 #ifdef SWIG
 #define MULTIRESOLUTIONIMAGEINTERFACE_EXPORT
 #define CORE_EXPORT
@@ -72,6 +174,9 @@ import_array();
 %ignore swap(ImageSource& first, ImageSource& second);
 %ignore AnnotationGroup::getAttribute(const std::string&);
 %ignore ProgressMonitor::operator++();
+%ignore Annotation::getCoordinates() const;
+%ignore Annotation::setCoordinates(std::vector<Point>&&);
+%ignore MultiResolutionImage::getThumbnail(const unsigned int&);
 
 %immutable ASAP_VERSION_STRING;
 %include "../config/ASAPMacros.h"
@@ -92,76 +197,93 @@ import_array();
 %include "../annotation/NDPARepository.h"
 %include "../annotation/ImageScopeRepository.h"
 
+// The C++ getter returns a reference into the annotation, which Python could outlive,
+// so Python receives a copy; getCoordinatesArray copies the packed points in one go.
+%extend Annotation {
+  std::vector<Point> getCoordinates() const {
+    return self->getCoordinates();
+  }
+
+  PyObject* getCoordinatesArray() const {
+    const std::vector<Point>& coordinates = self->getCoordinates();
+    npy_intp dimsDesc[2];
+    dimsDesc[0] = coordinates.size();
+    dimsDesc[1] = 2;
+    PyObject* coordinateArray = PyArray_SimpleNew(2, dimsDesc, NPY_FLOAT32);
+    float* array_data = (float*)PyArray_DATA((PyArrayObject*)coordinateArray);
+    for (std::vector<Point>::const_iterator it = coordinates.begin(); it != coordinates.end(); ++it) {
+      *array_data++ = it->getX();
+      *array_data++ = it->getY();
+    }
+    return coordinateArray;
+  }
+};
+
 %numpy_typemaps(void, NPY_NOTYPE, int)
 %include "MultiResolutionImage.h";
 %include "TIFFImage.h";
 
+// Patches are height x width x samples arrays. They are decoded straight into the array, or into
+// out when a preallocated array of the right type and shape is given, and the GIL is released
+// while reading. The batched variants read the patches at an N x 2 array of x, y coordinates into
+// an N x height x width x samples array.
 %extend MultiResolutionImage {
      PyObject* getUCharPatch(const long long& startX, const long long& startY, const unsigned long long& width, 
-						     const unsigned long long& height, const unsigned int& level) { 
-		unsigned int nrSamples = self->getSamplesPerPixel();
-        npy_intp dimsDesc[3];
-		dimsDesc[0] = height;
-		dimsDesc[1] = width;
-		dimsDesc[2] = nrSamples;
-		PyObject* patch = PyArray_SimpleNew(3, dimsDesc, NPY_UBYTE);
-		unsigned char* tmp = new unsigned char[height*width*nrSamples];
-		self->getRawRegion(startX, startY, width, height, level, tmp);
-		unsigned char* array_data = (unsigned char*)PyArray_DATA((PyArrayObject*)patch);
-		std::copy(tmp, tmp + height*width*nrSamples, array_data);
-		delete[] tmp;
-		return patch;
+						     const unsigned long long& height, const unsigned int& level, PyObject* out = NULL) { 
+		return readPatches<unsigned char>(self, std::vector<long long>{ startX, startY }, false, width, height, level, out, NPY_UBYTE);
 	}
-};
-%extend MultiResolutionImage {
      PyObject* getUInt16Patch(const long long& startX, const long long& startY, const unsigned long long& width, 
-						     const unsigned long long& height, const unsigned int& level) { 
-		unsigned int nrSamples = self->getSamplesPerPixel();
-        npy_intp dimsDesc[3];
-		dimsDesc[0] = height;
-		dimsDesc[1] = width;
-		dimsDesc[2] = nrSamples;
-		PyObject* patch = PyArray_SimpleNew(3, dimsDesc, NPY_UINT16);
-		unsigned short* tmp = new unsigned short[height*width*nrSamples];
-		self->getRawRegion(startX, startY, width, height, level, tmp);
-		unsigned short* array_data = (unsigned short*)PyArray_DATA((PyArrayObject*)patch);
-		std::copy(tmp, tmp + height*width*nrSamples, array_data);
-		delete[] tmp;
-		return patch;
+						     const unsigned long long& height, const unsigned int& level, PyObject* out = NULL) { 
+		return readPatches<unsigned short>(self, std::vector<long long>{ startX, startY }, false, width, height, level, out, NPY_UINT16);
+	}
+     PyObject* getUInt32Patch(const long long& startX, const long long& startY, const unsigned long long& width, 
+						     const unsigned long long& height, const unsigned int& level, PyObject* out = NULL) { 
+		return readPatches<unsigned int>(self, std::vector<long long>{ startX, startY }, false, width, height, level, out, NPY_UINT32);
+	}
+     PyObject* getFloatPatch(const long long& startX, const long long& startY, const unsigned long long& width, 
+						     const unsigned long long& height, const unsigned int& level, PyObject* out = NULL) { 
+		return readPatches<float>(self, std::vector<long long>{ startX, startY }, false, width, height, level, out, NPY_FLOAT);
+	}
+     PyObject* getUCharPatches(PyObject* positions, const unsigned long long& width, const unsigned long long& height,
+						     const unsigned int& level, PyObject* out = NULL) {
+		return readBatch<unsigned char>(self, positions, width, height, level, out, NPY_UBYTE);
+	}
+     PyObject* getUInt16Patches(PyObject* positions, const unsigned long long& width, const unsigned long long& height,
+						     const unsigned int& level, PyObject* out = NULL) {
+		return readBatch<unsigned short>(self, positions, width, height, level, out, NPY_UINT16);
+	}
+     PyObject* getUInt32Patches(PyObject* positions, const unsigned long long& width, const unsigned long long& height,
+						     const unsigned int& level, PyObject* out = NULL) {
+		return readBatch<unsigned int>(self, positions, width, height, level, out, NPY_UINT32);
+	}
+     PyObject* getFloatPatches(PyObject* positions, const unsigned long long& width, const unsigned long long& height,
+						     const unsigned int& level, PyObject* out = NULL) {
+		return readBatch<float>(self, positions, width, height, level, out, NPY_FLOAT);
 	}
 };
 %extend MultiResolutionImage {
-     PyObject* getUInt32Patch(const long long& startX, const long long& startY, const unsigned long long& width, 
-						     const unsigned long long& height, const unsigned int& level) { 
-		unsigned int nrSamples = self->getSamplesPerPixel();
-        npy_intp dimsDesc[3];
-		dimsDesc[0] = height;
-		dimsDesc[1] = width;
-		dimsDesc[2] = nrSamples;
-		PyObject* patch = PyArray_SimpleNew(3, dimsDesc, NPY_UINT32);
-		unsigned int* tmp = new unsigned int[height*width*nrSamples];
-		self->getRawRegion(startX, startY, width, height, level, tmp);
-		unsigned int* array_data = (unsigned int*)PyArray_DATA((PyArrayObject*)patch);
-		std::copy(tmp, tmp + height*width*nrSamples, array_data);
-		delete[] tmp;
-		return patch;
+     // None when the thumbnail could not be read
+     PyObject* getUCharThumbnail(const unsigned int& maxSize) { 
+		return patchToArray(self->getThumbnail(maxSize), NPY_UBYTE);
 	}
 };
+// Regions at a spacing in micrometer per pixel, resampled from the best level
 %extend MultiResolutionImage {
-     PyObject* getFloatPatch(const long long& startX, const long long& startY, const unsigned long long& width, 
-						     const unsigned long long& height, const unsigned int& level) { 
-		unsigned int nrSamples = self->getSamplesPerPixel();
-        npy_intp dimsDesc[3];
-		dimsDesc[0] = height;
-		dimsDesc[1] = width;
-		dimsDesc[2] = nrSamples;
-		PyObject* patch = PyArray_SimpleNew(3, dimsDesc, NPY_FLOAT);
-		float* tmp = new float[height*width*nrSamples];
-		self->getRawRegion(startX, startY, width, height, level, tmp);
-		float* array_data = (float*)PyArray_DATA((PyArrayObject*)patch);
-		std::copy(tmp, tmp + height*width*nrSamples, array_data);
-		delete[] tmp;
-		return patch;
+     PyObject* getUCharPatchAtSpacing(const long long& startX, const long long& startY, const unsigned long long& width,
+						     const unsigned long long& height, const double& spacing, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear) {
+		return patchToArray(self->getRegionAtSpacing<unsigned char>(startX, startY, width, height, spacing, interpolation), NPY_UBYTE);
+	}
+     PyObject* getUInt16PatchAtSpacing(const long long& startX, const long long& startY, const unsigned long long& width,
+						     const unsigned long long& height, const double& spacing, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear) {
+		return patchToArray(self->getRegionAtSpacing<unsigned short>(startX, startY, width, height, spacing, interpolation), NPY_UINT16);
+	}
+     PyObject* getUInt32PatchAtSpacing(const long long& startX, const long long& startY, const unsigned long long& width,
+						     const unsigned long long& height, const double& spacing, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear) {
+		return patchToArray(self->getRegionAtSpacing<unsigned int>(startX, startY, width, height, spacing, interpolation), NPY_UINT32);
+	}
+     PyObject* getFloatPatchAtSpacing(const long long& startX, const long long& startY, const unsigned long long& width,
+						     const unsigned long long& height, const double& spacing, const pathology::Interpolation& interpolation = pathology::Interpolation::Linear) {
+		return patchToArray(self->getRegionAtSpacing<float>(startX, startY, width, height, spacing, interpolation), NPY_FLOAT);
 	}
 };
 %extend TIFFImage {
@@ -188,6 +310,46 @@ import_array();
   }
 %}
 
+// The sampler does not own the image and the mask, keep them alive while it is used. Iterating
+// over it gives (patch, labels, label, x, y) tuples with a patchSize x patchSize x samples uint8
+// patch and a patchSize x patchSize uint8 label map, None when sampling tissue.
+%ignore PatchSampler::TrainingPatch;
+%ignore PatchSampler::next;
+%include "../annotation/PatchSampler.h"
+
+%extend PatchSampler {
+%pythoncode %{
+    def __iter__(self):
+        return self
+%}
+     PyObject* __next__() {
+		PatchSampler::TrainingPatch patch;
+		bool hasPatch = false;
+		Py_BEGIN_ALLOW_THREADS
+		hasPatch = self->next(patch);
+		Py_END_ALLOW_THREADS
+		if (!hasPatch) {
+			PyErr_SetNone(PyExc_StopIteration);
+			return NULL;
+		}
+		npy_intp dimsDesc[3];
+		dimsDesc[0] = patch.patchSize;
+		dimsDesc[1] = patch.patchSize;
+		dimsDesc[2] = patch.samplesPerPixel;
+		PyObject* pixels = PyArray_SimpleNew(3, dimsDesc, NPY_UBYTE);
+		std::copy(patch.pixels.begin(), patch.pixels.end(), (unsigned char*)PyArray_DATA((PyArrayObject*)pixels));
+		PyObject* labels = Py_None;
+		if (!patch.labels.empty()) {
+			labels = PyArray_SimpleNew(2, dimsDesc, NPY_UBYTE);
+			std::copy(patch.labels.begin(), patch.labels.end(), (unsigned char*)PyArray_DATA((PyArrayObject*)labels));
+		}
+		else {
+			Py_INCREF(Py_None);
+		}
+		return Py_BuildValue("(NNiLL)", pixels, labels, patch.label, patch.x, patch.y);
+	}
+};
+
 %newobject MultiResolutionImageReader::open;
 %include "MultiResolutionImageReader.h"
 
@@ -0,0 +1,667 @@
+#include "UnitTest++/UnitTest++.h"
+#include "MultiResolutionImage.h"
+#include "MultiResolutionImageReader.h"
+#include "MultiResolutionImageWriter.h"
+#include "PixelConversion.h"
+#include "JPEG2000Codec.h"
+#include "TIFFImage.h"
+#include "core/PathologyEnums.h"
+#include "core/CompiledLUT.h"
+#include "core/filetools.h"
+#include "TestData.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace UnitTest;
+using namespace std;
+
+namespace
+{
+  // Resident memory of the process in MB, 0 when not available on this platform
+  double residentMemoryInMB() {
+#ifdef WIN32
+    return 0;
+#else
+    ifstream statm("/proc/self/statm");
+    unsigned long long totalPages = 0, residentPages = 0;
+    if (statm >> totalPages >> residentPages) {
+      return residentPages * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024. * 1024.);
+    }
+    return 0;
+#endif
+  }
+
+  // Evicts a file from the page cache so the next reads go to the disk, returns false when this
+  // is not supported on this platform
+  bool dropFromPageCache(const string& path) {
+#if defined(WIN32) || defined(__APPLE__)
+    return false;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    fdatasync(fd);
+    bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return dropped;
+#endif
+  }
+
+  // Opens the image, reads the top-left tile of the base level and reports the timings and the
+  // growth in resident memory
+  void benchmarkTimeToFirstTile(const string& imagePath, const string& name) {
+    if (!core::fileExists(imagePath)) {
+      std::cout << name << ": " << imagePath << " not available, skipping" << std::endl;
+      return;
+    }
+    double memoryBefore = residentMemoryInMB();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MultiResolutionImageReader reader;
+    unique_ptr<MultiResolutionImage> img(reader.open(imagePath));
+    double openTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    CHECK(img != NULL);
+    if (!img) {
+      return;
+    }
+    unsigned char* tile = new unsigned char[512 * 512 * img->getSamplesPerPixel()];
+    img->getRawRegion<unsigned char>(0, 0, 512, 512, 0, tile);
+    double firstTileTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    delete[] tile;
+    double memoryAfter = residentMemoryInMB();
+    std::cout << name << " (" << img->getNumberOfLevels() << " levels)" << std::endl;
+    std::cout << "  open:               " << openTime << " ms" << std::endl;
+    std::cout << "  time to first tile: " << firstTileTime << " ms" << std::endl;
+    std::cout << "  resident memory:    +" << memoryAfter - memoryBefore << " MB" << std::endl;
+  }
+
+  // The per-pixel conversion OpenSlideImage used before the vectorized conversion
+  void convertPremultipliedBGRAToRGBReference(const unsigned char* bgra, unsigned long long nrPixels, unsigned char* rgb) {
+    for (unsigned long long i = 0, j = 0; i < nrPixels * 4; i += 4, j += 3) {
+      if (bgra[i + 3] == 255) {
+        rgb[j] = bgra[i + 2];
+        rgb[j + 1] = bgra[i + 1];
+        rgb[j + 2] = bgra[i];
+      }
+      else if (bgra[i + 3] == 0) {
+        rgb[j] = rgb[j + 1] = rgb[j + 2] = 255;
+      }
+      else {
+        rgb[j] = (255. * bgra[i + 2]) / bgra[i + 3];
+        rgb[j + 1] = (255. * bgra[i + 1]) / bgra[i + 3];
+        rgb[j + 2] = (255. * bgra[i]) / bgra[i + 3];
+      }
+    }
+  }
+
+  // Reads the full coarsest level which is at least maxSize pixels, as thumbnails and the minimap
+  // overview were made before getThumbnail; returns the time in ms
+  double benchmarkFullLevelThumbnail(MultiResolutionImage& img, unsigned int maxSize) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int level = img.getNumberOfLevels() - 1;
+    while (level > 0 && std::max(img.getLevelDimensions(level)[0], img.getLevelDimensions(level)[1]) < maxSize) {
+      --level;
+    }
+    vector<unsigned long long> dims = img.getLevelDimensions(level);
+    unsigned char* data = new unsigned char[dims[0] * dims[1] * img.getSamplesPerPixel()];
+    img.getRawRegion<unsigned char>(0, 0, dims[0], dims[1], level, data);
+    delete[] data;
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  }
+
+  // Decodes the tile nrTiles times with nrWorkers threads pulling tiles, returns the time in ms
+  double benchmarkJPEG2000Decode(const JPEG2000Codec& codec, const vector<unsigned char>& encoded, unsigned int tileByteSize,
+    unsigned int nrTiles, unsigned int nrWorkers, unsigned int reduction) {
+    atomic<unsigned int> nextTile(0);
+    auto worker = [&]() {
+      vector<unsigned char> decoded(tileByteSize);
+      while (nextTile++ < nrTiles) {
+        codec.decode(encoded.data(), static_cast<unsigned int>(encoded.size()), decoded.data(), tileByteSize, reduction);
+      }
+    };
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned int i = 0; i < nrWorkers; ++i) {
+      workers.push_back(thread(worker));
+    }
+    for (thread& t : workers) {
+      t.join();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  }
+
+  // The per-tile rendering ASAP used before compiled LUTs: memoize the color of each distinct value
+  template<typename T>
+  void renderWithMemoizedLUT(const T* data, unsigned long long nrPixels, double channelMin, double channelMax, const pathology::LUT& LUT, unsigned int* argb) {
+    std::map<T, unsigned int> valueToColor;
+    for (unsigned long long i = 0; i < nrPixels; ++i) {
+      auto it = valueToColor.find(data[i]);
+      if (it == valueToColor.end()) {
+        float value = LUT.relative ? (data[i] - channelMin) / (channelMax - channelMin) : data[i];
+        argb[i] = valueToColor[data[i]] = pathology::CompiledLUT::evaluate(value, LUT);
+      }
+      else {
+        argb[i] = it->second;
+      }
+    }
+  }
+
+  template<typename T>
+  void benchmarkLUTRendering(const vector<T>& tile, unsigned int nrTiles, double channelMin, double channelMax, const pathology::LUT& LUT, const string& name) {
+    vector<unsigned int> memoized(tile.size()), compiled(tile.size());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < nrTiles; ++i) {
+      renderWithMemoizedLUT(tile.data(), tile.size(), channelMin, channelMax, LUT, memoized.data());
+    }
+    double memoizedTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    pathology::CompiledLUT compiledLUT(LUT);
+    double compileTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < nrTiles; ++i) {
+      compiledLUT.apply(tile.data(), tile.size(), 0, 1, channelMin, channelMax, compiled.data());
+    }
+    double compiledTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    double megaPixels = nrTiles * tile.size() / 1e6;
+    std::cout << "  " << name << std::endl;
+    std::cout << "    memoized map:   " << memoizedTime << " ms (" << megaPixels / (memoizedTime / 1000.) << " MP/s)" << std::endl;
+    std::cout << "    compiled table: " << compiledTime << " ms (" << megaPixels / (compiledTime / 1000.) << " MP/s), compiling took " << compileTime << " ms" << std::endl;
+  }
+
+  struct TileRequest {
+    unsigned int level;
+    long long x;
+    long long y;
+  };
+
+  // Reads the requested tiles with nrWorkers threads pulling requests, returns the time in ms
+  double benchmarkTileRequests(MultiResolutionImage& img, const vector<TileRequest>& requests, unsigned int tileSize, unsigned int nrWorkers) {
+    atomic<size_t> nextRequest(0);
+    auto worker = [&]() {
+      unsigned char* tile = new unsigned char[tileSize * tileSize * img.getSamplesPerPixel()];
+      for (size_t i = nextRequest++; i < requests.size(); i = nextRequest++) {
+        img.getRawRegion<unsigned char>(requests[i].x, requests[i].y, tileSize, tileSize, requests[i].level, tile);
+      }
+      delete[] tile;
+    };
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned int i = 0; i < nrWorkers; ++i) {
+      workers.push_back(thread(worker));
+    }
+    for (thread& t : workers) {
+      t.join();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  }
+
+  struct CodecSetting {
+    string name;
+    pathology::Compression codec;
+    float quality;
+    bool predictor;
+  };
+
+  // Writes an image of 4x4 copies of a tile with every codec setting, without a pyramid, and
+  // reports the file size and the encode and decode throughput in MB of raw samples per second
+  template <typename T>
+  void benchmarkCodecs(const vector<T>& tile, unsigned int tileSize, pathology::DataType dataType, pathology::ColorType colorType,
+    const vector<CodecSetting>& settings, const string& name) {
+    const unsigned int tilesAcross = 4;
+    double megaBytes = tilesAcross * tilesAcross * tile.size() * sizeof(T) / 1e6;
+    string outPath = g_dataPath + "/images/CodecBenchmark.tif";
+    std::cout << "  " << name << " (" << megaBytes << " MB)" << std::endl;
+    for (const CodecSetting& setting : settings) {
+      MultiResolutionImageWriter writer;
+      writer.openFile(outPath);
+      writer.setTileSize(tileSize);
+      writer.setCompression(setting.codec);
+      writer.setJPEGQuality(setting.quality);
+      writer.setUsePredictor(setting.predictor);
+      writer.setDataType(dataType);
+      writer.setColorType(colorType);
+      writer.setMaxNumberOfPyramidLevels(0);
+      writer.setSkipEmptyTiles(false);
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      writer.writeImageInformation(tilesAcross * tileSize, tilesAcross * tileSize);
+      for (unsigned int i = 0; i < tilesAcross * tilesAcross; ++i) {
+        writer.writeBaseImagePart((void*)tile.data());
+      }
+      writer.finishImage();
+      double encodeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      std::ifstream written(outPath, std::ios::binary | std::ios::ate);
+      double fileSize = static_cast<double>(written.tellg());
+
+      TIFFImage img;
+      img.initialize(outPath);
+      img.setCacheSize(0);
+      vector<T> decoded(tile.size());
+      T* decodedData = decoded.data();
+      start = chrono::steady_clock::now();
+      for (unsigned int y = 0; y < tilesAcross; ++y) {
+        for (unsigned int x = 0; x < tilesAcross; ++x) {
+          img.getRawRegion<T>(x * tileSize, y * tileSize, tileSize, tileSize, 0, decodedData);
+        }
+      }
+      double decodeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      std::cout << "    " << setting.name << ": " << fileSize / 1024 << " kB (" << megaBytes * 1e6 / fileSize << "x), encode "
+        << megaBytes / (encodeTime / 1000.) << " MB/s, decode " << megaBytes / (decodeTime / 1000.) << " MB/s" << std::endl;
+    }
+  }
+
+  SUITE(MultiResolutionImageInterfaceBenchmark)
+  {
+    TEST(BenchmarkDICOMTimeToFirstTile)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // Any instance of the series can be used to open the slide
+      vector<string> instances;
+      core::getFiles(g_dataPath + "/images/dicom", "*.dcm", instances);
+      if (instances.empty()) {
+        std::cout << "DICOM benchmark: no instances in " << g_dataPath + "/images/dicom" << ", skipping" << std::endl;
+        return;
+      }
+      benchmarkTimeToFirstTile(instances[0], "DICOM benchmark");
+    }
+
+    TEST(BenchmarkTIFFMixedLevelReads)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      string imagePath = g_dataPath + "/images/OpenSlideInterfaceTestImage.tif";
+      TIFFImage img;
+      if (!core::fileExists(imagePath) || !img.initialize(imagePath)) {
+        std::cout << "TIFF mixed level reads: " << imagePath << " not available, skipping" << std::endl;
+        return;
+      }
+      // Without a tile cache every request is read from the file
+      img.setCacheSize(0);
+
+      // Random tiles spread over all levels in the order a viewer and a prefetcher interleave
+      // them, and the same tiles grouped per level
+      const unsigned int tileSize = 512, nrRequests = 2000;
+      vector<TileRequest> interleaved;
+      mt19937 generator(0);
+      for (unsigned int i = 0; i < nrRequests; ++i) {
+        TileRequest request;
+        request.level = generator() % img.getNumberOfLevels();
+        vector<unsigned long long> dims = img.getLevelDimensions(request.level);
+        double downsample = img.getLevelDownsample(request.level);
+        request.x = static_cast<long long>((generator() % (dims[0] / tileSize + 1)) * tileSize * downsample);
+        request.y = static_cast<long long>((generator() % (dims[1] / tileSize + 1)) * tileSize * downsample);
+        interleaved.push_back(request);
+      }
+      vector<TileRequest> grouped = interleaved;
+      stable_sort(grouped.begin(), grouped.end(), [](const TileRequest& a, const TileRequest& b) { return a.level < b.level; });
+
+      unsigned int nrCores = std::max(1u, thread::hardware_concurrency());
+      std::cout << "TIFF mixed level reads (" << nrRequests << " tiles of " << tileSize << "x" << tileSize << " over " << img.getNumberOfLevels() << " levels, " << nrCores << " cores)" << std::endl;
+      std::cout << "  grouped per level, 1 thread:     " << benchmarkTileRequests(img, grouped, tileSize, 1) << " ms" << std::endl;
+      std::cout << "  interleaved levels, 1 thread:    " << benchmarkTileRequests(img, interleaved, tileSize, 1) << " ms" << std::endl;
+      std::cout << "  interleaved levels, " << nrCores << " threads:   " << benchmarkTileRequests(img, interleaved, tileSize, nrCores) << " ms" << std::endl;
+    }
+
+    TEST(BenchmarkThumbnail)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      string imagePath = g_dataPath + "/images/OpenSlideInterfaceTestImage.tif";
+      TIFFImage img;
+      if (!core::fileExists(imagePath) || !img.initialize(imagePath)) {
+        std::cout << "Thumbnail: " << imagePath << " not available, skipping" << std::endl;
+        return;
+      }
+      img.setCacheSize(0);
+      EncodedTileInfo info;
+      bool encoded = img.getEncodedTileInfo(img.getNumberOfLevels() - 1, info);
+      std::cout << "Thumbnail (" << img.getNumberOfLevels() << " levels, " << (encoded ? "reduced resolution decode" : "no reduced resolution decode") << ")" << std::endl;
+      for (unsigned int maxSize : { 256u, 1024u }) {
+        double fullLevelTime = benchmarkFullLevelThumbnail(img, maxSize);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Patch<unsigned char> thumbnail = img.getThumbnail(maxSize);
+        double thumbnailTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        vector<unsigned long long> dims = thumbnail.getDimensions();
+        CHECK_EQUAL(maxSize, std::max(dims[0], dims[1]));
+        std::cout << "  " << maxSize << " pixels, full level:   " << fullLevelTime << " ms" << std::endl;
+        std::cout << "  " << maxSize << " pixels, getThumbnail: " << thumbnailTime << " ms" << std::endl;
+      }
+    }
+
+    TEST(BenchmarkRegionAtDownsample)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      string imagePath = g_dataPath + "/images/OpenSlideInterfaceTestImage.tif";
+      TIFFImage img;
+      if (!core::fileExists(imagePath) || !img.initialize(imagePath)) {
+        std::cout << "Region at downsample: " << imagePath << " not available, skipping" << std::endl;
+        return;
+      }
+      img.setCacheSize(0);
+
+      // Training patches at a spacing between the levels: reading the covering region of the
+      // finer level and rescaling it afterwards, or resampling block by block while reading
+      const unsigned int patchSize = 512, nrPatches = 100;
+      const double downsample = 1.5;
+      vector<unsigned long long> dims = img.getDimensions();
+      mt19937 generator(0);
+      vector<pair<long long, long long> > positions;
+      for (unsigned int i = 0; i < nrPatches; ++i) {
+        positions.push_back(make_pair(generator() % (dims[0] - 2 * patchSize), generator() % (dims[1] - 2 * patchSize)));
+      }
+      unsigned long long regionSize = static_cast<unsigned long long>(std::ceil(patchSize * downsample)) + 1;
+      vector<unsigned char> rescaled(patchSize * patchSize * 3);
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (const pair<long long, long long>& position : positions) {
+        unsigned char* region = new unsigned char[regionSize * regionSize * 3];
+        img.getRawRegion<unsigned char>(position.first, position.second, regionSize, regionSize, 0, region);
+        pathology::ResamplingAxis axis = pathology::createResamplingAxis(0., downsample, patchSize, regionSize, pathology::Interpolation::Linear);
+        pathology::resample(region, 0, 0, regionSize, regionSize, 3, axis, axis, 0, patchSize, 0, patchSize, rescaled.data(), patchSize);
+        delete[] region;
+      }
+      double rescaleTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      start = chrono::steady_clock::now();
+      for (const pair<long long, long long>& position : positions) {
+        Patch<unsigned char> patch = img.getRegionAtDownsample<unsigned char>(position.first, position.second, patchSize, patchSize, downsample);
+        CHECK_EQUAL(patchSize, patch.getDimensions()[0]);
+      }
+      double fusedTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      std::cout << "Region at downsample " << downsample << " (" << nrPatches << " patches of " << patchSize << "x" << patchSize << ")" << std::endl;
+      std::cout << "  read and rescale:      " << rescaleTime << " ms" << std::endl;
+      std::cout << "  getRegionAtDownsample: " << fusedTime << " ms" << std::endl;
+    }
+
+    TEST(BenchmarkBGRAToRGBConversion)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // 256 tiles of 512x512, mostly opaque tissue with a transparent and a partially transparent
+      // border as OpenSlide returns at the slide edges
+      const unsigned long long tileSize = 512, nrTiles = 256, nrPixels = tileSize * tileSize;
+      vector<unsigned char> bgra(nrPixels * 4);
+      mt19937 generator(0);
+      for (unsigned long long i = 0; i < nrPixels; ++i) {
+        unsigned long long x = i % tileSize;
+        unsigned char alpha = x < 8 ? 0 : (x < 16 ? static_cast<unsigned char>(128 + generator() % 127) : 255);
+        for (unsigned int c = 0; c < 3; ++c) {
+          bgra[i * 4 + c] = static_cast<unsigned char>(generator() % (alpha + 1));
+        }
+        bgra[i * 4 + 3] = alpha;
+      }
+      vector<unsigned char> reference(nrPixels * 3), converted(nrPixels * 3);
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (unsigned long long tile = 0; tile < nrTiles; ++tile) {
+        convertPremultipliedBGRAToRGBReference(bgra.data(), nrPixels, reference.data());
+      }
+      double referenceTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      start = chrono::steady_clock::now();
+      for (unsigned long long tile = 0; tile < nrTiles; ++tile) {
+        pathology::convertPremultipliedBGRAToRGB(bgra.data(), nrPixels, converted.data(), 255, 255, 255);
+      }
+      double convertedTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      CHECK(reference == converted);
+
+      double megaPixels = nrTiles * nrPixels / 1e6;
+      std::cout << "BGRA to RGB conversion (" << nrTiles << " tiles of " << tileSize << "x" << tileSize << ")" << std::endl;
+      std::cout << "  per-pixel loop: " << referenceTime << " ms (" << megaPixels / (referenceTime / 1000.) << " MP/s)" << std::endl;
+      std::cout << "  vectorized:     " << convertedTime << " ms (" << megaPixels / (convertedTime / 1000.) << " MP/s)" << std::endl;
+    }
+
+    TEST(BenchmarkDownsampleByTwo)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // Synthesizing a tile of a virtual pyramid level halves 1024x1024 RGB pixels
+      const unsigned long long size = 1024, nrTiles = 256;
+      vector<unsigned char> image(size * size * 3);
+      mt19937 generator(0);
+      for (unsigned long long i = 0; i < image.size(); ++i) {
+        image[i] = static_cast<unsigned char>(generator() % 256);
+      }
+      vector<unsigned char> reference(size * size * 3 / 4), halved(size * size * 3 / 4);
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (unsigned long long tile = 0; tile < nrTiles; ++tile) {
+        pathology::downsampleByTwo<unsigned char>(image.data(), size, size, 3, reference.data());
+      }
+      double referenceTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      start = chrono::steady_clock::now();
+      for (unsigned long long tile = 0; tile < nrTiles; ++tile) {
+        pathology::downsampleByTwo(static_cast<const unsigned char*>(image.data()), size, size, 3, halved.data());
+      }
+      double halvedTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      CHECK(reference == halved);
+
+      double megaPixels = nrTiles * size * size / 1e6;
+      std::cout << "2x2 downsampling (" << nrTiles << " tiles of " << size << "x" << size << ")" << std::endl;
+      std::cout << "  per-pixel loop: " << referenceTime << " ms (" << megaPixels / (referenceTime / 1000.) << " MP/s)" << std::endl;
+      std::cout << "  vectorized:     " << halvedTime << " ms (" << megaPixels / (halvedTime / 1000.) << " MP/s)" << std::endl;
+    }
+
+    TEST(BenchmarkJPEG2000Codec)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // Smooth RGB tile with some noise, compressed lossy as the writer does
+      const unsigned int tileSize = 512, nrComponents = 3, nrTiles = 64;
+      const unsigned int tileByteSize = tileSize * tileSize * nrComponents;
+      vector<unsigned char> encoded(tileByteSize);
+      mt19937 generator(0);
+      for (unsigned int y = 0; y < tileSize; ++y) {
+        for (unsigned int x = 0; x < tileSize; ++x) {
+          for (unsigned int c = 0; c < nrComponents; ++c) {
+            encoded[(y * tileSize + x) * nrComponents + c] = static_cast<unsigned char>((x + 2 * y + 64 * c) / 6 + generator() % 16);
+          }
+        }
+      }
+      JPEG2000Codec codec;
+      unsigned int encodedSize = tileByteSize;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      codec.encode(reinterpret_cast<char*>(encoded.data()), encodedSize, tileSize, 80, nrComponents, pathology::DataType::UChar, pathology::ColorType::RGB);
+      double encodeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      encoded.resize(encodedSize);
+
+      unsigned int nrCores = std::max(1u, thread::hardware_concurrency());
+      std::cout << "JPEG2000 codec (" << nrTiles << " tiles of " << tileSize << "x" << tileSize << ", " << encodedSize << " bytes per tile, " << nrCores << " cores)" << std::endl;
+      std::cout << "  encode one tile:                      " << encodeTime << " ms" << std::endl;
+      std::cout << "  decode, 1 thread:                     " << benchmarkJPEG2000Decode(codec, encoded, tileByteSize, nrTiles, 1, 0) << " ms" << std::endl;
+      codec.setNumberOfThreadsPerTile(0);
+      std::cout << "  decode, intra-tile threads:           " << benchmarkJPEG2000Decode(codec, encoded, tileByteSize, nrTiles, 1, 0) << " ms" << std::endl;
+      codec.setNumberOfThreadsPerTile(1);
+      std::cout << "  decode, across-tile threads:          " << benchmarkJPEG2000Decode(codec, encoded, tileByteSize, nrTiles, nrCores, 0) << " ms" << std::endl;
+      std::cout << "  decode, 1 thread, half resolution:    " << benchmarkJPEG2000Decode(codec, encoded, tileByteSize, nrTiles, 1, 1) << " ms" << std::endl;
+      std::cout << "  decode, 1 thread, quarter resolution: " << benchmarkJPEG2000Decode(codec, encoded, tileByteSize, nrTiles, 1, 2) << " ms" << std::endl;
+    }
+
+    TEST(BenchmarkSparseMaskWriting)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // A tissue mask of 32768x32768 pixels of which an ellipse of about a fifth of the slide is
+      // foreground, as written by the threshold filter
+      const unsigned int width = 32768, height = 32768, tileSize = 512;
+      vector<unsigned char> tile(tileSize * tileSize);
+      for (int skipEmptyTiles = 0; skipEmptyTiles < 2; ++skipEmptyTiles) {
+        string outPath = g_dataPath + "/images/SparseMaskBenchmark.tif";
+        MultiResolutionImageWriter writer;
+        writer.openFile(outPath);
+        writer.setTileSize(tileSize);
+        writer.setCompression(pathology::Compression::LZW);
+        writer.setDataType(pathology::DataType::UChar);
+        writer.setColorType(pathology::ColorType::Monochrome);
+        writer.setInterpolation(pathology::Interpolation::NearestNeighbor);
+        writer.setSkipEmptyTiles(skipEmptyTiles == 1);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        writer.writeImageInformation(width, height);
+        for (unsigned int tileY = 0; tileY < height; tileY += tileSize) {
+          for (unsigned int tileX = 0; tileX < width; tileX += tileSize) {
+            for (unsigned int y = 0; y < tileSize; ++y) {
+              for (unsigned int x = 0; x < tileSize; ++x) {
+                double dx = (tileX + x - 0.4 * width) / (0.3 * width), dy = (tileY + y - 0.5 * height) / (0.2 * height);
+                tile[y * tileSize + x] = dx * dx + dy * dy < 1 ? 1 : 0;
+              }
+            }
+            writer.writeBaseImagePart(tile.data());
+          }
+        }
+        writer.finishImage();
+        double writeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        std::ifstream written(outPath, std::ios::binary | std::ios::ate);
+        std::cout << "Mask writing (" << width << "x" << height << ", " << (skipEmptyTiles ? "empty tiles skipped" : "all tiles written") << ")" << std::endl;
+        std::cout << "  write time: " << writeTime << " ms" << std::endl;
+        std::cout << "  file size:  " << written.tellg() / 1024 << " kB" << std::endl;
+      }
+    }
+
+    TEST(BenchmarkCodecMatrix)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // Representative tiles: a smooth RGB tile with noise, a fluorescence channel of blurred
+      // nuclei on a dark background and a smooth likelihood map
+      const unsigned int tileSize = 512;
+      vector<unsigned char> rgb(tileSize * tileSize * 3);
+      vector<unsigned short> fluorescence(tileSize * tileSize);
+      vector<float> likelihoods(tileSize * tileSize);
+      mt19937 generator(0);
+      for (unsigned int y = 0; y < tileSize; ++y) {
+        for (unsigned int x = 0; x < tileSize; ++x) {
+          for (unsigned int c = 0; c < 3; ++c) {
+            rgb[(y * tileSize + x) * 3 + c] = static_cast<unsigned char>((x + 2 * y + 64 * c) / 6 + generator() % 16);
+          }
+          double dx = (x % 64) - 32., dy = (y % 64) - 32.;
+          fluorescence[y * tileSize + x] = static_cast<unsigned short>(200 + 3000 * std::exp(-(dx * dx + dy * dy) / 200.) + generator() % 64);
+          likelihoods[y * tileSize + x] = static_cast<float>(0.5 + 0.5 * std::sin(x / 40.) * std::cos(y / 60.));
+        }
+      }
+      typedef pathology::Compression Codec;
+      vector<CodecSetting> lossless = { { "RAW", Codec::RAW, 100, false }, { "LZW", Codec::LZW, 100, false }, { "LZW + predictor", Codec::LZW, 100, true },
+        { "ZSTD", Codec::ZSTD, 100, false }, { "ZSTD + predictor", Codec::ZSTD, 100, true } };
+      vector<CodecSetting> rgbSettings = lossless;
+      rgbSettings.push_back({ "WebP lossless", Codec::WEBP, 100, false });
+      rgbSettings.push_back({ "WebP quality 90", Codec::WEBP, 90, false });
+      rgbSettings.push_back({ "JPEG quality 90", Codec::JPEG, 90, false });
+      std::cout << "Codec matrix" << std::endl;
+      benchmarkCodecs(rgb, tileSize, pathology::DataType::UChar, pathology::ColorType::RGB, rgbSettings, "8-bit RGB");
+      benchmarkCodecs(fluorescence, tileSize, pathology::DataType::UInt16, pathology::ColorType::Monochrome, lossless, "16-bit fluorescence");
+      benchmarkCodecs(likelihoods, tileSize, pathology::DataType::Float, pathology::ColorType::Monochrome, lossless, "float likelihood map");
+    }
+
+    TEST(BenchmarkTileOrderRandomWindows)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // Reads the same random 1024x1024 windows from a 16384x16384 RGB image stored in raster,
+      // Z-order and Hilbert order, with the file evicted from the page cache before every window
+      const unsigned int tileSize = 256, tilesAcross = 64, windowSize = 1024, nrWindows = 100;
+      string outPath = g_dataPath + "/images/TileOrderBenchmark.tif";
+      vector<unsigned char> tile(tileSize * tileSize * 3);
+      mt19937 generator(0);
+      for (unsigned char& value : tile) {
+        value = static_cast<unsigned char>(generator() % 256);
+      }
+      vector<pair<unsigned long long, unsigned long long> > windows;
+      for (unsigned int i = 0; i < nrWindows; ++i) {
+        windows.push_back(make_pair(generator() % (tilesAcross * tileSize - windowSize), generator() % (tilesAcross * tileSize - windowSize)));
+      }
+      const pathology::TileOrder orders[3] = { pathology::TileOrder::Raster, pathology::TileOrder::ZOrder, pathology::TileOrder::Hilbert };
+      const string names[3] = { "raster", "Z-order", "Hilbert" };
+      std::cout << "Random " << windowSize << "x" << windowSize << " windows" << std::endl;
+      for (int o = 0; o < 3; ++o) {
+        MultiResolutionImageWriter writer;
+        writer.setTileOrder(orders[o]);
+        writer.openFile(outPath);
+        writer.setTileSize(tileSize);
+        writer.setCompression(pathology::Compression::JPEG);
+        writer.setJPEGQuality(80);
+        writer.setDataType(pathology::DataType::UChar);
+        writer.setColorType(pathology::ColorType::RGB);
+        writer.setMaxNumberOfPyramidLevels(0);
+        writer.writeImageInformation(tilesAcross * tileSize, tilesAcross * tileSize);
+        for (unsigned int tileNr : writer.getOrderedTileNumbers(tilesAcross, tilesAcross)) {
+          // Vary the tiles a little so they do not all compress to the same size
+          tile[tileNr % tile.size()] ^= 0xFF;
+          writer.writeBaseImagePartToLocation(tile.data(), (tileNr % tilesAcross) * tileSize, (tileNr / tilesAcross) * tileSize);
+        }
+        writer.finishImage();
+
+        TIFFImage img;
+        img.initialize(outPath);
+        img.setCacheSize(0);
+        vector<unsigned char> window(windowSize * windowSize * 3);
+        unsigned char* windowData = window.data();
+        vector<double> latencies;
+        bool cold = true;
+        for (const auto& position : windows) {
+          cold = dropFromPageCache(outPath) && cold;
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          img.getRawRegion<unsigned char>(position.first, position.second, windowSize, windowSize, 0, windowData);
+          latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        sort(latencies.begin(), latencies.end());
+        double mean = 0;
+        for (double latency : latencies) {
+          mean += latency / latencies.size();
+        }
+        std::cout << "  " << names[o] << (cold ? " (cold cache)" : " (page cache not dropped)") << ": mean " << mean
+          << " ms, median " << latencies[latencies.size() / 2] << " ms, p95 " << latencies[latencies.size() * 95 / 100] << " ms" << std::endl;
+      }
+    }
+
+    TEST(BenchmarkLUTRendering)
+    {
+      if (!g_runTimeIntensiveTests) {
+        return;
+      }
+      // A likelihood map, where nearly every pixel is a distinct value, and a label map
+      const unsigned int tileSize = 512, nrTiles = 32;
+      vector<float> likelihoods(tileSize * tileSize);
+      vector<unsigned int> labels(tileSize * tileSize);
+      mt19937 generator(0);
+      uniform_real_distribution<float> likelihood(0.f, 1.f);
+      for (unsigned int i = 0; i < likelihoods.size(); ++i) {
+        likelihoods[i] = likelihood(generator);
+        labels[i] = ((i % tileSize) / 64 + (i / tileSize) / 64) % 30;
+      }
+      std::cout << "LUT rendering (" << nrTiles << " tiles of " << tileSize << "x" << tileSize << ")" << std::endl;
+      benchmarkLUTRendering(likelihoods, nrTiles, 0., 1., pathology::DefaultColorLookupTables["Traffic Light (0 - 1)"], "float likelihood map");
+      benchmarkLUTRendering(likelihoods, nrTiles, 0., 1., pathology::DefaultColorLookupTables["Background"], "float, relative LUT");
+      benchmarkLUTRendering(labels, nrTiles, 0., 29., pathology::DefaultColorLookupTables["Label"], "uint32 label map");
+
+      // Label maps are looked up exactly
+      vector<unsigned int> memoized(labels.size()), compiled(labels.size());
+      renderWithMemoizedLUT(labels.data(), labels.size(), 0., 29., pathology::DefaultColorLookupTables["Label"], memoized.data());
+      pathology::CompiledLUT(pathology::DefaultColorLookupTables["Label"]).apply(labels.data(), labels.size(), 0, 1, 0., 29., compiled.data());
+      CHECK(memoized == compiled);
+    }
+  }
+}
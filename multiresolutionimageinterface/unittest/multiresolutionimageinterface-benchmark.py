@@ -0,0 +1,90 @@
+"""Patch reading throughput of the Python bindings with several threads.
+
+Reads random patches from the base level of an image with 1 to N threads, with a new array per
+patch, with a preallocated array per thread (out) and in batches (getUCharPatches). The patch
+readers release the GIL, so the throughput should grow with the number of threads.
+
+Usage: python multiresolutionimageinterface-benchmark.py image.tif [--patch-size 256]
+           [--patches 2000] [--batch-size 32] [--max-threads 8]
+"""
+
+import argparse
+import threading
+import time
+
+import numpy as np
+import multiresolutionimageinterface as mir
+
+
+def random_positions(image, patch_size, count, seed=0):
+    dimensions = image.getDimensions()
+    width, height = dimensions[0], dimensions[1]
+    generator = np.random.default_rng(seed)
+    x = generator.integers(0, max(1, width - patch_size), count)
+    y = generator.integers(0, max(1, height - patch_size), count)
+    return np.stack([x, y], axis=1).astype(np.int64)
+
+
+def run_threads(nr_threads, work):
+    threads = [threading.Thread(target=work, args=(thread,)) for thread in range(nr_threads)]
+    start = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return time.perf_counter() - start
+
+
+def benchmark(image, positions, patch_size, batch_size, nr_threads):
+    samples = image.getSamplesPerPixel()
+    chunks = np.array_split(positions, nr_threads)
+
+    def new_arrays(thread):
+        for x, y in chunks[thread]:
+            image.getUCharPatch(int(x), int(y), patch_size, patch_size, 0)
+
+    def preallocated(thread):
+        out = np.empty((patch_size, patch_size, samples), dtype=np.uint8)
+        for x, y in chunks[thread]:
+            image.getUCharPatch(int(x), int(y), patch_size, patch_size, 0, out)
+
+    def batched(thread):
+        out = np.empty((batch_size, patch_size, patch_size, samples), dtype=np.uint8)
+        chunk = chunks[thread]
+        for first in range(0, len(chunk), batch_size):
+            batch = chunk[first:first + batch_size]
+            image.getUCharPatches(batch, patch_size, patch_size, 0, out if len(batch) == batch_size else None)
+
+    results = {}
+    for name, work in (("new array", new_arrays), ("out", preallocated), ("batched", batched)):
+        results[name] = len(positions) / run_threads(nr_threads, work)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("--patch-size", type=int, default=256)
+    parser.add_argument("--patches", type=int, default=2000)
+    parser.add_argument("--batch-size", type=int, default=32)
+    parser.add_argument("--max-threads", type=int, default=8)
+    args = parser.parse_args()
+
+    reader = mir.MultiResolutionImageReader()
+    image = reader.open(args.image)
+    if image is None:
+        raise SystemExit("Could not open " + args.image)
+    positions = random_positions(image, args.patch_size, args.patches)
+    # Warm up the tile cache and the file system cache once, every run then reads the same patches
+    benchmark(image, positions, args.patch_size, args.batch_size, 1)
+
+    print("Patches of %dx%d per second" % (args.patch_size, args.patch_size))
+    nr_threads = 1
+    while nr_threads <= args.max_threads:
+        results = benchmark(image, positions, args.patch_size, args.batch_size, nr_threads)
+        print("  %d thread(s): " % nr_threads + ", ".join("%s %.0f" % item for item in results.items()))
+        nr_threads *= 2
+
+
+if __name__ == "__main__":
+    main()
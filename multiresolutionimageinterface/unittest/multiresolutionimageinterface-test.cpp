@@ -2,9 +2,15 @@
 #include "MultiResolutionImage.h"
 #include "MultiResolutionImageReader.h"
 #include "MultiResolutionImageWriter.h"
+#include "PixelConversion.h"
+#include "VirtualPyramidImage.h"
+#include "LIFImage.h"
 #include <iostream>
+#include <fstream>
+#include <algorithm>
 #include "core/filetools.h"
 #include "core/PathologyEnums.h"
+#include "core/CompiledLUT.h"
 #include "TestData.h"
 
 using namespace UnitTest;
@@ -58,6 +64,66 @@ namespace
       delete img;
 	  }
 
+    TEST(TestConvertPremultipliedBGRAToRGB)
+    {
+      // Opaque, transparent and partially transparent pixels, more than one SIMD block
+      const unsigned char bgra[] = { 10, 20, 30, 255, 1, 2, 3, 0, 50, 100, 127, 127, 0, 0, 0, 255, 
+                                     40, 50, 60, 255, 70, 80, 90, 255, 1, 1, 1, 2, 200, 100, 0, 255,
+                                     5, 6, 7, 255, 8, 9, 10, 255 };
+      const unsigned char expected[] = { 30, 20, 10, 1, 2, 3, 255, 200, 100, 0, 0, 0,
+                                         60, 50, 40, 90, 80, 70, 127, 127, 127, 0, 100, 200,
+                                         7, 6, 5, 10, 9, 8 };
+      unsigned char rgb[30];
+      convertPremultipliedBGRAToRGB(bgra, 10, rgb, 1, 2, 3);
+      CHECK_ARRAY_EQUAL(expected, rgb, 30);
+    }
+
+    TEST(TestDownsampleByTwo)
+    {
+      // Odd width and height, the last column and row are averaged with themselves
+      unsigned char image[5 * 3 * 3];
+      for (int i = 0; i < 5 * 3 * 3; ++i) {
+        image[i] = static_cast<unsigned char>((i * 37) % 256);
+      }
+      unsigned char expected[3 * 2 * 3];
+      unsigned char halved[3 * 2 * 3];
+      downsampleByTwo<unsigned char>(static_cast<const unsigned char*>(image), 5, 3, 3, expected);
+      downsampleByTwo(static_cast<const unsigned char*>(image), 5, 3, 3, halved);
+      CHECK_ARRAY_EQUAL(expected, halved, 3 * 2 * 3);
+      CHECK_EQUAL((image[0] + image[3] + image[15] + image[18] + 2) / 4, (int)halved[0]);
+      CHECK_EQUAL((image[12] + image[27] + 1) / 2, (int)halved[6]);
+    }
+
+    TEST(TestHalfAndBitConversion)
+    {
+      // Every half except NaN survives a round trip through float
+      for (unsigned int i = 0; i < 65536; ++i) {
+        unsigned short half = static_cast<unsigned short>(i), roundTrip = 0;
+        float value = 0;
+        convertHalfToFloat(&half, 1, &value);
+        convertFloatToHalf(&value, 1, &roundTrip);
+        if (value == value) {
+          CHECK_EQUAL(half, roundTrip);
+        }
+      }
+      const float values[] = { 1.f, -0.5f, 65504.f, 65520.f, 0.1f };
+      const unsigned short expected[] = { 0x3c00, 0xb800, 0x7bff, 0x7c00, 0x2e66 };
+      unsigned short halves[5];
+      convertFloatToHalf(values, 5, halves);
+      CHECK_ARRAY_EQUAL(expected, halves, 5);
+
+      const unsigned char samples[] = { 1, 0, 1, 1, 0, 0, 0, 1, 5, 0, 0, 1, 1 };
+      unsigned char packed[2];
+      packBits(samples, 13, packed);
+      CHECK_EQUAL(0xb1, (int)packed[0]);
+      CHECK_EQUAL(0x98, (int)packed[1]);
+      unsigned char unpacked[10];
+      unpackBits(packed, 3, 10, unpacked);
+      for (unsigned int i = 0; i < 10; ++i) {
+        CHECK_EQUAL(samples[i + 3] != 0, unpacked[i] == 1);
+      }
+    }
+
     TEST(TestgetRawRegionUInt32)
     {
       MultiResolutionImageReader test;
@@ -86,6 +152,157 @@ namespace
       delete img;
 	  }
     
+    TEST(TestGetThumbnail)
+    {
+      MultiResolutionImageReader test;
+      MultiResolutionImage* img = test.open(g_dataPath + "/images/OpenSlideInterfaceTestImage.tif");
+      vector<unsigned long long> dims = img->getDimensions();
+      Patch<unsigned char> thumbnail = img->getThumbnail(256);
+      vector<unsigned long long> thumbnailDims = thumbnail.getDimensions();
+      CHECK_EQUAL(256, std::max(thumbnailDims[0], thumbnailDims[1]));
+      CHECK_EQUAL(3, thumbnailDims[2]);
+      CHECK_CLOSE(static_cast<double>(dims[0]) / dims[1], static_cast<double>(thumbnailDims[0]) / thumbnailDims[1], 0.02);
+      delete img;
+    }
+
+    TEST(TestGetRegionAtDownsample)
+    {
+      MultiResolutionImageReader test;
+      MultiResolutionImage* img = test.open(g_dataPath + "/images/OpenSlideInterfaceTestImage.tif");
+      // At the downsample of a level the region is read from it as is
+      double levelDownsample = img->getLevelDownsample(1);
+      unsigned char* levelData = new unsigned char[256 * 256 * 3];
+      img->getRawRegion<unsigned char>(13824, 11776, 256, 256, 1, levelData);
+      Patch<unsigned char> atLevel = img->getRegionAtDownsample<unsigned char>(13824, 11776, 256, 256, levelDownsample);
+      CHECK_ARRAY_EQUAL(levelData, atLevel.getPointer(), 256 * 256 * 3);
+      CHECK_CLOSE(img->getSpacing()[0] * levelDownsample, atLevel.getSpacing()[0], 1e-6);
+      delete[] levelData;
+
+      // Between levels 2x2 blocks of the base level are averaged
+      unsigned char* baseData = new unsigned char[256 * 256 * 3];
+      img->getRawRegion<unsigned char>(13824, 11776, 256, 256, 0, baseData);
+      Patch<unsigned char> halved = img->getRegionAtDownsample<unsigned char>(13824, 11776, 128, 128, 2.);
+      int maxDifference = 0;
+      for (int y = 0; y < 128; ++y) {
+        for (int x = 0; x < 128; ++x) {
+          for (int s = 0; s < 3; ++s) {
+            int sum = baseData[((2 * y) * 256 + 2 * x) * 3 + s] + baseData[((2 * y) * 256 + 2 * x + 1) * 3 + s] +
+                      baseData[((2 * y + 1) * 256 + 2 * x) * 3 + s] + baseData[((2 * y + 1) * 256 + 2 * x + 1) * 3 + s];
+            maxDifference = std::max(maxDifference, std::abs((sum + 2) / 4 - halved.getPointer()[(y * 128 + x) * 3 + s]));
+          }
+        }
+      }
+      CHECK(maxDifference <= 1);
+      delete[] baseData;
+
+      // The same region by spacing, resampled in the same way
+      Patch<unsigned char> atSpacing = img->getRegionAtSpacing<unsigned char>(13824, 11776, 64, 64, img->getSpacing()[0] * 2.);
+      CHECK_EQUAL(64, atSpacing.getDimensions()[0]);
+      bool equal = true;
+      for (int y = 0; y < 64; ++y) {
+        equal &= std::equal(atSpacing.getPointer() + y * 64 * 3, atSpacing.getPointer() + (y + 1) * 64 * 3, halved.getPointer() + y * 128 * 3);
+      }
+      CHECK(equal);
+      delete img;
+    }
+
+    TEST(TestGetRegionAtDownsampleAtImageEdge)
+    {
+      // Pixels centered inside a uniform image keep its value up to the right and bottom edges,
+      // both when magnifying and when minifying; pixels beyond the edge are 0
+      MultiResolutionImageWriter testWrite;
+      testWrite.openFile(g_dataPath + "/images/ResampleEdgeTestImage.tif");
+      testWrite.setTileSize(512);
+      testWrite.setCompression(pathology::Compression::LZW);
+      testWrite.setDataType(pathology::DataType::UChar);
+      testWrite.setColorType(pathology::ColorType::RGB);
+      testWrite.writeImageInformation(1000, 700);
+      std::vector<unsigned char> tile(512 * 512 * 3, 200);
+      for (unsigned int i = 0; i < 4; ++i) {
+        testWrite.writeBaseImagePart(tile.data());
+      }
+      testWrite.finishImage();
+
+      MultiResolutionImageReader reader;
+      MultiResolutionImage* img = reader.open(g_dataPath + "/images/ResampleEdgeTestImage.tif");
+      CHECK(img != NULL);
+      if (!img) {
+        return;
+      }
+      const double downsamples[2] = { 0.75, 1.7 };
+      const long long starts[2][2] = { { 940, 640 }, { 900, 600 } };
+      for (unsigned int i = 0; i < 2; ++i) {
+        double downsample = downsamples[i];
+        Patch<unsigned char> patch = img->getRegionAtDownsample<unsigned char>(starts[i][0], starts[i][1], 80, 80, downsample);
+        unsigned int wrongInside = 0, wrongOutside = 0;
+        for (unsigned int y = 0; y < 80; ++y) {
+          for (unsigned int x = 0; x < 80; ++x) {
+            double centerX = starts[i][0] + (x + 0.5) * downsample;
+            double centerY = starts[i][1] + (y + 0.5) * downsample;
+            unsigned char value = patch.getPointer()[(y * 80 + x) * 3];
+            if (centerX < 1000 && centerY < 700) {
+              wrongInside += value != 200;
+            }
+            else if (starts[i][0] + x * downsample >= 1001 || starts[i][1] + y * downsample >= 701) {
+              wrongOutside += value != 0;
+            }
+          }
+        }
+        CHECK_EQUAL(0u, wrongInside);
+        CHECK_EQUAL(0u, wrongOutside);
+      }
+      delete img;
+    }
+
+    TEST(TestVirtualPyramid)
+    {
+      // A pyramid with levels 16 times apart gets two levels synthesized in between
+      MultiResolutionImageWriter testWrite;
+      testWrite.openFile(g_dataPath + "/images/VirtualPyramidTestImage.tif");
+      testWrite.setTileSize(256);
+      testWrite.setCompression(Compression::LZW);
+      testWrite.setDataType(DataType::UChar);
+      testWrite.setColorType(ColorType::RGB);
+      testWrite.setDownsamplePerLevel(16);
+      testWrite.writeImageInformation(8192, 256);
+      unsigned char* tile = new unsigned char[256 * 256 * 3];
+      for (int tileX = 0; tileX < 32; ++tileX) {
+        for (int i = 0; i < 256 * 256 * 3; ++i) {
+          tile[i] = static_cast<unsigned char>((tileX * 256 + (i / 3) % 256 + i / (256 * 3)) % 256);
+        }
+        testWrite.writeBaseImagePart((void*)tile);
+      }
+      testWrite.finishImage();
+      delete[] tile;
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* img = testRead.open(g_dataPath + "/images/VirtualPyramidTestImage.tif");
+      VirtualPyramidImage* pyramid = dynamic_cast<VirtualPyramidImage*>(img);
+      CHECK(pyramid != NULL);
+      if (pyramid) {
+        CHECK_EQUAL(4, pyramid->getNumberOfLevels());
+        CHECK(!pyramid->isVirtualLevel(0));
+        CHECK(pyramid->isVirtualLevel(1));
+        CHECK(pyramid->isVirtualLevel(2));
+        CHECK(!pyramid->isVirtualLevel(3));
+        CHECK_EQUAL(4096, pyramid->getLevelDimensions(1)[0]);
+        CHECK_EQUAL(128, pyramid->getLevelDimensions(1)[1]);
+
+        // Synthesized levels equal halving the level before them, also across tiles
+        unsigned char* base = new unsigned char[2048 * 256 * 3];
+        unsigned char* expected = new unsigned char[1024 * 128 * 3];
+        unsigned char* level1 = new unsigned char[1024 * 128 * 3];
+        pyramid->getRawRegion<unsigned char>(2048, 0, 2048, 256, 0, base);
+        downsampleByTwo(static_cast<const unsigned char*>(base), 2048, 256, 3, expected);
+        pyramid->getRawRegion<unsigned char>(2048, 0, 1024, 128, 1, level1);
+        CHECK_ARRAY_EQUAL(expected, level1, 1024 * 128 * 3);
+        delete[] base;
+        delete[] expected;
+        delete[] level1;
+      }
+      delete img;
+    }
+
     TEST(TestgetRawRegionUCharOpenSlide)
     {
       MultiResolutionImageReader test;
@@ -101,6 +318,27 @@ namespace
       delete img;
     }
 
+    TEST(TestgetRawRegionIntoOpenSlide)
+    {
+      // Reads through the native BGRA region of OpenSlide, which has to give the same pixels
+      // as getRawRegion, also at a lower level and partly outside the image
+      MultiResolutionImageReader test;
+      MultiResolutionImage* img = test.open(g_dataPath + "/images/OpenSlideInterfaceTestImage.svs");
+      CHECK(img);
+      if (img) {
+        const long long regions[][3] = { { 13824, 11776, 0 }, { 12800, 11264, 1 }, { -256, -256, 0 } };
+        for (unsigned int i = 0; i < 3; ++i) {
+          std::vector<unsigned char> into(512 * 512 * 3, 0);
+          unsigned char* raw = NULL;
+          img->getRawRegionInto<unsigned char>(regions[i][0], regions[i][1], 512, 512, regions[i][2], into.data());
+          img->getRawRegion<unsigned char>(regions[i][0], regions[i][1], 512, 512, regions[i][2], raw);
+          CHECK(raw && std::equal(into.begin(), into.end(), raw));
+          delete[] raw;
+        }
+      }
+      delete img;
+    }
+
     TEST(TestgetRawRegionFloatOpenSlide)
     {
       MultiResolutionImageReader test;
@@ -233,6 +471,297 @@ namespace
       delete img;
     }
 
+    TEST(TestReadWriteFloat16AndBit)
+    {
+      // A likelihood map and a mask with the same content, read back as float and unsigned char
+      float* likelihood = new float[256 * 256];
+      unsigned char* mask = new unsigned char[256 * 256];
+      for (int i = 0; i < 256 * 256; ++i) {
+        likelihood[i] = ((i / 256) % 64) / 64.f;
+        mask[i] = likelihood[i] >= 0.5f ? 1 : 0;
+      }
+      const DataType types[] = { DataType::Float16, DataType::Bit };
+      const std::string paths[] = { g_dataPath + "/images/Float16TestImage.tif", g_dataPath + "/images/BitTestImage.tif" };
+      for (int t = 0; t < 2; ++t) {
+        MultiResolutionImageWriter testWrite;
+        testWrite.openFile(paths[t]);
+        testWrite.setTileSize(256);
+        testWrite.setCompression(Compression::LZW);
+        testWrite.setDataType(types[t]);
+        testWrite.setColorType(ColorType::Monochrome);
+        testWrite.writeImageInformation(1024, 1024);
+        for (int i = 0; i < 16; ++i) {
+          testWrite.writeBaseImagePart(types[t] == DataType::Bit ? (void*)mask : (void*)likelihood);
+        }
+        testWrite.finishImage();
+      }
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* img = testRead.open(paths[0]);
+      CHECK(img->getDataType() == DataType::Float16);
+      CHECK_EQUAL(2, img->getNumberOfLevels());
+      float* floatData = new float[256 * 256];
+      img->getRawRegion<float>(256, 512, 256, 256, 0, floatData);
+      CHECK_ARRAY_EQUAL(likelihood, floatData, 256 * 256);
+      img->getRawRegion<float>(0, 0, 128, 128, 1, floatData);
+      CHECK_CLOSE((likelihood[0] + likelihood[256]) / 2, floatData[0], 1e-3);
+      delete img;
+
+      img = testRead.open(paths[1]);
+      CHECK(img->getDataType() == DataType::Bit);
+      CHECK_EQUAL(1., img->getMaxValue(0));
+      unsigned char* ucharData = new unsigned char[250 * 250];
+      img->getRawRegion<unsigned char>(3, 5, 250, 250, 0, ucharData);
+      for (int y = 0; y < 250; ++y) {
+        CHECK(std::equal(ucharData + y * 250, ucharData + (y + 1) * 250, mask + (y + 5) * 256 + 3));
+      }
+      img->getRawRegion<float>(0, 0, 1, 1, 0, floatData);
+      CHECK_EQUAL(0.f, floatData[0]);
+      delete img;
+      delete[] likelihood;
+      delete[] mask;
+      delete[] floatData;
+      delete[] ucharData;
+    }
+
+    TEST(TestReadWriteZSTDAndWebP)
+    {
+      // ZSTD with the floating point predictor and lossless WebP read back exactly
+      float* likelihood = new float[256 * 256];
+      unsigned char* rgb = new unsigned char[256 * 256 * 3];
+      for (int i = 0; i < 256 * 256; ++i) {
+        likelihood[i] = (i % 256) / 255.f * ((i / 256) % 7);
+        for (int c = 0; c < 3; ++c) {
+          rgb[i * 3 + c] = static_cast<unsigned char>((i % 256 + (i / 256) * c) % 256);
+        }
+      }
+      const std::string paths[] = { g_dataPath + "/images/ZSTDTestImage.tif", g_dataPath + "/images/WebPTestImage.tif" };
+      for (int t = 0; t < 2; ++t) {
+        MultiResolutionImageWriter testWrite;
+        testWrite.openFile(paths[t]);
+        testWrite.setTileSize(256);
+        testWrite.setCompression(t == 0 ? Compression::ZSTD : Compression::WEBP);
+        testWrite.setJPEGQuality(100);
+        testWrite.setUsePredictor(t == 0);
+        testWrite.setDataType(t == 0 ? DataType::Float : DataType::UChar);
+        testWrite.setColorType(t == 0 ? ColorType::Monochrome : ColorType::RGB);
+        testWrite.writeImageInformation(512, 512);
+        for (int i = 0; i < 4; ++i) {
+          testWrite.writeBaseImagePart(t == 0 ? (void*)likelihood : (void*)rgb);
+        }
+        testWrite.finishImage();
+      }
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* img = testRead.open(paths[0]);
+      float* floatData = new float[256 * 256];
+      img->getRawRegion<float>(256, 256, 256, 256, 0, floatData);
+      CHECK_ARRAY_EQUAL(likelihood, floatData, 256 * 256);
+      delete img;
+      img = testRead.open(paths[1]);
+      unsigned char* ucharData = new unsigned char[256 * 256 * 3];
+      img->getRawRegion<unsigned char>(0, 256, 256, 256, 0, ucharData);
+      CHECK_ARRAY_EQUAL(rgb, ucharData, 256 * 256 * 3);
+      delete img;
+      delete[] likelihood;
+      delete[] rgb;
+      delete[] floatData;
+      delete[] ucharData;
+    }
+
+    TEST(TestSkipEmptyTiles)
+    {
+      // Only the top left tile has content, the other base tiles and the pyramid tiles which
+      // only cover them are left out of the file and read back as 0
+      unsigned char* tile = new unsigned char[256 * 256];
+      std::string paths[2] = { g_dataPath + "/images/SparseTestImage.tif", g_dataPath + "/images/DenseTestImage.tif" };
+      for (int skip = 1; skip >= 0; --skip) {
+        MultiResolutionImageWriter testWrite;
+        testWrite.openFile(paths[1 - skip]);
+        testWrite.setTileSize(256);
+        testWrite.setCompression(Compression::RAW);
+        testWrite.setDataType(DataType::UChar);
+        testWrite.setColorType(ColorType::Monochrome);
+        testWrite.setSkipEmptyTiles(skip == 1);
+        testWrite.writeImageInformation(2048, 2048);
+        for (int i = 0; i < 64; ++i) {
+          for (int j = 0; j < 256 * 256; ++j) {
+            tile[j] = i == 0 ? static_cast<unsigned char>(j % 251 + 1) : 0;
+          }
+          testWrite.writeBaseImagePart((void*)tile);
+        }
+        testWrite.finishImage();
+      }
+      std::ifstream sparseFile(paths[0], std::ios::binary | std::ios::ate), denseFile(paths[1], std::ios::binary | std::ios::ate);
+      CHECK(sparseFile.tellg() * 4 < denseFile.tellg());
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* img = testRead.open(paths[0]);
+      CHECK_EQUAL(0., img->getMinValue(0));
+      CHECK_EQUAL(251., img->getMaxValue(0));
+      unsigned char* data = new unsigned char[512 * 512];
+      img->getRawRegion<unsigned char>(0, 0, 512, 512, 0, data);
+      CHECK_EQUAL(1, (int)data[0]);
+      CHECK_EQUAL(251, (int)data[250]);
+      CHECK(std::all_of(data + 256, data + 512, [](unsigned char v) { return v == 0; }));
+      CHECK(std::all_of(data + 512 * 256, data + 512 * 512, [](unsigned char v) { return v == 0; }));
+      img->getRawRegion<unsigned char>(0, 0, 256, 256, 1, data);
+      CHECK(data[0] != 0);
+      CHECK_EQUAL(0, (int)data[256 * 255 + 255]);
+      delete img;
+      delete[] tile;
+      delete[] data;
+    }
+
+    TEST(TestTileOrder)
+    {
+      // Images written in raster, Z-order and Hilbert order contain the same pixels
+      const TileOrder orders[3] = { TileOrder::Raster, TileOrder::ZOrder, TileOrder::Hilbert };
+      const unsigned int tilesX = 5, tilesY = 3;
+      unsigned char* tile = new unsigned char[256 * 256];
+      unsigned char* data[3];
+      unsigned char* levelData[3];
+      for (int o = 0; o < 3; ++o) {
+        MultiResolutionImageWriter testWrite;
+        testWrite.setTileOrder(orders[o]);
+        std::vector<unsigned int> tileNumbers = testWrite.getOrderedTileNumbers(tilesX, tilesY);
+        std::vector<unsigned int> sortedTileNumbers = tileNumbers;
+        std::sort(sortedTileNumbers.begin(), sortedTileNumbers.end());
+        CHECK_EQUAL(tilesX * tilesY, (unsigned int)tileNumbers.size());
+        CHECK(std::adjacent_find(sortedTileNumbers.begin(), sortedTileNumbers.end()) == sortedTileNumbers.end());
+        CHECK(sortedTileNumbers.back() == tilesX * tilesY - 1);
+
+        std::string path = g_dataPath + "/images/TileOrderTestImage.tif";
+        testWrite.openFile(path);
+        testWrite.setTileSize(256);
+        testWrite.setCompression(Compression::LZW);
+        testWrite.setDataType(DataType::UChar);
+        testWrite.setColorType(ColorType::Monochrome);
+        testWrite.writeImageInformation(tilesX * 256, tilesY * 256);
+        for (unsigned int tileNr : tileNumbers) {
+          unsigned int x = (tileNr % tilesX) * 256, y = (tileNr / tilesX) * 256;
+          for (unsigned int j = 0; j < 256 * 256; ++j) {
+            tile[j] = static_cast<unsigned char>(((x + j % 256) * 3 + (y + j / 256) * 7) % 256);
+          }
+          testWrite.writeBaseImagePartToLocation((void*)tile, x, y);
+        }
+        testWrite.finishImage();
+
+        MultiResolutionImageReader testRead;
+        MultiResolutionImage* img = testRead.open(path);
+        data[o] = new unsigned char[tilesX * 256 * tilesY * 256];
+        levelData[o] = new unsigned char[tilesX * 128 * tilesY * 128];
+        img->getRawRegion<unsigned char>(0, 0, tilesX * 256, tilesY * 256, 0, data[o]);
+        img->getRawRegion<unsigned char>(0, 0, tilesX * 128, tilesY * 128, 1, levelData[o]);
+        delete img;
+      }
+      CHECK_EQUAL(((1000 * 3 + 700 * 7) % 256), (int)data[0][700 * tilesX * 256 + 1000]);
+      for (int o = 1; o < 3; ++o) {
+        CHECK_ARRAY_EQUAL(data[0], data[o], tilesX * 256 * tilesY * 256);
+        CHECK_ARRAY_EQUAL(levelData[0], levelData[o], tilesX * 128 * tilesY * 128);
+      }
+      for (int o = 0; o < 3; ++o) {
+        delete[] data[o];
+        delete[] levelData[o];
+      }
+      delete[] tile;
+    }
+
+    TEST(TestGetRawRegionInto)
+    {
+      // Reads into a caller-owned buffer, natively and with conversion, match getRawRegion
+      std::string path = g_dataPath + "/images/RegionIntoTestImage.tif";
+      unsigned char* tile = new unsigned char[256 * 256 * 3];
+      for (int i = 0; i < 256 * 256 * 3; ++i) {
+        tile[i] = static_cast<unsigned char>(i % 253);
+      }
+      MultiResolutionImageWriter testWrite;
+      testWrite.openFile(path);
+      testWrite.setTileSize(256);
+      testWrite.setCompression(Compression::LZW);
+      testWrite.setDataType(DataType::UChar);
+      testWrite.setColorType(ColorType::RGB);
+      testWrite.writeImageInformation(512, 512);
+      for (int i = 0; i < 4; ++i) {
+        testWrite.writeBaseImagePart((void*)tile);
+      }
+      testWrite.finishImage();
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* img = testRead.open(path);
+      std::vector<unsigned char> owned(300 * 200 * 3);
+      std::vector<float> ownedFloat(300 * 200 * 3);
+      unsigned char* data = new unsigned char[300 * 200 * 3];
+      img->getRawRegion<unsigned char>(100, 150, 300, 200, 0, data);
+      img->getRawRegionInto<unsigned char>(100, 150, 300, 200, 0, owned.data());
+      img->getRawRegionInto<float>(100, 150, 300, 200, 0, ownedFloat.data());
+      CHECK_ARRAY_EQUAL(data, owned.data(), 300 * 200 * 3);
+      CHECK(std::equal(owned.begin(), owned.end(), ownedFloat.begin(), [](unsigned char a, float b) { return static_cast<float>(a) == b; }));
+      delete img;
+      delete[] data;
+      delete[] tile;
+    }
+
+    TEST(TestTilePassthrough)
+    {
+      // Converting a JPEG TIFF with the same codec and tile size copies the compressed tiles, with
+      // the spacing taken from the override as MultiResImageConverter does for SVS files
+      std::string sourcePath = g_dataPath + "/images/PassthroughSourceTestImage.tif";
+      std::string outPath = g_dataPath + "/images/PassthroughOutTestImage.tif";
+      unsigned char* tile = new unsigned char[256 * 256 * 3];
+      MultiResolutionImageWriter sourceWrite;
+      sourceWrite.openFile(sourcePath);
+      sourceWrite.setTileSize(256);
+      sourceWrite.setCompression(Compression::JPEG);
+      sourceWrite.setDataType(DataType::UChar);
+      sourceWrite.setColorType(ColorType::RGB);
+      sourceWrite.writeImageInformation(768, 512);
+      for (int t = 0; t < 6; ++t) {
+        for (int i = 0; i < 256 * 256 * 3; ++i) {
+          tile[i] = static_cast<unsigned char>((i / 3 % 256 + (i / 768) * (t + 1) + (i % 3) * 60) % 256);
+        }
+        sourceWrite.writeBaseImagePart((void*)tile);
+      }
+      sourceWrite.finishImage();
+
+      MultiResolutionImageReader testRead;
+      MultiResolutionImage* source = testRead.open(sourcePath);
+      MultiResolutionImageWriter testWrite;
+      testWrite.setTileSize(256);
+      testWrite.setCompression(Compression::LZW);
+      CHECK(!testWrite.canCopyEncodedTiles(source));
+      testWrite.setCompression(Compression::JPEG);
+      testWrite.setTileSize(512);
+      CHECK(!testWrite.canCopyEncodedTiles(source));
+      testWrite.setTileSize(256);
+      CHECK(testWrite.canCopyEncodedTiles(source));
+      std::vector<double> spacing(2, 0.25);
+      testWrite.setOverrideSpacing(spacing);
+      testWrite.writeImageToFile(source, outPath);
+
+      MultiResolutionImage* out = testRead.open(outPath);
+      CHECK(out != NULL);
+      if (out) {
+        std::vector<double> outSpacing = out->getSpacing();
+        CHECK_EQUAL(2, (int)outSpacing.size());
+        if (outSpacing.size() == 2) {
+          CHECK_CLOSE(0.25, outSpacing[0], 1e-6);
+          CHECK_CLOSE(0.25, outSpacing[1], 1e-6);
+        }
+        std::vector<unsigned char> sourceTile, outTile;
+        for (unsigned long long tileY = 0; tileY < 2; ++tileY) {
+          for (unsigned long long tileX = 0; tileX < 3; ++tileX) {
+            CHECK(source->readEncodedTile(0, tileX, tileY, sourceTile));
+            CHECK(out->readEncodedTile(0, tileX, tileY, outTile));
+            CHECK(sourceTile == outTile);
+          }
+        }
+        delete out;
+      }
+      delete source;
+      delete[] tile;
+    }
+
     TEST(TestReadWriteMultiRes)
     {
       MultiResolutionImageReader testRead;
@@ -380,6 +909,30 @@ namespace
     }
   }
   
+  // Whether a region of the base level read at once from one image equals the same region read
+  // in pieces of pieceSize pixels from another (with its own cache)
+  bool regionMatchesPieces(MultiResolutionImage* whole, MultiResolutionImage* pieces, const long long& x, const long long& y,
+    const unsigned long long& width, const unsigned long long& height, const unsigned long long& pieceSize)
+  {
+    unsigned int samples = whole->getSamplesPerPixel();
+    std::vector<unsigned char> region(width * height * samples);
+    std::vector<unsigned char> piece(pieceSize * pieceSize * samples);
+    whole->getRawRegionInto<unsigned char>(x, y, width, height, 0, region.data());
+    for (unsigned long long py = 0; py < height; py += pieceSize) {
+      for (unsigned long long px = 0; px < width; px += pieceSize) {
+        pieces->getRawRegionInto<unsigned char>(x + px, y + py, pieceSize, pieceSize, 0, piece.data());
+        for (unsigned long long row = 0; row < pieceSize && py + row < height; ++row) {
+          unsigned long long rowLength = std::min(pieceSize, width - px) * samples;
+          if (!std::equal(piece.begin() + row * pieceSize * samples, piece.begin() + row * pieceSize * samples + rowLength,
+            region.begin() + ((py + row) * width + px) * samples)) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
   SUITE(VSISupport)
   {
 
@@ -409,6 +962,37 @@ namespace
       delete[] testData;
       delete img;
 	  }
+
+    TEST(ReadMultipleTilesFromVSI)
+    {
+      // A region covering several ETS tiles is decoded tile by tile into the right places
+      MultiResolutionImageReader test;
+      MultiResolutionImage* whole = test.open(g_dataPath + "/images/TestImage.vsi");
+      MultiResolutionImage* pieces = test.open(g_dataPath + "/images/TestImage.vsi");
+      CHECK(whole && pieces);
+      if (whole && pieces) {
+        CHECK(regionMatchesPieces(whole, pieces, 3608, 9752, 1536, 1024, 256));
+      }
+      delete whole;
+      delete pieces;
+    }
+
+    TEST(ReadRegionLeftOfVSI)
+    {
+      // Regions partly or completely left of and above the image are filled with white
+      MultiResolutionImageReader test;
+      MultiResolutionImage* whole = test.open(g_dataPath + "/images/TestImage.vsi");
+      MultiResolutionImage* pieces = test.open(g_dataPath + "/images/TestImage.vsi");
+      CHECK(whole && pieces);
+      if (whole && pieces) {
+        std::vector<unsigned char> outside(512 * 512 * 3, 0);
+        whole->getRawRegionInto<unsigned char>(-600, -600, 512, 512, 0, outside.data());
+        CHECK(std::count(outside.begin(), outside.end(), 255) == static_cast<long>(outside.size()));
+        CHECK(regionMatchesPieces(whole, pieces, -600, -600, 1536, 1024, 256));
+      }
+      delete whole;
+      delete pieces;
+    }
     
     TEST(ReadLosslessJPEG) 
     {
@@ -439,8 +1023,126 @@ namespace
     }
   }
 
+  // Writes a LIF file with a single 8-bit monochrome image of width x height pixels
+  void writeTestLIF(const std::string& path, const unsigned int& width, const unsigned int& height, const std::vector<unsigned char>& pixels)
+  {
+    std::string xml = "<LMSDataContainerHeader><Element Name=\"Test\"><Data><Image><ImageDescription><Channels>"
+      "<ChannelDescription BytesInc=\"0\" LUTName=\"Gray\"/></Channels><Dimensions>"
+      "<DimensionDescription DimID=\"1\" NumberOfElements=\"" + std::to_string(width) + "\" BytesInc=\"1\" Length=\"0.001\" Unit=\"m\"/>"
+      "<DimensionDescription DimID=\"2\" NumberOfElements=\"" + std::to_string(height) + "\" BytesInc=\"" + std::to_string(width) + "\" Length=\"0.001\" Unit=\"m\"/>"
+      "</Dimensions></ImageDescription></Image></Data></Element></LMSDataContainerHeader>";
+    auto writeInt = [](std::ofstream& file, const int& value) { file.write(reinterpret_cast<const char*>(&value), 4); };
+    auto writeUTF16 = [](std::ofstream& file, const std::string& text) {
+      for (char c : text) {
+        file.put(c);
+        file.put(0);
+      }
+    };
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    writeInt(file, 0x70);
+    writeInt(file, static_cast<int>(xml.size() * 2 + 5));
+    file.put(0x2a);
+    writeInt(file, static_cast<int>(xml.size()));
+    writeUTF16(file, xml);
+    std::string description = "MemBlock_1";
+    writeInt(file, 0x70);
+    writeInt(file, 0);
+    file.put(0x2a);
+    writeInt(file, static_cast<int>(pixels.size()));
+    file.put(0x2a);
+    writeInt(file, static_cast<int>(description.size()));
+    writeUTF16(file, description);
+    file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+  }
+
+  SUITE(DICOMSupport)
+  {
+    TEST(ReadRegionAcrossInstances)
+    {
+      // Levels can be split over several concatenated instances; reading bands of the base level
+      // at once covers the boundaries between them. Like the other format tests this needs its
+      // slide in the test data, a (small) concatenated slide in images/dicom-concatenated.
+      vector<string> instances;
+      core::getFiles(g_dataPath + "/images/dicom-concatenated", "*.dcm", instances);
+      CHECK(!instances.empty());
+      if (instances.empty()) {
+        return;
+      }
+      MultiResolutionImageReader test;
+      MultiResolutionImage* whole = test.open(instances[0]);
+      MultiResolutionImage* pieces = test.open(instances[0]);
+      CHECK(whole && pieces);
+      if (whole && pieces) {
+        std::vector<unsigned long long> dims = whole->getDimensions();
+        for (unsigned long long y = 0; y < dims[1]; y += 1024) {
+          CHECK(regionMatchesPieces(whole, pieces, 0, y, dims[0], std::min<unsigned long long>(1024, dims[1] - y), 256));
+        }
+      }
+      delete whole;
+      delete pieces;
+    }
+  }
+
   SUITE(LIFSupport)
   { 
+    TEST(TestLIFSyntheticLevels)
+    {
+      // Levels are added by halving until the image is at most 512 pixels, their tiles of 512
+      // pixels are 2x2 averages of the previous level, also with a cache too small to hold them
+      const unsigned int width = 1200, height = 700;
+      std::vector<unsigned char> pixels(width * height);
+      for (unsigned int i = 0; i < width * height; ++i) {
+        pixels[i] = static_cast<unsigned char>(((i % width) * 3 + (i / width) * 5) % 256);
+      }
+      std::string path = g_dataPath + "/images/SyntheticLevelsTestImage.lif";
+      writeTestLIF(path, width, height, pixels);
+
+      // Expected levels, computed with the same rounding and edge handling as the writer
+      std::vector<std::vector<unsigned char> > expected(1, pixels);
+      std::vector<std::pair<unsigned int, unsigned int> > expectedDims(1, std::make_pair(width, height));
+      while (std::max(expectedDims.back().first, expectedDims.back().second) > 512) {
+        unsigned int w = expectedDims.back().first, h = expectedDims.back().second;
+        std::vector<unsigned char> level(((w + 1) / 2) * ((h + 1) / 2));
+        pathology::downsampleByTwo(expected.back().data(), w, h, 1, level.data());
+        expected.push_back(level);
+        expectedDims.push_back(std::make_pair((w + 1) / 2, (h + 1) / 2));
+      }
+      CHECK_EQUAL(3, (int)expected.size());
+
+      for (int cacheSize = 0; cacheSize < 2; ++cacheSize) {
+        LIFImage img;
+        CHECK(img.initialize(path));
+        if (!img.valid()) {
+          return;
+        }
+        if (cacheSize == 0) {
+          img.setCacheSize(1024);
+        }
+        CHECK_EQUAL(3, img.getNumberOfLevels());
+        for (int level = 0; level < img.getNumberOfLevels() && level < 3; ++level) {
+          std::vector<unsigned long long> dims = img.getLevelDimensions(level);
+          CHECK_EQUAL(expectedDims[level].first, (unsigned int)dims[0]);
+          CHECK_EQUAL(expectedDims[level].second, (unsigned int)dims[1]);
+          unsigned char* data = new unsigned char[dims[0] * dims[1]];
+          img.getRawRegion<unsigned char>(0, 0, dims[0], dims[1], level, data);
+          CHECK(std::equal(data, data + dims[0] * dims[1], expected[level].begin()));
+          delete[] data;
+        }
+        // A region across the tile boundary of level 1 and past the edge of the image
+        unsigned char* region = new unsigned char[200 * 100];
+        img.getRawRegion<unsigned char>(450 * 2, 300 * 2, 200, 100, 1, region);
+        unsigned int nrDifferent = 0;
+        for (unsigned int y = 0; y < 100; ++y) {
+          for (unsigned int x = 0; x < 200; ++x) {
+            unsigned char value = x + 450 < 600 && y + 300 < 350 ? expected[1][(y + 300) * 600 + x + 450] : 0;
+            nrDifferent += value != region[y * 200 + x];
+          }
+        }
+        CHECK_EQUAL(0u, nrDifferent);
+        delete[] region;
+      }
+    }
+
     TEST(TestCanOpenLIF)
     {
       MultiResolutionImageReader test;
@@ -522,4 +1224,136 @@ namespace
 
     }
   }
-}
\ No newline at end of file
+
+  // Color of a value as convertMonochromeToRGB looked it up before LUTs were compiled: values of
+  // relative LUTs are normalized with the channel range, then the LUT is evaluated directly
+  unsigned int referenceLUTColor(const double& value, const LUT& LUT, const double& channelMin, const double& channelMax)
+  {
+    if (LUT.relative) {
+      return CompiledLUT::evaluate(static_cast<float>((value - channelMin) / (channelMax - channelMin)), LUT);
+    }
+    return CompiledLUT::evaluate(static_cast<float>(value), LUT);
+  }
+
+  // Largest difference between the A, R, G and B components of two ARGB colors
+  int maxComponentDifference(const unsigned int& first, const unsigned int& second)
+  {
+    int difference = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      difference = std::max(difference, std::abs(static_cast<int>((first >> shift) & 0xff) - static_cast<int>((second >> shift) & 0xff)));
+    }
+    return difference;
+  }
+
+  // Whether a color from the sampled table is as close to the lookup as sampling allows: the
+  // table holds the color of the nearest sample, which lies within half a step of the value
+  bool matchesSampledLookup(const unsigned int& color, const double& value, const double& step, const LUT& LUT, const double& channelMin, const double& channelMax)
+  {
+    unsigned int exact = referenceLUTColor(value, LUT, channelMin, channelMax);
+    int tolerance = std::max(maxComponentDifference(exact, referenceLUTColor(value - step, LUT, channelMin, channelMax)),
+      maxComponentDifference(exact, referenceLUTColor(value + step, LUT, channelMin, channelMax))) + 1;
+    return maxComponentDifference(color, exact) <= tolerance;
+  }
+
+  SUITE(CompiledLUT)
+  {
+    TEST(TestEvaluateKnownColors)
+    {
+      const LUT& normal = DefaultColorLookupTables["Normal"];
+      CHECK_EQUAL(0xff000000u, CompiledLUT::evaluate(0.f, normal));
+      CHECK_EQUAL(0xffffffffu, CompiledLUT::evaluate(1.f, normal));
+      CHECK_EQUAL(0xff000000u, CompiledLUT::evaluate(-5.f, normal));
+      CHECK_EQUAL(0xffffffffu, CompiledLUT::evaluate(7.f, normal));
+      const LUT& trafficLight = DefaultColorLookupTables["Traffic Light (0 - 255)"];
+      CHECK_EQUAL(0x00000000u, CompiledLUT::evaluate(0.f, trafficLight));
+      CHECK_EQUAL(0xff00ff00u, CompiledLUT::evaluate(10.f, trafficLight));
+      CHECK_EQUAL(0xffffff00u, CompiledLUT::evaluate(127.f, trafficLight));
+      CHECK_EQUAL(0xffff0000u, CompiledLUT::evaluate(300.f, trafficLight));
+    }
+
+    TEST(TestCompiledLUTMatchesLookupUChar)
+    {
+      // 8-bit data is looked up exactly, both for absolute LUTs (values beyond the last index
+      // get the last color) and relative LUTs (values outside the channel range are clamped)
+      vector<unsigned char> data(256);
+      for (unsigned int i = 0; i < 256; ++i) {
+        data[i] = static_cast<unsigned char>(i);
+      }
+      const double ranges[2][2] = { { 0, 255 }, { 20, 200 } };
+      vector<unsigned int> argb(256);
+      for (map<string, LUT>::const_iterator it = DefaultColorLookupTables.begin(); it != DefaultColorLookupTables.end(); ++it) {
+        CompiledLUT compiled(it->second);
+        for (unsigned int r = 0; r < 2; ++r) {
+          compiled.apply(data.data(), data.size(), 0, 1, ranges[r][0], ranges[r][1], argb.data());
+          for (unsigned int i = 0; i < 256; ++i) {
+            CHECK_EQUAL(referenceLUTColor(i, it->second, ranges[r][0], ranges[r][1]), argb[i]);
+          }
+        }
+      }
+    }
+
+    TEST(TestCompiledLUTMatchesLookupUInt16)
+    {
+      // Absolute LUTs use the exact table for integer data, relative LUTs the sampled table
+      vector<unsigned short> data(65536);
+      for (unsigned int i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned short>(i);
+      }
+      const double ranges[2][2] = { { 0, 65535 }, { 1000, 30000 } };
+      vector<unsigned int> argb(data.size());
+      for (map<string, LUT>::const_iterator it = DefaultColorLookupTables.begin(); it != DefaultColorLookupTables.end(); ++it) {
+        const LUT& LUT = it->second;
+        CompiledLUT compiled(LUT);
+        for (unsigned int r = 0; r < 2; ++r) {
+          compiled.apply(data.data(), data.size(), 0, 1, ranges[r][0], ranges[r][1], argb.data());
+          // Distance between the samples of the table in data values
+          double step = (LUT.indices.back() - LUT.indices.front()) / (CompiledLUT::SAMPLED_TABLE_SIZE - 1) * (ranges[r][1] - ranges[r][0]);
+          unsigned int mismatches = 0;
+          for (unsigned int i = 0; i < data.size(); ++i) {
+            if (LUT.relative ? !matchesSampledLookup(argb[i], i, step, LUT, ranges[r][0], ranges[r][1]) : argb[i] != referenceLUTColor(i, LUT, ranges[r][0], ranges[r][1])) {
+              ++mismatches;
+            }
+          }
+          CHECK_EQUAL(0u, mismatches);
+        }
+      }
+    }
+
+    TEST(TestCompiledLUTMatchesLookupFloat)
+    {
+      // Float data always uses the sampled table. Values run from a range below to a range
+      // above the LUT indices (absolute) or the channel range (relative), so both are clamped.
+      // One channel takes the vectorized path, the second of three channels the scalar one.
+      const double ranges[2][2] = { { 0, 1 }, { -0.5, 0.25 } };
+      const unsigned int nrValues = 10000;
+      for (map<string, LUT>::const_iterator it = DefaultColorLookupTables.begin(); it != DefaultColorLookupTables.end(); ++it) {
+        const LUT& LUT = it->second;
+        CompiledLUT compiled(LUT);
+        for (unsigned int r = 0; r < 2; ++r) {
+          double first = LUT.relative ? ranges[r][0] : LUT.indices.front();
+          double last = LUT.relative ? ranges[r][1] : LUT.indices.back();
+          double span = last - first;
+          vector<float> data(nrValues), interleaved(3 * nrValues, 0.f);
+          for (unsigned int i = 0; i < nrValues; ++i) {
+            data[i] = static_cast<float>(first - span + 3 * span * i / (nrValues - 1));
+            interleaved[3 * i + 1] = data[i];
+          }
+          vector<unsigned int> argb(nrValues), interleavedArgb(nrValues);
+          compiled.apply(data.data(), nrValues, 0, 1, ranges[r][0], ranges[r][1], argb.data());
+          compiled.apply(interleaved.data(), nrValues, 1, 3, ranges[r][0], ranges[r][1], interleavedArgb.data());
+          CHECK(argb == interleavedArgb);
+          double step = (LUT.indices.back() - LUT.indices.front()) / (CompiledLUT::SAMPLED_TABLE_SIZE - 1) * (LUT.relative ? ranges[r][1] - ranges[r][0] : 1.);
+          unsigned int mismatches = 0;
+          for (unsigned int i = 0; i < nrValues; ++i) {
+            if (!matchesSampledLookup(argb[i], data[i], step, LUT, ranges[r][0], ranges[r][1])) {
+              ++mismatches;
+            }
+          }
+          CHECK_EQUAL(0u, mismatches);
+          CHECK_EQUAL(referenceLUTColor(first - span, LUT, ranges[r][0], ranges[r][1]), argb.front());
+          CHECK_EQUAL(referenceLUTColor(last + span, LUT, ranges[r][0], ranges[r][1]), argb.back());
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,69 @@
+"""Training patch throughput of PatchSampler compared to a Python sampling loop.
+
+The Python loop picks random positions in the image and reads them one by one with getUCharPatch,
+PatchSampler samples positions by label and reads the patches on background threads while the
+consumer (simulated by --work-ms of sleep per patch, e.g. a training step) holds on to the GIL.
+
+Usage: python patchsampler-benchmark.py image.tif [--spacing 0.5] [--patch-size 256]
+           [--patches 2000] [--max-threads 8] [--work-ms 0]
+"""
+
+import argparse
+import time
+
+import numpy as np
+import multiresolutionimageinterface as mir
+
+
+def python_loop(image, patch_size, count, work):
+    dimensions = image.getDimensions()
+    generator = np.random.default_rng(0)
+    start = time.perf_counter()
+    for _ in range(count):
+        x = int(generator.integers(0, max(1, dimensions[0] - patch_size)))
+        y = int(generator.integers(0, max(1, dimensions[1] - patch_size)))
+        image.getUCharPatch(x, y, patch_size, patch_size, 0)
+        work()
+    return count / (time.perf_counter() - start)
+
+
+def patch_sampler(image, spacing, patch_size, count, nr_threads, work):
+    sampler = mir.PatchSampler(image, spacing, patch_size)
+    sampler.setNumberOfThreads(nr_threads)
+    sampler.setNumberOfPatches(count)
+    start = time.perf_counter()
+    for _ in sampler:
+        work()
+    return count / (time.perf_counter() - start)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("--spacing", type=float, default=0)
+    parser.add_argument("--patch-size", type=int, default=256)
+    parser.add_argument("--patches", type=int, default=2000)
+    parser.add_argument("--max-threads", type=int, default=8)
+    parser.add_argument("--work-ms", type=float, default=0)
+    args = parser.parse_args()
+
+    reader = mir.MultiResolutionImageReader()
+    image = reader.open(args.image)
+    if image is None:
+        raise SystemExit("Could not open " + args.image)
+
+    def work():
+        if args.work_ms > 0:
+            time.sleep(args.work_ms / 1000.)
+
+    print("Patches of %dx%d per second" % (args.patch_size, args.patch_size))
+    print("  Python loop (base level): %.0f" % python_loop(image, args.patch_size, args.patches, work))
+    nr_threads = 1
+    while nr_threads <= args.max_threads:
+        result = patch_sampler(image, args.spacing, args.patch_size, args.patches, nr_threads, work)
+        print("  PatchSampler, %d thread(s): %.0f" % (nr_threads, result))
+        nr_threads *= 2
+
+
+if __name__ == "__main__":
+    main()